@@ -0,0 +1,34 @@
+#!/bin/bash
+
+# Generate a synthetic rule set and report the memory its route rules take.
+# The rules are 80% "endsWith", 10% "is" and 10% "network", each with its own
+# destination and all "via" one tunnel; nothing is started.
+#
+# usage: ./bench_route_rules.sh [number of rules, default 1000000]
+# or:    make bench-rules
+
+set -e
+cd "$( dirname "${BASH_SOURCE[0]}" )"
+
+COUNT=${1:-1000000}
+CONF="${TMPDIR:-/tmp}/smartsocksproxy-bench-$$.conf"
+trap 'rm -f "$CONF"' EXIT
+
+awk -v count="$COUNT" 'BEGIN {
+  print "ssh bench"
+  print "  socksPort 19999"
+  print "proxy bench"
+  for (i=0; i<count; i++) {
+    kind = i % 10
+    if (kind < 8) {
+      printf "  route endsWith .host%d.bench.example.com via bench\n", i
+    } else if (kind == 8) {
+      printf "  route is host%d.bench.example.org via bench\n", i
+    } else {
+      printf "  route network %d.%d.%d.0/24 via bench\n", 10 + int(i / 65536), int(i / 256) % 256, i % 256
+    }
+  }
+}' > "$CONF"
+
+echo "$COUNT route rules"
+./smartsocksproxy -t -c "$CONF"
@@ -0,0 +1,222 @@
+// Copyright 2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+// SPDX-License-Identifier: MIT-0
+
+#include<stdlib.h>
+#include<errno.h>
+#include<pthread.h>
+#include<stdatomic.h>
+
+#include"log.h"
+#include"buffer_pool.h"
+
+// Every buffer is preceded by a small header recording its class, so
+// buffer_pool_put() doesn't need to be told the size. Requests larger
+// than the biggest class bypass the pool (class -1) but keep the header.
+//
+// A thread cache holds up to 'thread_cache_max' free buffers per class.
+// When it's empty we take from the central list (or malloc); when it's
+// full we hand the buffer back to the central list, which keeps up to
+// 'central_max' and free()s the rest. Caches are flushed to the central
+// list when their thread exits.
+
+typedef struct buffer_pool_header {
+  int class_index;
+  int reserved;
+  size_t size;
+} buffer_pool_header;
+
+// keeps the payload 16-byte aligned
+#define BUFFER_POOL_HEADER_SIZE ((sizeof(buffer_pool_header) + 15) & ~((size_t)15))
+
+typedef struct buffer_pool_free {
+  struct buffer_pool_free *next;
+} buffer_pool_free;
+
+typedef struct buffer_pool_class {
+  size_t size;
+  int thread_cache_max;
+  int central_max;
+
+  pthread_mutex_t mutex;
+  buffer_pool_free *central; // ** USE MUTEX
+  long long central_count;   // ** USE MUTEX
+
+  atomic_llong allocated;
+  atomic_llong in_use;
+  atomic_llong thread_cached;
+} buffer_pool_class;
+
+buffer_pool_class buffer_pool_classes[BUFFER_POOL_CLASS_COUNT] = {
+  { .size =    256, .thread_cache_max = 16, .central_max = 1024, .mutex = PTHREAD_MUTEX_INITIALIZER },
+  { .size =   1024, .thread_cache_max = 8,  .central_max = 512,  .mutex = PTHREAD_MUTEX_INITIALIZER },
+  { .size =   4096, .thread_cache_max = 8,  .central_max = 256,  .mutex = PTHREAD_MUTEX_INITIALIZER },
+  { .size =  16384, .thread_cache_max = 4,  .central_max = 128,  .mutex = PTHREAD_MUTEX_INITIALIZER },
+  { .size =  65536, .thread_cache_max = 2,  .central_max = 64,   .mutex = PTHREAD_MUTEX_INITIALIZER },
+  { .size = 262144, .thread_cache_max = 1,  .central_max = 16,   .mutex = PTHREAD_MUTEX_INITIALIZER },
+};
+
+typedef struct buffer_pool_cache {
+  buffer_pool_free *list[BUFFER_POOL_CLASS_COUNT];
+  int count[BUFFER_POOL_CLASS_COUNT];
+} buffer_pool_cache;
+
+pthread_key_t buffer_pool_cache_key;
+pthread_once_t buffer_pool_cache_key_once = PTHREAD_ONCE_INIT;
+
+void buffer_pool_lock(buffer_pool_class *cls) {
+  int rc;
+  do {
+    rc = pthread_mutex_lock(&cls->mutex);
+  } while (rc == EINTR);
+}
+
+void buffer_pool_unlock(buffer_pool_class *cls) {
+  int rc;
+  do {
+    rc = pthread_mutex_unlock(&cls->mutex);
+  } while (rc == EINTR);
+}
+
+// hand a free buffer (header included) to the central list, or free() it if that's full
+void buffer_pool_central_put(buffer_pool_class *cls, buffer_pool_free *item) {
+  buffer_pool_lock(cls);
+  if (cls->central_count < cls->central_max) {
+    item->next = cls->central;
+    cls->central = item;
+    cls->central_count++;
+    item = NULL;
+  }
+  buffer_pool_unlock(cls);
+  if (item) {
+    free(item);
+    atomic_fetch_sub_explicit(&cls->allocated, 1, memory_order_relaxed);
+  }
+}
+
+void buffer_pool_cache_destroy(void *ptr) {
+  buffer_pool_cache *cache = ptr;
+  for (int c=0; c<BUFFER_POOL_CLASS_COUNT; c++) {
+    buffer_pool_class *cls = &buffer_pool_classes[c];
+    while (cache->list[c]) {
+      buffer_pool_free *item = cache->list[c];
+      cache->list[c] = item->next;
+      atomic_fetch_sub_explicit(&cls->thread_cached, 1, memory_order_relaxed);
+      buffer_pool_central_put(cls, item);
+    }
+  }
+  free(cache);
+}
+
+void buffer_pool_cache_key_init() {
+  int rc = pthread_key_create(&buffer_pool_cache_key, buffer_pool_cache_destroy);
+  if (rc != 0) {
+    unexpected_exit(53,"pthread_key_create() for buffer pool");
+  }
+}
+
+buffer_pool_cache *buffer_pool_cache_get() {
+  pthread_once(&buffer_pool_cache_key_once, buffer_pool_cache_key_init);
+  buffer_pool_cache *cache = pthread_getspecific(buffer_pool_cache_key);
+  if (cache == NULL) {
+    cache = calloc(1, sizeof(buffer_pool_cache));
+    if (cache == NULL) {
+      unexpected_exit(54,"Error allocating buffer pool cache");
+    }
+    pthread_setspecific(buffer_pool_cache_key, cache);
+  }
+  return cache;
+}
+
+int buffer_pool_class_for(size_t size) {
+  for (int c=0; c<BUFFER_POOL_CLASS_COUNT; c++) {
+    if (size <= buffer_pool_classes[c].size) {
+      return c;
+    }
+  }
+  return -1;
+}
+
+void *buffer_pool_get(size_t size) {
+  int class_index = buffer_pool_class_for(size);
+  buffer_pool_header *header = NULL;
+
+  if (class_index < 0) {
+    header = malloc(BUFFER_POOL_HEADER_SIZE + size);
+    if (header == NULL) {
+      unexpected_exit(55,"Error allocating buffer");
+    }
+    header->class_index = -1;
+    header->size = size;
+    return (unsigned char*)header + BUFFER_POOL_HEADER_SIZE;
+  }
+
+  buffer_pool_class *cls = &buffer_pool_classes[class_index];
+  buffer_pool_cache *cache = buffer_pool_cache_get();
+  if (cache->list[class_index]) {
+    buffer_pool_free *item = cache->list[class_index];
+    cache->list[class_index] = item->next;
+    cache->count[class_index]--;
+    atomic_fetch_sub_explicit(&cls->thread_cached, 1, memory_order_relaxed);
+    header = (buffer_pool_header*)item;
+  } else {
+    buffer_pool_lock(cls);
+    if (cls->central) {
+      header = (buffer_pool_header*)cls->central;
+      cls->central = cls->central->next;
+      cls->central_count--;
+    }
+    buffer_pool_unlock(cls);
+  }
+  if (header == NULL) {
+    header = malloc(BUFFER_POOL_HEADER_SIZE + cls->size);
+    if (header == NULL) {
+      unexpected_exit(55,"Error allocating buffer");
+    }
+    atomic_fetch_add_explicit(&cls->allocated, 1, memory_order_relaxed);
+  }
+  header->class_index = class_index;
+  header->size = cls->size;
+  atomic_fetch_add_explicit(&cls->in_use, 1, memory_order_relaxed);
+  return (unsigned char*)header + BUFFER_POOL_HEADER_SIZE;
+}
+
+size_t buffer_pool_size(void *buf) {
+  buffer_pool_header *header = (buffer_pool_header*)((unsigned char*)buf - BUFFER_POOL_HEADER_SIZE);
+  return header->size;
+}
+
+void buffer_pool_put(void *buf) {
+  if (buf == NULL) {
+    return;
+  }
+  buffer_pool_header *header = (buffer_pool_header*)((unsigned char*)buf - BUFFER_POOL_HEADER_SIZE);
+  int class_index = header->class_index;
+  if (class_index < 0) {
+    free(header);
+    return;
+  }
+
+  buffer_pool_class *cls = &buffer_pool_classes[class_index];
+  atomic_fetch_sub_explicit(&cls->in_use, 1, memory_order_relaxed);
+  buffer_pool_free *item = (buffer_pool_free*)header; // header is no longer needed once it's free
+  buffer_pool_cache *cache = buffer_pool_cache_get();
+  if (cache->count[class_index] < cls->thread_cache_max) {
+    item->next = cache->list[class_index];
+    cache->list[class_index] = item;
+    cache->count[class_index]++;
+    atomic_fetch_add_explicit(&cls->thread_cached, 1, memory_order_relaxed);
+    return;
+  }
+  buffer_pool_central_put(cls, item);
+}
+
+void buffer_pool_get_stats(int class_index, buffer_pool_stats *stats) {
+  buffer_pool_class *cls = &buffer_pool_classes[class_index];
+  stats->size = cls->size;
+  stats->allocated = atomic_load_explicit(&cls->allocated, memory_order_relaxed);
+  stats->in_use = atomic_load_explicit(&cls->in_use, memory_order_relaxed);
+  stats->thread_cached = atomic_load_explicit(&cls->thread_cached, memory_order_relaxed);
+  buffer_pool_lock(cls);
+  stats->central_free = cls->central_count;
+  buffer_pool_unlock(cls);
+}
@@ -0,0 +1,30 @@
+// Copyright 2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+// SPDX-License-Identifier: MIT-0
+
+#ifndef BUFFER_POOL_H
+#define BUFFER_POOL_H
+
+#include<stddef.h>
+
+// Size-classed buffer pool for relay and handshake buffers.
+// Each thread keeps a few free buffers of each class so the common
+// get/put pair costs no locking; the rest live in a central free list.
+
+#define BUFFER_POOL_CLASS_COUNT 6 // 256, 1K, 4K, 16K, 64K, 256K
+#define BUFFER_POOL_MAX_SIZE (256*1024)
+
+void *buffer_pool_get(size_t size); // at least 'size' bytes; see buffer_pool_size()
+size_t buffer_pool_size(void *buf);
+void buffer_pool_put(void *buf);    // NULL is fine
+
+typedef struct buffer_pool_stats {
+  size_t size;            // bytes per buffer in this class
+  long long allocated;    // buffers currently malloc'ed for this class
+  long long in_use;       // handed out, not yet returned
+  long long central_free; // on the central free list
+  long long thread_cached;// parked in per-thread caches
+} buffer_pool_stats;
+
+void buffer_pool_get_stats(int class_index, buffer_pool_stats *stats);
+
+#endif // BUFFER_POOL_H
@@ -15,6 +15,14 @@
 #include"service_socks.h"
 #include"version.h"
 #include"socks5.h"
+#include"event_loop.h"
+#include"null_sink.h"
+#include"thread_pool.h"
+#include"buffer_pool.h"
+#include"traffic_counter.h"
+#include"token_bucket.h"
+#include"route_rule.h"
+#include"route_cache.h"
 
 long default_size=1024;
 
@@ -189,6 +197,12 @@ void add_client_connection(char **buf, int *size, char **ptr, client_connection
   }
   add_int(buf,size,ptr,"remotePortEffective",host_id_get_port(&con->dst_host));
   add_comma(buf,size,ptr);
+  if (con->connect_ms >= 0) {
+    add_int(buf,size,ptr,"connectMs",con->connect_ms);
+    add_comma(buf,size,ptr);
+    add_int(buf,size,ptr,"connectAttempts",con->connect_attempts);
+    add_comma(buf,size,ptr);
+  }
 
   add_int(buf,size,ptr,"status",con->status);
   add_comma(buf,size,ptr);
@@ -201,12 +215,13 @@ void add_client_connection(char **buf, int *size, char **ptr, client_connection
     add_comma(buf,size,ptr);
   }
 
+  // byte counters aren't covered by the mutex; read the live values
   add_to_buf(buf,size,ptr,"\"bytesTx\":");
-  add_to_buf_uint(buf,size,ptr,con->bytes_tx);
+  add_to_buf_uint(buf,size,ptr,atomic_load_explicit(&con_in->bytes_tx,memory_order_relaxed));
   add_to_buf(buf,size,ptr,",");
 
   add_to_buf(buf,size,ptr,"\"bytesRx\":");
-  add_to_buf_uint(buf,size,ptr,con->bytes_rx);
+  add_to_buf_uint(buf,size,ptr,atomic_load_explicit(&con_in->bytes_rx,memory_order_relaxed));
   add_to_buf(buf,size,ptr,",");
 
   if (srv->type == SERVICE_TYPE_HTTP) {
@@ -238,8 +253,53 @@ void add_client_connection(char **buf, int *size, char **ptr, client_connection
   add_to_buf(buf,size,ptr,"}"); // this connection
 }
 
+////////////////////////// TRAFFIC
+
+void add_traffic(char **buf, int *size, char **ptr, traffic_counter *counter) {
+  traffic_totals totals;
+  traffic_counter_get(counter, &totals);
+  add_to_buf(buf,size,ptr,"\"traffic\":{");
+  add_uint(buf,size,ptr,"bytesTx",totals.bytes_tx);
+  add_comma(buf,size,ptr);
+  add_uint(buf,size,ptr,"bytesRx",totals.bytes_rx);
+  add_comma(buf,size,ptr);
+  add_uint(buf,size,ptr,"connections",totals.connections);
+  add_to_buf(buf,size,ptr,"}");
+}
+
 ////////////////////////// PROXY_INSTANCE
 
+void add_token_bucket(char **buf, int *size, char **ptr, char *name, token_bucket *tb) {
+  token_bucket_stats stats;
+  token_bucket_get_stats(tb, &stats);
+  add_to_buf(buf,size,ptr,"\"");
+  add_to_buf(buf,size,ptr,name);
+  add_to_buf(buf,size,ptr,"\":{");
+  add_int(buf,size,ptr,"rate",stats.rate);
+  add_comma(buf,size,ptr);
+  add_int(buf,size,ptr,"burst",stats.burst);
+  add_comma(buf,size,ptr);
+  add_int(buf,size,ptr,"tokens",stats.tokens);
+  add_comma(buf,size,ptr);
+  add_uint(buf,size,ptr,"throttled",stats.throttled);
+  add_to_buf(buf,size,ptr,"}");
+}
+
+// "rateLimit":{"up":{...},"down":{...}}; a direction without a limit is left out
+void add_rate_limit(char **buf, int *size, char **ptr, token_bucket *rate_limit) {
+  add_to_buf(buf,size,ptr,"\"rateLimit\":{");
+  int needComma = 0;
+  if (token_bucket_enabled(&rate_limit[TRAFFIC_TX])) {
+    add_token_bucket(buf,size,ptr,"up",&rate_limit[TRAFFIC_TX]);
+    needComma = 1;
+  }
+  if (token_bucket_enabled(&rate_limit[TRAFFIC_RX])) {
+    if (needComma) add_comma(buf,size,ptr);
+    add_token_bucket(buf,size,ptr,"down",&rate_limit[TRAFFIC_RX]);
+  }
+  add_to_buf(buf,size,ptr,"}");
+}
+
 void add_proxy_instance(char **buf, int *size, char **ptr, proxy_instance *proxy) {
   add_to_buf(buf,size,ptr,"\"");
   add_to_buf(buf,size,ptr,proxy->name); // this proxy_instance
@@ -260,8 +320,58 @@ void add_proxy_instance(char **buf, int *size, char **ptr, proxy_instance *proxy
   }
   add_to_buf(buf,size,ptr,"\","); 
 
-  add_to_buf(buf,size,ptr,"\"service\":{"); // service
+  add_string(buf,size,ptr,"relayMode",relay_mode_str(proxy->relay_mode));
+  add_comma(buf,size,ptr);
+  add_int(buf,size,ptr,"idleTimeout",proxy->idle_timeout);
+  add_comma(buf,size,ptr);
+  add_int(buf,size,ptr,"connectTimeout",proxy->connect_timeout);
+  add_comma(buf,size,ptr);
+  add_int(buf,size,ptr,"tcpKeepAlive",proxy->tcp_keepalive);
+  add_comma(buf,size,ptr);
+  add_int(buf,size,ptr,"tcpUserTimeout",proxy->tcp_user_timeout);
+  add_comma(buf,size,ptr);
+
+  if (proxy->route_cache) {
+    route_cache_stats cache_stats;
+    route_cache_get_stats(proxy->route_cache, &cache_stats);
+    add_to_buf(buf,size,ptr,"\"routeCache\":{");
+    add_int(buf,size,ptr,"size",cache_stats.size);
+    add_comma(buf,size,ptr);
+    add_int(buf,size,ptr,"entries",cache_stats.entries);
+    add_comma(buf,size,ptr);
+    add_uint(buf,size,ptr,"hits",cache_stats.hits);
+    add_comma(buf,size,ptr);
+    add_uint(buf,size,ptr,"misses",cache_stats.misses);
+    add_to_buf(buf,size,ptr,"}");
+    add_comma(buf,size,ptr);
+  }
+
+  add_traffic(buf,size,ptr,&proxy->traffic);
+  add_comma(buf,size,ptr);
+  add_rate_limit(buf,size,ptr,proxy->rate_limit);
+  add_comma(buf,size,ptr);
+
+  // route rules with a rate limit of their own
+  add_to_buf(buf,size,ptr,"\"routeRateLimit\":[");
   int needComma = 0;
+  for (route_rule *route = proxy->route_rule_list; route; route=route->next) {
+    if (route->rate_limit == NULL || (!token_bucket_enabled(&route->rate_limit[0]) && !token_bucket_enabled(&route->rate_limit[1]))) {
+      continue;
+    }
+    if (needComma) add_comma(buf,size,ptr);
+    needComma=1;
+    add_to_buf(buf,size,ptr,"{");
+    add_string(buf,size,ptr,"file",route->file_name);
+    add_comma(buf,size,ptr);
+    add_int(buf,size,ptr,"line",route->file_line_number);
+    add_comma(buf,size,ptr);
+    add_rate_limit(buf,size,ptr,route->rate_limit);
+    add_to_buf(buf,size,ptr,"}");
+  }
+  add_to_buf(buf,size,ptr,"],");
+
+  add_to_buf(buf,size,ptr,"\"service\":{"); // service
+  needComma = 0;
   for (service *srv = proxy->service_list; srv ; srv=srv->next) {
     if (needComma) add_to_buf(buf,size,ptr,","); // bloody json doesn't allow trailing comma's
     needComma=1;
@@ -289,6 +399,14 @@ void add_ssh_tunnel(char **buf, int *size, char **ptr, ssh_tunnel *ssh) {
  
   add_string(buf,size,ptr,"name",ssh->name);
   add_comma(buf,size,ptr);
+  add_string(buf,size,ptr,"type",ssh_tunnel_type_str(ssh->type));
+  add_comma(buf,size,ptr);
+  if (ssh->type != TUNNEL_TYPE_SSH) {
+    char server[MAX_DNS+20];
+    snprintf(server,sizeof(server),"%s:%i",host_id_get_name(&ssh->server),host_id_get_port(&ssh->server));
+    add_string(buf,size,ptr,"server",server);
+    add_comma(buf,size,ptr);
+  }
 
   if (ssh->pid > 0) {
     add_to_buf(buf,size,ptr,"\"pid\":"); 
@@ -302,6 +420,64 @@ void add_ssh_tunnel(char **buf, int *size, char **ptr, ssh_tunnel *ssh) {
     add_to_buf(buf,size,ptr,"\"numConnections\":"); 
     add_to_buf_uint(buf,size,ptr,ssh->connection_count);
     add_to_buf(buf,size,ptr,",");
+
+    add_string(buf,size,ptr,"state",ssh_tunnel_state_str(atomic_load(&ssh->state)));
+    add_comma(buf,size,ptr);
+    if (ssh->startup_ms >= 0) {
+      add_int(buf,size,ptr,"startupMs",ssh->startup_ms);
+      add_comma(buf,size,ptr);
+    }
+  }
+
+  if (ssh->replica_count > 0) {
+    add_int(buf,size,ptr,"replicas",ssh->replica_count);
+    add_comma(buf,size,ptr);
+    add_to_buf(buf,size,ptr,"\"numConnections\":");
+    add_to_buf_uint(buf,size,ptr,ssh->connection_count);
+    add_to_buf(buf,size,ptr,",");
+  }
+  if (ssh->pool) {
+    add_string(buf,size,ptr,"replicaOf",ssh->pool->name);
+    add_comma(buf,size,ptr);
+  } else {
+    add_uint(buf,size,ptr,"coldStarts",atomic_load(&ssh->cold_starts));
+    add_comma(buf,size,ptr);
+  }
+  if (ssh->keep_warm) {
+    add_to_buf(buf,size,ptr,"\"keepWarm\":true,");
+  }
+  if (!ssh->pipeline && ssh->type != TUNNEL_TYPE_HTTP_CONNECT) {
+    add_to_buf(buf,size,ptr,"\"pipelineHandshake\":false,");
+  }
+  if (ssh->idle_timeout > 0) {
+    add_int(buf,size,ptr,"idleTimeout",ssh->idle_timeout);
+    add_comma(buf,size,ptr);
+  }
+
+  add_rate_limit(buf,size,ptr,ssh->rate_limit);
+  add_comma(buf,size,ptr);
+
+  tunnel_balance_snapshot snap;
+  tunnel_balance_get_snapshot(&ssh->balance, &snap);
+  char tmp[300];
+  snprintf(tmp,sizeof(tmp),"\"balance\":{\"load\":%i,\"handshakes\":%llu,\"failures\":%llu,\"ewmaLatencyMs\":%.1f,\"ewmaFailureRate\":%.3f,\"ewmaScore\":%.1f},",
+    snap.load, snap.handshakes, snap.failures, snap.latency_ms, snap.failure_rate, snap.score);
+  add_to_buf(buf,size,ptr,tmp);
+
+  if (circuit_breaker_enabled(&ssh->breaker)) {
+    circuit_breaker_stats cb;
+    circuit_breaker_get_stats(&ssh->breaker, &cb);
+    add_to_buf(buf,size,ptr,"\"circuitBreaker\":{");
+    add_string(buf,size,ptr,"config",circuit_breaker_str(&ssh->breaker,tmp,sizeof(tmp)));
+    add_comma(buf,size,ptr);
+    add_string(buf,size,ptr,"state",circuit_breaker_state_str(cb.state));
+    add_comma(buf,size,ptr);
+    add_int(buf,size,ptr,"failures",cb.failures);
+    add_comma(buf,size,ptr);
+    add_uint(buf,size,ptr,"timesOpened",cb.times_opened);
+    add_comma(buf,size,ptr);
+    add_uint(buf,size,ptr,"skipped",cb.skipped);
+    add_to_buf(buf,size,ptr,"},");
   }
 
   add_to_buf(buf,size,ptr,"\"socksPort\":"); 
@@ -334,6 +510,64 @@ char *build_json(proxy_instance *proxy_instance_list, time_t proxy_start_time, s
   add_comma(&buf,&size,&ptr);
   add_string(&buf,&size,&ptr,"gitHash",SMARTSOCKSPROXY_GIT_HASH);
   add_comma(&buf,&size,&ptr);
+  add_string(&buf,&size,&ptr,"engine",event_loop_running() ? "eventloop" : "thread");
+  add_comma(&buf,&size,&ptr);
+
+  // totals over every proxy instance
+  add_traffic(&buf,&size,&ptr,&traffic_global);
+  add_comma(&buf,&size,&ptr);
+
+  // connections currently owned by each event loop thread
+  add_to_buf(&buf,&size,&ptr,"\"eventLoopConnections\":[");
+  for (int i=0; i<event_loop_count(); i++) {
+    char tmp[100];
+    snprintf(tmp,sizeof(tmp),"%s%i",i>0?",":"",event_loop_connection_count(i));
+    add_to_buf(&buf,&size,&ptr,tmp);
+  }
+  add_to_buf(&buf,&size,&ptr,"],");
+
+  // connections routed "via null"
+  add_to_buf(&buf,&size,&ptr,"\"nullSink\":{");
+  add_int(&buf,&size,&ptr,"connections",null_sink_connection_count());
+  add_comma(&buf,&size,&ptr);
+  add_uint(&buf,&size,&ptr,"bytes",null_sink_bytes());
+  add_to_buf(&buf,&size,&ptr,"},");
+
+  thread_pool_stats pool;
+  thread_pool_get_stats(&pool);
+  add_to_buf(&buf,&size,&ptr,"\"threadPool\":{");
+  add_int(&buf,&size,&ptr,"size",pool.size);
+  add_comma(&buf,&size,&ptr);
+  add_int(&buf,&size,&ptr,"idle",pool.idle);
+  add_comma(&buf,&size,&ptr);
+  add_int(&buf,&size,&ptr,"queued",pool.queued);
+  add_comma(&buf,&size,&ptr);
+  add_uint(&buf,&size,&ptr,"overflowSpawned",pool.overflow_spawned);
+  add_comma(&buf,&size,&ptr);
+  add_uint(&buf,&size,&ptr,"rejected",pool.rejected);
+  add_comma(&buf,&size,&ptr);
+  add_uint(&buf,&size,&ptr,"stolen",pool.stolen);
+  add_to_buf(&buf,&size,&ptr,"},");
+
+  // one entry per buffer size class
+  add_to_buf(&buf,&size,&ptr,"\"bufferPool\":[");
+  for (int i=0; i<BUFFER_POOL_CLASS_COUNT; i++) {
+    buffer_pool_stats bp;
+    buffer_pool_get_stats(i, &bp);
+    if (i>0) add_comma(&buf,&size,&ptr);
+    add_to_buf(&buf,&size,&ptr,"{");
+    add_uint(&buf,&size,&ptr,"size",bp.size);
+    add_comma(&buf,&size,&ptr);
+    add_int(&buf,&size,&ptr,"allocated",bp.allocated);
+    add_comma(&buf,&size,&ptr);
+    add_int(&buf,&size,&ptr,"inUse",bp.in_use);
+    add_comma(&buf,&size,&ptr);
+    add_int(&buf,&size,&ptr,"free",bp.central_free);
+    add_comma(&buf,&size,&ptr);
+    add_int(&buf,&size,&ptr,"threadCached",bp.thread_cached);
+    add_to_buf(&buf,&size,&ptr,"}");
+  }
+  add_to_buf(&buf,&size,&ptr,"],");
 
   // proxy_instance section
   add_to_buf(&buf,&size,&ptr,"\"proxyInstance\":{");
@@ -351,7 +585,7 @@ char *build_json(proxy_instance *proxy_instance_list, time_t proxy_start_time, s
   add_to_buf(&buf,&size,&ptr,"\"sshTunnel\":{");
   needComma=0;
   for (ssh_tunnel *ssh=ssh_tunnel_list; ssh ; ssh = ssh -> next) {
-    if (ssh->socks_port == 0) {  // don't print our "special" tunnels
+    if (ssh->type == TUNNEL_TYPE_SSH && ssh->socks_port == 0) {  // don't print our "special" tunnels
       continue;
     }
     if (needComma) add_to_buf(&buf,&size,&ptr,","); // bloody json doesn't allow trailing comma's
@@ -0,0 +1,137 @@
+// Copyright 2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+// SPDX-License-Identifier: MIT-0
+
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<errno.h>
+
+#include"log.h"
+#include"circuit_breaker.h"
+
+void circuit_breaker_init(circuit_breaker *cb, int threshold, int window, int cooldown) {
+  if (pthread_mutex_init(&cb->mutex,NULL)) {
+    errorNum("pthread_mutex_init()");
+    unexpected_exit(58,"pthread_mutex_init()");
+  }
+  cb->threshold = threshold;
+  cb->window = window;
+  cb->cooldown = cooldown;
+  cb->state = CIRCUIT_CLOSED;
+  cb->failures = 0;
+  cb->first_failure = 0;
+  cb->opened = 0;
+  cb->times_opened = 0;
+  cb->skipped = 0;
+}
+
+// "<failures>[/<window_seconds>[/<cooldown_seconds>]]". returns 1 on success, 0 on error
+int circuit_breaker_parse(circuit_breaker *cb, char *spec) {
+  int threshold = 0;
+  int window = CIRCUIT_BREAKER_DEFAULT_WINDOW;
+  int cooldown = CIRCUIT_BREAKER_DEFAULT_COOLDOWN;
+  char extra;
+  int n = sscanf(spec, "%i/%i/%i%c", &threshold, &window, &cooldown, &extra);
+  if (n < 1 || n > 3 || threshold < 0 || window <= 0 || cooldown <= 0) {
+    return 0;
+  }
+  // sscanf stops quietly at junk; make sure it all got used
+  int slashes = 0;
+  for (char *p = spec; *p; p++) {
+    if (*p == '/') {
+      slashes++;
+    } else if (*p < '0' || *p > '9') {
+      return 0;
+    }
+  }
+  if (slashes != n-1) {
+    return 0;
+  }
+  // the mutex and counters were set up by circuit_breaker_init() when the tunnel was made
+  cb->threshold = threshold;
+  cb->window = window;
+  cb->cooldown = cooldown;
+  return 1;
+}
+
+int circuit_breaker_enabled(circuit_breaker *cb) {
+  return cb->threshold > 0;
+}
+
+char *circuit_breaker_str(circuit_breaker *cb, char *buf, int buflen) {
+  if (!circuit_breaker_enabled(cb)) {
+    snprintf(buf, buflen, "off");
+  } else {
+    snprintf(buf, buflen, "%i/%i/%i", cb->threshold, cb->window, cb->cooldown);
+  }
+  return buf;
+}
+
+// May a new connection try this tunnel?
+// Once the cooldown is over this lets one connection through as the probe; if that probe never
+// reports back (say it lost a race and was dropped), another is let through a cooldown later.
+int circuit_breaker_allow(circuit_breaker *cb, time_t now) {
+  if (!circuit_breaker_enabled(cb)) {
+    return 1;
+  }
+  int allow = 1;
+  pthread_mutex_lock(&cb->mutex);
+  if (cb->state != CIRCUIT_CLOSED) {
+    if (now - cb->opened >= cb->cooldown) {
+      cb->state = CIRCUIT_HALF_OPEN;
+      cb->opened = now;
+    } else {
+      allow = 0;
+      cb->skipped++;
+    }
+  }
+  pthread_mutex_unlock(&cb->mutex);
+  return allow;
+}
+
+void circuit_breaker_record(circuit_breaker *cb, int ok, time_t now) {
+  if (!circuit_breaker_enabled(cb)) {
+    return;
+  }
+  pthread_mutex_lock(&cb->mutex);
+  if (ok) {
+    cb->state = CIRCUIT_CLOSED;
+    cb->failures = 0;
+  } else {
+    if (cb->failures == 0 || now - cb->first_failure > cb->window) {
+      cb->failures = 0;
+      cb->first_failure = now;
+    }
+    cb->failures++;
+    if (cb->state == CIRCUIT_HALF_OPEN || (cb->state == CIRCUIT_CLOSED && cb->failures >= cb->threshold)) {
+      cb->state = CIRCUIT_OPEN;
+      cb->opened = now;
+      cb->times_opened++;
+    }
+  }
+  pthread_mutex_unlock(&cb->mutex);
+}
+
+void circuit_breaker_record_verdict(circuit_breaker *cb, int verdict, time_t now) {
+  if (verdict != CIRCUIT_VERDICT_NONE) {
+    circuit_breaker_record(cb, verdict == CIRCUIT_VERDICT_ALIVE, now);
+  }
+}
+
+void circuit_breaker_get_stats(circuit_breaker *cb, circuit_breaker_stats *stats) {
+  pthread_mutex_lock(&cb->mutex);
+  stats->state = cb->state;
+  stats->failures = cb->failures;
+  stats->times_opened = cb->times_opened;
+  stats->skipped = cb->skipped;
+  pthread_mutex_unlock(&cb->mutex);
+}
+
+char *circuit_breaker_state_str(int state) {
+  switch (state) {
+    case CIRCUIT_CLOSED:    return "closed";
+    case CIRCUIT_OPEN:      return "open";
+    case CIRCUIT_HALF_OPEN: return "halfOpen";
+  }
+  return "unknown";
+}
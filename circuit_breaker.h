@@ -0,0 +1,74 @@
+// Copyright 2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+// SPDX-License-Identifier: MIT-0
+
+#ifndef CIRCUIT_BREAKER_H
+#define CIRCUIT_BREAKER_H
+
+#include<pthread.h>
+#include<time.h>
+
+// Circuit breaker for an ssh tunnel, shared by every proxy instance.
+//
+// A tunnel whose ssh process is up but whose far end has gone away takes
+// every connection through a failed SOCKS5 handshake before the next
+// tunnel gets a go. After 'threshold' handshake failures in a row, all
+// within 'window' seconds, the breaker opens and new connections skip
+// the tunnel. After 'cooldown' seconds one connection is let through as
+// a probe (half open): if its handshake succeeds the breaker closes, if
+// it fails the breaker opens for another cooldown.
+//
+// Only the tunnel's own health counts. Any well-formed reply, even an
+// error from the far end about the destination, shows the tunnel is alive;
+// a connection that broke off or got a garbled reply mid-handshake, or a
+// handshake still hanging when the race's time ran out, shows it isn't.
+// A tunnel that isn't listening yet is ssh starting up, not a dead tunnel,
+// and ssh hanging up on CONNECT is its way of saying it can't reach the
+// destination; neither says anything either way.
+//
+// Times are seconds from time(NULL); the functions take 'now' in order
+// to be testable.
+
+#define CIRCUIT_CLOSED    0
+#define CIRCUIT_OPEN      1
+#define CIRCUIT_HALF_OPEN 2
+
+// what a handshake says about the tunnel
+#define CIRCUIT_VERDICT_NONE  0
+#define CIRCUIT_VERDICT_ALIVE 1
+#define CIRCUIT_VERDICT_DEAD  2
+
+#define CIRCUIT_BREAKER_DEFAULT_WINDOW   30
+#define CIRCUIT_BREAKER_DEFAULT_COOLDOWN 10
+
+typedef struct circuit_breaker {
+  int threshold; // consecutive failures that open the breaker; 0 = never opens
+  int window;    // seconds
+  int cooldown;  // seconds
+
+  pthread_mutex_t mutex;
+  int state;                      // ** USE MUTEX
+  int failures;                   // ** USE MUTEX  consecutive
+  time_t first_failure;           // ** USE MUTEX  of the current run of failures
+  time_t opened;                  // ** USE MUTEX  when it last opened, or when the probe started
+  unsigned long long times_opened; // ** USE MUTEX
+  unsigned long long skipped;      // ** USE MUTEX  connections that passed the tunnel by
+} circuit_breaker;
+
+typedef struct circuit_breaker_stats {
+  int state;
+  int failures;
+  unsigned long long times_opened;
+  unsigned long long skipped;
+} circuit_breaker_stats;
+
+void circuit_breaker_init(circuit_breaker *cb, int threshold, int window, int cooldown);
+int  circuit_breaker_parse(circuit_breaker *cb, char *spec);
+int  circuit_breaker_enabled(circuit_breaker *cb);
+char *circuit_breaker_str(circuit_breaker *cb, char *buf, int buflen);
+int  circuit_breaker_allow(circuit_breaker *cb, time_t now);
+void circuit_breaker_record(circuit_breaker *cb, int ok, time_t now);
+void circuit_breaker_record_verdict(circuit_breaker *cb, int verdict, time_t now);
+void circuit_breaker_get_stats(circuit_breaker *cb, circuit_breaker_stats *stats);
+char *circuit_breaker_state_str(int state);
+
+#endif // CIRCUIT_BREAKER_H
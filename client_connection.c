@@ -34,11 +34,16 @@ client_connection *new_client_connection() {
   con->srv=NULL;
   con->fd_in=-1;
   con->fd_out=-1;
-  con->thread_should_exit=0;
+  atomic_init(&con->thread_should_exit,0);
   con->thread_has_exited=0;
   con->pthread_create_called=0;
-  con->bytes_rx=0;
-  con->bytes_tx=0;
+  atomic_init(&con->bytes_rx,0);
+  atomic_init(&con->bytes_tx,0);
+  atomic_init(&con->last_activity,0);
+  atomic_init(&con->idle_timeout,0);
+  con->connect_timeout=0;
+  con->connect_ms=-1;
+  con->connect_attempts=0;
   con->start_time=time(NULL);
   con->end_time=0;
   con->status=CCSTATUS_OKAY;
@@ -48,7 +53,10 @@ client_connection *new_client_connection() {
 
   // service-specific variables
   con->route=NULL;
+  con->route_rate_limit[0]=NULL;
+  con->route_rate_limit[1]=NULL;
   con->tunnel=NULL;
+  con->tunnel_verdict=CIRCUIT_VERDICT_NONE;
   con->urlPath[0]=0;
   host_id_init(&(con->dst_host));
   host_id_init(&(con->dst_host_original));
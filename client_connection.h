@@ -7,6 +7,7 @@
 #include<pthread.h>
 #include<netinet/in.h>
 #include<time.h>
+#include<stdatomic.h>
 
 #include"service.h"
 #include"ssh_tunnel.h"
@@ -17,6 +18,7 @@
 #define CCSTATUS_ERROR        1
 #define CCSTATUS_ERR_INTERNAL 2
 #define CCSTATUS_ERR_NETWORK  3
+#define CCSTATUS_IDLE_TIMEOUT 4 // closed by the idle-connection reaper
 
 typedef struct client_connection {
   struct client_connection *prev,*next;
@@ -33,14 +35,20 @@ typedef struct client_connection {
   int        pthread_create_called;
   int        pthread_create_value;
   pthread_t  thread_id;
-  int        thread_should_exit; // message from server -> thread that thread should exit.
+  atomic_int thread_should_exit; // message from server -> thread that thread should exit. Relays check it; handshakes don't.
   int        thread_has_exited;  // message from thread -> server that thread is done.
   
   host_id src_host;
 
   // metrics
-  unsigned long long bytes_tx; // client -> server        ** USE MUTEX 
-  unsigned long long bytes_rx; // server -> client        ** USE MUTEX
+  // Only the thread relaying this connection adds to these; everyone else reads them with relaxed atomic loads. No mutex.
+  atomic_ullong bytes_tx; // client -> server
+  atomic_ullong bytes_rx; // server -> client
+  atomic_llong last_activity; // time() bytes last moved, as seen by the relay; 0 until relaying starts
+  atomic_int idle_timeout;    // seconds; 0 = never. Proxy default, may be overridden by a route rule.
+  int connect_timeout;        // seconds for a direct connection to be established; 0 = kernel default. Proxy default, may be overridden by a route rule.
+  int connect_ms;             // ** USE MUTEX time taken by the last direct connect; -1 if none
+  int connect_attempts;       // ** USE MUTEX addresses tried by the last direct connect
   time_t start_time; // time of connection creation
   time_t end_time;   // time when connection was closed
 
@@ -61,10 +69,13 @@ typedef struct client_connection {
   /////// Routing
   // The routing rule we matched against
   route_rule *route; 
+  // bandwidth buckets of the last matching route rule to set one; NULL if none. [0] up, [1] down
+  token_bucket *route_rate_limit[2];
 
   /////// SOCKS-related variables
   // All socks-related stuff changes by the connection thread - ** USE MUTEX **
   ssh_tunnel *tunnel;     // if non-null, indicates the tunnel we successfully connected to. 
+  int tunnel_verdict;     // CIRCUIT_VERDICT_* of the last handshake with a tunnel; connection thread only
   int socks_version; 
   int socks_command, socks_command_original;
   int socks_address_type, socks_address_type_original;
@@ -20,6 +20,7 @@
 #include"service_http.h"
 #include"route_rule.h"
 #include"main_config.h"
+#include"token_bucket.h"
 
 #define MAX_LINE_LENGTH 10240
 
@@ -291,6 +292,10 @@ ssh_tunnel* config_file_parse_ssh_tunnel(char *filename, int line_num, char *lin
     error("(%s line %i) Invalid ssh definition: %s",filename, line_num, line);
     exit(1);
   }
+  if (strlen(section)>SSH_TUNNEL_MAX_NAME_LEN) {
+    error("(%s line %i) ssh name longer than %i characters: %s",filename, line_num, SSH_TUNNEL_MAX_NAME_LEN, section);
+    exit(1);
+  }
   if (strcmp(section,"default")==0) { 
     debug("(%s line %i) switch ssh_tunnel to default",filename, line_num);
     return ssh_default;
@@ -354,6 +359,20 @@ int config_set_string(char *filename, int line_num, char *line, char *object_typ
   return 0;
 }
 
+int config_set_rate_limit(char *filename, int line_num, char *line, char *object_type, char *object_name, char *field, char *help, token_bucket *dst) {
+  char *valueStr;
+  if ((valueStr = match_start(line, field))) {
+    if (!token_bucket_parse(dst, valueStr)) {
+      error("USAGE: %s",help);
+      return 0;
+    }
+    char buf[100];
+    debug("(%s line %i) set %s %s %s= %s", filename, line_num, object_type, object_name, field, token_bucket_str(dst, buf, sizeof(buf)));
+    return 1;
+  }
+  return 0;
+}
+
 ////////////////////////////////// ////////////////////////////////// ////////////////////////////////// //////////////////////////////////
 
 int config_file_parse_main_entry(char *filename, int line_num, char *line, main_config *main_conf, log_file **log_file_list, log_file *log_file_default ) {
@@ -372,6 +391,26 @@ int config_file_parse_main_entry(char *filename, int line_num, char *line, main_
     return 1;
   }
   if (config_set_int(filename, line_num, line, "main", "main", "ulimit ","ulimit <int>", &main_conf->ulimit)) return 1;
+  help="engine [thread|eventloop]";
+  if (config_set_string(filename, line_num, line, "main", "", "engine ",help, stringBuf, sizeof(stringBuf))) {
+    main_conf->engine = engine_from_str(stringBuf);
+    if (main_conf->engine == ENGINE_INVALID) {
+      error("USAGE: %s",help);
+      return 0;
+    }
+    return 1;
+  }
+  if (config_set_int(filename, line_num, line, "main", "main", "eventLoopThreads ","eventLoopThreads <int>", &main_conf->event_loop_threads)) return 1;
+  if (config_set_int(filename, line_num, line, "main", "main", "threadPoolSize ","threadPoolSize <int>", &main_conf->thread_pool_size)) return 1;
+  help="threadPoolOverflow [spawn|queue|reject]";
+  if (config_set_string(filename, line_num, line, "main", "", "threadPoolOverflow ",help, stringBuf, sizeof(stringBuf))) {
+    main_conf->thread_pool_overflow = pool_overflow_from_str(stringBuf);
+    if (main_conf->thread_pool_overflow == POOL_OVERFLOW_INVALID) {
+      error("USAGE: %s",help);
+      return 0;
+    }
+    return 1;
+  }
   return 0;
 }
 
@@ -397,6 +436,23 @@ int config_file_parse_proxy_instance_entry(char *filename, int line_num, char *l
     return 1;
   }
   
+  help="relayMode [copy|splice|uring]";
+  if (config_set_string(filename, line_num, line, "proxy", proxy->name, "relayMode ",help, stringBuf, sizeof(stringBuf))) {
+    proxy->relay_mode = relay_mode_from_str(stringBuf);
+    if (proxy->relay_mode == RELAY_MODE_INVALID) {
+      error("USAGE: %s",help);
+      return 0;
+    }
+    return 1;
+  }
+  if (config_set_int(filename, line_num, line, "proxy", proxy->name, "idleTimeout ","idleTimeout <seconds>", &proxy->idle_timeout)) return 1;
+  if (config_set_int(filename, line_num, line, "proxy", proxy->name, "connectTimeout ","connectTimeout <seconds>", &proxy->connect_timeout)) return 1;
+  if (config_set_int(filename, line_num, line, "proxy", proxy->name, "tcpKeepAlive ","tcpKeepAlive <seconds>", &proxy->tcp_keepalive)) return 1;
+  if (config_set_int(filename, line_num, line, "proxy", proxy->name, "tcpUserTimeout ","tcpUserTimeout <seconds>", &proxy->tcp_user_timeout)) return 1;
+  if (config_set_int(filename, line_num, line, "proxy", proxy->name, "routeCacheSize ","routeCacheSize <entries>", &proxy->route_cache_size)) return 1;
+  if (config_set_rate_limit(filename, line_num, line, "proxy", proxy->name, "rateLimitUp ","rateLimitUp <bytes_per_second>[/<burst_bytes>]", &proxy->rate_limit[TRAFFIC_TX])) return 1;
+  if (config_set_rate_limit(filename, line_num, line, "proxy", proxy->name, "rateLimitDown ","rateLimitDown <bytes_per_second>[/<burst_bytes>]", &proxy->rate_limit[TRAFFIC_RX])) return 1;
+  
   // socks 4/5 server
   help = "socksServer ";
   if (config_set_string(filename, line_num, line, "proxy", proxy->name, "socksServer ",help, stringBuf, sizeof(stringBuf))) {
@@ -526,8 +582,67 @@ int config_file_parse_proxy_instance_entry(char *filename, int line_num, char *l
 
 int config_file_parse_ssh_tunnel_entry(char *filename, int line_num, char *line, ssh_tunnel *ssh, log_file **log_file_list, log_file *log_file_default) {
   char stringBuf[8192];
+  char* type_help="type [ ssh | socks5 | httpConnect ]";
+  if (config_set_string(filename, line_num, line, "ssh", ssh->name, "type ",type_help, stringBuf, sizeof(stringBuf))) {
+    ssh->type = ssh_tunnel_type_from_str(stringBuf);
+    if (ssh->type == TUNNEL_TYPE_INVALID) {
+      error("USAGE: %s",type_help);
+      return 0;
+    }
+    return 1;
+  }
+  char* server_help="server <host>:<port>";
+  if (config_set_string(filename, line_num, line, "ssh", ssh->name, "server ",server_help, stringBuf, sizeof(stringBuf))) {
+    if (!ssh_tunnel_parse_server(ssh, stringBuf)) {
+      error("USAGE: %s",server_help);
+      return 0;
+    }
+    return 1;
+  }
   if (config_set_int(filename, line_num, line, "ssh", ssh->name, "socksPort ","socksPort <int>", &(ssh->socks_port))) return 1;
   if (config_set_string(filename, line_num, line, "ssh", ssh->name, "command ","command <shell_command_to_start_ssh>", ssh->command_to_run, sizeof(ssh->command_to_run)))  return 1;
+  if (config_set_rate_limit(filename, line_num, line, "ssh", ssh->name, "rateLimitUp ","rateLimitUp <bytes_per_second>[/<burst_bytes>]", &ssh->rate_limit[0])) return 1;
+  if (config_set_rate_limit(filename, line_num, line, "ssh", ssh->name, "rateLimitDown ","rateLimitDown <bytes_per_second>[/<burst_bytes>]", &ssh->rate_limit[1])) return 1;
+  if (config_set_int(filename, line_num, line, "ssh", ssh->name, "replicas ","replicas <count>", &(ssh->replicas))) {
+    if (ssh->replicas < 1 || ssh->replicas > SSH_TUNNEL_MAX_REPLICAS) {
+      error("(%s line %i) replicas must be between 1 and %i",filename,line_num,SSH_TUNNEL_MAX_REPLICAS);
+      return 0;
+    }
+    return 1;
+  }
+  if (config_set_int(filename, line_num, line, "ssh", ssh->name, "idleTimeout ","idleTimeout <seconds>", &(ssh->idle_timeout))) return 1;
+  char* keep_warm_help="keepWarm [ yes | no ]";
+  if (config_set_string(filename, line_num, line, "ssh", ssh->name, "keepWarm ",keep_warm_help, stringBuf, sizeof(stringBuf))) {
+    if (strcmp(stringBuf,"yes")==0) {
+      ssh->keep_warm=1;
+    } else if (strcmp(stringBuf,"no")==0) {
+      ssh->keep_warm=0;
+    } else {
+      error("USAGE: %s",keep_warm_help);
+      return 0;
+    }
+    return 1;
+  }
+  char* pipeline_help="pipelineHandshake [ yes | no ]";
+  if (config_set_string(filename, line_num, line, "ssh", ssh->name, "pipelineHandshake ",pipeline_help, stringBuf, sizeof(stringBuf))) {
+    if (strcmp(stringBuf,"yes")==0) {
+      ssh->pipeline=1;
+    } else if (strcmp(stringBuf,"no")==0) {
+      ssh->pipeline=0;
+    } else {
+      error("USAGE: %s",pipeline_help);
+      return 0;
+    }
+    return 1;
+  }
+  char* breaker_help="circuitBreaker <failures>[/<window_seconds>[/<cooldown_seconds>]]";
+  if (config_set_string(filename, line_num, line, "ssh", ssh->name, "circuitBreaker ",breaker_help, stringBuf, sizeof(stringBuf))) {
+    if (!circuit_breaker_parse(&ssh->breaker, stringBuf)) {
+      error("USAGE: %s",breaker_help);
+      return 0;
+    }
+    return 1;
+  }
 
   if (config_set_string(filename, line_num, line, "ssh", ssh->name, "logFilename ","logFilename <file_name>", stringBuf, sizeof(stringBuf))) {
     ssh->log.file = find_or_create_log_file(log_file_list, log_file_default, stringBuf);
@@ -12,6 +12,10 @@
 #include"host_id.h"
 
 #include<stdio.h>
+
+// EAI_AGAIN also means "no resolver reachable"; don't spin on it forever
+#define DNS_UTIL_EAI_AGAIN_TRIES 3
+
 int resolve_dns_for_host_id(host_id *id) {
   if (!host_id_has_name(id)) {
     return 0;
@@ -22,9 +26,10 @@ int resolve_dns_for_host_id(host_id *id) {
   struct addrinfo *info_p;
   int result;
 
+  int tries=0;
   do {
     result=getaddrinfo(host_id_get_name(id),NULL,NULL,&info_p);
-  } while (result == EAI_AGAIN);
+  } while (result == EAI_AGAIN && ++tries < DNS_UTIL_EAI_AGAIN_TRIES);
 
   // DNS resolution failed.
   if (result) { 
@@ -42,23 +47,89 @@ int resolve_dns_for_host_id(host_id *id) {
     debug("%s = %s", host_id_get_name(id), hostname);
   }
 
-  // TODO: favor IPv4 results, fall back to IPv6 if supported
-  // TODO: actually, we could try connecting to all of the results in sequence and return the first one that works. 
-  // int my_result = rand() % num_results;
-  int my_result = 0; // always pick first, to avoid IPv6 lower down in the options
-  int i;
-  for ( i=0, ai=info_p ; i<my_result ; ai=ai->ai_next, i++ );
+  // Favor IPv4, fall back to IPv6. A single address is what the rules engine needs;
+  // connect_direct() uses resolve_dns_all_for_host_id() and tries all of them.
+  struct addrinfo *pick = NULL;
+  for ( ai=info_p ; ai!=NULL && pick==NULL ; ai=ai->ai_next ) {
+    if (ai->ai_family == AF_INET) {
+      pick = ai;
+    }
+  }
+  for ( ai=info_p ; ai!=NULL && pick==NULL ; ai=ai->ai_next ) {
+    if (ai->ai_family == AF_INET6) {
+      pick = ai;
+    }
+  }
+  if (pick == NULL) {
+    warn("getaddrinfo(%s) returned no IPv4 or IPv6 addresses",host_id_get_name(id));
+    freeaddrinfo(info_p);
+    return 0;
+  }
 
-  getnameinfo(ai->ai_addr, ai->ai_addrlen, hostname, sizeof(hostname), NULL, 0, NI_NUMERICHOST);
+  getnameinfo(pick->ai_addr, pick->ai_addrlen, hostname, sizeof(hostname), NULL, 0, NI_NUMERICHOST);
   debug("Selected IP address: %s = %s", host_id_get_name(id), hostname);
 
-  struct sockaddr_in sin;
-  sin.sin_len = sizeof(struct sockaddr_in);
-  sin.sin_family = AF_INET;
-  sin.sin_port=htons(host_id_get_port(id));
-  inet_pton(AF_INET, hostname, &sin.sin_addr);
-  host_id_set_addr_in(id,&sin);
-  
+  int port = host_id_get_port(id);
+  if (pick->ai_family == AF_INET) {
+    struct sockaddr_in sin;
+    memcpy(&sin, pick->ai_addr, sizeof(sin));
+    sin.sin_port=htons(port);
+    host_id_set_addr_in(id,&sin);
+  } else {
+    struct sockaddr_in6 sin6;
+    memcpy(&sin6, pick->ai_addr, sizeof(sin6));
+    sin6.sin6_port=htons(port);
+    host_id_set_addr_in6(id,&sin6);
+  }
+  freeaddrinfo(info_p);
   return 1;
 }
 
+// Every IPv4 and IPv6 address for the name, with the port filled in, in the order getaddrinfo() returned them.
+// returns the number of addresses written to 'addrs'; 0 if resolution failed
+int resolve_dns_all_for_host_id(host_id *id, struct sockaddr_storage *addrs, int max) {
+  if (!host_id_has_name(id)) {
+    return 0;
+  }
+
+  trace("DNS resolution (all addresses) for %s",host_id_get_name(id));
+
+  struct addrinfo hints;
+  struct addrinfo *info_p;
+  int result;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags = AI_ADDRCONFIG; // don't offer IPv6 addresses to a host with no IPv6
+
+  int tries=0;
+  do {
+    result=getaddrinfo(host_id_get_name(id),NULL,&hints,&info_p);
+  } while (result == EAI_AGAIN && ++tries < DNS_UTIL_EAI_AGAIN_TRIES);
+
+  if (result) { 
+    warn("getaddrinfo(%s) %s",host_id_get_name(id), gai_strerror(result));
+    return 0;
+  }
+
+  int port = host_id_get_port(id);
+  int count = 0;
+  char hostname[256];
+  for (struct addrinfo *ai=info_p ; ai!=NULL && count<max ; ai=ai->ai_next ) {
+    if (ai->ai_family == AF_INET) {
+      memcpy(&addrs[count], ai->ai_addr, sizeof(struct sockaddr_in));
+      ((struct sockaddr_in*)&addrs[count])->sin_port = htons(port);
+    } else if (ai->ai_family == AF_INET6) {
+      memcpy(&addrs[count], ai->ai_addr, sizeof(struct sockaddr_in6));
+      ((struct sockaddr_in6*)&addrs[count])->sin6_port = htons(port);
+    } else {
+      continue;
+    }
+    getnameinfo(ai->ai_addr, ai->ai_addrlen, hostname, sizeof(hostname), NULL, 0, NI_NUMERICHOST);
+    debug("%s = %s", host_id_get_name(id), hostname);
+    count++;
+  }
+  freeaddrinfo(info_p);
+  return count;
+}
+
@@ -4,6 +4,11 @@
 #ifndef DNS_UTIL_H
 #define DNS_UTIL_H
 
+#include<sys/socket.h>
+
+#include"host_id.h"
+
 int resolve_dns_for_host_id(host_id *id);
+int resolve_dns_all_for_host_id(host_id *id, struct sockaddr_storage *addrs, int max);
 
 #endif // DNS_UTIL_H
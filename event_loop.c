@@ -0,0 +1,437 @@
+// Copyright 2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+// SPDX-License-Identifier: MIT-0
+
+#include<stdlib.h>
+#include<unistd.h>
+#include<fcntl.h>
+#include<poll.h>
+#include<errno.h>
+#include<pthread.h>
+#ifdef __linux__
+#include<sys/epoll.h>
+#endif
+
+#include"log.h"
+#include"client_connection.h"
+#include"proxy_instance.h"
+#include"thread_local.h"
+#include"service_thread.h"
+#include"shuttle.h"
+#include"event_loop.h"
+
+// Each event loop thread owns a set of connections and relays data for
+// all of them. On Linux this uses edge-triggered epoll; elsewhere it
+// falls back to rebuilding a poll() set each time around the loop.
+//
+// Connections arrive from service threads through the 'incoming' list;
+// the service thread writes a byte to wake_fd to get our attention.
+//
+// A rate-limited relay that stopped reading won't see another edge for
+// the data still sitting in its socket, so the loop also wakes up when
+// the first throttled relay is due and pumps it.
+
+#define EVENT_LOOP_MAX_THREADS 256
+#define EVENT_LOOP_MAX_EVENTS  256
+
+typedef struct event_loop_entry {
+  struct event_loop_entry *prev, *next;
+  client_connection *con;
+  proxy_instance *proxy; // for log messages & relay mode
+  shuttle_relay relay;
+  int finished;          // relay done; entry freed at the end of this pass
+} event_loop_entry;
+
+typedef struct event_loop {
+  int index;
+  pthread_t thread_id;
+  int wake_fd[2];
+
+  pthread_mutex_t mutex;
+  event_loop_entry *incoming; // ** USE MUTEX  handed over, not yet adopted by the loop
+  int connection_count;       // ** USE MUTEX  incoming + active
+
+  event_loop_entry *active;   // only touched by the loop thread
+  int active_count;
+  int rate_limited_count;     // active entries whose relay has buckets
+#ifdef __linux__
+  int epoll_fd;
+#else
+  struct pollfd *pfd;           // rebuilt every time around the loop
+  event_loop_entry **pfd_entry; // entry owning each pfd[]
+  int pfd_size;
+#endif
+} event_loop;
+
+event_loop *event_loop_list = NULL;
+int event_loop_list_count = 0;
+
+void event_loop_lock(event_loop *loop) {
+  int rc;
+  do {
+    rc = pthread_mutex_lock(&loop->mutex);
+  } while (rc == EINTR);
+}
+
+void event_loop_unlock(event_loop *loop) {
+  int rc;
+  do {
+    rc = pthread_mutex_unlock(&loop->mutex);
+  } while (rc == EINTR);
+}
+
+void event_loop_set_thread_local(event_loop_entry *entry) {
+  if (entry) {
+    thread_local_set_proxy_instance(entry->proxy);
+    thread_local_set_service(entry->con->srv);
+    thread_local_set_client_connection(entry->con);
+  } else {
+    thread_local_set_proxy_instance(NULL);
+    thread_local_set_service(NULL);
+    thread_local_set_client_connection(NULL);
+  }
+}
+
+void event_loop_drain_wake_fd(event_loop *loop) {
+  char buf[256];
+  int rc;
+  do {
+    rc = read(loop->wake_fd[0], buf, sizeof(buf));
+  } while (rc > 0 || (rc < 0 && errno == EINTR));
+}
+
+void event_loop_pump(event_loop_entry *entry) {
+  if (entry->finished) {
+    return;
+  }
+  event_loop_set_thread_local(entry);
+  int state = shuttle_relay_pump(&entry->relay);
+  if (state == SHUTTLE_RELAY_DONE) {
+    entry->finished = 1;
+  } else if (state == SHUTTLE_RELAY_ERROR) {
+    entry->finished = -1;
+  }
+}
+
+// Move connections from the incoming list to the active list and start relaying them.
+void event_loop_adopt(event_loop *loop) {
+  event_loop_lock(loop);
+  event_loop_entry *list = loop->incoming;
+  loop->incoming = NULL;
+  event_loop_unlock(loop);
+
+  while (list) {
+    event_loop_entry *entry = list;
+    list = list->next;
+
+    event_loop_set_thread_local(entry);
+    if (!shuttle_relay_init(&entry->relay, entry->con, entry->proxy ? entry->proxy->relay_mode : RELAY_MODE_COPY)) {
+      service_thread_shutdown(entry->con, 0);
+      event_loop_lock(loop);
+      loop->connection_count--;
+      event_loop_unlock(loop);
+      free(entry);
+      continue;
+    }
+    entry->prev = NULL;
+    entry->next = loop->active;
+    if (loop->active) {
+      loop->active->prev = entry;
+    }
+    loop->active = entry;
+    loop->active_count++;
+    if (entry->relay.rate_limited) {
+      loop->rate_limited_count++;
+    }
+    trace("event loop %i adopted connection (%i active)", loop->index, loop->active_count);
+
+#ifdef __linux__
+    struct epoll_event ev;
+    ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    ev.data.ptr = entry;
+    if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, entry->con->fd_in, &ev) < 0 ||
+        epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, entry->con->fd_out, &ev) < 0) {
+      errorNum("epoll_ctl(EPOLL_CTL_ADD)");
+      entry->finished = -1;
+    }
+#endif
+    event_loop_pump(entry); // there may already be data waiting
+  }
+  event_loop_set_thread_local(NULL);
+}
+
+// Release every connection whose relay has finished, or that the idle reaper wants closed.
+// The wait above times out at least every SHUTTLE_IDLE_CHECK_MS, so quiet connections are seen here too.
+void event_loop_reap(event_loop *loop) {
+  event_loop_entry *entry = loop->active;
+  while (entry) {
+    event_loop_entry *next = entry->next;
+    if (!entry->finished && atomic_load(&entry->con->thread_should_exit)) {
+      entry->finished = -1; // the reaper has set the status
+    }
+    if (entry->finished) {
+      event_loop_set_thread_local(entry);
+      client_connection *con = entry->con;
+#ifdef __linux__
+      epoll_ctl(loop->epoll_fd, EPOLL_CTL_DEL, con->fd_in, NULL);
+      epoll_ctl(loop->epoll_fd, EPOLL_CTL_DEL, con->fd_out, NULL);
+#endif
+      shuttle_relay_free(&entry->relay);
+      trace("shuttle connection closed %s. Tx %llu  Rx %llu  bytes",entry->finished > 0 ? "normally" : "with error",con->bytes_tx,con->bytes_rx);
+      service_thread_shutdown(con, entry->finished > 0);
+
+      if (entry->prev) {
+        entry->prev->next = entry->next;
+      } else {
+        loop->active = entry->next;
+      }
+      if (entry->next) {
+        entry->next->prev = entry->prev;
+      }
+      loop->active_count--;
+      if (entry->relay.rate_limited) {
+        loop->rate_limited_count--;
+      }
+      event_loop_lock(loop);
+      loop->connection_count--;
+      event_loop_unlock(loop);
+      free(entry);
+    }
+    entry = next;
+  }
+  event_loop_set_thread_local(NULL);
+}
+
+// Pump every throttled relay whose rate limit has let up.
+// returns how long the next wait may last, in milliseconds
+int event_loop_check_throttled(event_loop *loop) {
+  int timeout = SHUTTLE_IDLE_CHECK_MS;
+  if (loop->rate_limited_count == 0) {
+    return timeout;
+  }
+  for (event_loop_entry *entry = loop->active; entry; entry = entry->next) {
+    if (entry->finished || !entry->relay.rate_limited) {
+      continue;
+    }
+    int ms = shuttle_relay_throttle_ms(&entry->relay);
+    if (ms == 0) {
+      event_loop_pump(entry);
+      ms = entry->finished ? -1 : shuttle_relay_throttle_ms(&entry->relay);
+    }
+    if (ms >= 0 && ms < timeout) {
+      timeout = ms;
+    }
+  }
+  event_loop_set_thread_local(NULL);
+  return timeout;
+}
+
+#ifdef __linux__
+
+void event_loop_wait(event_loop *loop) {
+  struct epoll_event events[EVENT_LOOP_MAX_EVENTS];
+  int timeout = event_loop_check_throttled(loop);
+  int rc;
+  do {
+    rc = epoll_wait(loop->epoll_fd, events, EVENT_LOOP_MAX_EVENTS, timeout);
+  } while (rc < 0 && errno == EINTR);
+  if (rc < 0) {
+    errorNum("epoll_wait()");
+    unexpected_exit(61,"epoll_wait()");
+  }
+  for (int i=0; i<rc; i++) {
+    if (events[i].data.ptr == NULL) {
+      event_loop_drain_wake_fd(loop);
+      event_loop_adopt(loop);
+    } else {
+      // EPOLLERR / EPOLLHUP surface through the read()/write() in the pump
+      event_loop_pump(events[i].data.ptr);
+    }
+  }
+}
+
+#else // __linux__
+
+void event_loop_wait(event_loop *loop) {
+  int timeout = event_loop_check_throttled(loop);
+  int needed = 1 + 2 * loop->active_count;
+  if (needed > loop->pfd_size) {
+    loop->pfd_size = needed * 2;
+    loop->pfd = realloc(loop->pfd, sizeof(struct pollfd) * loop->pfd_size);
+    loop->pfd_entry = realloc(loop->pfd_entry, sizeof(event_loop_entry*) * loop->pfd_size);
+    if (loop->pfd == NULL || loop->pfd_entry == NULL) {
+      unexpected_exit(62,"Error allocating event loop poll set");
+    }
+  }
+  struct pollfd *pfd = loop->pfd;
+  event_loop_entry **pfd_entry = loop->pfd_entry;
+
+  int pfd_max = 0;
+  pfd[pfd_max].fd = loop->wake_fd[0];
+  pfd[pfd_max].events = POLLIN;
+  pfd_entry[pfd_max] = NULL;
+  pfd_max++;
+  for (event_loop_entry *entry = loop->active; entry; entry = entry->next) {
+    short events_in, events_out;
+    shuttle_relay_poll_events(&entry->relay, &events_in, &events_out);
+    // an fd we want nothing from is left out, otherwise a POLLHUP on it would spin the loop
+    pfd[pfd_max].fd = events_in ? entry->con->fd_in : -1;
+    pfd[pfd_max].events = events_in;
+    pfd_entry[pfd_max] = entry;
+    pfd_max++;
+    pfd[pfd_max].fd = events_out ? entry->con->fd_out : -1;
+    pfd[pfd_max].events = events_out;
+    pfd_entry[pfd_max] = entry;
+    pfd_max++;
+  }
+
+  int rc;
+  do {
+    rc = poll(pfd, pfd_max, timeout);
+  } while (rc < 0 && errno == EINTR);
+  if (rc < 0) {
+    errorNum("poll()");
+    unexpected_exit(61,"poll()");
+  }
+  for (int i=1; i<pfd_max; i++) {
+    if (pfd[i].revents & POLLNVAL) {
+      pfd_entry[i]->finished = -1;
+    } else if (pfd[i].revents) {
+      event_loop_pump(pfd_entry[i]);
+    }
+  }
+  if (pfd[0].revents) {
+    event_loop_drain_wake_fd(loop);
+    event_loop_adopt(loop);
+  }
+}
+
+#endif // __linux__
+
+void *event_loop_thread(void *data) {
+  event_loop *loop = data;
+  thread_local_set_log_config(NULL);
+  event_loop_set_thread_local(NULL);
+  debug("event loop %i started",loop->index);
+  while (1) {
+    event_loop_wait(loop);
+    event_loop_reap(loop);
+  }
+  return NULL;
+}
+
+int event_loop_set_nonblocking(int fd) {
+  int flags = fcntl(fd, F_GETFL);
+  return flags >= 0 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) >= 0;
+}
+
+// returns 1 on success, 0 on error
+int event_loop_start(int thread_count) {
+  if (thread_count <= 0) {
+    thread_count = sysconf(_SC_NPROCESSORS_ONLN);
+  }
+  if (thread_count <= 0) {
+    thread_count = 1;
+  }
+  if (thread_count > EVENT_LOOP_MAX_THREADS) {
+    thread_count = EVENT_LOOP_MAX_THREADS;
+  }
+
+  event_loop_list = calloc(thread_count, sizeof(event_loop));
+  if (event_loop_list == NULL) {
+    unexpected_exit(60,"Error allocating event loops");
+  }
+
+  for (int i=0; i<thread_count; i++) {
+    event_loop *loop = &event_loop_list[i];
+    loop->index = i;
+    pthread_mutex_init(&loop->mutex, NULL);
+    if (pipe(loop->wake_fd) < 0 || !event_loop_set_nonblocking(loop->wake_fd[0]) || !event_loop_set_nonblocking(loop->wake_fd[1])) {
+      errorNum("event loop pipe()");
+      return 0;
+    }
+#ifdef __linux__
+    loop->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (loop->epoll_fd < 0) {
+      errorNum("epoll_create1()");
+      return 0;
+    }
+    struct epoll_event ev;
+    ev.events = EPOLLIN; // level-triggered; we drain it anyways
+    ev.data.ptr = NULL;
+    if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, loop->wake_fd[0], &ev) < 0) {
+      errorNum("epoll_ctl() wake fd");
+      return 0;
+    }
+#endif
+    int rc = pthread_create(&loop->thread_id, NULL, event_loop_thread, loop);
+    if (rc != 0) {
+      errno = rc;
+      errorNum("pthread_create() for event loop");
+      return 0;
+    }
+    pthread_detach(loop->thread_id);
+    event_loop_list_count = i+1;
+  }
+  info("Started %i event loop thread%s", thread_count, thread_count == 1 ? "" : "s");
+  return 1;
+}
+
+int event_loop_running() {
+  return event_loop_list_count > 0;
+}
+
+int event_loop_count() {
+  return event_loop_list_count;
+}
+
+int event_loop_connection_count(int index) {
+  if (index < 0 || index >= event_loop_list_count) {
+    return 0;
+  }
+  event_loop *loop = &event_loop_list[index];
+  event_loop_lock(loop);
+  int count = loop->connection_count;
+  event_loop_unlock(loop);
+  return count;
+}
+
+// Give the connection's relay to the least busy event loop.
+// returns 1 if the event loop took ownership of 'con' (including closing it),
+//         0 if the caller should relay it itself.
+int event_loop_handoff(client_connection *con) {
+  if (!event_loop_running()) {
+    return 0;
+  }
+
+  event_loop *loop = &event_loop_list[0];
+  int best = -1;
+  for (int i=0; i<event_loop_list_count; i++) {
+    int count = event_loop_connection_count(i);
+    if (best < 0 || count < best) {
+      best = count;
+      loop = &event_loop_list[i];
+    }
+  }
+
+  event_loop_entry *entry = calloc(1, sizeof(event_loop_entry));
+  if (entry == NULL) {
+    errorNum("Error allocating event loop entry; relaying on this thread");
+    return 0;
+  }
+  entry->con = con;
+  entry->proxy = thread_local_get_proxy_instance();
+
+  event_loop_lock(loop);
+  entry->next = loop->incoming;
+  loop->incoming = entry;
+  loop->connection_count++;
+  event_loop_unlock(loop);
+
+  trace("handing connection to event loop %i",loop->index);
+  int rc;
+  do {
+    rc = write(loop->wake_fd[1], "", 1);
+  } while (rc < 0 && errno == EINTR);
+  // EAGAIN means the pipe is already full of wake-ups, which is just as good
+  return 1;
+}
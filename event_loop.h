@@ -0,0 +1,20 @@
+// Copyright 2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+// SPDX-License-Identifier: MIT-0
+
+#ifndef EVENT_LOOP_H
+#define EVENT_LOOP_H
+
+#include"client_connection.h"
+
+// With "engine eventloop", the service thread still does the handshake
+// (SOCKS negotiation, DNS, connecting to the destination) and then hands
+// the connection to one of a fixed set of event-loop threads, which relays
+// the data for every connection it owns. The service thread then exits.
+
+int event_loop_start(int thread_count);
+int event_loop_running();
+int event_loop_handoff(client_connection *con);
+int event_loop_count();
+int event_loop_connection_count(int index);
+
+#endif // EVENT_LOOP_H
@@ -0,0 +1,223 @@
+// Copyright 2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+// SPDX-License-Identifier: MIT-0
+
+#include<stdlib.h>
+#include<string.h>
+#include<unistd.h>
+#include<fcntl.h>
+#include<poll.h>
+#include<errno.h>
+#include<time.h>
+#include<netinet/in.h>
+#include<sys/socket.h>
+
+#include"log.h"
+#include"happy_eyeballs.h"
+
+long long happy_eyeballs_now_ms() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+socklen_t happy_eyeballs_addr_len(struct sockaddr_storage *addr) {
+  if (addr->ss_family == AF_INET6) {
+    return sizeof(struct sockaddr_in6);
+  }
+  return sizeof(struct sockaddr_in);
+}
+
+// Interleave address families, keeping the order within each family and
+// starting with the family of the first address (RFC 8305 section 4), so
+// a broken IPv6 path costs one attempt delay instead of one per address.
+void happy_eyeballs_order(struct sockaddr_storage *addrs, int count) {
+  if (count <= 2) {
+    return;
+  }
+  struct sockaddr_storage sorted[HAPPY_EYEBALLS_MAX_ADDRS];
+  int taken[HAPPY_EYEBALLS_MAX_ADDRS];
+  if (count > HAPPY_EYEBALLS_MAX_ADDRS) {
+    count = HAPPY_EYEBALLS_MAX_ADDRS;
+  }
+  memset(taken, 0, sizeof(taken));
+  int family = addrs[0].ss_family;
+  for (int out=0; out<count; out++) {
+    // next address of the wanted family; if there are none left, of any family
+    int pick = -1;
+    for (int i=0; i<count && pick < 0; i++) {
+      if (!taken[i] && addrs[i].ss_family == family) {
+        pick = i;
+      }
+    }
+    for (int i=0; i<count && pick < 0; i++) {
+      if (!taken[i]) {
+        pick = i;
+      }
+    }
+    taken[pick] = 1;
+    sorted[out] = addrs[pick];
+    family = addrs[pick].ss_family == AF_INET6 ? AF_INET : AF_INET6;
+  }
+  memcpy(addrs, sorted, sizeof(struct sockaddr_storage) * count);
+}
+
+void happy_eyeballs_close(int fd) {
+  int rc;
+  do {
+    rc = close(fd);
+  } while (rc < 0 && errno == EINTR);
+}
+
+// Start a non-blocking connect.
+// returns the socket (in progress or already connected in *connected), or -1 with errno set
+int happy_eyeballs_start(struct sockaddr_storage *addr, int *connected) {
+  *connected = 0;
+  int fd = socket(addr->ss_family, SOCK_STREAM, 0);
+  if (fd < 0) {
+    return -1;
+  }
+  int flags = fcntl(fd, F_GETFL);
+  if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+    int saved_errno = errno;
+    happy_eyeballs_close(fd);
+    errno = saved_errno;
+    return -1;
+  }
+  int rc;
+  do {
+    rc = connect(fd, (struct sockaddr*)addr, happy_eyeballs_addr_len(addr));
+  } while (rc < 0 && errno == EINTR);
+  if (rc == 0) {
+    *connected = 1;
+    return fd;
+  }
+  if (errno == EINPROGRESS) {
+    return fd;
+  }
+  int saved_errno = errno;
+  happy_eyeballs_close(fd);
+  errno = saved_errno;
+  return -1;
+}
+
+// Connect to the first of 'addrs' that answers. timeout_ms <= 0 means no limit beyond the kernel's own.
+// returns 1 if connected, 0 otherwise; details in 'result'
+int happy_eyeballs_connect(struct sockaddr_storage *addrs, int count, int timeout_ms, happy_eyeballs_result *result) {
+  int fd[HAPPY_EYEBALLS_MAX_ADDRS];
+  struct pollfd pfd[HAPPY_EYEBALLS_MAX_ADDRS];
+  int pfd_addr[HAPPY_EYEBALLS_MAX_ADDRS];
+  if (count > HAPPY_EYEBALLS_MAX_ADDRS) {
+    count = HAPPY_EYEBALLS_MAX_ADDRS;
+  }
+
+  result->fd = -1;
+  result->winner = -1;
+  result->error = count > 0 ? 0 : EHOSTUNREACH;
+  result->attempts = 0;
+
+  long long start = happy_eyeballs_now_ms();
+  long long last_start = 0;
+  int next = 0;
+  int in_flight = 0;
+  while (result->winner < 0) {
+    long long now = happy_eyeballs_now_ms();
+    if (timeout_ms > 0 && now - start >= timeout_ms) {
+      result->error = ETIMEDOUT;
+      break;
+    }
+
+    // time for the next attempt?
+    if (next < count && (in_flight == 0 || now - last_start >= HAPPY_EYEBALLS_ATTEMPT_DELAY_MS)) {
+      int connected;
+      fd[next] = happy_eyeballs_start(&addrs[next], &connected);
+      result->attempts++;
+      last_start = now;
+      if (fd[next] < 0) {
+        result->error = errno;
+        trace2("connect attempt %i failed immediately: %s",next,strerror(errno));
+      } else if (connected) {
+        result->winner = next;
+      } else {
+        in_flight++;
+      }
+      next++;
+      continue;
+    }
+    if (in_flight == 0) {
+      break; // every address has failed
+    }
+
+    // wait for an attempt to finish, the next attempt to be due, or the deadline
+    int wait_ms = -1;
+    if (next < count) {
+      wait_ms = (int)(last_start + HAPPY_EYEBALLS_ATTEMPT_DELAY_MS - now);
+    }
+    if (timeout_ms > 0) {
+      int left = (int)(start + timeout_ms - now);
+      if (wait_ms < 0 || left < wait_ms) {
+        wait_ms = left;
+      }
+    }
+    if (wait_ms < 0 && (next < count || timeout_ms > 0)) {
+      wait_ms = 0;
+    }
+    int pfd_max = 0;
+    for (int i=0; i<next; i++) {
+      if (fd[i] >= 0) {
+        pfd[pfd_max].fd = fd[i];
+        pfd[pfd_max].events = POLLOUT;
+        pfd[pfd_max].revents = 0;
+        pfd_addr[pfd_max] = i;
+        pfd_max++;
+      }
+    }
+    int rc;
+    do {
+      rc = poll(pfd, pfd_max, wait_ms);
+    } while (rc < 0 && errno == EINTR);
+    if (rc < 0) {
+      result->error = errno;
+      errorNum("poll() in connect");
+      break;
+    }
+    for (int p=0; p<pfd_max && result->winner < 0; p++) {
+      if (pfd[p].revents == 0) {
+        continue;
+      }
+      int i = pfd_addr[p];
+      int so_error = 0;
+      socklen_t len = sizeof(so_error);
+      if (getsockopt(fd[i], SOL_SOCKET, SO_ERROR, &so_error, &len) < 0) {
+        so_error = errno;
+      }
+      if (so_error == 0) {
+        result->winner = i;
+      } else {
+        trace2("connect attempt %i failed: %s",i,strerror(so_error));
+        result->error = so_error;
+        happy_eyeballs_close(fd[i]);
+        fd[i] = -1;
+        in_flight--;
+        last_start = now - HAPPY_EYEBALLS_ATTEMPT_DELAY_MS; // a failure starts the next attempt right away
+      }
+    }
+  }
+
+  // keep the winner; abandon the rest
+  for (int i=0; i<next; i++) {
+    if (i != result->winner && fd[i] >= 0) {
+      happy_eyeballs_close(fd[i]);
+    }
+  }
+  result->elapsed_ms = happy_eyeballs_now_ms() - start;
+  if (result->winner < 0) {
+    return 0;
+  }
+  result->fd = fd[result->winner];
+  int flags = fcntl(result->fd, F_GETFL);
+  if (flags >= 0) {
+    fcntl(result->fd, F_SETFL, flags & ~O_NONBLOCK);
+  }
+  result->error = 0;
+  return 1;
+}
@@ -0,0 +1,30 @@
+// Copyright 2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+// SPDX-License-Identifier: MIT-0
+
+#ifndef HAPPY_EYEBALLS_H
+#define HAPPY_EYEBALLS_H
+
+#include<sys/socket.h>
+
+// Non-blocking connect to the first of several addresses that answers,
+// after RFC 8305 ("Happy Eyeballs Version 2"): address families are
+// interleaved, attempts start HAPPY_EYEBALLS_ATTEMPT_DELAY_MS apart (or
+// as soon as the previous one fails) and race each other; the first to
+// connect wins and the rest are abandoned.
+
+#define HAPPY_EYEBALLS_MAX_ADDRS        16
+#define HAPPY_EYEBALLS_ATTEMPT_DELAY_MS 250 // RFC 8305 section 5 recommends 250ms
+
+typedef struct happy_eyeballs_result {
+  int fd;              // the connected socket, in blocking mode; -1 if none connected
+  int winner;          // index into addrs of the address that connected; -1 if none
+  int error;           // errno of the last failed attempt, or ETIMEDOUT
+  int attempts;        // connection attempts started
+  long long elapsed_ms;
+} happy_eyeballs_result;
+
+socklen_t happy_eyeballs_addr_len(struct sockaddr_storage *addr);
+void happy_eyeballs_order(struct sockaddr_storage *addrs, int count);
+int  happy_eyeballs_connect(struct sockaddr_storage *addrs, int count, int timeout_ms, happy_eyeballs_result *result);
+
+#endif // HAPPY_EYEBALLS_H
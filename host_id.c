@@ -123,6 +123,7 @@ void host_id_set_addr_in_from_byte_array(host_id *id, unsigned char* ipv4, int p
 void host_id_set_addr_in6_from_byte_array(host_id *id, unsigned char* ipv6, int port) {
   id->port=port;
   struct sockaddr_in6* sin = &(id->addr.sa_in6);
+  memset(sin, 0, sizeof(struct sockaddr_in6)); // no flow info or scope ID
   sin->sin6_len = sizeof(struct sockaddr_in6);
   sin->sin6_family = AF_INET6;
   sin->sin6_port=htons(port);
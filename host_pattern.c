@@ -0,0 +1,804 @@
+// Copyright 2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+// SPDX-License-Identifier: MIT-0
+
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<ctype.h>
+#include<pthread.h>
+
+#include"log.h"
+#include"host_pattern.h"
+
+void *hp_grow(void *array, int count, int *capacity, size_t size) {
+  if (count < *capacity) {
+    return array;
+  }
+  int new_capacity = *capacity > 0 ? *capacity * 2 : 16;
+  void *new_array = realloc(array, size * new_capacity);
+  if (new_array == NULL) {
+    unexpected_exit(68,"Error allocating host_pattern");
+  }
+  *capacity = new_capacity;
+  return new_array;
+}
+
+////////////////////////// COMPILING ONE PATTERN
+
+// Each fragment of the NFA has one way in ('start') and one way out ('end',
+// an EPSILON state whose 'out' is still -1), so fragments join up by pointing
+// one's end at the other's start.
+typedef struct hp_frag {
+  int start;
+  int end;
+} hp_frag;
+
+typedef struct hp_parser {
+  host_pattern *p;
+  char *s;
+  int pos;
+  char *err;
+  int errlen;
+  int failed;
+} hp_parser;
+
+int hp_new_state(host_pattern *p, int type, int out, int out1, int set) {
+  p->state = hp_grow(p->state, p->state_count, &p->state_capacity, sizeof(host_pattern_state));
+  host_pattern_state *st = &p->state[p->state_count];
+  st->type = type;
+  st->out = out;
+  st->out1 = out1;
+  st->set = set;
+  return p->state_count++;
+}
+
+int hp_new_set(host_pattern *p) {
+  p->set = hp_grow(p->set, p->set_count, &p->set_capacity, sizeof(p->set[0]));
+  memset(p->set[p->set_count], 0, sizeof(p->set[0]));
+  return p->set_count++;
+}
+
+// sets only hold lowercase characters; names are lowercased before matching
+void hp_set_add(host_pattern *p, int set, int lo, int hi) {
+  for (int c=lo; c<=hi; c++) {
+    int l = tolower(c);
+    p->set[set][l >> 3] |= 1 << (l & 7);
+  }
+}
+
+void hp_set_negate(host_pattern *p, int set) {
+  for (int i=0; i<32; i++) {
+    p->set[set][i] = ~p->set[set][i];
+  }
+}
+
+hp_frag hp_frag_set(host_pattern *p, int set) {
+  hp_frag f;
+  f.end = hp_new_state(p, HOST_PATTERN_STATE_EPSILON, -1, -1, -1);
+  f.start = hp_new_state(p, HOST_PATTERN_STATE_CHAR, f.end, -1, set);
+  return f;
+}
+
+hp_frag hp_frag_any(host_pattern *p) {
+  int set = hp_new_set(p);
+  hp_set_add(p, set, 0, 255);
+  return hp_frag_set(p, set);
+}
+
+hp_frag hp_frag_char(host_pattern *p, int c) {
+  int set = hp_new_set(p);
+  hp_set_add(p, set, c, c);
+  return hp_frag_set(p, set);
+}
+
+hp_frag hp_frag_empty(host_pattern *p) {
+  hp_frag f;
+  f.start = f.end = hp_new_state(p, HOST_PATTERN_STATE_EPSILON, -1, -1, -1);
+  return f;
+}
+
+hp_frag hp_concat(host_pattern *p, hp_frag a, hp_frag b) {
+  p->state[a.end].out = b.start;
+  a.end = b.end;
+  return a;
+}
+
+hp_frag hp_alt(host_pattern *p, hp_frag a, hp_frag b) {
+  hp_frag f;
+  f.end = hp_new_state(p, HOST_PATTERN_STATE_EPSILON, -1, -1, -1);
+  f.start = hp_new_state(p, HOST_PATTERN_STATE_SPLIT, a.start, b.start, -1);
+  p->state[a.end].out = f.end;
+  p->state[b.end].out = f.end;
+  return f;
+}
+
+// 'op' is '*', '+' or '?'
+hp_frag hp_repeat(host_pattern *p, hp_frag a, char op) {
+  hp_frag f;
+  f.end = hp_new_state(p, HOST_PATTERN_STATE_EPSILON, -1, -1, -1);
+  int split = hp_new_state(p, HOST_PATTERN_STATE_SPLIT, a.start, f.end, -1);
+  p->state[a.end].out = op == '?' ? f.end : split;
+  f.start = op == '+' ? a.start : split;
+  return f;
+}
+
+void hp_error(hp_parser *ps, char *msg) {
+  if (!ps->failed) {
+    snprintf(ps->err, ps->errlen, "%s at position %i", msg, ps->pos + 1);
+    ps->failed = 1;
+  }
+}
+
+// \d \w \s; returns 0 if 'c' isn't one of them
+int hp_escape_class(host_pattern *p, int set, char c) {
+  switch (c) {
+    case 'd': hp_set_add(p, set, '0', '9'); return 1;
+    case 'w': hp_set_add(p, set, 'a', 'z'); hp_set_add(p, set, '0', '9'); hp_set_add(p, set, '_', '_'); return 1;
+    case 's': hp_set_add(p, set, ' ', ' '); hp_set_add(p, set, '\t', '\r'); return 1;
+  }
+  return 0;
+}
+
+// [abc] [a-z] [^a-z], and [!a-z] in a glob; ps->pos is at the '['
+hp_frag hp_parse_class(hp_parser *ps) {
+  host_pattern *p = ps->p;
+  int set = hp_new_set(p);
+  ps->pos++;
+  int negate = 0;
+  if (ps->s[ps->pos] == '^' || (p->type == HOST_PATTERN_GLOB && ps->s[ps->pos] == '!')) {
+    negate = 1;
+    ps->pos++;
+  }
+  int first = 1;
+  while (!ps->failed) {
+    unsigned char c = ps->s[ps->pos];
+    if (c == 0) {
+      hp_error(ps, "unterminated [");
+      break;
+    }
+    if (c == ']' && !first) {
+      ps->pos++;
+      break;
+    }
+    first = 0;
+    int lo = c;
+    ps->pos++;
+    if (c == '\\') {
+      lo = (unsigned char)ps->s[ps->pos];
+      if (lo == 0) {
+        hp_error(ps, "unterminated [");
+        break;
+      }
+      ps->pos++;
+      if (p->type == HOST_PATTERN_REGEX && hp_escape_class(p, set, lo)) {
+        continue;
+      }
+    }
+    int hi = lo;
+    if (ps->s[ps->pos] == '-' && ps->s[ps->pos+1] != 0 && ps->s[ps->pos+1] != ']') {
+      ps->pos++;
+      hi = (unsigned char)ps->s[ps->pos++];
+      if (hi == '\\' && ps->s[ps->pos] != 0) {
+        hi = (unsigned char)ps->s[ps->pos++];
+      }
+      if (hi < lo) {
+        hp_error(ps, "bad range in []");
+        break;
+      }
+    }
+    hp_set_add(p, set, lo, hi);
+  }
+  if (negate) {
+    hp_set_negate(p, set);
+  }
+  return hp_frag_set(p, set);
+}
+
+hp_frag hp_parse_regex_alt(hp_parser *ps);
+
+hp_frag hp_parse_regex_atom(hp_parser *ps) {
+  host_pattern *p = ps->p;
+  char c = ps->s[ps->pos];
+  switch (c) {
+    case '(': {
+      ps->pos++;
+      hp_frag f = hp_parse_regex_alt(ps);
+      if (ps->s[ps->pos] != ')') {
+        hp_error(ps, "missing )");
+      } else {
+        ps->pos++;
+      }
+      return f;
+    }
+    case '[':
+      return hp_parse_class(ps);
+    case '.':
+      ps->pos++;
+      return hp_frag_any(p);
+    case '\\': {
+      char e = ps->s[ps->pos+1];
+      if (e == 0) {
+        hp_error(ps, "trailing \\");
+        return hp_frag_empty(p);
+      }
+      ps->pos += 2;
+      int set = hp_new_set(p);
+      if (!hp_escape_class(p, set, e)) {
+        hp_set_add(p, set, (unsigned char)e, (unsigned char)e);
+      }
+      return hp_frag_set(p, set);
+    }
+    case '*': case '+': case '?':
+      hp_error(ps, "nothing to repeat");
+      return hp_frag_empty(p);
+    case '{':
+      hp_error(ps, "{} repetition is not supported");
+      return hp_frag_empty(p);
+    case '^': case '$':
+      hp_error(ps, "^ and $ only anchor the start and end of the pattern");
+      return hp_frag_empty(p);
+  }
+  ps->pos++;
+  return hp_frag_char(p, (unsigned char)c);
+}
+
+hp_frag hp_parse_regex_concat(hp_parser *ps) {
+  host_pattern *p = ps->p;
+  hp_frag f = hp_frag_empty(p);
+  while (!ps->failed && ps->s[ps->pos] != 0 && ps->s[ps->pos] != '|' && ps->s[ps->pos] != ')') {
+    hp_frag g = hp_parse_regex_atom(ps);
+    char op = ps->s[ps->pos];
+    while (!ps->failed && (op == '*' || op == '+' || op == '?')) {
+      g = hp_repeat(p, g, op);
+      op = ps->s[++ps->pos];
+    }
+    if (op == '{') {
+      hp_error(ps, "{} repetition is not supported");
+    }
+    f = hp_concat(p, f, g);
+  }
+  return f;
+}
+
+hp_frag hp_parse_regex_alt(hp_parser *ps) {
+  hp_frag f = hp_parse_regex_concat(ps);
+  while (!ps->failed && ps->s[ps->pos] == '|') {
+    ps->pos++;
+    f = hp_alt(ps->p, f, hp_parse_regex_concat(ps));
+  }
+  return f;
+}
+
+hp_frag hp_parse_regex(hp_parser *ps) {
+  host_pattern *p = ps->p;
+  int len = strlen(ps->s);
+
+  // Unanchored, a regex may start anywhere in the name (a leading .*), and
+  // once it has matched, whatever follows doesn't matter (sticky).
+  int anchor_start = ps->s[0] == '^';
+  int anchor_end = 0;
+  if (len > anchor_start && ps->s[len-1] == '$') {
+    int backslashes = 0;
+    for (int i=len-2; i >= 0 && ps->s[i] == '\\'; i--) {
+      backslashes++;
+    }
+    anchor_end = backslashes % 2 == 0;
+  }
+  if (anchor_end) {
+    ps->s[len-1] = 0;
+  }
+  ps->pos = anchor_start;
+  p->sticky = !anchor_end;
+
+  hp_frag f = anchor_start ? hp_frag_empty(p) : hp_repeat(p, hp_frag_any(p), '*');
+  f = hp_concat(p, f, hp_parse_regex_alt(ps));
+  if (!ps->failed && ps->s[ps->pos] == ')') {
+    hp_error(ps, "unmatched )");
+  }
+  return f;
+}
+
+hp_frag hp_parse_glob(hp_parser *ps) {
+  host_pattern *p = ps->p;
+  hp_frag f = hp_frag_empty(p);
+  while (!ps->failed && ps->s[ps->pos] != 0) {
+    char c = ps->s[ps->pos];
+    if (c == '*') {
+      while (ps->s[ps->pos] == '*') {
+        ps->pos++;
+      }
+      if (ps->s[ps->pos] == 0) {
+        p->sticky = 1; // a trailing * matches whatever is left
+        break;
+      }
+      f = hp_concat(p, f, hp_repeat(p, hp_frag_any(p), '*'));
+    } else if (c == '?') {
+      ps->pos++;
+      f = hp_concat(p, f, hp_frag_any(p));
+    } else if (c == '[') {
+      f = hp_concat(p, f, hp_parse_class(ps));
+    } else if (c == '\\') {
+      if (ps->s[ps->pos+1] == 0) {
+        hp_error(ps, "trailing \\");
+        break;
+      }
+      f = hp_concat(p, f, hp_frag_char(p, (unsigned char)ps->s[ps->pos+1]));
+      ps->pos += 2;
+    } else {
+      ps->pos++;
+      f = hp_concat(p, f, hp_frag_char(p, (unsigned char)c));
+    }
+  }
+  return f;
+}
+
+void host_pattern_free(host_pattern *p) {
+  if (p == NULL) {
+    return;
+  }
+  free(p->source);
+  free(p->state);
+  free(p->set);
+  free(p);
+}
+
+// bytes allocated for 'p', for the memory report
+size_t host_pattern_memory(host_pattern *p) {
+  if (p == NULL) {
+    return 0;
+  }
+  return sizeof(host_pattern) + strlen(p->source) + 1 +
+         sizeof(host_pattern_state) * p->state_capacity + sizeof(p->set[0]) * p->set_capacity;
+}
+
+// returns NULL, with the reason in 'err', if 'source' isn't a valid pattern
+host_pattern *host_pattern_compile(char *source, int type, char *err, int errlen) {
+  char buf[HOST_PATTERN_MAX_LEN];
+  if (strlen(source) >= sizeof(buf)) {
+    snprintf(err, errlen, "longer than %i characters", HOST_PATTERN_MAX_LEN - 1);
+    return NULL;
+  }
+  strcpy(buf, source);
+
+  host_pattern *p = calloc(1, sizeof(host_pattern));
+  if (p == NULL || (p->source = strdup(source)) == NULL) {
+    unexpected_exit(68,"Error allocating host_pattern");
+  }
+  p->type = type;
+
+  hp_parser ps;
+  ps.p = p;
+  ps.s = buf;
+  ps.pos = 0;
+  ps.err = err;
+  ps.errlen = errlen;
+  ps.failed = 0;
+  hp_frag f = type == HOST_PATTERN_REGEX ? hp_parse_regex(&ps) : hp_parse_glob(&ps);
+  if (ps.failed) {
+    host_pattern_free(p);
+    return NULL;
+  }
+  p->start = f.start;
+  p->state[f.end].out = hp_new_state(p, HOST_PATTERN_STATE_MATCH, -1, -1, -1);
+  p->scratch_size = p->state_count * 5;
+  return p;
+}
+
+////////////////////////// MATCHING ONE PATTERN
+
+#define HP_SET_HAS(set, c) ((set)[(c) >> 3] & (1 << ((c) & 7)))
+
+// Follow SPLIT and EPSILON states from the 'seed' states, appending the CHAR
+// and MATCH states reached to 'list'. 'mark' holds 'gen' for every state
+// visited in this round; 'stack' has room for every state.
+// returns the new length of 'list'
+int hp_closure(host_pattern_state *state, int *seed, int seed_count, int *mark, int gen, int *stack, int *list, int list_count) {
+  int top = 0;
+  for (int i=0; i<seed_count; i++) {
+    if (mark[seed[i]] != gen) {
+      mark[seed[i]] = gen;
+      stack[top++] = seed[i];
+    }
+  }
+  while (top > 0) {
+    int s = stack[--top];
+    host_pattern_state *st = &state[s];
+    if (st->type == HOST_PATTERN_STATE_CHAR || st->type == HOST_PATTERN_STATE_MATCH) {
+      list[list_count++] = s;
+      continue;
+    }
+    int outs[2] = { st->out, st->type == HOST_PATTERN_STATE_SPLIT ? st->out1 : -1 };
+    for (int i=1; i >= 0; i--) {
+      if (outs[i] >= 0 && mark[outs[i]] != gen) {
+        mark[outs[i]] = gen;
+        stack[top++] = outs[i];
+      }
+    }
+  }
+  return list_count;
+}
+
+// Working space for host_pattern_match(), one per thread. It only ever grows,
+// to fit the largest pattern the thread has matched, so matching allocates nothing.
+typedef struct hp_scratch {
+  int size;
+  int mem[];
+} hp_scratch;
+
+pthread_key_t hp_scratch_key;
+pthread_once_t hp_scratch_key_once = PTHREAD_ONCE_INIT;
+
+void hp_scratch_key_init() {
+  int rc = pthread_key_create(&hp_scratch_key, free);
+  if (rc != 0) {
+    unexpected_exit(68,"pthread_key_create() for host_pattern");
+  }
+}
+
+int *hp_scratch_get(int size) {
+  pthread_once(&hp_scratch_key_once, hp_scratch_key_init);
+  hp_scratch *scratch = pthread_getspecific(hp_scratch_key);
+  if (scratch == NULL || scratch->size < size) {
+    free(scratch);
+    scratch = malloc(sizeof(hp_scratch) + sizeof(int) * size);
+    if (scratch == NULL || pthread_setspecific(hp_scratch_key, scratch) != 0) {
+      unexpected_exit(68,"Error allocating host_pattern");
+    }
+    scratch->size = size;
+  }
+  return scratch->mem;
+}
+
+// returns 1 if 'str' matches, 0 otherwise
+int host_pattern_match(host_pattern *p, char *str) {
+  int n = p->state_count;
+  int *mem = hp_scratch_get(p->scratch_size);
+  int *mark = mem, *stack = mem + n, *list = mem + n*2, *next = mem + n*3, *seed = mem + n*4;
+  for (int i=0; i<n; i++) {
+    mark[i] = 0;
+  }
+  int gen = 1;
+  int count = hp_closure(p->state, &p->start, 1, mark, gen, stack, list, 0);
+  int matched = 0;
+  for (unsigned char *ptr=(unsigned char*)str; ; ptr++) {
+    matched = 0;
+    for (int i=0; i<count; i++) {
+      if (p->state[list[i]].type == HOST_PATTERN_STATE_MATCH) {
+        matched = 1;
+      }
+    }
+    if ((matched && p->sticky) || *ptr == 0 || count == 0) {
+      break;
+    }
+    int c = tolower(*ptr);
+    int seed_count = 0;
+    for (int i=0; i<count; i++) {
+      host_pattern_state *st = &p->state[list[i]];
+      if (st->type == HOST_PATTERN_STATE_CHAR && HP_SET_HAS(p->set[st->set], c)) {
+        seed[seed_count++] = st->out;
+      }
+    }
+    gen++;
+    count = hp_closure(p->state, seed, seed_count, mark, gen, stack, next, 0);
+    int *tmp = list; list = next; next = tmp;
+  }
+  return matched;
+}
+
+////////////////////////// THE COMBINED DFA
+
+// Every pattern's NFA side by side, with the state numbers made global, and
+// the DFA states made from them so far.
+typedef struct hp_dfa_builder {
+  host_pattern_state *state;
+  unsigned char **set; // per state; CHAR states only
+  int *owner;          // per state: which pattern it belongs to
+  int state_count;
+  host_pattern **pattern;
+  int *id;
+
+  host_pattern_dfa *dfa;
+  int state_capacity;
+  int out_count;
+  int out_capacity;
+
+  // the NFA states that make up each DFA state: pool[pool_start[s] .. pool_start[s+1])
+  int *pool;
+  int pool_count;
+  int pool_capacity;
+  int *pool_start;
+  unsigned int *hash;
+
+  int *table; // open addressing over the DFA states; -1 if empty
+  int table_size;
+} hp_dfa_builder;
+
+int hp_compare_int(const void *a, const void *b) {
+  int x = *(int*)a, y = *(int*)b;
+  return x < y ? -1 : x > y;
+}
+
+unsigned int hp_hash_ints(int *list, int count) {
+  unsigned int hash = 5381;
+  for (int i=0; i<count; i++) {
+    hash = hash * 33 + (unsigned int)list[i];
+  }
+  return hash;
+}
+
+void hp_dfa_table_insert(hp_dfa_builder *b, int s) {
+  int slot = b->hash[s] & (b->table_size - 1);
+  while (b->table[slot] >= 0) {
+    slot = (slot + 1) & (b->table_size - 1);
+  }
+  b->table[slot] = s;
+}
+
+// Add a DFA state, with room for its transitions and outputs.
+// returns the new state
+int hp_dfa_new_state(hp_dfa_builder *b, int *key, int key_count, unsigned int hash) {
+  host_pattern_dfa *dfa = b->dfa;
+  int s = dfa->state_count;
+  if (s + 1 >= b->state_capacity) {
+    b->state_capacity = b->state_capacity * 2;
+    dfa->next = realloc(dfa->next, sizeof(int) * b->state_capacity * dfa->class_count);
+    dfa->out_start = realloc(dfa->out_start, sizeof(int) * (b->state_capacity + 1));
+    dfa->sticky_count = realloc(dfa->sticky_count, sizeof(int) * b->state_capacity);
+    b->pool_start = realloc(b->pool_start, sizeof(int) * (b->state_capacity + 1));
+    b->hash = realloc(b->hash, sizeof(unsigned int) * b->state_capacity);
+    if (dfa->next == NULL || dfa->out_start == NULL || dfa->sticky_count == NULL || b->pool_start == NULL || b->hash == NULL) {
+      unexpected_exit(68,"Error allocating host_pattern_dfa");
+    }
+  }
+  for (int c=0; c<dfa->class_count; c++) {
+    dfa->next[s * dfa->class_count + c] = 0;
+  }
+  for (int i=0; i<key_count; i++) {
+    b->pool = hp_grow(b->pool, b->pool_count, &b->pool_capacity, sizeof(int));
+    b->pool[b->pool_count++] = key[i];
+  }
+  b->pool_start[s+1] = b->pool_count;
+  b->hash[s] = hash;
+
+  // sticky patterns that match on the way in, then the rest that match if the name ends here
+  dfa->out_start[s] = b->out_count;
+  dfa->sticky_count[s] = 0;
+  for (int pass=0; pass<2; pass++) {
+    for (int i=0; i<key_count; i++) {
+      if (b->state[key[i]].type != HOST_PATTERN_STATE_MATCH) {
+        continue;
+      }
+      int o = b->owner[key[i]];
+      if ((pass == 0) == (b->pattern[o]->sticky != 0)) {
+        b->dfa->out = hp_grow(b->dfa->out, b->out_count, &b->out_capacity, sizeof(int));
+        b->dfa->out[b->out_count++] = b->id[o];
+        if (pass == 0) {
+          dfa->sticky_count[s]++;
+        }
+      }
+    }
+  }
+  dfa->out_start[s+1] = b->out_count;
+  dfa->state_count++;
+
+  if (dfa->state_count * 2 > b->table_size) {
+    free(b->table);
+    b->table_size *= 2;
+    b->table = malloc(sizeof(int) * b->table_size);
+    if (b->table == NULL) {
+      unexpected_exit(68,"Error allocating host_pattern_dfa");
+    }
+    for (int i=0; i<b->table_size; i++) {
+      b->table[i] = -1;
+    }
+    for (int i=1; i<dfa->state_count; i++) {
+      hp_dfa_table_insert(b, i);
+    }
+  } else if (s > 0) {
+    hp_dfa_table_insert(b, s);
+  }
+  return s;
+}
+
+// Find or make the DFA state for the NFA states in 'list', as hp_closure()
+// left them; 'list' is sorted in place.
+// returns the state, 0 if 'list' is empty, -1 if there would be too many states
+int hp_dfa_state(hp_dfa_builder *b, int *list, int key_count) {
+  if (key_count == 0) {
+    return 0;
+  }
+  qsort(list, key_count, sizeof(int), hp_compare_int);
+
+  unsigned int hash = hp_hash_ints(list, key_count);
+  for (int slot = hash & (b->table_size - 1); b->table[slot] >= 0; slot = (slot + 1) & (b->table_size - 1)) {
+    int s = b->table[slot];
+    int len = b->pool_start[s+1] - b->pool_start[s];
+    if (b->hash[s] == hash && len == key_count && memcmp(&b->pool[b->pool_start[s]], list, sizeof(int) * len) == 0) {
+      return s;
+    }
+  }
+  if (b->dfa->state_count >= HOST_PATTERN_DFA_MAX_STATES) {
+    return -1;
+  }
+  return hp_dfa_new_state(b, list, key_count, hash);
+}
+
+// Split the characters into classes that every set either takes whole or not at all.
+void hp_dfa_classes(hp_dfa_builder *b) {
+  host_pattern_dfa *dfa = b->dfa;
+  memset(dfa->class_of, 0, sizeof(dfa->class_of));
+  dfa->class_count = 1;
+  for (int s=0; s<b->state_count; s++) {
+    if (b->state[s].type != HOST_PATTERN_STATE_CHAR) {
+      continue;
+    }
+    int map[512];
+    for (int i=0; i<dfa->class_count * 2; i++) {
+      map[i] = -1;
+    }
+    int count = 0;
+    for (int c=0; c<256; c++) {
+      int k = dfa->class_of[c] * 2 + (HP_SET_HAS(b->set[s], c) ? 1 : 0);
+      if (map[k] < 0) {
+        map[k] = count++;
+      }
+      dfa->class_of[c] = map[k];
+    }
+    dfa->class_count = count;
+  }
+}
+
+void host_pattern_dfa_free(host_pattern_dfa *dfa) {
+  if (dfa == NULL) {
+    return;
+  }
+  free(dfa->next);
+  free(dfa->out_start);
+  free(dfa->sticky_count);
+  free(dfa->out);
+  free(dfa);
+}
+
+// bytes of 'dfa' in use, for the memory report; its arrays may have a little spare capacity on top
+size_t host_pattern_dfa_memory(host_pattern_dfa *dfa) {
+  if (dfa == NULL) {
+    return 0;
+  }
+  return sizeof(host_pattern_dfa) +
+         sizeof(int) * dfa->state_count * dfa->class_count + // next
+         sizeof(int) * (dfa->state_count + 1) +              // out_start
+         sizeof(int) * dfa->state_count +                    // sticky_count
+         sizeof(int) * dfa->out_start[dfa->state_count];     // out
+}
+
+// Compile 'count' patterns into one DFA, which reports id[i] when pattern[i] matches.
+// returns the DFA, or NULL if it would have more than HOST_PATTERN_DFA_MAX_STATES states
+host_pattern_dfa *host_pattern_dfa_build(host_pattern **pattern, int *id, int count) {
+  hp_dfa_builder b;
+  memset(&b, 0, sizeof(b));
+  b.pattern = pattern;
+  b.id = id;
+  for (int i=0; i<count; i++) {
+    b.state_count += pattern[i]->state_count;
+  }
+  int n = b.state_count;
+  b.state = malloc(sizeof(host_pattern_state) * (n + 1));
+  b.set = malloc(sizeof(unsigned char*) * (n + 1));
+  b.owner = malloc(sizeof(int) * (n + 1));
+  int *mem = malloc(sizeof(int) * (n + 1) * 5);
+  b.dfa = calloc(1, sizeof(host_pattern_dfa));
+  b.state_capacity = 64;
+  b.table_size = 128;
+  b.table = malloc(sizeof(int) * b.table_size);
+  b.pool_start = malloc(sizeof(int) * (b.state_capacity + 1));
+  b.hash = malloc(sizeof(unsigned int) * b.state_capacity);
+  if (b.state == NULL || b.set == NULL || b.owner == NULL || mem == NULL || b.dfa == NULL ||
+      b.table == NULL || b.pool_start == NULL || b.hash == NULL) {
+    unexpected_exit(68,"Error allocating host_pattern_dfa");
+  }
+  int *mark = mem, *stack = mem + (n+1), *list = mem + (n+1)*2, *seed = mem + (n+1)*3, *cur = mem + (n+1)*4;
+  for (int i=0; i<b.table_size; i++) {
+    b.table[i] = -1;
+  }
+
+  int offset = 0;
+  for (int i=0; i<count; i++) {
+    host_pattern *p = pattern[i];
+    for (int s=0; s<p->state_count; s++) {
+      host_pattern_state *st = &b.state[offset + s];
+      *st = p->state[s];
+      st->out = st->out >= 0 ? st->out + offset : -1;
+      st->out1 = st->out1 >= 0 ? st->out1 + offset : -1;
+      b.set[offset + s] = st->type == HOST_PATTERN_STATE_CHAR ? p->set[st->set] : NULL;
+      b.owner[offset + s] = i;
+      mark[offset + s] = 0;
+    }
+    seed[i] = p->start + offset;
+    offset += p->state_count;
+  }
+
+  host_pattern_dfa *dfa = b.dfa;
+  hp_dfa_classes(&b);
+  int rep[256]; // a character of each class
+  for (int c=255; c >= 0; c--) {
+    rep[dfa->class_of[c]] = c;
+  }
+  dfa->next = malloc(sizeof(int) * b.state_capacity * dfa->class_count);
+  dfa->out_start = malloc(sizeof(int) * (b.state_capacity + 1));
+  dfa->sticky_count = malloc(sizeof(int) * b.state_capacity);
+  if (dfa->next == NULL || dfa->out_start == NULL || dfa->sticky_count == NULL) {
+    unexpected_exit(68,"Error allocating host_pattern_dfa");
+  }
+
+  // state 0 is the dead state, which every state goes to once nothing can match any more
+  b.pool_start[0] = 0;
+  hp_dfa_new_state(&b, NULL, 0, 0);
+  int gen = 1;
+  int ok = hp_dfa_state(&b, list, hp_closure(b.state, seed, count, mark, gen, stack, list, 0)) == 1;
+
+  for (int s=1; ok && s<dfa->state_count; s++) {
+    int cur_count = b.pool_start[s+1] - b.pool_start[s];
+    memcpy(cur, &b.pool[b.pool_start[s]], sizeof(int) * cur_count);
+    for (int c=0; ok && c<dfa->class_count; c++) {
+      int seed_count = 0;
+      for (int i=0; i<cur_count; i++) {
+        if (b.state[cur[i]].type == HOST_PATTERN_STATE_CHAR && HP_SET_HAS(b.set[cur[i]], rep[c])) {
+          seed[seed_count++] = b.state[cur[i]].out;
+        }
+      }
+      gen++;
+      int t = hp_dfa_state(&b, list, hp_closure(b.state, seed, seed_count, mark, gen, stack, list, 0));
+      if (t < 0) {
+        ok = 0;
+      } else {
+        dfa->next[s * dfa->class_count + c] = t;
+      }
+    }
+  }
+
+  free(b.state);
+  free(b.set);
+  free(b.owner);
+  free(mem);
+  free(b.pool);
+  free(b.pool_start);
+  free(b.hash);
+  free(b.table);
+  if (!ok) {
+    host_pattern_dfa_free(dfa);
+    return NULL;
+  }
+  return dfa;
+}
+
+// Put the ids of the patterns that match 'str' in 'ids'.
+// returns how many, or -1 if there are more than 'max_ids'
+int host_pattern_dfa_match(host_pattern_dfa *dfa, char *str, int *ids, int max_ids) {
+  int count = 0;
+  int s = 1;
+  for (unsigned char *ptr=(unsigned char*)str; ; ptr++) {
+    int first = dfa->out_start[s];
+    int last = *ptr == 0 ? dfa->out_start[s+1] : first + dfa->sticky_count[s];
+    for (int i=first; i<last; i++) {
+      // a sticky pattern is reported by every state it matches in; keep the first
+      int seen = 0;
+      for (int j=0; j<count && !seen; j++) {
+        seen = ids[j] == dfa->out[i];
+      }
+      if (!seen) {
+        if (count >= max_ids) {
+          return -1;
+        }
+        ids[count++] = dfa->out[i];
+      }
+    }
+    if (*ptr == 0) {
+      break;
+    }
+    s = dfa->next[s * dfa->class_count + dfa->class_of[tolower(*ptr)]];
+    if (s == 0) {
+      break;
+    }
+  }
+  return count;
+}
@@ -0,0 +1,84 @@
+// Copyright 2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+// SPDX-License-Identifier: MIT-0
+
+#ifndef HOST_PATTERN_H
+#define HOST_PATTERN_H
+
+#include<stddef.h>
+
+// Glob and regex patterns for the "matches" and "regex" route conditions.
+//
+// Both kinds are compiled to a Thompson NFA: there is no backtracking, so a
+// match costs at most (length of the name) x (size of the pattern). Case is
+// ignored, as DNS does.
+//
+//   glob   the whole name must match. '*' is any run of characters (dots
+//          included), '?' any one character, [abc] [a-z] [!a-z] a class,
+//          '\' quotes the next character.
+//   regex  may match anywhere in the name unless anchored with '^' at the
+//          start and/or '$' at the end. Supports . [] [^] * + ? | ( ) and
+//          the escapes \d \w \s; anything else after '\' is taken literally.
+//          {m,n} is not supported.
+//
+// A proxy's patterns are also compiled together into one DFA for the route
+// index (host_pattern_dfa_build), so finding every pattern that matches a name
+// takes one step per character however many patterns there are. Building it
+// gives up beyond HOST_PATTERN_DFA_MAX_STATES states; the caller then checks
+// the patterns one by one instead.
+
+#define HOST_PATTERN_GLOB  0
+#define HOST_PATTERN_REGEX 1
+
+#define HOST_PATTERN_MAX_LEN 1024
+#define HOST_PATTERN_DFA_MAX_STATES 10000
+
+#define HOST_PATTERN_STATE_CHAR    0 // consume a character in 'set', then go to 'out'
+#define HOST_PATTERN_STATE_SPLIT   1 // go to both 'out' and 'out1'
+#define HOST_PATTERN_STATE_EPSILON 2 // go to 'out'
+#define HOST_PATTERN_STATE_MATCH   3
+
+typedef struct host_pattern_state {
+  int type;
+  int out;
+  int out1;
+  int set; // CHAR only; index into 'set'
+} host_pattern_state;
+
+typedef struct host_pattern {
+  char *source; // as written in the rule
+  int type;     // HOST_PATTERN_GLOB or HOST_PATTERN_REGEX
+  int sticky;   // nothing after the match matters: it's a match as soon as MATCH is reached
+  int start;
+  host_pattern_state *state;
+  int state_count;
+  int state_capacity;
+  unsigned char (*set)[32]; // 256-bit character sets, lowercase characters only
+  int set_count;
+  int set_capacity;
+  int scratch_size; // ints of working space host_pattern_match() needs
+} host_pattern;
+
+typedef struct host_pattern_dfa {
+  unsigned char class_of[256]; // characters no pattern tells apart share a class
+  int class_count;
+  int state_count; // state 0 matches nothing, ever; state 1 is the start
+  int *next;       // next[state * class_count + class]
+  // Ids of the patterns that match, per state, in out[out_start[s] .. out_start[s+1]).
+  // The first sticky_count[s] of them match as soon as the state is entered,
+  // the rest only if the name ends there.
+  int *out_start;
+  int *sticky_count;
+  int *out;
+} host_pattern_dfa;
+
+host_pattern *host_pattern_compile(char *source, int type, char *err, int errlen);
+void host_pattern_free(host_pattern *p);
+int  host_pattern_match(host_pattern *p, char *str);
+size_t host_pattern_memory(host_pattern *p);
+
+host_pattern_dfa *host_pattern_dfa_build(host_pattern **pattern, int *id, int count);
+void host_pattern_dfa_free(host_pattern_dfa *dfa);
+size_t host_pattern_dfa_memory(host_pattern_dfa *dfa);
+int  host_pattern_dfa_match(host_pattern_dfa *dfa, char *str, int *ids, int max_ids);
+
+#endif // HOST_PATTERN_H
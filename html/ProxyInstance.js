@@ -8,9 +8,11 @@ class ProxyInstance extends React.Component {
 
   render() {
     let key="tab_"+this.props.proxyInstance.name;
+    let traffic=this.props.proxyInstance.traffic;
     return (
       <div>
         <div key={key} id={key} className="tabcontent">
+          <div>Total {traffic.connections} connections &nbsp; Rx {traffic.bytesRx} Tx {traffic.bytesTx}</div>
           {Object.values(this.props.proxyInstance.service).map( service => {
             return(
               <Service key={"Service_"+service.serviceId} service={service} />
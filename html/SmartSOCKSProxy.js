@@ -98,6 +98,7 @@ class SmartSOCKSProxy extends React.Component {
     let conState=this.state.connectionState;
     let proxyInst=conState.proxyInstance;
     let sshTunnel=conState.sshTunnel;
+    let traffic=conState.traffic;
 
     return (
       <div>
@@ -116,6 +117,7 @@ class SmartSOCKSProxy extends React.Component {
           return(
             <ProxyInstance key={"tab_"+proxyInstance.name} proxyInstance={proxyInstance} />
         )})}
+        <p>All proxies: {traffic.connections} connections &nbsp; Rx {traffic.bytesRx} Tx {traffic.bytesTx}</p>
         <p><small><small>Version {conState.version} built on {conState.buildDate} <a href="https://github.com/bryan15/SmartSOCKSProxy">Source</a></small></small></p>
       </div>
     );
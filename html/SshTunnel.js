@@ -13,13 +13,26 @@ class SshTunnel extends React.Component {
     let key="ssh_"+ssh.name;
 
     let status = ssh.socksPort + " " + ssh.name ;
+    if ("server" in ssh) {
+      status = ssh.name + " (" + ssh.type + " " + ssh.server + ")";
+    }
     if ("pid" in ssh) {
       status += " ("+ssh.numConnections+" connections, pid "+ssh.pid+") ";
-    } else {
+      if (ssh.state == "starting") {
+        status += "starting ";
+      }
+    } else if (!("server" in ssh)) {
       status += " unused ";
     }
+    if (ssh.coldStarts > 0) {
+      status += ssh.coldStarts + " cold starts ";
+    }
+    let breaker = "";
+    if ("circuitBreaker" in ssh && ssh.circuitBreaker.state != "closed") {
+      breaker = " circuit " + ssh.circuitBreaker.state + " (opened " + ssh.circuitBreaker.timesOpened + " times, " + ssh.circuitBreaker.skipped + " connections skipped)";
+    }
     return (
-      <div><small>SSH port {status}</small></div>
+      <div><small>SSH port {status}<span style={{color: "red"}}>{breaker}</span></small></div>
     );
   }
 }
@@ -0,0 +1,162 @@
+// Copyright 2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+// SPDX-License-Identifier: MIT-0
+
+#include<stdio.h>
+#include<string.h>
+#include<errno.h>
+#include<sys/socket.h>
+
+#include"log.h"
+#include"safe_blocking_readwrite.h"
+#include"socks5.h"
+#include"socks5_client.h"
+#include"http_connect_client.h"
+
+// Build the CONNECT request for con's destination.
+// returns the number of bytes written to buf, 0 on error
+int http_connect_build_request(client_connection *con, char *buf, int buflen) {
+  char addr[100];
+  char host[MAX_DNS + 2];
+  if (con->socks_address_type == SOCKS5_ADDRTYPE_DOMAIN) {
+    snprintf(host,sizeof(host),"%s",host_id_get_name(&con->dst_host));
+  } else if (host_id_addr_str(&con->dst_host,addr,sizeof(addr)) == NULL) {
+    error("No address to CONNECT to");
+    return 0;
+  } else if (con->socks_address_type == SOCKS5_ADDRTYPE_IPV6) {
+    snprintf(host,sizeof(host),"[%s]",addr);
+  } else {
+    snprintf(host,sizeof(host),"%s",addr);
+  }
+  int port = host_id_get_port(&con->dst_host);
+  int len = snprintf(buf,buflen,"CONNECT %s:%i HTTP/1.1\r\nHost: %s:%i\r\n\r\n",host,port,host,port);
+  if (len < 0 || len >= buflen) {
+    return 0;
+  }
+  return len;
+}
+
+// Length of the proxy's reply (status line and headers, up to and including
+// the blank line), given its first 'len' bytes.
+// returns the length once the blank line has arrived, 0 if more bytes are needed, -1 if it's too long
+int http_connect_reply_len(char *buf, int len) {
+  for (int i=0; i<len; i++) {
+    if (buf[i] != '\n') {
+      continue;
+    }
+    if (i+1 < len && buf[i+1] == '\n') {
+      return i+2;
+    }
+    if (i+2 < len && buf[i+1] == '\r' && buf[i+2] == '\n') {
+      return i+3;
+    }
+  }
+  if (len >= HTTP_CONNECT_MAX_REPLY) {
+    return -1;
+  }
+  return 0;
+}
+
+// returns the status code from the reply's status line, -1 if malformed
+int http_connect_reply_status(char *buf, int len) {
+  if (len < 12 || strncmp(buf,"HTTP/1.",7) != 0 || buf[8] != ' ') {
+    return -1;
+  }
+  int status=0;
+  for (int i=9; i<12; i++) {
+    if (buf[i] < '0' || buf[i] > '9') {
+      return -1;
+    }
+    status = status*10 + buf[i] - '0';
+  }
+  return status;
+}
+
+// What to tell the SOCKS client when the proxy answered with 'status'.
+int http_connect_failure_type(int status) {
+  if (status >= 200 && status < 300) {
+    return SOCKS5_REPLY_SUCCEED;
+  }
+  switch (status) {
+    case 403:
+    case 405:
+    case 407:
+      return SOCKS5_REPLY_NOT_ALLOWED;
+    case 404:
+    case 502:
+    case 503:
+      return SOCKS5_REPLY_HOST_UNREACHABLE;
+    case 504:
+      return SOCKS5_REPLY_TTL_EXPIRED;
+  }
+  return SOCKS5_REPLY_SERVER_FAILURE;
+}
+
+// Read the reply without consuming anything after it: peek, and only take
+// what is known to be part of the headers.
+// returns the reply length, 0 if the connection closed or failed
+int http_connect_read_reply(int fd, char *buf) {
+  int have=0;
+  for (;;) {
+    int rc;
+    do {
+      rc = recv(fd, buf+have, HTTP_CONNECT_MAX_REPLY-have, MSG_PEEK);
+    } while (rc < 0 && errno == EINTR);
+    if (rc <= 0) {
+      return 0;
+    }
+    int reply_len = http_connect_reply_len(buf, have+rc);
+    if (reply_len < 0) {
+      error("HTTP proxy reply headers longer than %i bytes",HTTP_CONNECT_MAX_REPLY);
+      return 0;
+    }
+    int take = reply_len > 0 ? reply_len - have : rc;
+    if (sb_read_len(fd, (unsigned char*)buf+have, take) != take) {
+      return 0;
+    }
+    have += take;
+    if (reply_len > 0) {
+      return have;
+    }
+  }
+}
+
+// returns 1 if connection successful, 0 otherwise.
+// specific failure type written to failure_type
+int connect_via_http_connect(client_connection *con, ssh_tunnel *tun, int *failure_type) {
+  char buf[HTTP_CONNECT_MAX_REPLY];
+  *failure_type=SOCKS5_REPLY_SERVER_FAILURE;
+  con->tunnel_verdict=CIRCUIT_VERDICT_NONE;
+
+  set_client_connection_status(con, CCSTATUS_OKAY,"Connecting","Connecting to HTTP proxy");
+  if (!connect_to_tunnel(con, tun)) {
+    return 0;
+  }
+  set_client_connection_status(con, CCSTATUS_OKAY,"Negotiating","Sending CONNECT to HTTP proxy");
+  int len = http_connect_build_request(con, buf, sizeof(buf));
+  if (len == 0) {
+    return 0;
+  }
+  con->tunnel_verdict=CIRCUIT_VERDICT_DEAD; // until it answers
+  if (sb_write_len(con->fd_out, (unsigned char*)buf, len) < 0) {
+    return 0;
+  }
+  len = http_connect_read_reply(con->fd_out, buf);
+  if (len == 0) {
+    *failure_type=SOCKS5_REPLY_CONNECTION_REFUSED;
+    return 0;
+  }
+  int status = http_connect_reply_status(buf, len);
+  if (status < 0) {
+    error("HTTP proxy %s sent a malformed reply",tun->name);
+    return 0;
+  }
+  *failure_type = http_connect_failure_type(status);
+  con->tunnel_verdict=CIRCUIT_VERDICT_ALIVE; // whatever the status, the proxy answered
+  if (*failure_type != SOCKS5_REPLY_SUCCEED) {
+    trace("HTTP proxy %s answered CONNECT with status %i",tun->name,status);
+    return 0;
+  }
+  trace("HTTP proxy %s connected",tun->name);
+  set_client_connection_status(con, CCSTATUS_OKAY,NULL,NULL);
+  return 1;
+}
@@ -0,0 +1,25 @@
+// Copyright 2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+// SPDX-License-Identifier: MIT-0
+
+#ifndef HTTP_CONNECT_CLIENT_H
+#define HTTP_CONNECT_CLIENT_H
+
+#include"client_connection.h"
+#include"ssh_tunnel.h"
+
+// Client side of an HTTP proxy's CONNECT method (RFC 7231 section 4.3.6),
+// for tunnels of type httpConnect: send "CONNECT host:port", read the
+// status line and headers up to the blank line, and from then on the
+// connection carries the client's bytes. The reply is read without going
+// past the blank line, so bytes the destination sends first are relayed.
+
+#define HTTP_CONNECT_MAX_REQUEST 600  // CONNECT line and Host header for a 255-byte name
+#define HTTP_CONNECT_MAX_REPLY  2048  // status line and headers
+
+int http_connect_build_request(client_connection *con, char *buf, int buflen);
+int http_connect_reply_len(char *buf, int len);
+int http_connect_reply_status(char *buf, int len);
+int http_connect_failure_type(int status);
+int connect_via_http_connect(client_connection *con, ssh_tunnel *tun, int *failure_type);
+
+#endif // HTTP_CONNECT_CLIENT_H
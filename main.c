@@ -8,6 +8,7 @@
 #include<time.h>
 #include<strings.h>
 #include<errno.h>
+#include<sys/resource.h>
 
 #include"log.h"
 #include"server.h"
@@ -19,6 +20,8 @@
 #include"config_file.h"
 #include"version.h"
 #include"main_config.h"
+#include"route_index.h"
+#include"route_cache.h"
 
 // These pragma's are to squelch a warning. 
 #pragma GCC diagnostic push
@@ -39,12 +42,46 @@ int set_ulimit(new_limit) {
   return 0;
 }
 
+// For -t: the memory the route rules take. The structures are counted rather
+// than asking malloc, so the figures are the same on macOS and Linux; the peak
+// resident set is the process as a whole, allocator overhead included.
+void print_route_rule_memory(proxy_instance *proxy_list) {
+  size_t rules = 0;
+  size_t index = 0;
+  long long rule_count = 0;
+  for (proxy_instance *proxy = proxy_list; proxy != NULL; proxy = proxy->next) {
+    size_t r = route_rule_memory(proxy->route_rule_list);
+    size_t i = route_index_memory(proxy->route_index);
+    int count = proxy->route_index ? proxy->route_index->rule_count : 0;
+    printf("proxy %s: %i route rules, %zu bytes; index %zu bytes\n", proxy->name, count, r, i);
+    rules += r;
+    index += i;
+    rule_count += count;
+  }
+  size_t strings = route_rule_strings ? route_rule_strings->bytes : 0;
+  printf("shared strings and tunnel lists: %zu, %zu bytes\n", route_rule_strings ? route_rule_strings->count : 0, strings);
+  printf("route rules: %zu bytes in all, %zu of them the index\n", rules + strings + index, index);
+  if (rule_count > 0) {
+    printf("per rule: %lli bytes, %lli with the index\n", (long long)(rules + strings) / rule_count, (long long)(rules + strings + index) / rule_count);
+  }
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) == 0) {
+#ifdef __APPLE__
+    long long peak = usage.ru_maxrss;        // bytes
+#else
+    long long peak = usage.ru_maxrss * 1024; // kilobytes
+#endif
+    printf("peak resident set: %lli bytes\n", peak);
+  }
+}
+
 // main() is mostly concerned with init and configuraiton. 
 int main(int argc,char **argv) {
   int rc;
   int help=0;
   int error=0;
   int daemonize=0;
+  int check_config=0;
 
   rc=thread_local_init();
   if (rc != 0) {
@@ -103,7 +140,7 @@ int main(int argc,char **argv) {
   #define CONFIG_FILENAME_STACK_SIZE 200 // arbitrarily picked.
   char* filename_stack[CONFIG_FILENAME_STACK_SIZE+1];
   char option;
-  while ((option = getopt(argc,argv, "c:dv:V:h")) != -1) {
+  while ((option = getopt(argc,argv, "c:dtv:V:h")) != -1) {
     switch(option) {
       case 'c':
         if (!config_file_parse(&log_file_list, log_file_default, &main_conf, 
@@ -116,6 +153,9 @@ int main(int argc,char **argv) {
       case 'd':
         daemonize = 1;
         break;
+      case 't':
+        check_config = 1;
+        break;
       case 'v':
         main_conf.log.level = log_level_from_str(optarg);
         trace("set main thread verbosity to %s",log_level_str(main_conf.log.level));
@@ -154,6 +194,7 @@ int main(int argc,char **argv) {
     printf("  -c <file>    Load configuration from <file>. Can be used multiple times.\n");
     printf("  -d           Daemonize; start proxy in background.\n");
     printf("  -h           Print this help.\n");
+    printf("  -t           Load the configuration, print the memory its route rules take, and exit.\n");
     printf("  -v <level>   Set *main thread* verbosity to <level> where <level> is one of the following:\n");
     printf("                  error\n");
     printf("                  warn\n");
@@ -173,6 +214,25 @@ int main(int argc,char **argv) {
   if (error) {
     return 1;
   }
+  if (!ssh_tunnel_validate(ssh_tunnel_list) || !ssh_tunnel_create_replicas(ssh_tunnel_list)) {
+    return 1;
+  }
+  for (proxy_instance *proxy = proxy_instance_list; proxy != NULL; proxy = proxy->next) {
+    route_index *idx = route_index_build(proxy->route_rule_list);
+    debug("proxy %s: %i route rules; indexed %i is, %i network, %i endsWith, %i startsWith, %i contains, %i matches/regex; %i checked on every connection",
+      proxy->name, idx->rule_count, idx->count_is, idx->count_network, idx->count_ends_with, idx->count_starts_with, idx->count_contains, idx->count_patterns, idx->scan_count);
+    proxy->route_index = idx;
+    if (proxy->route_cache_size > 0) {
+      proxy->route_cache = new_route_cache(proxy->route_cache_size);
+    }
+  }
+  if (route_rule_strings) {
+    debug("route rules share %zu distinct strings and tunnel lists, %zu bytes", route_rule_strings->count, route_rule_strings->bytes);
+  }
+  if (check_config) {
+    print_route_rule_memory(proxy_instance_list);
+    return 0;
+  }
 
   if (daemonize && call_daemon() < 0) {
     unexpected_exit(12,"daemon()");
@@ -1,10 +1,62 @@
 // Copyright 2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
 // SPDX-License-Identifier: MIT-0
 
+#include<string.h>
+
 #include"main_config.h"
 
 void main_config_init(main_config *main_conf) {
   main_conf->ulimit = 4096;
   log_config_init(&main_conf->log);
+  main_conf->engine = ENGINE_THREAD;
+  main_conf->event_loop_threads = 0;
+  main_conf->thread_pool_size = 0;
+  main_conf->thread_pool_overflow = POOL_OVERFLOW_SPAWN;
+}
+
+int engine_from_str(char *str) {
+  if (str == NULL) {
+    return ENGINE_INVALID;
+  }
+  if (strcmp(str,"thread")==0) {
+    return ENGINE_THREAD;
+  }
+  if (strcmp(str,"eventloop")==0) {
+    return ENGINE_EVENT_LOOP;
+  }
+  return ENGINE_INVALID;
+}
+
+char *engine_str(int engine) {
+  switch(engine) {
+    case ENGINE_THREAD:     return "thread";
+    case ENGINE_EVENT_LOOP: return "eventloop";
+  }
+  return "invalid";
 }
 
+
+int pool_overflow_from_str(char *str) {
+  if (str == NULL) {
+    return POOL_OVERFLOW_INVALID;
+  }
+  if (strcmp(str,"spawn")==0) {
+    return POOL_OVERFLOW_SPAWN;
+  }
+  if (strcmp(str,"queue")==0) {
+    return POOL_OVERFLOW_QUEUE;
+  }
+  if (strcmp(str,"reject")==0) {
+    return POOL_OVERFLOW_REJECT;
+  }
+  return POOL_OVERFLOW_INVALID;
+}
+
+char *pool_overflow_str(int overflow) {
+  switch(overflow) {
+    case POOL_OVERFLOW_SPAWN:  return "spawn";
+    case POOL_OVERFLOW_QUEUE:  return "queue";
+    case POOL_OVERFLOW_REJECT: return "reject";
+  }
+  return "invalid";
+}
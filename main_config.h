@@ -6,12 +6,32 @@
 
 #include"log.h"
 
+// how connections are serviced once the SOCKS / port-forward handshake is done
+#define ENGINE_INVALID    -1
+#define ENGINE_THREAD      0 // one thread per connection for its whole life
+#define ENGINE_EVENT_LOOP  1 // relay handed to a small set of event-loop threads
+
+// what to do with a new connection when every pooled thread is busy
+#define POOL_OVERFLOW_INVALID -1
+#define POOL_OVERFLOW_SPAWN    0 // start a one-off thread for it, as if there were no pool
+#define POOL_OVERFLOW_QUEUE    1 // wait for a pooled thread to become free
+#define POOL_OVERFLOW_REJECT   2 // close the connection straight away
+
 typedef struct main_config {
   int ulimit;
   log_config log;
 
+  int engine;             // ENGINE_*
+  int event_loop_threads; // 0 = one per CPU core
+
+  int thread_pool_size;     // 0 = no pool; one new thread per connection
+  int thread_pool_overflow; // POOL_OVERFLOW_*
 } main_config;
 
 void main_config_init(main_config *main_conf);
+int engine_from_str(char *str);
+char *engine_str(int engine);
+int pool_overflow_from_str(char *str);
+char *pool_overflow_str(int overflow);
 
 #endif // MAIN_CONFIG_H
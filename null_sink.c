@@ -0,0 +1,375 @@
+// Copyright 2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+// SPDX-License-Identifier: MIT-0
+
+#include<stdlib.h>
+#include<string.h>
+#include<unistd.h>
+#include<fcntl.h>
+#include<poll.h>
+#include<errno.h>
+#include<pthread.h>
+#include<stdatomic.h>
+#include<sys/types.h>
+#include<sys/socket.h>
+#ifdef __linux__
+#include<sys/epoll.h>
+#endif
+
+#include"log.h"
+#include"client_connection.h"
+#include"proxy_instance.h"
+#include"thread_local.h"
+#include"service_thread.h"
+#include"buffer_pool.h"
+#include"safe_blocking_readwrite.h"
+#include"shuttle.h"
+#include"null_sink.h"
+
+// The sink thread is started the first time a null route is used. It
+// works like an event loop with only a read side: connections arrive on
+// the 'incoming' list, a byte on wake_fd gets its attention, and each
+// readable connection gets up to NULL_SINK_MAX_READS large reads per
+// wake-up so one fire hose can't starve the rest. Byte counters are
+// bumped once per wake-up, not per read.
+
+#define NULL_SINK_READ_SIZE BUFFER_POOL_MAX_SIZE
+#define NULL_SINK_MAX_READS 16
+#define NULL_SINK_MAX_EVENTS 256
+
+#ifdef __linux__
+// For TCP, MSG_TRUNC has the kernel drop the bytes instead of copying them to us.
+#define NULL_SINK_RECV_FLAGS (MSG_DONTWAIT | MSG_TRUNC)
+#else
+#define NULL_SINK_RECV_FLAGS MSG_DONTWAIT
+#endif
+
+typedef struct null_sink_entry {
+  struct null_sink_entry *prev, *next;
+  client_connection *con;
+  proxy_instance *proxy; // for log messages & traffic totals
+  int finished;          // 1 = end-of-stream, -1 = error; entry freed at the end of this pass
+} null_sink_entry;
+
+pthread_mutex_t null_sink_mutex = PTHREAD_MUTEX_INITIALIZER;
+int null_sink_state = 0;                    // ** USE MUTEX  0 = not started, 1 = running, -1 = could not start
+null_sink_entry *null_sink_incoming = NULL; // ** USE MUTEX  handed over, not yet adopted
+int null_sink_count = 0;                    // ** USE MUTEX  incoming + active
+atomic_ullong null_sink_total = 0;          // bytes swallowed, ever
+
+// only touched by the sink thread
+pthread_t null_sink_thread_id;
+int null_sink_wake_fd[2];
+null_sink_entry *null_sink_active = NULL;
+unsigned char *null_sink_scratch = NULL;
+#ifdef __linux__
+int null_sink_epoll_fd = -1;
+#else
+struct pollfd *null_sink_pfd = NULL;
+null_sink_entry **null_sink_pfd_entry = NULL;
+int null_sink_pfd_size = 0;
+#endif
+
+void null_sink_lock() {
+  int rc;
+  do {
+    rc = pthread_mutex_lock(&null_sink_mutex);
+  } while (rc == EINTR);
+}
+
+void null_sink_unlock() {
+  int rc;
+  do {
+    rc = pthread_mutex_unlock(&null_sink_mutex);
+  } while (rc == EINTR);
+}
+
+void null_sink_set_thread_local(null_sink_entry *entry) {
+  thread_local_set_proxy_instance(entry ? entry->proxy : NULL);
+  thread_local_set_service(entry ? entry->con->srv : NULL);
+  thread_local_set_client_connection(entry ? entry->con : NULL);
+}
+
+void null_sink_drain_wake_fd() {
+  char buf[256];
+  int rc;
+  do {
+    rc = read(null_sink_wake_fd[0], buf, sizeof(buf));
+  } while (rc > 0 || (rc < 0 && errno == EINTR));
+}
+
+// Swallow what's waiting on the connection.
+void null_sink_drain(null_sink_entry *entry) {
+  if (entry->finished) {
+    return;
+  }
+  client_connection *con = entry->con;
+  null_sink_set_thread_local(entry);
+  unsigned long long total = 0;
+  ssize_t rc = 0;
+  for (int i=0; i<NULL_SINK_MAX_READS; i++) {
+    do {
+      rc = recv(con->fd_in, null_sink_scratch, NULL_SINK_READ_SIZE, NULL_SINK_RECV_FLAGS);
+    } while (rc < 0 && errno == EINTR);
+    if (rc <= 0) {
+      break;
+    }
+    total += rc;
+  }
+  int saved_errno = errno;
+  if (total > 0) {
+    atomic_fetch_add_explicit(&con->bytes_rx, total, memory_order_relaxed);
+    traffic_counter_add_bytes(entry->proxy ? &entry->proxy->traffic : NULL, TRAFFIC_RX, total);
+    atomic_fetch_add_explicit(&null_sink_total, total, memory_order_relaxed);
+    atomic_store_explicit(&con->last_activity, time(NULL), memory_order_relaxed);
+  }
+  if (rc == 0) {
+    trace("null sink: end of transmission");
+    entry->finished = 1;
+  } else if (rc < 0 && saved_errno != EAGAIN && saved_errno != EWOULDBLOCK) {
+    set_client_connection_status(con,saved_errno,"Error",strerror(saved_errno));
+    if (saved_errno != ECONNRESET) {
+      errno = saved_errno;
+      errorNum("null sink recv()");
+    }
+    entry->finished = -1;
+  }
+}
+
+void null_sink_adopt() {
+  null_sink_lock();
+  null_sink_entry *list = null_sink_incoming;
+  null_sink_incoming = NULL;
+  null_sink_unlock();
+
+  while (list) {
+    null_sink_entry *entry = list;
+    list = list->next;
+
+    entry->prev = NULL;
+    entry->next = null_sink_active;
+    if (null_sink_active) {
+      null_sink_active->prev = entry;
+    }
+    null_sink_active = entry;
+    atomic_store_explicit(&entry->con->last_activity, time(NULL), memory_order_relaxed);
+
+#ifdef __linux__
+    struct epoll_event ev;
+    ev.events = EPOLLIN | EPOLLRDHUP; // level-triggered; we may stop reading before it's empty
+    ev.data.ptr = entry;
+    if (epoll_ctl(null_sink_epoll_fd, EPOLL_CTL_ADD, entry->con->fd_in, &ev) < 0) {
+      errorNum("null sink epoll_ctl(EPOLL_CTL_ADD)");
+      entry->finished = -1;
+    }
+#endif
+    null_sink_drain(entry); // there may already be data waiting
+  }
+  null_sink_set_thread_local(NULL);
+}
+
+// Close every connection that hung up, failed, or that the idle reaper wants closed.
+void null_sink_reap() {
+  null_sink_entry *entry = null_sink_active;
+  while (entry) {
+    null_sink_entry *next = entry->next;
+    if (!entry->finished && atomic_load(&entry->con->thread_should_exit)) {
+      entry->finished = -1; // the reaper has set the status
+    }
+    if (entry->finished) {
+      null_sink_set_thread_local(entry);
+#ifdef __linux__
+      epoll_ctl(null_sink_epoll_fd, EPOLL_CTL_DEL, entry->con->fd_in, NULL);
+#endif
+      service_thread_shutdown(entry->con, entry->finished > 0);
+
+      if (entry->prev) {
+        entry->prev->next = entry->next;
+      } else {
+        null_sink_active = entry->next;
+      }
+      if (entry->next) {
+        entry->next->prev = entry->prev;
+      }
+      null_sink_lock();
+      null_sink_count--;
+      null_sink_unlock();
+      free(entry);
+    }
+    entry = next;
+  }
+  null_sink_set_thread_local(NULL);
+}
+
+#ifdef __linux__
+
+void null_sink_wait() {
+  struct epoll_event events[NULL_SINK_MAX_EVENTS];
+  int rc;
+  do {
+    rc = epoll_wait(null_sink_epoll_fd, events, NULL_SINK_MAX_EVENTS, SHUTTLE_IDLE_CHECK_MS);
+  } while (rc < 0 && errno == EINTR);
+  if (rc < 0) {
+    errorNum("null sink epoll_wait()");
+    unexpected_exit(64,"null sink epoll_wait()");
+  }
+  for (int i=0; i<rc; i++) {
+    if (events[i].data.ptr == NULL) {
+      null_sink_drain_wake_fd();
+      null_sink_adopt();
+    } else {
+      null_sink_drain(events[i].data.ptr);
+    }
+  }
+  null_sink_set_thread_local(NULL);
+}
+
+#else // __linux__
+
+void null_sink_wait() {
+  null_sink_lock();
+  int needed = 1 + null_sink_count;
+  null_sink_unlock();
+  if (needed > null_sink_pfd_size) {
+    null_sink_pfd_size = needed * 2;
+    null_sink_pfd = realloc(null_sink_pfd, sizeof(struct pollfd) * null_sink_pfd_size);
+    null_sink_pfd_entry = realloc(null_sink_pfd_entry, sizeof(null_sink_entry*) * null_sink_pfd_size);
+    if (null_sink_pfd == NULL || null_sink_pfd_entry == NULL) {
+      unexpected_exit(63,"Error allocating null sink poll set");
+    }
+  }
+  int pfd_max = 0;
+  null_sink_pfd[pfd_max].fd = null_sink_wake_fd[0];
+  null_sink_pfd[pfd_max].events = POLLIN;
+  null_sink_pfd_entry[pfd_max] = NULL;
+  pfd_max++;
+  for (null_sink_entry *entry = null_sink_active; entry && pfd_max < null_sink_pfd_size; entry = entry->next) {
+    null_sink_pfd[pfd_max].fd = entry->con->fd_in;
+    null_sink_pfd[pfd_max].events = POLLIN;
+    null_sink_pfd_entry[pfd_max] = entry;
+    pfd_max++;
+  }
+
+  int rc;
+  do {
+    rc = poll(null_sink_pfd, pfd_max, SHUTTLE_IDLE_CHECK_MS);
+  } while (rc < 0 && errno == EINTR);
+  if (rc < 0) {
+    errorNum("null sink poll()");
+    unexpected_exit(64,"null sink poll()");
+  }
+  for (int i=1; i<pfd_max; i++) {
+    if (null_sink_pfd[i].revents & POLLNVAL) {
+      null_sink_pfd_entry[i]->finished = -1;
+    } else if (null_sink_pfd[i].revents) {
+      null_sink_drain(null_sink_pfd_entry[i]);
+    }
+  }
+  null_sink_set_thread_local(NULL);
+  if (null_sink_pfd[0].revents) {
+    null_sink_drain_wake_fd();
+    null_sink_adopt();
+  }
+}
+
+#endif // __linux__
+
+void *null_sink_thread(void *data) {
+  thread_local_set_log_config(NULL);
+  null_sink_set_thread_local(NULL);
+  debug("null sink started");
+  while (1) {
+    null_sink_wait();
+    null_sink_reap();
+  }
+  return NULL;
+}
+
+int null_sink_set_nonblocking(int fd) {
+  int flags = fcntl(fd, F_GETFL);
+  return flags >= 0 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) >= 0;
+}
+
+// Must hold the mutex.
+// returns 1 on success, 0 on error
+int null_sink_start() {
+  if (pipe(null_sink_wake_fd) < 0) {
+    errorNum("null sink pipe()");
+    return 0;
+  }
+  if (!null_sink_set_nonblocking(null_sink_wake_fd[0]) || !null_sink_set_nonblocking(null_sink_wake_fd[1])) {
+    errorNum("null sink fcntl()");
+    return 0;
+  }
+#ifdef __linux__
+  null_sink_epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  if (null_sink_epoll_fd < 0) {
+    errorNum("null sink epoll_create1()");
+    return 0;
+  }
+  struct epoll_event ev;
+  ev.events = EPOLLIN;
+  ev.data.ptr = NULL;
+  if (epoll_ctl(null_sink_epoll_fd, EPOLL_CTL_ADD, null_sink_wake_fd[0], &ev) < 0) {
+    errorNum("null sink epoll_ctl() wake fd");
+    return 0;
+  }
+#endif
+  null_sink_scratch = buffer_pool_get(NULL_SINK_READ_SIZE);
+  int rc = pthread_create(&null_sink_thread_id, NULL, null_sink_thread, NULL);
+  if (rc != 0) {
+    errno = rc;
+    errorNum("pthread_create() for null sink");
+    return 0;
+  }
+  pthread_detach(null_sink_thread_id);
+  return 1;
+}
+
+// Give a null-routed connection to the sink thread, starting it if need be.
+// returns 1 if the sink took ownership of 'con' (including closing it),
+//         0 if the caller should drain it itself.
+int null_sink_handoff(client_connection *con) {
+  if (byte_dump_enabled()) {
+    return 0; // trace2 wants to see the bytes; shuttle_null_connection() dumps them
+  }
+  null_sink_entry *entry = calloc(1, sizeof(null_sink_entry));
+  if (entry == NULL) {
+    errorNum("Error allocating null sink entry; draining on this thread");
+    return 0;
+  }
+  entry->con = con;
+  entry->proxy = thread_local_get_proxy_instance();
+
+  null_sink_lock();
+  if (null_sink_state == 0) {
+    null_sink_state = null_sink_start() ? 1 : -1;
+  }
+  if (null_sink_state < 0) {
+    null_sink_unlock();
+    free(entry);
+    return 0;
+  }
+  entry->next = null_sink_incoming;
+  null_sink_incoming = entry;
+  null_sink_count++;
+  null_sink_unlock();
+
+  trace("handing connection to the null sink");
+  int rc;
+  do {
+    rc = write(null_sink_wake_fd[1], "", 1);
+  } while (rc < 0 && errno == EINTR);
+  // EAGAIN means the pipe is already full of wake-ups, which is just as good
+  return 1;
+}
+
+int null_sink_connection_count() {
+  null_sink_lock();
+  int count = null_sink_count;
+  null_sink_unlock();
+  return count;
+}
+
+unsigned long long null_sink_bytes() {
+  return atomic_load_explicit(&null_sink_total, memory_order_relaxed);
+}
@@ -0,0 +1,17 @@
+// Copyright 2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+// SPDX-License-Identifier: MIT-0
+
+#ifndef NULL_SINK_H
+#define NULL_SINK_H
+
+#include"client_connection.h"
+
+// Connections routed "via null" are handed to a single shared thread
+// which throws away whatever the client sends, until it hangs up.
+// The service thread that did the handshake then exits.
+
+int null_sink_handoff(client_connection *con);
+int null_sink_connection_count();
+unsigned long long null_sink_bytes();
+
+#endif // NULL_SINK_H
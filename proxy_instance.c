@@ -7,11 +7,15 @@
 
 #include"log.h"
 #include"proxy_instance.h"
+#include"route_cache.h"
 
 proxy_instance *new_proxy_instance() {
   proxy_instance *pinst;
 
-  pinst=malloc(sizeof(proxy_instance));
+  // aligned for the cache-line shards of 'traffic'
+  if (posix_memalign((void**)&pinst, TRAFFIC_COUNTER_ALIGN, sizeof(proxy_instance)) != 0) {
+    pinst = NULL;
+  }
   if (pinst == NULL) {
     unexpected_exit(50,"Error allocating new proxy_instance"); 
   }
@@ -22,11 +26,23 @@ proxy_instance *new_proxy_instance() {
 
   pinst->service_list=NULL;
   pinst->route_rule_list=NULL;
+  pinst->route_index=NULL;
+  pinst->route_cache=NULL;
 
   pinst->client_connection_list=NULL;
 
   log_config_init(&(pinst->log));
   pinst->log.level=LOG_LEVEL_ERROR;
+
+  pinst->relay_mode=RELAY_MODE_COPY;
+  pinst->idle_timeout=0;
+  pinst->connect_timeout=30;
+  pinst->tcp_keepalive=0;
+  pinst->tcp_user_timeout=0;
+  pinst->route_cache_size=ROUTE_CACHE_DEFAULT_SIZE;
+  traffic_counter_init(&(pinst->traffic));
+  token_bucket_init(&(pinst->rate_limit[TRAFFIC_TX]),0,0);
+  token_bucket_init(&(pinst->rate_limit[TRAFFIC_RX]),0,0);
     
   return pinst;
 }
@@ -52,10 +68,45 @@ proxy_instance *new_proxy_instance_from_template(proxy_instance *template) {
 
   pinst->log.level = template->log.level;  
   pinst->log.file  = template->log.file;  
+  pinst->relay_mode = template->relay_mode;
+  pinst->idle_timeout = template->idle_timeout;
+  pinst->connect_timeout = template->connect_timeout;
+  pinst->tcp_keepalive = template->tcp_keepalive;
+  pinst->tcp_user_timeout = template->tcp_user_timeout;
+  pinst->route_cache_size = template->route_cache_size;
+  // each proxy gets its own buckets; only the settings are copied
+  for (int i=0; i<2; i++) {
+    token_bucket_set(&(pinst->rate_limit[i]), template->rate_limit[i].rate, template->rate_limit[i].burst);
+  }
 
   return pinst;
 }
 
+int relay_mode_from_str(char *str) {
+  if (str == NULL) {
+    return RELAY_MODE_INVALID;
+  }
+  if (strcmp(str,"copy")==0) {
+    return RELAY_MODE_COPY;
+  }
+  if (strcmp(str,"splice")==0) {
+    return RELAY_MODE_SPLICE;
+  }
+  if (strcmp(str,"uring")==0) {
+    return RELAY_MODE_URING;
+  }
+  return RELAY_MODE_INVALID;
+}
+
+char *relay_mode_str(int relay_mode) {
+  switch(relay_mode) {
+    case RELAY_MODE_COPY:   return "copy";
+    case RELAY_MODE_SPLICE: return "splice";
+    case RELAY_MODE_URING:  return "uring";
+  }
+  return "invalid";
+}
+
 char *proxy_instance_str(proxy_instance *pinst, char *buf, int buflen) {
   if (buf) {
     buf[0]=0;
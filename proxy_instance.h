@@ -7,23 +7,43 @@
 #include"service.h"
 #include"client_connection.h"
 #include"log.h"
+#include"traffic_counter.h"
+#include"token_bucket.h"
 
 #define PROXY_INSTANCE_MAX_NAME_LEN  1024 
 #define PROXY_INSTANCE_MAX_LISTENING_PORTS  200 // really? how many do you need?!
 
+// how shuttle.c moves bytes between the client and the outbound connection
+#define RELAY_MODE_INVALID -1
+#define RELAY_MODE_COPY     0 // read() into a user-space buffer, write() it back out
+#define RELAY_MODE_SPLICE   1 // splice() socket -> pipe -> socket; Linux only, falls back to copy
+#define RELAY_MODE_URING    2 // io_uring multishot recv + linked sends; needs liburing, falls back to copy
+
 typedef struct proxy_instance {
   struct proxy_instance *next;
 
   char name[PROXY_INSTANCE_MAX_NAME_LEN];
   log_config log;
+  int relay_mode;
+  int idle_timeout;     // seconds without traffic before a relayed connection is closed; 0 = never
+  int connect_timeout;  // seconds to establish a direct connection, over all addresses tried; 0 = kernel default
+  int tcp_keepalive;    // seconds idle before TCP keepalive probes start; 0 = off
+  int tcp_user_timeout; // seconds unacknowledged data may wait before the kernel drops the connection; 0 = system default
+  int route_cache_size; // routing decisions to remember; 0 = run the rules for every connection
+  traffic_counter traffic; // totals over all of this proxy's connections, past and present
+  token_bucket rate_limit[2]; // shared by all of this proxy's connections; indexed by TRAFFIC_TX (up) / TRAFFIC_RX (down)
   service *service_list;
   route_rule *route_rule_list;
+  struct route_index *route_index; // built from route_rule_list once the config is loaded; NULL walks the list
+  struct route_cache *route_cache; // created with route_index if route_cache_size > 0
   client_connection *client_connection_list;
 } proxy_instance;
 
 proxy_instance *new_proxy_instance();
 proxy_instance *insert_proxy_instance(proxy_instance *head, proxy_instance *con);
 proxy_instance *new_proxy_instance_from_template(proxy_instance *template);
+int relay_mode_from_str(char *str);
+char *relay_mode_str(int relay_mode);
 char *proxy_instance_str(proxy_instance *inst, char *buf, int buflen);
 
 
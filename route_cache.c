@@ -0,0 +1,190 @@
+// Copyright 2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+// SPDX-License-Identifier: MIT-0
+
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+
+#include"log.h"
+#include"route_cache.h"
+
+route_cache *new_route_cache(int size) {
+  route_cache *cache = calloc(1, sizeof(route_cache));
+  if (cache == NULL) {
+    unexpected_exit(65,"Error allocating route cache");
+  }
+  int capacity = (size + ROUTE_CACHE_STRIPES - 1) / ROUTE_CACHE_STRIPES;
+  if (capacity < 1) {
+    capacity = 1;
+  }
+  cache->size = capacity * ROUTE_CACHE_STRIPES;
+  atomic_init(&cache->generation, 1);
+  atomic_init(&cache->hits, 0);
+  atomic_init(&cache->misses, 0);
+  for (int s=0; s<ROUTE_CACHE_STRIPES; s++) {
+    route_cache_stripe *stripe = &cache->stripe[s];
+    if (pthread_mutex_init(&stripe->mutex,NULL)) {
+      errorNum("pthread_mutex_init()");
+      unexpected_exit(65,"pthread_mutex_init()");
+    }
+    stripe->capacity = capacity;
+    stripe->count = 0;
+    stripe->bucket_count = capacity * 2 + 1;
+    stripe->entry = malloc(sizeof(route_cache_entry) * capacity);
+    stripe->bucket = malloc(sizeof(int) * stripe->bucket_count);
+    if (stripe->entry == NULL || stripe->bucket == NULL) {
+      unexpected_exit(65,"Error allocating route cache");
+    }
+    for (int i=0; i<stripe->bucket_count; i++) {
+      stripe->bucket[i] = -1;
+    }
+    stripe->lru_head = -1;
+    stripe->lru_tail = -1;
+  }
+  return cache;
+}
+
+// The destination as the client asked for it. The name goes last: it's the
+// only part a client can put anything into, so two destinations can't make
+// the same key.
+void route_cache_key(host_id *dst, char *buf, int buflen) {
+  char addr[MAX_DNS];
+  if (!host_id_has_addr(dst) || host_id_addr_str(dst, addr, sizeof(addr)) == NULL) {
+    addr[0] = 0;
+  }
+  snprintf(buf, buflen, "%i|%s|%s", host_id_get_port(dst), addr, host_id_has_name(dst) ? host_id_get_name(dst) : "");
+}
+
+unsigned int route_cache_hash(char *key) {
+  unsigned int hash = 5381;
+  for (unsigned char *ptr=(unsigned char*)key; *ptr; ptr++) {
+    hash = hash * 33 + *ptr;
+  }
+  return hash;
+}
+
+// ** CALLER MUST HOLD MUTEX
+int route_cache_find(route_cache_stripe *stripe, char *key, unsigned int hash) {
+  for (int i=stripe->bucket[hash % stripe->bucket_count]; i >= 0; i=stripe->entry[i].next) {
+    if (stripe->entry[i].hash == hash && strcmp(stripe->entry[i].key, key) == 0) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+// ** CALLER MUST HOLD MUTEX
+void route_cache_lru_unlink(route_cache_stripe *stripe, int i) {
+  route_cache_entry *e = &stripe->entry[i];
+  if (e->lru_prev >= 0) {
+    stripe->entry[e->lru_prev].lru_next = e->lru_next;
+  } else {
+    stripe->lru_head = e->lru_next;
+  }
+  if (e->lru_next >= 0) {
+    stripe->entry[e->lru_next].lru_prev = e->lru_prev;
+  } else {
+    stripe->lru_tail = e->lru_prev;
+  }
+}
+
+// ** CALLER MUST HOLD MUTEX
+void route_cache_lru_push(route_cache_stripe *stripe, int i) {
+  route_cache_entry *e = &stripe->entry[i];
+  e->lru_prev = -1;
+  e->lru_next = stripe->lru_head;
+  if (stripe->lru_head >= 0) {
+    stripe->entry[stripe->lru_head].lru_prev = i;
+  }
+  stripe->lru_head = i;
+  if (stripe->lru_tail < 0) {
+    stripe->lru_tail = i;
+  }
+}
+
+// ** CALLER MUST HOLD MUTEX
+void route_cache_hash_unlink(route_cache_stripe *stripe, int i) {
+  int *link = &stripe->bucket[stripe->entry[i].hash % stripe->bucket_count];
+  while (*link >= 0 && *link != i) {
+    link = &stripe->entry[*link].next;
+  }
+  if (*link == i) {
+    *link = stripe->entry[i].next;
+  }
+}
+
+// returns 1 and fills in 'decision' if there's a current decision for 'key', 0 otherwise
+int route_cache_lookup(route_cache *cache, char *key, route_decision *decision, time_t now) {
+  unsigned int hash = route_cache_hash(key);
+  route_cache_stripe *stripe = &cache->stripe[hash % ROUTE_CACHE_STRIPES];
+  int found = 0;
+
+  pthread_mutex_lock(&stripe->mutex);
+  int i = route_cache_find(stripe, key, hash);
+  if (i >= 0) {
+    route_cache_entry *e = &stripe->entry[i];
+    // a stale entry stays where it is; storing the new decision overwrites it
+    if (e->generation == atomic_load(&cache->generation) && (e->expires == 0 || now < e->expires)) {
+      route_cache_lru_unlink(stripe, i);
+      route_cache_lru_push(stripe, i);
+      *decision = e->decision;
+      found = 1;
+    }
+  }
+  pthread_mutex_unlock(&stripe->mutex);
+
+  atomic_fetch_add(found ? &cache->hits : &cache->misses, 1);
+  return found;
+}
+
+void route_cache_store(route_cache *cache, char *key, route_decision *decision, time_t now) {
+  if (strlen(key) >= ROUTE_CACHE_MAX_KEY) {
+    return;
+  }
+  unsigned int hash = route_cache_hash(key);
+  route_cache_stripe *stripe = &cache->stripe[hash % ROUTE_CACHE_STRIPES];
+
+  pthread_mutex_lock(&stripe->mutex);
+  int i = route_cache_find(stripe, key, hash);
+  if (i >= 0) {
+    route_cache_lru_unlink(stripe, i);
+  } else {
+    if (stripe->count < stripe->capacity) {
+      i = stripe->count++;
+    } else {
+      // evict the least recently used
+      i = stripe->lru_tail;
+      route_cache_lru_unlink(stripe, i);
+      route_cache_hash_unlink(stripe, i);
+    }
+    route_cache_entry *e = &stripe->entry[i];
+    strcpy(e->key, key);
+    e->hash = hash;
+    int b = hash % stripe->bucket_count;
+    e->next = stripe->bucket[b];
+    stripe->bucket[b] = i;
+  }
+  route_cache_entry *e = &stripe->entry[i];
+  e->generation = atomic_load(&cache->generation);
+  e->expires = decision->resolved_dns ? now + ROUTE_CACHE_DNS_TTL : 0;
+  e->decision = *decision;
+  route_cache_lru_push(stripe, i);
+  pthread_mutex_unlock(&stripe->mutex);
+}
+
+// Forget every decision; call whenever the rules change.
+void route_cache_invalidate(route_cache *cache) {
+  atomic_fetch_add(&cache->generation, 1);
+}
+
+void route_cache_get_stats(route_cache *cache, route_cache_stats *stats) {
+  stats->size = cache->size;
+  stats->entries = 0;
+  for (int s=0; s<ROUTE_CACHE_STRIPES; s++) {
+    pthread_mutex_lock(&cache->stripe[s].mutex);
+    stats->entries += cache->stripe[s].count;
+    pthread_mutex_unlock(&cache->stripe[s].mutex);
+  }
+  stats->hits = atomic_load(&cache->hits);
+  stats->misses = atomic_load(&cache->misses);
+}
@@ -0,0 +1,92 @@
+// Copyright 2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+// SPDX-License-Identifier: MIT-0
+
+#ifndef ROUTE_CACHE_H
+#define ROUTE_CACHE_H
+
+#include<pthread.h>
+#include<stdatomic.h>
+#include<time.h>
+
+#include"host_id.h"
+#include"route_rule.h"
+#include"token_bucket.h"
+
+// Cache of routing decisions for one proxy instance.
+//
+// Browsers and build tools connect to the same few hundred destinations over
+// and over. The cache remembers what the rules decided for a destination, as
+// the client asked for it (name, address and port), so that the next
+// connection there skips the rules, and any DNS lookup they asked for.
+//
+// Entries are split over ROUTE_CACHE_STRIPES stripes by hash, each with its
+// own mutex and least-recently-used list, so handler threads seldom wait on
+// each other. Each entry records the cache's generation when it was stored;
+// route_cache_invalidate() moves the generation on, which makes every entry
+// stale at once. A decision that resolved a name is kept for
+// ROUTE_CACHE_DNS_TTL seconds only, so the address doesn't go stale.
+//
+// Times are seconds from time(NULL); the functions take 'now' in order to be
+// testable.
+
+#define ROUTE_CACHE_STRIPES 16
+#define ROUTE_CACHE_DNS_TTL 60
+#define ROUTE_CACHE_DEFAULT_SIZE 4096
+#define ROUTE_CACHE_MAX_KEY (MAX_DNS + 80)
+
+// Everything the rules did to a connection.
+typedef struct route_decision {
+  route_rule *route;         // NULL if no rule matched
+  host_id dst;               // destination after any 'to' or resolveDNS
+  int socks_address_type;
+  int idle_timeout;          // -1 = no rule set it
+  int connect_timeout;       // -1 = no rule set it
+  token_bucket *rate_limit[2]; // NULL = no rule set it
+  int resolved_dns;
+} route_decision;
+
+typedef struct route_cache_entry {
+  char key[ROUTE_CACHE_MAX_KEY];
+  unsigned int hash;
+  unsigned long long generation;
+  time_t expires; // 0 = never
+  route_decision decision;
+  int next;       // hash chain
+  int lru_prev;   // towards the most recently used
+  int lru_next;   // towards the least recently used
+} route_cache_entry;
+
+typedef struct route_cache_stripe {
+  pthread_mutex_t mutex;
+  route_cache_entry *entry; // ** USE MUTEX
+  int count;                // ** USE MUTEX
+  int capacity;
+  int *bucket;              // ** USE MUTEX
+  int bucket_count;
+  int lru_head;             // ** USE MUTEX  most recently used, -1 if empty
+  int lru_tail;             // ** USE MUTEX  least recently used, -1 if empty
+} route_cache_stripe;
+
+typedef struct route_cache {
+  int size; // entries over all stripes
+  atomic_ullong generation;
+  atomic_ullong hits;
+  atomic_ullong misses;
+  route_cache_stripe stripe[ROUTE_CACHE_STRIPES];
+} route_cache;
+
+typedef struct route_cache_stats {
+  int size;
+  int entries;
+  unsigned long long hits;
+  unsigned long long misses;
+} route_cache_stats;
+
+route_cache *new_route_cache(int size);
+void route_cache_key(host_id *dst, char *buf, int buflen);
+int  route_cache_lookup(route_cache *cache, char *key, route_decision *decision, time_t now);
+void route_cache_store(route_cache *cache, char *key, route_decision *decision, time_t now);
+void route_cache_invalidate(route_cache *cache);
+void route_cache_get_stats(route_cache *cache, route_cache_stats *stats);
+
+#endif // ROUTE_CACHE_H
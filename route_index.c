@@ -0,0 +1,429 @@
+// Copyright 2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+// SPDX-License-Identifier: MIT-0
+
+#include<stdlib.h>
+#include<string.h>
+#include<ctype.h>
+
+#include"log.h"
+#include"route_index.h"
+
+// Grow an array of 'size'-byte elements so that one more fits.
+void *route_index_grow(void *array, int count, int *capacity, size_t size) {
+  if (count < *capacity) {
+    return array;
+  }
+  int new_capacity = *capacity > 0 ? *capacity * 2 : 64;
+  void *new_array = realloc(array, size * new_capacity);
+  if (new_array == NULL) {
+    unexpected_exit(59,"Error allocating route index");
+  }
+  *capacity = new_capacity;
+  return new_array;
+}
+
+unsigned int route_index_hash(char *str) {
+  unsigned int hash = 5381;
+  for (unsigned char *ptr=(unsigned char*)str; *ptr; ptr++) {
+    hash = hash * 33 + *ptr;
+  }
+  return hash;
+}
+
+// returns the new posting list head
+int route_index_add_posting(route_index *idx, int head, int pos) {
+  idx->posting = route_index_grow(idx->posting, idx->posting_count, &idx->posting_capacity, sizeof(route_index_posting));
+  route_index_posting *p = &idx->posting[idx->posting_count];
+  p->pos = pos;
+  p->next = head;
+  return idx->posting_count++;
+}
+
+int route_index_trie_new_node(route_index_trie *trie, unsigned char c) {
+  trie->node = route_index_grow(trie->node, trie->count, &trie->capacity, sizeof(route_index_trie_node));
+  route_index_trie_node *n = &trie->node[trie->count];
+  n->child = -1;
+  n->sibling = -1;
+  n->rules = -1;
+  n->fail = 0;
+  n->output = -1;
+  n->c = c;
+  return trie->count++;
+}
+
+// returns the child of 'parent' for 'c', -1 if there is none
+int route_index_trie_child(route_index_trie *trie, int parent, unsigned char c) {
+  for (int i=trie->node[parent].child; i >= 0; i=trie->node[i].sibling) {
+    if (trie->node[i].c == c) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+// File rule 'pos' under 'str', read backwards if 'reverse'.
+void route_index_trie_insert(route_index *idx, route_index_trie *trie, char *str, int reverse, int pos) {
+  int len = strlen(str);
+  int node = 0;
+  for (int i=0; i<len; i++) {
+    unsigned char c = reverse ? str[len-1-i] : str[i];
+    int child = route_index_trie_child(trie, node, c);
+    if (child < 0) {
+      child = route_index_trie_new_node(trie, c);
+      trie->node[child].sibling = trie->node[node].child;
+      trie->node[node].child = child;
+    }
+    node = child;
+  }
+  trie->node[node].rules = route_index_add_posting(idx, trie->node[node].rules, pos);
+}
+
+// contains is case-insensitive, so the automaton holds the strings lowercased
+void route_index_contains_insert(route_index *idx, char *str, int pos) {
+  char lower[MAX_DNS];
+  int i;
+  for (i=0; str[i] && i < sizeof(lower)-1; i++) {
+    lower[i] = tolower((unsigned char)str[i]);
+  }
+  lower[i] = 0;
+  route_index_trie_insert(idx, &idx->contains, lower, 0, pos);
+}
+
+// Once every string is in, link each node to the longest proper suffix of its
+// string that is also in the trie, breadth first so the shorter ones are done.
+void route_index_contains_link(route_index *idx) {
+  route_index_trie *trie = &idx->contains;
+  int *queue = malloc(sizeof(int) * trie->count);
+  if (queue == NULL) {
+    unexpected_exit(59,"Error allocating route index");
+  }
+  int head = 0, tail = 0;
+  for (int child=trie->node[0].child; child >= 0; child=trie->node[child].sibling) {
+    queue[tail++] = child;
+  }
+  while (head < tail) {
+    int node = queue[head++];
+    for (int child=trie->node[node].child; child >= 0; child=trie->node[child].sibling) {
+      unsigned char c = trie->node[child].c;
+      int fail = trie->node[node].fail;
+      int next = route_index_trie_child(trie, fail, c);
+      while (next < 0 && fail != 0) {
+        fail = trie->node[fail].fail;
+        next = route_index_trie_child(trie, fail, c);
+      }
+      fail = next >= 0 ? next : 0;
+      trie->node[child].fail = fail;
+      trie->node[child].output = trie->node[fail].rules >= 0 ? fail : trie->node[fail].output;
+      queue[tail++] = child;
+    }
+  }
+  free(queue);
+}
+
+// returns 1 if every bit of the mask is above every bit not in it (a /n netmask)
+int route_index_mask_is_prefix(unsigned long mask) {
+  unsigned long inverse = ~mask & 0xffffffff;
+  return (inverse & (inverse + 1)) == 0;
+}
+
+int route_index_net_new_node(route_index *idx) {
+  idx->net = route_index_grow(idx->net, idx->net_count, &idx->net_capacity, sizeof(route_index_bit_node));
+  route_index_bit_node *n = &idx->net[idx->net_count];
+  n->child[0] = n->child[1] = -1;
+  n->rules = -1;
+  return idx->net_count++;
+}
+
+void route_index_net_insert(route_index *idx, unsigned long addr, unsigned long mask, int pos) {
+  int node = 0;
+  for (int bit=31; bit >= 0 && (mask >> bit) & 1; bit--) {
+    int b = (addr >> bit) & 1;
+    if (idx->net[node].child[b] < 0) {
+      int child = route_index_net_new_node(idx);
+      idx->net[node].child[b] = child;
+    }
+    node = idx->net[node].child[b];
+  }
+  idx->net[node].rules = route_index_add_posting(idx, idx->net[node].rules, pos);
+}
+
+void route_index_hash_insert(route_index *idx, char *key, int pos) {
+  route_index_hash_entry *e = &idx->hash[idx->hash_count];
+  e->hash = route_index_hash(key);
+  e->key = key;
+  e->pos = pos;
+  int bucket = e->hash % idx->hash_size;
+  e->next = idx->hash_bucket[bucket];
+  idx->hash_bucket[bucket] = idx->hash_count++;
+}
+
+int route_index_compare_int(const void *a, const void *b) {
+  return *(int*)a - *(int*)b;
+}
+
+route_index *route_index_build(route_rule *list) {
+  route_index *idx = calloc(1, sizeof(route_index));
+  if (idx == NULL) {
+    unexpected_exit(59,"Error allocating route index");
+  }
+  for (route_rule *route=list; route; route=route->next) {
+    idx->rule_count++;
+  }
+  idx->rule = malloc(sizeof(route_rule*) * (idx->rule_count + 1));
+  idx->scan = malloc(sizeof(int) * (idx->rule_count + 1));
+  idx->hash_size = idx->rule_count * 2 + 1;
+  idx->hash_bucket = malloc(sizeof(int) * idx->hash_size);
+  idx->hash = malloc(sizeof(route_index_hash_entry) * (idx->rule_count + 1));
+  if (idx->rule == NULL || idx->scan == NULL || idx->hash_bucket == NULL || idx->hash == NULL) {
+    unexpected_exit(59,"Error allocating route index");
+  }
+  for (int i=0; i<idx->hash_size; i++) {
+    idx->hash_bucket[i] = -1;
+  }
+  route_index_trie_new_node(&idx->suffix, 0);
+  route_index_trie_new_node(&idx->prefix, 0);
+  route_index_trie_new_node(&idx->contains, 0);
+  route_index_net_new_node(idx);
+
+  host_pattern **pattern = malloc(sizeof(host_pattern*) * (idx->rule_count + 1));
+  int *pattern_pos = malloc(sizeof(int) * (idx->rule_count + 1));
+  if (pattern == NULL || pattern_pos == NULL) {
+    unexpected_exit(59,"Error allocating route index");
+  }
+  int pattern_count = 0;
+
+  int pos = 0;
+  for (route_rule *route=list; route; route=route->next, pos++) {
+    idx->rule[pos] = route;
+    // A rule is filed under the condition likely to narrow things down the most.
+    if (route->match_is[0] != 0) {
+      route_index_hash_insert(idx, route->match_is, pos);
+      idx->count_is++;
+    } else if (route->have_match_ipv4 && route_index_mask_is_prefix(route->match_ipv4_mask)) {
+      route_index_net_insert(idx, route->match_ipv4_addr, route->match_ipv4_mask, pos);
+      idx->count_network++;
+    } else if (route->match_ends_with[0] != 0) {
+      route_index_trie_insert(idx, &idx->suffix, route->match_ends_with, 1, pos);
+      idx->count_ends_with++;
+    } else if (route->match_starts_with[0] != 0) {
+      route_index_trie_insert(idx, &idx->prefix, route->match_starts_with, 0, pos);
+      idx->count_starts_with++;
+    } else if (route->match_contains[0] != 0) {
+      route_index_contains_insert(idx, route->match_contains, pos);
+      idx->count_contains++;
+    } else if (route->match_glob || route->match_regex) {
+      pattern[pattern_count] = route->match_glob ? route->match_glob : route->match_regex;
+      pattern_pos[pattern_count++] = pos;
+    } else {
+      idx->scan[idx->scan_count++] = pos;
+    }
+  }
+  route_index_contains_link(idx);
+
+  if (pattern_count > 0) {
+    idx->patterns = host_pattern_dfa_build(pattern, pattern_pos, pattern_count);
+    if (idx->patterns) {
+      idx->count_patterns = pattern_count;
+    } else {
+      warn("matches/regex patterns too complex to combine (over %i DFA states); checking those %i rules one at a time", HOST_PATTERN_DFA_MAX_STATES, pattern_count);
+      for (int i=0; i<pattern_count; i++) {
+        idx->scan[idx->scan_count++] = pattern_pos[i];
+      }
+      qsort(idx->scan, idx->scan_count, sizeof(int), route_index_compare_int);
+    }
+  }
+  free(pattern);
+  free(pattern_pos);
+  return idx;
+}
+
+void route_index_free(route_index *idx) {
+  if (idx == NULL) {
+    return;
+  }
+  free(idx->rule);
+  free(idx->scan);
+  free(idx->hash_bucket);
+  free(idx->hash);
+  free(idx->suffix.node);
+  free(idx->prefix.node);
+  free(idx->contains.node);
+  free(idx->net);
+  free(idx->posting);
+  host_pattern_dfa_free(idx->patterns);
+  free(idx);
+}
+
+// bytes allocated for the index, for the memory report; not the rules themselves
+size_t route_index_memory(route_index *idx) {
+  if (idx == NULL) {
+    return 0;
+  }
+  return sizeof(route_index) +
+         sizeof(route_rule*) * (idx->rule_count + 1) +
+         sizeof(int) * (idx->rule_count + 1) +                       // scan
+         sizeof(int) * idx->hash_size +
+         sizeof(route_index_hash_entry) * (idx->rule_count + 1) +
+         sizeof(route_index_trie_node) * (idx->suffix.capacity + idx->prefix.capacity + idx->contains.capacity) +
+         sizeof(route_index_bit_node) * idx->net_capacity +
+         sizeof(route_index_posting) * idx->posting_capacity +
+         host_pattern_dfa_memory(idx->patterns);
+}
+
+// returns 0 if the candidate list is full
+int route_index_add_candidates(route_index_cursor *cur, int head, int from_pos) {
+  for (int i=head; i >= 0; i=cur->idx->posting[i].next) {
+    if (cur->idx->posting[i].pos < from_pos) {
+      continue;
+    }
+    if (cur->cand_count >= ROUTE_INDEX_MAX_CANDIDATES) {
+      return 0;
+    }
+    cur->cand[cur->cand_count++] = cur->idx->posting[i].pos;
+  }
+  return 1;
+}
+
+int route_index_lookup_string(route_index_cursor *cur, char *str, int from_pos) {
+  route_index *idx = cur->idx;
+  int ok = 1;
+
+  unsigned int hash = route_index_hash(str);
+  for (int i=idx->hash_bucket[hash % idx->hash_size]; i >= 0 && ok; i=idx->hash[i].next) {
+    route_index_hash_entry *e = &idx->hash[i];
+    if (e->hash == hash && e->pos >= from_pos && strcmp(e->key, str) == 0) {
+      if (cur->cand_count >= ROUTE_INDEX_MAX_CANDIDATES) {
+        ok = 0;
+      } else {
+        cur->cand[cur->cand_count++] = e->pos;
+      }
+    }
+  }
+
+  // endsWith compares the lowercased destination with the rule's string as written
+  int len = strlen(str);
+  int node = 0;
+  for (int i=len-1; i >= 0 && node >= 0 && ok; i--) {
+    node = route_index_trie_child(&idx->suffix, node, tolower((unsigned char)str[i]));
+    if (node >= 0) {
+      ok = route_index_add_candidates(cur, idx->suffix.node[node].rules, from_pos);
+    }
+  }
+
+  node = 0;
+  for (int i=0; i<len && node >= 0 && ok; i++) {
+    node = route_index_trie_child(&idx->prefix, node, str[i]);
+    if (node >= 0) {
+      ok = route_index_add_candidates(cur, idx->prefix.node[node].rules, from_pos);
+    }
+  }
+
+  // one pass yields every contains string found anywhere in 'str'
+  route_index_trie *ac = &idx->contains;
+  node = 0;
+  for (int i=0; i<len && ok; i++) {
+    unsigned char c = tolower((unsigned char)str[i]);
+    int next = route_index_trie_child(ac, node, c);
+    while (next < 0 && node != 0) {
+      node = ac->node[node].fail;
+      next = route_index_trie_child(ac, node, c);
+    }
+    node = next >= 0 ? next : 0;
+    int found = ac->node[node].rules >= 0 ? node : ac->node[node].output;
+    for (; found > 0 && ok; found=ac->node[found].output) {
+      ok = route_index_add_candidates(cur, ac->node[found].rules, from_pos);
+    }
+  }
+
+  if (idx->patterns && ok) {
+    int *found = &cur->cand[cur->cand_count];
+    int count = host_pattern_dfa_match(idx->patterns, str, found, ROUTE_INDEX_MAX_CANDIDATES - cur->cand_count);
+    if (count < 0) {
+      ok = 0;
+    }
+    for (int i=0; i<count; i++) {
+      if (found[i] >= from_pos) {
+        cur->cand[cur->cand_count++] = found[i];
+      }
+    }
+  }
+  return ok;
+}
+
+// Start a lookup of the rules from position 'from_pos' on that may match the destination.
+void route_index_lookup(route_index *idx, route_index_cursor *cur, int from_pos, char *name, char *ipaddr, int have_ipv4, unsigned long ipv4_addr) {
+  cur->idx = idx;
+  cur->cand_count = 0;
+  cur->cand_next = 0;
+  cur->linear_next = -1;
+  cur->pos = from_pos - 1;
+
+  int ok = 1;
+  if (name) {
+    ok = route_index_lookup_string(cur, name, from_pos);
+  }
+  if (ok && ipaddr) {
+    ok = route_index_lookup_string(cur, ipaddr, from_pos);
+  }
+  if (ok && have_ipv4) {
+    int node = 0;
+    ok = route_index_add_candidates(cur, idx->net[0].rules, from_pos);
+    for (int bit=31; bit >= 0 && ok; bit--) {
+      node = idx->net[node].child[(ipv4_addr >> bit) & 1];
+      if (node < 0) {
+        break;
+      }
+      ok = route_index_add_candidates(cur, idx->net[node].rules, from_pos);
+    }
+  }
+  if (!ok) {
+    trace("more than %i candidate rules; checking every rule",ROUTE_INDEX_MAX_CANDIDATES);
+    cur->linear_next = from_pos;
+    return;
+  }
+
+  // file order; a rule found through both the name and the address is tried once
+  qsort(cur->cand, cur->cand_count, sizeof(int), route_index_compare_int);
+  int unique = 0;
+  for (int i=0; i<cur->cand_count; i++) {
+    if (unique == 0 || cur->cand[unique-1] != cur->cand[i]) {
+      cur->cand[unique++] = cur->cand[i];
+    }
+  }
+  cur->cand_count = unique;
+
+  int lo = 0, hi = idx->scan_count;
+  while (lo < hi) {
+    int mid = (lo + hi) / 2;
+    if (idx->scan[mid] < from_pos) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  cur->scan_next = lo;
+}
+
+// returns the next rule that may match, in file order; NULL when there are no more
+route_rule *route_index_next(route_index_cursor *cur) {
+  route_index *idx = cur->idx;
+  if (cur->linear_next >= 0) {
+    if (cur->linear_next >= idx->rule_count) {
+      return NULL;
+    }
+    cur->pos = cur->linear_next++;
+    return idx->rule[cur->pos];
+  }
+  int cand = cur->cand_next < cur->cand_count ? cur->cand[cur->cand_next] : idx->rule_count;
+  int scan = cur->scan_next < idx->scan_count ? idx->scan[cur->scan_next] : idx->rule_count;
+  if (cand < scan) {
+    cur->cand_next++;
+    cur->pos = cand;
+  } else if (scan < idx->rule_count) {
+    cur->scan_next++;
+    cur->pos = scan;
+  } else {
+    return NULL;
+  }
+  return idx->rule[cur->pos];
+}
@@ -0,0 +1,107 @@
+// Copyright 2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+// SPDX-License-Identifier: MIT-0
+
+#ifndef ROUTE_INDEX_H
+#define ROUTE_INDEX_H
+
+#include"route_rule.h"
+
+// Index over a proxy's route rules, built once the config is loaded, so that
+// a connection doesn't have to test every rule in turn. Each rule is filed
+// under one of its conditions:
+//   is          hash table of the exact strings
+//   network     binary trie of the network's address bits
+//   endsWith    trie of the suffixes, last character first
+//   startsWith  trie of the prefixes
+//   contains    Aho-Corasick automaton over the lowercased strings
+//   matches     one DFA for all of the globs and regexes
+//   regex
+// Rules with none of these (only port or map, or a netmask that isn't a
+// prefix) go on a list that every lookup scans, as do the pattern rules if
+// their DFA would be too big. A lookup yields the
+// rules that can match the destination, in file order. The rules engine still
+// checks each of them in full, so it picks the same rule as a walk of the
+// whole list would.
+
+#define ROUTE_INDEX_MAX_CANDIDATES 1024 // more than this and the lookup walks every rule instead
+
+typedef struct route_index_trie_node {
+  int child;   // first child, -1 if none
+  int sibling; // next child of the same parent, -1 if none
+  int rules;   // rules whose string ends at this node; a posting list, -1 if none
+  int fail;    // contains automaton only: longest proper suffix that is also in the trie
+  int output;  // contains automaton only: next node down the fail chain with rules, -1 if none
+  unsigned char c;
+} route_index_trie_node;
+
+typedef struct route_index_trie {
+  route_index_trie_node *node; // node[0] is the root
+  int count;
+  int capacity;
+} route_index_trie;
+
+typedef struct route_index_bit_node {
+  int child[2];
+  int rules; // rules whose network is the path to this node
+} route_index_bit_node;
+
+typedef struct route_index_hash_entry {
+  unsigned int hash;
+  char *key; // the rule's match_is
+  int pos;
+  int next;
+} route_index_hash_entry;
+
+typedef struct route_index_posting {
+  int pos;  // rule's position in the list
+  int next;
+} route_index_posting;
+
+typedef struct route_index {
+  route_rule **rule; // by position in the list
+  int rule_count;
+
+  int *hash_bucket;
+  int hash_size;
+  route_index_hash_entry *hash;
+  int hash_count;
+
+  route_index_trie suffix;
+  route_index_trie prefix;
+  route_index_trie contains;
+
+  host_pattern_dfa *patterns; // NULL if there are no pattern rules, or the DFA would be too big
+
+  route_index_bit_node *net;
+  int net_count;
+  int net_capacity;
+
+  route_index_posting *posting;
+  int posting_count;
+  int posting_capacity;
+
+  int *scan; // positions of the rules not filed under anything, ascending
+  int scan_count;
+
+  // how the rules were filed, for the log
+  int count_is, count_network, count_ends_with, count_starts_with, count_contains, count_patterns;
+} route_index;
+
+// Where a lookup is up to; lives on the caller's stack.
+typedef struct route_index_cursor {
+  route_index *idx;
+  int cand[ROUTE_INDEX_MAX_CANDIDATES];
+  int cand_count;
+  int cand_next;
+  int scan_next;
+  int linear_next; // >= 0 when there were too many candidates and every rule is walked
+  int pos;         // position of the rule last returned
+} route_index_cursor;
+
+route_index *route_index_build(route_rule *list);
+void route_index_free(route_index *idx);
+size_t route_index_memory(route_index *idx);
+void route_index_lookup(route_index *idx, route_index_cursor *cur, int from_pos, char *name, char *ipaddr, int have_ipv4, unsigned long ipv4_addr);
+route_rule *route_index_next(route_index_cursor *cur);
+
+#endif // ROUTE_INDEX_H
@@ -11,6 +11,22 @@
 
 unsigned long long route_rule_id_pool=0;
 
+// Strings and tunnel lists of every rule in the config.
+string_intern *route_rule_strings = NULL;
+
+ssh_tunnel *route_rule_no_tunnels[1] = { NULL };
+
+void *route_rule_intern_bytes(void *data, size_t len) {
+  if (route_rule_strings == NULL) {
+    route_rule_strings = new_string_intern();
+  }
+  return string_intern_bytes(route_rule_strings, data, len);
+}
+
+char *route_rule_intern(char *str) {
+  return route_rule_intern_bytes(str, strlen(str) + 1);
+}
+
 route_rule *new_route_rule() {
   route_rule* rule = malloc(sizeof(route_rule));
   if (rule) {
@@ -18,13 +34,23 @@ route_rule *new_route_rule() {
     rule->id=route_rule_id_pool;
     rule->next=NULL;
 
-    rule->match_is[0]=0;
-    rule->match_starts_with[0]=0;
-    rule->match_ends_with[0]=0;
-    rule->match_contains[0]=0;
+    rule->match_is="";
+    rule->match_starts_with="";
+    rule->match_ends_with="";
+    rule->match_contains="";
+    rule->match_glob=NULL;
+    rule->match_regex=NULL;
     rule->match_port=0;
 
     rule->resolve_dns=0;
+    rule->idle_timeout=-1;
+    rule->connect_timeout=-1;
+    rule->strategy=ROUTE_STRATEGY_FAILOVER;
+    rule->race_delay=0;
+    rule->balance=TUNNEL_BALANCE_IN_ORDER;
+    atomic_init(&rule->round_robin_next,0);
+    rule->standby=ROUTE_STANDBY_COLD;
+    rule->rate_limit=NULL;
 
     rule->have_match_ipv4=0;
     rule->match_ipv4_addr=0;
@@ -39,35 +65,73 @@ route_rule *new_route_rule() {
 
     // host_id_init(&(rule->hid));
     
-    rule->tunnel[0]=NULL; 
+    rule->tunnel=route_rule_no_tunnels;
 
-    rule->file_name[0]=0;
+    rule->file_name="";
     rule->file_line_number=-1;
   }
   return rule; 
 }
 
+// Where the last append ended, so a config of a million rules doesn't walk
+// the whole list for every one. Rules are only added while the config loads.
+route_rule *insert_route_rule_head = NULL;
+route_rule *insert_route_rule_tail = NULL;
+
 route_rule *insert_route_rule(route_rule *head, route_rule *route) {
   trace2("insert_route_rule()");
+  route->next = NULL;
   if (head == NULL) {
+    insert_route_rule_head = route;
+    insert_route_rule_tail = route;
     return route; // the new head!
   }
-  route_rule* tmp;
-  for (tmp=head; tmp->next != NULL; tmp=tmp->next);
+  route_rule* tmp = head == insert_route_rule_head ? insert_route_rule_tail : head;
+  for (; tmp->next != NULL; tmp=tmp->next);
   tmp->next=route;
-  route->next = NULL;
+  insert_route_rule_head = head;
+  insert_route_rule_tail = route;
   return head;
 }
 
-int route_rule_grab_param(char *expected_cmd, char *cmd, char *src, char *dst, int dstlen) {
-  if (strcmp(expected_cmd,cmd)==0) {
-    strncpy(dst,src,dstlen);
-    dst[dstlen-1]=0; // just in case.
+int route_rule_grab_param(char *expected_cmd, char *cmd, char *src, char **dst) {
+  if (src != NULL && strcmp(expected_cmd,cmd)==0) {
+    char buf[MAX_DNS];
+    strncpy(buf,src,sizeof(buf));
+    buf[sizeof(buf)-1]=0; // longer than any name could be; just in case.
+    *dst = route_rule_intern(buf);
     return 1;
   }
   return 0; 
 }
 
+// bytes allocated for the rules in 'list', for the memory report. Their
+// strings and tunnel lists are in route_rule_strings, shared, and not counted here.
+size_t route_rule_memory(route_rule *list) {
+  size_t bytes = 0;
+  for (route_rule *route=list; route; route=route->next) {
+    bytes += sizeof(route_rule);
+    if (route->rate_limit) {
+      bytes += sizeof(token_bucket) * 2;
+    }
+    bytes += host_pattern_memory(route->match_glob) + host_pattern_memory(route->match_regex);
+  }
+  return bytes;
+}
+
+// the rule's pair of buckets, made the first time it's asked for
+token_bucket *route_rule_rate_limit(route_rule *route) {
+  if (route->rate_limit == NULL) {
+    route->rate_limit = malloc(sizeof(token_bucket) * 2);
+    if (route->rate_limit == NULL) {
+      unexpected_exit(67,"Error allocating route_rule rate limit");
+    }
+    token_bucket_init(&route->rate_limit[0],0,0);
+    token_bucket_init(&route->rate_limit[1],0,0);
+  }
+  return route->rate_limit;
+}
+
 int convert_string_to_ipv4_ulong(char *ipaddr_string, unsigned long *ipaddr) {
   struct sockaddr_in sin;
   sin.sin_len=sizeof(sin);
@@ -135,11 +199,8 @@ route_rule *parse_route_rule_spec(char *strIn, char *filename, int line_num, ssh
     } 
   }
   if (okay) {
-    if (filename == NULL) {
-      route->file_name[0]=0;
-    } else {
-      strncpy(route->file_name,filename,sizeof(route->file_name));
-      route->file_name[sizeof(route->file_name)-1]=0;
+    if (filename != NULL) {
+      route->file_name = route_rule_intern(filename);
     }
     route->file_line_number=line_num;
   }
@@ -165,15 +226,71 @@ route_rule *parse_route_rule_spec(char *strIn, char *filename, int line_num, ssh
     }
     trace2("Got cmd: '%s' param '%s'",cmd,param);
     int got_it = 0; 
-    if (!got_it) got_it = route_rule_grab_param("is",cmd,param,route->match_is,sizeof(route->match_is));
-    if (!got_it) got_it = route_rule_grab_param("startsWith",cmd,param,route->match_starts_with,sizeof(route->match_starts_with));
-    if (!got_it) got_it = route_rule_grab_param("endsWith",cmd,param,route->match_ends_with,sizeof(route->match_ends_with));
-    if (!got_it) got_it = route_rule_grab_param("contains",cmd,param,route->match_contains,sizeof(route->match_contains));
+    if (!got_it) got_it = route_rule_grab_param("is",cmd,param,&route->match_is);
+    if (!got_it) got_it = route_rule_grab_param("startsWith",cmd,param,&route->match_starts_with);
+    if (!got_it) got_it = route_rule_grab_param("endsWith",cmd,param,&route->match_ends_with);
+    if (!got_it) got_it = route_rule_grab_param("contains",cmd,param,&route->match_contains);
+    if (!got_it && param != NULL && (strcmp(cmd,"matches")==0 || strcmp(cmd,"regex")==0)) {
+      int type = strcmp(cmd,"matches")==0 ? HOST_PATTERN_GLOB : HOST_PATTERN_REGEX;
+      host_pattern **field = type == HOST_PATTERN_GLOB ? &route->match_glob : &route->match_regex;
+      char err[200];
+      host_pattern *pattern = host_pattern_compile(param, type, err, sizeof(err));
+      if (pattern == NULL) {
+        error("bad %s pattern '%s' in %s line %i: %s", cmd, param, filename, line_num, err);
+      } else {
+        host_pattern_free(*field);
+        *field = pattern;
+        got_it=1;
+      }
+    }
     if (!got_it && param != NULL && strcmp(cmd,"port")==0) {
       if (sscanf(param,"%i",&route->match_port) ==1) {
         got_it=1;
       }
     }
+    if (!got_it && param != NULL && strcmp(cmd,"idleTimeout")==0) {
+      if (sscanf(param,"%i",&route->idle_timeout) ==1 && route->idle_timeout >= 0) {
+        got_it=1;
+      }
+    }
+    if (!got_it && param != NULL && strcmp(cmd,"connectTimeout")==0) {
+      if (sscanf(param,"%i",&route->connect_timeout) ==1 && route->connect_timeout >= 0) {
+        got_it=1;
+      }
+    }
+    if (!got_it && param != NULL && strcmp(cmd,"strategy")==0) {
+      if (strcmp(param,"failover")==0) {
+        route->strategy=ROUTE_STRATEGY_FAILOVER;
+        got_it=1;
+      } else if (strcmp(param,"race")==0) {
+        route->strategy=ROUTE_STRATEGY_RACE;
+        got_it=1;
+      }
+    }
+    if (!got_it && param != NULL && strcmp(cmd,"balance")==0) {
+      route->balance = tunnel_balance_from_str(param);
+      got_it = route->balance != TUNNEL_BALANCE_INVALID;
+    }
+    if (!got_it && param != NULL && strcmp(cmd,"standby")==0) {
+      if (strcmp(param,"cold")==0) {
+        route->standby=ROUTE_STANDBY_COLD;
+        got_it=1;
+      } else if (strcmp(param,"warm")==0) {
+        route->standby=ROUTE_STANDBY_WARM;
+        got_it=1;
+      }
+    }
+    if (!got_it && param != NULL && strcmp(cmd,"raceDelay")==0) {
+      if (sscanf(param,"%i",&route->race_delay) ==1 && route->race_delay >= 0) {
+        got_it=1;
+      }
+    }
+    if (!got_it && param != NULL && strcmp(cmd,"rateLimitUp")==0) {
+      got_it = token_bucket_parse(&route_rule_rate_limit(route)[0], param);
+    }
+    if (!got_it && param != NULL && strcmp(cmd,"rateLimitDown")==0) {
+      got_it = token_bucket_parse(&route_rule_rate_limit(route)[1], param);
+    }
     if (!got_it) got_it = route_rule_grab_netv4("network",cmd,param,&route->have_match_ipv4, &route->match_ipv4_addr, &route->match_ipv4_mask);
     if (!got_it) got_it = route_rule_grab_netv4("map",cmd,param,&route->have_map_ipv4, &route->map_ipv4_addr, &route->map_ipv4_mask);
     if (!got_it) got_it = route_rule_grab_netv4("to",cmd,param,&route->have_to_ipv4, &route->to_ipv4_addr, &route->to_ipv4_mask);
@@ -184,6 +301,8 @@ route_rule *parse_route_rule_spec(char *strIn, char *filename, int line_num, ssh
 
   // parse via command
   char *ssh_name;
+  ssh_tunnel *via[ROUTE_RULE_MAX_SSH_TUNNELS_PER_RULE];
+  int via_count=0;
   while(okay && strPtr != NULL) {
     ssh_name=NULL;
     while(okay && ssh_name == NULL && strPtr != NULL) {
@@ -200,12 +319,9 @@ route_rule *parse_route_rule_spec(char *strIn, char *filename, int line_num, ssh
         error("attempt to route via an undefined SSH tunnel (%s) in %s line %i: %s", ssh_name, filename, line_num, strIn);
         okay=0;
       } else {
-        int i;
-        for (i=0; i<(ROUTE_RULE_MAX_SSH_TUNNELS_PER_RULE-1) && route->tunnel[i]!=NULL; i++);
-        if (i<ROUTE_RULE_MAX_SSH_TUNNELS_PER_RULE-1) {
+        if (via_count<ROUTE_RULE_MAX_SSH_TUNNELS_PER_RULE-1) {
           trace2("route via %s",ssh_name);
-          route->tunnel[i]=ssh; 
-          route->tunnel[i+1]=NULL; 
+          via[via_count++]=ssh; 
         } else {
           error("Ignoring excess via \"%s\" (over %i) in %s line %i: %s", ssh_name, ROUTE_RULE_MAX_SSH_TUNNELS_PER_RULE, filename, line_num, strIn);
           // log the error, but otherwise ignore this 
@@ -214,6 +330,11 @@ route_rule *parse_route_rule_spec(char *strIn, char *filename, int line_num, ssh
     }
   }
 
+  if (okay && via_count > 0) {
+    via[via_count++]=NULL;
+    route->tunnel = route_rule_intern_bytes(via, sizeof(ssh_tunnel*) * via_count);
+  }
+
   // clean up after ourselves
   if (local_copy != NULL) {
     free(local_copy);
@@ -221,6 +342,9 @@ route_rule *parse_route_rule_spec(char *strIn, char *filename, int line_num, ssh
   }
   if (!okay) {
     if (route != NULL) {
+      free(route->rate_limit);
+      host_pattern_free(route->match_glob);
+      host_pattern_free(route->match_regex);
       free(route);
       route=NULL;
     }
@@ -6,9 +6,20 @@
 
 #include"host_id.h"
 #include"ssh_tunnel.h"
+#include"token_bucket.h"
+#include"tunnel_balance.h"
+#include"string_intern.h"
+#include"host_pattern.h"
 
 #define ROUTE_RULE_MAX_SSH_TUNNELS_PER_RULE 100
 
+// how a rule with several ssh tunnels picks one ("strategy" command)
+#define ROUTE_STRATEGY_FAILOVER 0 // in order; the next tunnel is only tried once the ones before it have failed
+#define ROUTE_STRATEGY_RACE     1 // handshake with all of them at once (or "raceDelay" ms apart); first to answer wins
+
+#define ROUTE_STANDBY_COLD 0 // the second tunnel is only started when a connection needs it
+#define ROUTE_STANDBY_WARM 1 // the second tunnel runs whenever the first does
+
 typedef struct route_rule {
   struct route_rule *next;
   unsigned long long id;
@@ -16,11 +27,15 @@ typedef struct route_rule {
   ///////////////////
   // CONDITIONS
 
-  // match against DNS or string-verison of hid
-  char match_is[MAX_DNS];
-  char match_starts_with[MAX_DNS];
-  char match_ends_with[MAX_DNS];
-  char match_contains[MAX_DNS];
+  // match against DNS or string-verison of hid; "" if not given.
+  // Interned in route_rule_strings, like every string and list below, so
+  // rules that say the same thing share one copy.
+  char *match_is;
+  char *match_starts_with;
+  char *match_ends_with;
+  char *match_contains;
+  host_pattern *match_glob;  // "matches" command; NULL if not given
+  host_pattern *match_regex; // "regex" command; NULL if not given
   int  match_port;
 
   int have_match_ipv4; // boolean, because both values below could legitimately be 0
@@ -33,6 +48,16 @@ typedef struct route_rule {
   // "resolveDns" command
   int resolve_dns; // boolean
 
+  // "idleTimeout" command; overrides the proxy's idleTimeout. -1 if not given.
+  int idle_timeout;
+
+  // "connectTimeout" command; overrides the proxy's connectTimeout. -1 if not given.
+  int connect_timeout;
+
+  // "rateLimitUp" / "rateLimitDown" commands; shared by every connection this rule matches. [0] up, [1] down
+  // NULL unless the rule has one or the other.
+  token_bucket *rate_limit;
+
   int have_map_ipv4; // boolean, because both values below could legitimately be 0
   unsigned long map_ipv4_addr;
   unsigned long map_ipv4_mask;
@@ -44,8 +69,19 @@ typedef struct route_rule {
   ///////////////////
   // END-STATE
 
-  // "via" command which assigns a route if conditions are true
-  ssh_tunnel* tunnel[ROUTE_RULE_MAX_SSH_TUNNELS_PER_RULE];
+  // "via" command which assigns a route if conditions are true; NULL-terminated
+  ssh_tunnel **tunnel;
+
+  // "strategy" and "raceDelay" commands; only used by the rule that supplies the "via"
+  int strategy;
+  int race_delay; // milliseconds
+
+  // "balance" command: which of the tunnels to try first; TUNNEL_BALANCE_*
+  int balance;
+  atomic_uint round_robin_next;
+
+  // "standby" command: ROUTE_STANDBY_*
+  int standby;
 
   ///////////////////
   // Metadata
@@ -53,15 +89,18 @@ typedef struct route_rule {
   // unrelated to rule or its operation, but for debugging and
   // producing useful log messages, let's
   // remember where this rule came from.
-  char file_name[4096];
+  char *file_name;
   long file_line_number;
 
   // metrics
   unsigned long long num_matches;
 } route_rule;
 
+extern string_intern *route_rule_strings;
+
 route_rule *new_route_rule();
 route_rule *insert_route_rule(route_rule *head, route_rule *rule);
+size_t route_rule_memory(route_rule *list);
 route_rule *parse_route_rule_spec(char *strIn, char *filename, int line_num, ssh_tunnel *ssh_tunnel_list);
 
 #endif // ROUTE_RULE_H
@@ -13,8 +13,11 @@
 #include"string2.h"
 #include"dns_util.h"
 #include"socks5.h"
+#include"route_index.h"
+#include"route_cache.h"
 
 route_rule *default_direct = NULL;
+ssh_tunnel *default_direct_tunnel[2] = { NULL, NULL };
 
 char *rre_get_host_id_name(host_id *dst, char *buf, int buflen) {
   if (host_id_has_name(dst)) {
@@ -41,184 +44,315 @@ char *rre_get_host_id_addr(host_id *dst, char *buf, int buflen, sa_family_t *fam
 }
 
 
-int decide_applicable_rule(proxy_instance *proxy, service *srv, client_connection *con) {
+// The destination as the rules see it; permutations change it as rules apply.
+typedef struct rre_dst {
   host_id *dst;
   char name_mem[MAX_DNS], *name;
   char ipaddr_mem[MAX_DNS], *ipaddr;
   unsigned long ipv4_addr;
   int port;
   sa_family_t family; 
+} rre_dst;
 
-  dst = &con->dst_host;
-  name = rre_get_host_id_name(dst, name_mem, sizeof(name_mem));
-  ipaddr = rre_get_host_id_addr(dst,ipaddr_mem, sizeof(ipaddr_mem), &family, &ipv4_addr);
-  port = host_id_get_port(dst);
- 
-  route_rule *applicable_route=NULL;
-  for (route_rule *route = proxy->route_rule_list; route && !applicable_route; route=route->next) {
-    int this_route_applies=1;
-    int final_route=0;
-    
-    ////////////////
-    // CONITIONS 
-
-    if (this_route_applies && route->match_is[0] != 0) {
-      this_route_applies=0;
-      if (name   &&  strcmp(name,   route->match_is) == 0)   { this_route_applies=1; }
-      if (ipaddr &&  strcmp(ipaddr, route->match_is) == 0)   { this_route_applies=1; }
-      if (this_route_applies) {
-        debug("%s line %i: host %s(%s) matches %s",route->file_name, route->file_line_number, name, ipaddr, route->match_is);
-      } else {
-        trace("%s line %i: host %s(%s) DOES NOT match %s",route->file_name, route->file_line_number, name, ipaddr, route->match_is);
-      }
+void rre_dst_refresh(rre_dst *d) {
+  d->name = rre_get_host_id_name(d->dst, d->name_mem, sizeof(d->name_mem));
+  d->ipaddr = rre_get_host_id_addr(d->dst, d->ipaddr_mem, sizeof(d->ipaddr_mem), &d->family, &d->ipv4_addr);
+  d->port = host_id_get_port(d->dst);
+}
+
+// Check one rule against the destination and, if it applies, carry out its permutations.
+// Timeouts and rate limits go into 'decision', to be applied once the route is picked.
+// '*dst_changed' is set if a permutation changed the destination.
+// returns 1 if the rule applies and picks the route, 0 otherwise
+int rre_apply_rule(route_rule *route, client_connection *con, rre_dst *d, route_decision *decision, int *dst_changed) {
+  host_id *dst = d->dst;
+  char *name = d->name;
+  char *ipaddr = d->ipaddr;
+  unsigned long ipv4_addr = d->ipv4_addr;
+  int port = d->port;
+  sa_family_t family = d->family;
+  int this_route_applies=1;
+  int final_route=0;
+  
+  ////////////////
+  // CONITIONS 
+
+  if (this_route_applies && route->match_is[0] != 0) {
+    this_route_applies=0;
+    if (name   &&  strcmp(name,   route->match_is) == 0)   { this_route_applies=1; }
+    if (ipaddr &&  strcmp(ipaddr, route->match_is) == 0)   { this_route_applies=1; }
+    if (this_route_applies) {
+      debug("%s line %i: host %s(%s) matches %s",route->file_name, route->file_line_number, name, ipaddr, route->match_is);
+    } else {
+      trace("%s line %i: host %s(%s) DOES NOT match %s",route->file_name, route->file_line_number, name, ipaddr, route->match_is);
     }
-    if (this_route_applies && route->match_starts_with[0] != 0) {
-      this_route_applies=0;
-      if (name   && string_starts_with(name,   route->match_starts_with))  { this_route_applies = 1; }
-      if (ipaddr && string_starts_with(ipaddr, route->match_starts_with))  { this_route_applies = 1; }
-      if (this_route_applies) {
-        debug("%s line %i: host %s(%s) starts with %s",route->file_name, route->file_line_number, name, ipaddr, route->match_starts_with);
-      } else {
-        trace("%s line %i: host %s(%s) DOES NOT start with %s",route->file_name, route->file_line_number, name, ipaddr, route->match_starts_with);
-      }
+  }
+  if (this_route_applies && route->match_starts_with[0] != 0) {
+    this_route_applies=0;
+    if (name   && string_starts_with(name,   route->match_starts_with))  { this_route_applies = 1; }
+    if (ipaddr && string_starts_with(ipaddr, route->match_starts_with))  { this_route_applies = 1; }
+    if (this_route_applies) {
+      debug("%s line %i: host %s(%s) starts with %s",route->file_name, route->file_line_number, name, ipaddr, route->match_starts_with);
+    } else {
+      trace("%s line %i: host %s(%s) DOES NOT start with %s",route->file_name, route->file_line_number, name, ipaddr, route->match_starts_with);
     }
-    if (this_route_applies && route->match_ends_with[0] != 0) {
-      this_route_applies=0;
-      if (name   && string_ends_with(name,   route->match_ends_with))  { this_route_applies = 1; }
-      if (ipaddr && string_ends_with(ipaddr, route->match_ends_with))  { this_route_applies = 1; }
-      if (this_route_applies) {
-        debug("%s line %i: host %s(%s) ends with %s",route->file_name, route->file_line_number, name, ipaddr, route->match_ends_with);
-      } else {
-        trace("%s line %i: host %s(%s) DOES NOT end with %s",route->file_name, route->file_line_number, name, ipaddr, route->match_ends_with);
-      }
+  }
+  if (this_route_applies && route->match_ends_with[0] != 0) {
+    this_route_applies=0;
+    if (name   && string_ends_with(name,   route->match_ends_with))  { this_route_applies = 1; }
+    if (ipaddr && string_ends_with(ipaddr, route->match_ends_with))  { this_route_applies = 1; }
+    if (this_route_applies) {
+      debug("%s line %i: host %s(%s) ends with %s",route->file_name, route->file_line_number, name, ipaddr, route->match_ends_with);
+    } else {
+      trace("%s line %i: host %s(%s) DOES NOT end with %s",route->file_name, route->file_line_number, name, ipaddr, route->match_ends_with);
     }
-    if (this_route_applies && route->match_contains[0] != 0) {
-      this_route_applies=0;
-      if (name   && string_contains(name,   route->match_contains))  { this_route_applies = 1; }
-      if (ipaddr && string_contains(ipaddr, route->match_contains))  { this_route_applies = 1; }
-      if (this_route_applies) {
-        debug("%s line %i: host %s(%s) contains %s",route->file_name, route->file_line_number, name, ipaddr, route->match_contains);
-      } else {
-        trace("%s line %i: host %s(%s) DOES NOT contain %s",route->file_name, route->file_line_number, name, ipaddr, route->match_contains);
-      }
+  }
+  if (this_route_applies && route->match_contains[0] != 0) {
+    this_route_applies=0;
+    if (name   && string_contains(name,   route->match_contains))  { this_route_applies = 1; }
+    if (ipaddr && string_contains(ipaddr, route->match_contains))  { this_route_applies = 1; }
+    if (this_route_applies) {
+      debug("%s line %i: host %s(%s) contains %s",route->file_name, route->file_line_number, name, ipaddr, route->match_contains);
+    } else {
+      trace("%s line %i: host %s(%s) DOES NOT contain %s",route->file_name, route->file_line_number, name, ipaddr, route->match_contains);
     }
-    if (this_route_applies && route->match_port != 0) {
-      if (route->match_port != port) {
-        this_route_applies=0;
-      }
-      if (this_route_applies) {
-        debug("%s line %i: port %i matches %i",route->file_name, route->file_line_number, port, route->match_port);
-      } else {
-        trace("%s line %i: port %i DOES NOT match %i",route->file_name, route->file_line_number, port, route->match_port);
-      }
+  }
+  if (this_route_applies && route->match_glob) {
+    this_route_applies=0;
+    if (name   && host_pattern_match(route->match_glob, name))    { this_route_applies = 1; }
+    if (ipaddr && host_pattern_match(route->match_glob, ipaddr))  { this_route_applies = 1; }
+    if (this_route_applies) {
+      debug("%s line %i: host %s(%s) matches %s",route->file_name, route->file_line_number, name, ipaddr, route->match_glob->source);
+    } else {
+      trace("%s line %i: host %s(%s) DOES NOT match %s",route->file_name, route->file_line_number, name, ipaddr, route->match_glob->source);
     }
-    if (this_route_applies && route->have_match_ipv4) {
-      this_route_applies=0;
-      if (ipaddr && family == AF_INET) {
-        unsigned long dst_net  = ipv4_addr & route->match_ipv4_mask;
-        unsigned long rule_net = route->match_ipv4_addr & route->match_ipv4_mask;
-        if (dst_net == rule_net) { this_route_applies = 1; }
-      } 
-      if (this_route_applies) {
-        debug("%s line %i: host %s(%s) matches network 0x%08x / 0x%08x",route->file_name, route->file_line_number, name, ipaddr, route->match_ipv4_addr, route->match_ipv4_mask);
-      } else {
-        trace("%s line %i: host %s(%s) DOES NOT match network 0x%08x / 0x%08x",route->file_name, route->file_line_number, name, ipaddr, route->match_ipv4_addr, route->match_ipv4_mask);
-      }
+  }
+  if (this_route_applies && route->match_regex) {
+    this_route_applies=0;
+    if (name   && host_pattern_match(route->match_regex, name))    { this_route_applies = 1; }
+    if (ipaddr && host_pattern_match(route->match_regex, ipaddr))  { this_route_applies = 1; }
+    if (this_route_applies) {
+      debug("%s line %i: host %s(%s) matches regex %s",route->file_name, route->file_line_number, name, ipaddr, route->match_regex->source);
+    } else {
+      trace("%s line %i: host %s(%s) DOES NOT match regex %s",route->file_name, route->file_line_number, name, ipaddr, route->match_regex->source);
     }
-    // 'map' is effectively identical to 'network'. But I'm not sure it always will be, so I made it a seprate command
-    if (this_route_applies && route->have_map_ipv4) {
+  }
+  if (this_route_applies && route->match_port != 0) {
+    if (route->match_port != port) {
       this_route_applies=0;
-      if (ipaddr && family == AF_INET) {
-        unsigned long dst_net  = ipv4_addr & route->map_ipv4_mask;
-        unsigned long rule_net = route->map_ipv4_addr & route->map_ipv4_mask;
-        if (dst_net == rule_net) { this_route_applies = 1; }
-      } 
-      if (this_route_applies) {
-        debug("%s line %i: host %s(%s) matches map 0x%08x / 0x%08x",route->file_name, route->file_line_number, name, ipaddr, route->map_ipv4_addr, route->map_ipv4_mask);
-      } else {
-        trace("%s line %i: host %s(%s) DOES NOT match map 0x%08x / 0x%08x",route->file_name, route->file_line_number, name, ipaddr, route->map_ipv4_addr, route->map_ipv4_mask);
-      }
     }
+    if (this_route_applies) {
+      debug("%s line %i: port %i matches %i",route->file_name, route->file_line_number, port, route->match_port);
+    } else {
+      trace("%s line %i: port %i DOES NOT match %i",route->file_name, route->file_line_number, port, route->match_port);
+    }
+  }
+  if (this_route_applies && route->have_match_ipv4) {
+    this_route_applies=0;
+    if (ipaddr && family == AF_INET) {
+      unsigned long dst_net  = ipv4_addr & route->match_ipv4_mask;
+      unsigned long rule_net = route->match_ipv4_addr & route->match_ipv4_mask;
+      if (dst_net == rule_net) { this_route_applies = 1; }
+    } 
+    if (this_route_applies) {
+      debug("%s line %i: host %s(%s) matches network 0x%08x / 0x%08x",route->file_name, route->file_line_number, name, ipaddr, route->match_ipv4_addr, route->match_ipv4_mask);
+    } else {
+      trace("%s line %i: host %s(%s) DOES NOT match network 0x%08x / 0x%08x",route->file_name, route->file_line_number, name, ipaddr, route->match_ipv4_addr, route->match_ipv4_mask);
+    }
+  }
+  // 'map' is effectively identical to 'network'. But I'm not sure it always will be, so I made it a seprate command
+  if (this_route_applies && route->have_map_ipv4) {
+    this_route_applies=0;
+    if (ipaddr && family == AF_INET) {
+      unsigned long dst_net  = ipv4_addr & route->map_ipv4_mask;
+      unsigned long rule_net = route->map_ipv4_addr & route->map_ipv4_mask;
+      if (dst_net == rule_net) { this_route_applies = 1; }
+    } 
+    if (this_route_applies) {
+      debug("%s line %i: host %s(%s) matches map 0x%08x / 0x%08x",route->file_name, route->file_line_number, name, ipaddr, route->map_ipv4_addr, route->map_ipv4_mask);
+    } else {
+      trace("%s line %i: host %s(%s) DOES NOT match map 0x%08x / 0x%08x",route->file_name, route->file_line_number, name, ipaddr, route->map_ipv4_addr, route->map_ipv4_mask);
+    }
+  }
    
-    ////////////////
-    // PERMUTATIONS
-
-    if (this_route_applies && route->have_to_ipv4) { 
-      if (ipaddr && family == AF_INET) {
-        unsigned long orig_ipv4_addr = ipv4_addr; 
-        unsigned long mask     = route->to_ipv4_mask;
-        unsigned long mask_neg = 0x0ffffffff ^ mask;
-        unsigned long new_ipv4_addr = (ipv4_addr & mask_neg) | (route->to_ipv4_addr & mask);
-    
-        struct sockaddr_in sin;
-        sin.sin_len = sizeof(struct sockaddr_in);
-        sin.sin_family = AF_INET;
-        sin.sin_port=htons(host_id_get_port(dst));
-        sin.sin_addr.s_addr=htonl(new_ipv4_addr);
-
-        lock_client_connection(con);
-        host_id_set_addr_in(dst,&sin);
-        host_id_set_name(dst,""); 
-        con->socks_address_type=SOCKS5_ADDRTYPE_IPV4;
-        unlock_client_connection(con);
-
-        name = rre_get_host_id_name(dst, name_mem, sizeof(name_mem));
-        ipaddr = rre_get_host_id_addr(dst,ipaddr_mem, sizeof(ipaddr_mem), &family, &ipv4_addr);
-        debug("%s line %i: ip4 address transformed from %08x to %08x",route->file_name, route->file_line_number, orig_ipv4_addr, new_ipv4_addr);
-      }
+  ////////////////
+  // PERMUTATIONS
+
+  if (this_route_applies && route->have_to_ipv4) { 
+    if (ipaddr && family == AF_INET) {
+      unsigned long orig_ipv4_addr = ipv4_addr; 
+      unsigned long mask     = route->to_ipv4_mask;
+      unsigned long mask_neg = 0x0ffffffff ^ mask;
+      unsigned long new_ipv4_addr = (ipv4_addr & mask_neg) | (route->to_ipv4_addr & mask);
+  
+      struct sockaddr_in sin;
+      sin.sin_len = sizeof(struct sockaddr_in);
+      sin.sin_family = AF_INET;
+      sin.sin_port=htons(host_id_get_port(dst));
+      sin.sin_addr.s_addr=htonl(new_ipv4_addr);
+
+      lock_client_connection(con);
+      host_id_set_addr_in(dst,&sin);
+      host_id_set_name(dst,""); 
+      con->socks_address_type=SOCKS5_ADDRTYPE_IPV4;
+      unlock_client_connection(con);
+
+      rre_dst_refresh(d);
+      name = d->name;
+      ipaddr = d->ipaddr;
+      *dst_changed = 1;
+      debug("%s line %i: ip4 address transformed from %08x to %08x",route->file_name, route->file_line_number, orig_ipv4_addr, new_ipv4_addr);
+    }
+  }
+
+  if (this_route_applies && route->resolve_dns) {
+    char buf[300];
+    if (host_id_has_name(dst)) {
+      host_id tmp_id = *dst;
+      debug("%s line %i: Executing DNS lookup for hostname %s ip %s",route->file_name, route->file_line_number, name, host_id_addr_str(dst, buf, sizeof(buf)));
+      resolve_dns_for_host_id(&tmp_id);
+
+      lock_client_connection(con);
+      *dst=tmp_id;
+      unlock_client_connection(con);
+
+      rre_dst_refresh(d);
+      name = d->name;
+      ipaddr = d->ipaddr;
+      *dst_changed = 1;
+      decision->resolved_dns = 1;
+    } else {
+      debug("%s line %i: destination %s has no hostname associated with it, nothing to resovle via DNS.",route->file_name, route->file_line_number, host_id_addr_str(dst, buf, sizeof(buf)));
     }
+  }
 
-    if (this_route_applies && route->resolve_dns) {
-      char buf[300];
-      if (host_id_has_name(dst)) {
-        host_id tmp_id = *dst;
-        debug("%s line %i: Executing DNS lookup for hostname %s ip %s",route->file_name, route->file_line_number, name, host_id_addr_str(dst, buf, sizeof(buf)));
-        resolve_dns_for_host_id(&tmp_id);
+  if (this_route_applies && route->idle_timeout >= 0) {
+    debug("%s line %i: idle timeout %i seconds",route->file_name, route->file_line_number, route->idle_timeout);
+    decision->idle_timeout = route->idle_timeout;
+  }
+  if (this_route_applies && route->connect_timeout >= 0) {
+    debug("%s line %i: connect timeout %i seconds",route->file_name, route->file_line_number, route->connect_timeout);
+    decision->connect_timeout = route->connect_timeout;
+  }
+  for (int i=0; i<2; i++) {
+    if (this_route_applies && route->rate_limit && token_bucket_enabled(&route->rate_limit[i])) {
+      char tb_buf[100];
+      debug("%s line %i: rate limit %s %s",route->file_name, route->file_line_number, i == 0 ? "up" : "down", token_bucket_str(&route->rate_limit[i], tb_buf, sizeof(tb_buf)));
+      decision->rate_limit[i] = &route->rate_limit[i];
+    }
+  }
 
-        lock_client_connection(con);
-        *dst=tmp_id;
-        unlock_client_connection(con);
+  ////////////////
+  // END-STATE
 
-        name = rre_get_host_id_name(dst, name_mem, sizeof(name_mem));
-        ipaddr = rre_get_host_id_addr(dst,ipaddr_mem, sizeof(ipaddr_mem), &family, &ipv4_addr);
-      } else {
-        debug("%s line %i: destination %s has no hostname associated with it, nothing to resovle via DNS.",route->file_name, route->file_line_number, host_id_addr_str(dst, buf, sizeof(buf)));
+  if (this_route_applies && route->tunnel[0] != NULL) {
+    char tunnel_descr[200]; 
+    // so ugly
+    if (route->tunnel[1] != NULL && route->tunnel[2] != NULL) {
+      snprintf(tunnel_descr,sizeof(tunnel_descr)-1,"%s, %s, ...",route->tunnel[0]->name, route->tunnel[1]->name);
+    } else if (route->tunnel[1] != NULL) {
+      snprintf(tunnel_descr,sizeof(tunnel_descr)-1,"%s, %s",route->tunnel[0]->name, route->tunnel[1]->name);
+    } else {
+      strncpy(tunnel_descr,route->tunnel[0]->name,sizeof(tunnel_descr)-1);
+    } 
+    tunnel_descr[sizeof(tunnel_descr)-1]=0;
+    debug("%s line %i: route %s(%s) via %s",route->file_name, route->file_line_number, name, ipaddr, tunnel_descr);
+    final_route = 1;
+  }
+ 
+  return this_route_applies && final_route;
+}
+
+// Run the rules for the connection's destination, rewriting it as they say.
+void rre_decide(proxy_instance *proxy, client_connection *con, route_decision *decision) {
+  rre_dst d;
+  d.dst = &con->dst_host;
+  rre_dst_refresh(&d);
+
+  decision->route = NULL;
+  decision->idle_timeout = -1;
+  decision->connect_timeout = -1;
+  decision->rate_limit[0] = decision->rate_limit[1] = NULL;
+  decision->resolved_dns = 0;
+
+  route_rule *applicable_route=NULL;
+  if (proxy->route_index) {
+    route_index_cursor cur;
+    route_rule *route;
+    route_index_lookup(proxy->route_index, &cur, 0, d.name, d.ipaddr, d.ipaddr && d.family == AF_INET, d.ipv4_addr);
+    while (!applicable_route && (route = route_index_next(&cur))) {
+      int dst_changed = 0;
+      if (rre_apply_rule(route, con, &d, decision, &dst_changed)) {
+        applicable_route = route;
+      } else if (dst_changed) {
+        // later rules match against the new destination
+        route_index_lookup(proxy->route_index, &cur, cur.pos+1, d.name, d.ipaddr, d.ipaddr && d.family == AF_INET, d.ipv4_addr);
+      }
+    }
+  } else {
+    for (route_rule *route = proxy->route_rule_list; route && !applicable_route; route=route->next) {
+      int dst_changed = 0;
+      if (rre_apply_rule(route, con, &d, decision, &dst_changed)) {
+        applicable_route = route;
       }
     }
+  }
+  if (!applicable_route) {
+    debug("No matching route_rule found for %s (%s) port %i. Using default.", d.name, d.ipaddr, d.port);
+  }
 
-    ////////////////
-    // END-STATE
+  decision->route = applicable_route;
+  lock_client_connection(con);
+  decision->dst = con->dst_host;
+  decision->socks_address_type = con->socks_address_type;
+  unlock_client_connection(con);
+}
 
-    if (this_route_applies && route->tunnel[0] != NULL) {
-      char tunnel_descr[200]; 
-      // so ugly
-      if (route->tunnel[1] != NULL && route->tunnel[2] != NULL) {
-        snprintf(tunnel_descr,sizeof(tunnel_descr)-1,"%s, %s, ...",route->tunnel[0]->name, route->tunnel[1]->name);
-      } else if (route->tunnel[1] != NULL) {
-        snprintf(tunnel_descr,sizeof(tunnel_descr)-1,"%s, %s",route->tunnel[0]->name, route->tunnel[1]->name);
-      } else {
-        strncpy(tunnel_descr,route->tunnel[0]->name,sizeof(tunnel_descr)-1);
-      } 
-      tunnel_descr[sizeof(tunnel_descr)-1]=0;
-      debug("%s line %i: route %s(%s) via %s",route->file_name, route->file_line_number, name, ipaddr, tunnel_descr);
-      final_route = 1;
+int decide_applicable_rule(proxy_instance *proxy, service *srv, client_connection *con) {
+  route_decision decision;
+  char key[ROUTE_CACHE_MAX_KEY];
+  int cached = 0;
+  if (proxy->route_cache) {
+    route_cache_key(&con->dst_host, key, sizeof(key));
+    cached = route_cache_lookup(proxy->route_cache, key, &decision, time(NULL));
+  }
+  if (cached) {
+    char buf[300];
+    debug("route cache: %s goes to %s line %i", key, decision.route ? decision.route->file_name : "default", decision.route ? decision.route->file_line_number : 0);
+    lock_client_connection(con);
+    con->dst_host = decision.dst;
+    con->socks_address_type = decision.socks_address_type;
+    unlock_client_connection(con);
+    trace("route cache: destination now %s", host_id_str(&con->dst_host, buf, sizeof(buf)));
+  } else {
+    rre_decide(proxy, con, &decision);
+    if (proxy->route_cache) {
+      route_cache_store(proxy->route_cache, key, &decision, time(NULL));
     }
- 
-    if (this_route_applies && final_route) {
-      applicable_route=route;
+  }
+
+  if (decision.idle_timeout >= 0) {
+    atomic_store(&con->idle_timeout, decision.idle_timeout);
+  }
+  if (decision.connect_timeout >= 0) {
+    con->connect_timeout = decision.connect_timeout;
+  }
+  for (int i=0; i<2; i++) {
+    if (decision.rate_limit[i]) {
+      con->route_rate_limit[i] = decision.rate_limit[i];
     }
   }
 
+  route_rule *applicable_route = decision.route;
   if (!default_direct) {
     default_direct=new_route_rule();
-    strcpy(default_direct->file_name,"default_direct");
-    default_direct->tunnel[0]=ssh_tunnel_direct;
-    default_direct->tunnel[1]=NULL;
+    default_direct->file_name="default_direct";
+    default_direct_tunnel[0]=ssh_tunnel_direct;
+    default_direct->tunnel=default_direct_tunnel;
   }
 
   int returnval = 1;
   if (!applicable_route) {
-    debug("No matching route_rule found for %s (%s) port %i. Using default.", name, ipaddr, port);
     returnval = 0;
     applicable_route = default_direct;
   }
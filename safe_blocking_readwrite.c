@@ -12,6 +12,19 @@
 #include"thread_local.h"
 #include"proxy_instance.h"
 
+// returns 1 if byte_dump() would produce output for the current thread, 0 otherwise
+int byte_dump_enabled() {
+  log_config *conf = thread_local_get_log_config();
+  if (conf != NULL && conf->level != LOG_LEVEL_TRACE2) {
+    return 0;
+  }
+  proxy_instance *proxy = thread_local_get_proxy_instance();
+  if (proxy != NULL && proxy->log.level != LOG_LEVEL_TRACE2) {
+    return 0;
+  }
+  return 1;
+}
+
 void byte_dump(int fd, char *prefix, unsigned char *buf, size_t buflen) {
   char line[1000], *ptr;
   char tmp[100];
@@ -20,12 +33,7 @@ void byte_dump(int fd, char *prefix, unsigned char *buf, size_t buflen) {
   // This routine is a little bit heavyweight; if the output
   // is going to be ignored anyways, then don't generate
   // the output.
-  log_config *conf = thread_local_get_log_config();
-  if (conf != NULL && conf->level != LOG_LEVEL_TRACE2) {
-    return;
-  }
-  proxy_instance *proxy = thread_local_get_proxy_instance();
-  if (proxy != NULL && proxy->log.level != LOG_LEVEL_TRACE2) {
+  if (!byte_dump_enabled()) {
     return;
   }
 
@@ -6,6 +6,8 @@
 
 #include<unistd.h>
 
+int byte_dump_enabled();
+void byte_dump(int fd, char *prefix, unsigned char *buf, size_t buflen);
 int sb_read(int fd, unsigned char *buf, size_t buflen);
 int sb_read_len(int fd, unsigned char *buf, size_t buflen);
 int sb_write_len(int fd, unsigned char *buf, size_t buflen);
@@ -24,6 +24,10 @@
 #include"thread_msg.h"
 #include"server.h"
 #include"main_config.h"
+#include"event_loop.h"
+#include"thread_pool.h"
+#include"traffic_counter.h"
+#include"tcp_keepalive.h"
 
 int exit_server=0;
 
@@ -152,6 +156,26 @@ client_connection *cleanup_connections(client_connection *pool) {
   return pool;
 }
 
+// Ask relays that have been quiet for longer than their idle timeout to close.
+// Relays wake up at least every SHUTTLE_IDLE_CHECK_MS to look at thread_should_exit.
+void reap_idle_connections(client_connection *pool) {
+  time_t now = time(NULL);
+  for (client_connection *con = pool; con; con = con->next) {
+    int idle_timeout = atomic_load(&con->idle_timeout);
+    time_t last_activity = atomic_load_explicit(&con->last_activity, memory_order_relaxed);
+    if (idle_timeout <= 0 || last_activity == 0 || con->thread_has_exited || atomic_load(&con->thread_should_exit)) {
+      continue;
+    }
+    if (now - last_activity >= idle_timeout) {
+      char buf[200];
+      debug("Idle for %li seconds; closing connection %s", (long)(now - last_activity), client_connection_str(con,buf,sizeof(buf)));
+      snprintf(buf,sizeof(buf),"No traffic for %i seconds.",idle_timeout);
+      set_client_connection_status(con,CCSTATUS_IDLE_TIMEOUT,"Idle Timeout",buf);
+      atomic_store(&con->thread_should_exit, 1);
+    }
+  }
+}
+
 void read_from_child(char *label, ssh_tunnel *ssh, int fd) {
   int rc; 
   char tmpbuf[2000]; 
@@ -243,6 +267,15 @@ int server(log_file* log_file_list, proxy_instance* proxy_instance_list, ssh_tun
   thread_local_set_proxy_instance(NULL);
   thread_local_set_log_config(&main_conf->log);
 
+  if (!thread_pool_start(main_conf->thread_pool_size, main_conf->thread_pool_overflow)) {
+    unexpected_exit(97,"thread_pool_start()");
+  }
+  if (main_conf->engine == ENGINE_EVENT_LOOP) {
+    if (!event_loop_start(main_conf->event_loop_threads)) {
+      unexpected_exit(96,"event_loop_start()");
+    }
+  }
+
   time_t proxy_start_time = time(NULL);
 
 
@@ -281,6 +314,9 @@ int server(log_file* log_file_list, proxy_instance* proxy_instance_list, ssh_tun
     // this is arbitrary... no magic here. 
     // just wake up periodically and reap dead threads.
     timeout = 1200;
+    if (ssh_tunnels_starting(ssh_tunnel_list)) {
+      timeout = SSH_TUNNEL_PROBE_INTERVAL_MS; // check_ssh_tunnels() probes starting tunnels each time round
+    }
 
     //trace("poll()...");
     do {
@@ -363,10 +399,16 @@ int server(log_file* log_file_list, proxy_instance* proxy_instance_list, ssh_tun
           client_connection *con = accept_connection(srv);
           if (con != NULL) {
             proxy->client_connection_list = insert_client_connection(proxy->client_connection_list, con);
+            traffic_counter_add_connection(&proxy->traffic);
+            atomic_store(&con->idle_timeout, proxy->idle_timeout);
+            con->connect_timeout = proxy->connect_timeout;
+            tcp_keepalive_set(con->fd_in, proxy->tcp_keepalive, proxy->tcp_user_timeout);
             thread_local_set_client_connection(con);
             char tmpbuf[2000]; 
             debug("New connection from %s",client_connection_str(con,tmpbuf,sizeof(tmpbuf)));
-            launch_thread(proxy, srv, con);
+            if (thread_pool_submit(proxy, srv, con) == THREAD_POOL_OVERFLOW) {
+              launch_thread(proxy, srv, con);
+            }
             thread_local_set_client_connection(NULL);
           }
         }
@@ -381,6 +423,7 @@ int server(log_file* log_file_list, proxy_instance* proxy_instance_list, ssh_tun
     for (proxy_instance *proxy=proxy_instance_list; proxy; proxy = proxy -> next) {
       thread_local_set_proxy_instance(proxy);
       proxy->client_connection_list = cleanup_connections(proxy->client_connection_list);
+      reap_idle_connections(proxy->client_connection_list);
     }
     thread_local_set_proxy_instance(NULL);
     thread_local_set_log_config(&main_conf->log);
@@ -17,6 +17,10 @@
 #include"thread_msg.h"
 #include"string2.h"
 #include"service_thread.h"
+#include"buffer_pool.h"
+
+// files are sent in chunks of this size, using a buffer from the buffer pool
+#define HTTP_FILE_BUFFER_SIZE 16384
 
 char *service_http_str(service_http *http, char *buf, int buflen) {
   char local_buf[4096];
@@ -166,9 +170,9 @@ char *return_file_contents(proxy_instance *proxy, service_http *http, client_con
       responseStr="200 OK";
       if (ok) ok=basic_response(con, responseStr, content_type);
       int rc; 
-      unsigned char buf[1000];
+      unsigned char *buf = buffer_pool_get(HTTP_FILE_BUFFER_SIZE);
       do {
-        rc=read(file_fd,buf,sizeof(buf)-1);
+        rc=read(file_fd,buf,HTTP_FILE_BUFFER_SIZE);
         if (rc>0) {
           if (sb_write_len(con->fd_in,buf,rc) != rc) {
             ok=0;
@@ -179,6 +183,7 @@ char *return_file_contents(proxy_instance *proxy, service_http *http, client_con
           errorNum("read()");
         }
       } while (ok && (rc > 0 || errno == EINTR));
+      buffer_pool_put(buf);
     } else {
       responseStr="404 Not Found";
       if (ok) ok=basic_response(con, responseStr, NULL);
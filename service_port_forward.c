@@ -57,6 +57,9 @@ void *service_port_forward_connection_handler(void *data) {
   if (ok) {
     ok=socks_connect(proxy, (service*)fwd, con, &failure_type);
   }
+  if (ok && socks_connect_handoff(con)) {
+    return NULL; // the event loop or null sink moves the data and shuts the connection down
+  }
   if (ok) {
     ok = socks_connect_shuttle(con);
   }
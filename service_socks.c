@@ -3,6 +3,7 @@
 
 #include<stdio.h>
 #include<errno.h>
+#include<string.h>
 #include<strings.h>
 #include<stdlib.h>
 
@@ -21,43 +22,30 @@
 #include"socks_connection.h"
 #include"route_rule.h"
 #include"route_rules_engine.h"
+#include"buffer_pool.h"
+#include"socks_request.h"
+#include"traffic_counter.h"
 
 //////////////////////////////////////////////////////////
 
-int socks_get_client_version(client_connection *con) {
-  unsigned char buf[10];
-  int rc;
-
-  rc=sb_read_len(con->fd_in,buf,1); if (rc != 1) return SOCKS_VERSION_ERROR;
-
-  int socks_version = buf[0];
-  trace("Client request SOCKS v 0x%02x",socks_version);
-  if (socks_version != 0x04 && socks_version != 0x05) { 
-    trace("request version not 4/5; closing connection.");
-    buf[0]=0x05; 
-    buf[1]=SOCKS5_AUTH_NO_ACCEPTABLE_METHODS; // no acceptable auth methods. Go away.
-    sb_write_len(con->fd_in,buf,2);
-    return SOCKS_VERSION_ERROR;
-  }
-  return socks_version;
+// Tell a client speaking neither SOCKS4 nor SOCKS5 to go away.
+void socks_refuse_version(client_connection *con, unsigned char version) {
+  unsigned char buf[2];
+  trace("Client request SOCKS v 0x%02x",version);
+  trace("request version not 4/5; closing connection.");
+  buf[0]=0x05; 
+  buf[1]=SOCKS5_AUTH_NO_ACCEPTABLE_METHODS; // no acceptable auth methods. Go away.
+  sb_write_len(con->fd_in,buf,2);
 }
 
-int socks5_negotiate_auth(client_connection *con) {
-  unsigned char buf[300];
+int socks5_negotiate_auth(client_connection *con, unsigned char *greeting, socks_request *req) {
+  unsigned char buf[2];
   int rc;
 
-  // auth methods
-  unsigned int count;
-  rc=sb_read_len(con->fd_in,buf,1); if (rc != 1) return SOCKS_AUTH_ERROR;
-  count = buf[0];
-  count &= 0x0FF;
-  trace("Client provided 0x%02x available auth methods ",buf[0],count);
-
-  // methods
-  rc=sb_read_len(con->fd_in,buf,count); if (rc != count) return SOCKS_AUTH_ERROR;
-  // read all the methods. We don't care about them. 
-  for (int i=0;i<count;i++) {
-    trace("  0x%02x",buf[i]);
+  trace("Client provided 0x%02x available auth methods ",req->method_count);
+  // We don't care about them. 
+  for (int i=0;i<req->method_count;i++) {
+    trace("  0x%02x",greeting[2+i]);
   }
 
   // send auth method to use
@@ -69,112 +57,91 @@ int socks5_negotiate_auth(client_connection *con) {
 
 }
 
-//////////////////////////////////////////////////////////
-
-int socks4_get_command(client_connection *con) {
-  unsigned char buf[300];
-  int rc;
-
-  // command
-  rc=sb_read_len(con->fd_in,buf,1); if (rc != 1) return SOCKS5_CMD_ERROR;
-  unsigned char command=buf[0];
-  if (command != SOCKS4_CMD_CONNECT) return SOCKS5_CMD_ERROR;
-
-  // destination port
-  rc=sb_read_len(con->fd_in,buf,2); if (rc != 2) return SOCKS5_CMD_ERROR;
-  int port = ((unsigned int)buf[0]) << 8 | (unsigned int)buf[1];
-  trace("  port %i", port);
-
-  // destination IPv4 address
-  unsigned char ipv4[4];
-  rc=sb_read_len(con->fd_in,ipv4,4); if (rc != 4) return SOCKS5_CMD_ERROR;
-  trace("  address IPv4: %02x %02x %02x %02x", 
-    ipv4[0],
-    ipv4[1],
-    ipv4[2],
-    ipv4[3]
-   );
-
-  lock_client_connection(con); 
-  con->socks_version               = 4;
-  con->socks_command               = command; 
-  con->socks_command_original      = command;      // save original unmolested by processing or routing
-  con->socks_address_type          = SOCKS5_ADDRTYPE_IPV4;
-  con->socks_address_type_original = SOCKS5_ADDRTYPE_IPV4; // save original unmolested by processing or routing
-  host_id_set_addr_in_from_byte_array(&con->dst_host,ipv4,port);
-  con->dst_host_original=con->dst_host; // save original unmolested by processing or routing
-  unlock_client_connection(con); 
- 
-  // userid
-  int max=1000;
-  do {
-    rc=sb_read_len(con->fd_in,buf,1); if (rc != 1) return SOCKS5_CMD_ERROR;
-  } while (buf[0] != 0 && --max > 0);
-  if (max <= 0)  return SOCKS5_CMD_ERROR;
-
-  return SOCKS4_CMD_CONNECT;
+// Read from the client until its request is complete, answering a SOCKS5
+// greeting along the way. Each read takes whatever the client has sent, so
+// the request and anything after it can arrive together.
+// returns the number of bytes in buf (greeting, request and anything after them), 0 on error
+int socks_read_request(client_connection *con, unsigned char *buf, int buflen, socks_request *req) {
+  int have=0;
+  int greeted=0;
+  for (;;) {
+    int state = socks_request_parse(buf, have, req);
+    if (state == SOCKS_REQUEST_ERROR) {
+      if (req->version == SOCKS_VERSION_ERROR) {
+        socks_refuse_version(con, buf[0]);
+      } else {
+        debug("Malformed SOCKS%i request. Closing connection.",req->version);
+      }
+      return 0;
+    }
+    if (state >= SOCKS_REQUEST_GREETING && req->version == 5 && !greeted) {
+      int auth_type = socks5_negotiate_auth(con, buf, req);
+      if (auth_type == SOCKS5_AUTH_NONE_REQUIRED) {
+        trace("Auth: None");
+      } else if (auth_type == SOCKS5_AUTH_USERNAME_PASSWORD) {
+        // see https://tools.ietf.org/html/rfc1929
+        debug("Auth: username / password not supported. Closing connection.");
+        return 0;
+      } else if (auth_type == SOCKS5_AUTH_GSSAPI) {
+        debug("Auth: GSSAPI not supported. Closing connection.");
+        return 0;
+      } else {
+        debug("Auth: unknown or error. Closing connection.");
+        return 0;
+      }
+      greeted=1;
+    }
+    if (state == SOCKS_REQUEST_DONE) {
+      return have;
+    }
+    if (have >= buflen) {
+      debug("SOCKS request longer than %i bytes. Closing connection.",buflen);
+      return 0;
+    }
+    int rc=sb_read(con->fd_in, buf+have, buflen-have);
+    if (rc <= 0) {
+      return 0;
+    }
+    have += rc;
+  }
 }
 
 //////////////////////////////////////////////////////////
 
-int socks5_get_command(client_connection *con) {
-  unsigned char buf[300];
-  int rc;
-
-  // version and command
-  rc=sb_read_len(con->fd_in,buf,4); if (rc != 4) return SOCKS5_CMD_ERROR; 
-  unsigned char version=buf[0];
-  unsigned char command=buf[1];
-  unsigned char rsv=buf[2];
-  unsigned char address_type=buf[3];
-  trace("Client request version 0x%02x, command 0x%02x, address type 0x%02x",version, command, address_type);
-  if (version != 0x05) return SOCKS5_CMD_ERROR;
-  if (rsv != 0x00) return SOCKS5_CMD_ERROR;
-
-
-  unsigned char addr[4096];
-  if (address_type == SOCKS5_ADDRTYPE_IPV4) { // IPv4
-    rc=sb_read_len(con->fd_in,addr,4); if (rc != 4) return SOCKS5_CMD_ERROR;
+// Record the client's request on the connection.
+// returns the command, or SOCKS5_CMD_ERROR if it isn't one we handle
+int socks_apply_request(client_connection *con, socks_request *req) {
+  unsigned char *addr = req->addr;
+  trace("Client request version 0x%02x, command 0x%02x, address type 0x%02x",req->version, req->command, req->address_type);
+  if (req->version == 4 && req->command != SOCKS4_CMD_CONNECT) {
+    return SOCKS5_CMD_ERROR;
+  }
+  if (req->address_type == SOCKS5_ADDRTYPE_IPV4) {
     trace("  address IPv4: %02x %02x %02x %02x", 
       addr[0],
       addr[1],
       addr[2],
       addr[3]
       );
-  } else if (address_type == SOCKS5_ADDRTYPE_IPV6) { // IPv6
-    rc=sb_read_len(con->fd_in,addr,16); if (rc != 16) return SOCKS5_CMD_ERROR;
+  } else if (req->address_type == SOCKS5_ADDRTYPE_IPV6) {
     trace("  address IPv6");
-    return SOCKS5_CMD_ERROR; // we don't support IPv6
-  } else if (address_type == SOCKS5_ADDRTYPE_DOMAIN) { // DNS
-    // length
-    rc=sb_read_len(con->fd_in,buf,1); if (rc != 1) return SOCKS5_CMD_ERROR;
-    unsigned int length = (unsigned int)buf[0] & 0x0FF;
-    // data
-    rc=sb_read_len(con->fd_in,addr,length); if (rc != length) return SOCKS5_CMD_ERROR;
-    addr[length]=0; // add null terminator
+  } else {
     trace("  address DNS: %s",addr);
-  } else { 
-    return SOCKS5_CMD_ERROR; 
   }
-  
-  // destination port
-  rc=sb_read_len(con->fd_in,buf,2); if (rc != 2) return SOCKS5_CMD_ERROR;
-  int port = ((unsigned int)buf[0]) << 8 | (unsigned int)buf[1];
-  trace("  port %i", port);
+  trace("  port %i", req->port);
 
   lock_client_connection(con);
-  con->socks_version               = version;
-  con->socks_command               = command; 
-  con->socks_command_original      = command;      // save original unmolested by processing or routing
-  con->socks_address_type          = address_type;
-  con->socks_address_type_original = address_type; // save original unmolested by processing or routing
-  if (address_type == SOCKS5_ADDRTYPE_IPV4) { 
-    host_id_set_addr_in_from_byte_array(&con->dst_host,addr,port);
-  } else if (address_type == SOCKS5_ADDRTYPE_IPV6) { // IPv6
-    host_id_set_addr_in6_from_byte_array(&con->dst_host,addr,port);
-  } else if (address_type == SOCKS5_ADDRTYPE_DOMAIN) { // DNS
+  con->socks_command               = req->command; 
+  con->socks_command_original      = req->command;      // save original unmolested by processing or routing
+  con->socks_address_type          = req->address_type;
+  con->socks_address_type_original = req->address_type; // save original unmolested by processing or routing
+  if (req->address_type == SOCKS5_ADDRTYPE_IPV4) { 
+    host_id_set_addr_in_from_byte_array(&con->dst_host,addr,req->port);
+  } else if (req->address_type == SOCKS5_ADDRTYPE_IPV6) { // IPv6
+    host_id_set_addr_in6_from_byte_array(&con->dst_host,addr,req->port);
+  } else if (req->address_type == SOCKS5_ADDRTYPE_DOMAIN) { // DNS
     host_id_set_name(&con->dst_host,(char*)addr);
-    host_id_set_port(&con->dst_host,port);
+    host_id_set_port(&con->dst_host,req->port);
   }
   con->dst_host_original = con->dst_host;
   unlock_client_connection(con);
@@ -187,7 +154,29 @@ int socks5_get_command(client_connection *con) {
     return SOCKS5_CMD_UDP_ASSOCIATE; 
   }
   return SOCKS5_CMD_ERROR;  
+}
 
+// Bytes the client sent right behind its request are its first data. Send
+// them on before the relay takes over; the relay only sees what's still on
+// the socket.
+// returns 1 on success, 0 on error
+int socks_forward_early_data(proxy_instance *proxy, client_connection *con, unsigned char *buf, int len) {
+  if (len <= 0) {
+    return 1;
+  }
+  trace("%i bytes from the client arrived with its request",len);
+  if (con->tunnel == ssh_tunnel_null) {
+    atomic_fetch_add_explicit(&con->bytes_rx, len, memory_order_relaxed);
+    traffic_counter_add_bytes(&proxy->traffic, TRAFFIC_RX, len);
+    return 1;
+  }
+  if (sb_write_len(con->fd_out, buf, len) != len) {
+    set_client_connection_status(con,errno,"Error",strerror(errno));
+    return 0;
+  }
+  atomic_fetch_add_explicit(&con->bytes_tx, len, memory_order_relaxed);
+  traffic_counter_add_bytes(&proxy->traffic, TRAFFIC_TX, len);
+  return 1;
 }
 
 int socks4_respond(client_connection *con, int failure_type) {
@@ -367,42 +356,24 @@ void *service_socks_connection_handler(void *data) {
 
   int ok=1;
 
+  // The read buffer comes from the buffer pool rather than the handler thread's stack.
+  unsigned char *buf = buffer_pool_get(SOCKS_REQUEST_BUFFER_SIZE);
+  int buf_len=0;
+  socks_request req;
+
   if (ok) {
-    int socks_version = socks_get_client_version(con);
+    buf_len = socks_read_request(con, buf, buffer_pool_size(buf), &req);
     lock_client_connection(con);
-    con->socks_version = socks_version;
+    con->socks_version = req.version;
     unlock_client_connection(con);
-    if (con->socks_version == SOCKS_VERSION_ERROR) {
-      ok=0;
-    }
-  }
-
-  if (ok && con->socks_version == 5) {
-    int auth_type;
-    auth_type = socks5_negotiate_auth(con);
-    if (auth_type == SOCKS5_AUTH_NONE_REQUIRED) {
-      trace("Auth: None");
-    } else if (auth_type == SOCKS5_AUTH_USERNAME_PASSWORD) {
-      // see https://tools.ietf.org/html/rfc1929
-      debug("Auth: username / password not supported. Closing connection.");
-      ok=0;
-    } else if (auth_type == SOCKS5_AUTH_GSSAPI) {
-      debug("Auth: GSSAPI not supported. Closing connection.");
-      ok=0;
-    } else {
-      debug("Auth: unknown or error. Closing connection.");
+    if (buf_len == 0) {
       ok=0;
     }
   }
 
   // we don't use command_type but, meh, maybe one day we will...
   if (ok) {
-    int command_type;
-    if (con->socks_version == 4) {
-      command_type=socks4_get_command(con);
-    } else {
-      command_type=socks5_get_command(con);
-    }
+    int command_type = socks_apply_request(con, &req);
     if (command_type == SOCKS5_CMD_ERROR) {
       ok=0;
     }
@@ -421,6 +392,13 @@ void *service_socks_connection_handler(void *data) {
       ok=0;
     }
   }
+  if (ok) {
+    ok = socks_forward_early_data(proxy, con, buf+req.len, buf_len-req.len);
+  }
+  buffer_pool_put(buf);
+  if (ok && socks_connect_handoff(con)) {
+    return NULL; // the event loop or null sink moves the data and shuts the connection down
+  }
   if (ok) {
     ok = socks_connect_shuttle(con);
   }
@@ -3,194 +3,646 @@
 
 #include<sys/types.h>
 #include<sys/uio.h>
+#include<sys/socket.h>
 #include<unistd.h>
+#include<fcntl.h>
 #include<poll.h>
 #include<errno.h>
 #include<string.h>
+#include<stdlib.h>
+#include<pthread.h>
+#include<stdint.h>
+#include<limits.h>
 
 #include"log.h"
 #include"client_connection.h"
+#include"proxy_instance.h"
+#include"thread_local.h"
 #include"safe_blocking_readwrite.h"
+#include"buffer_pool.h"
+#include"shuttle.h"
+#include"shuttle_uring.h"
 
-// returns 
-//    <0  error
-//    =0  end of transmission on fd_read
-//    >0  bytes read from fd_read and written to fd_write
-int shuttle(client_connection *con, int fd_read, int fd_write) {
-  unsigned char buf[10000];
-  int read_rc=sb_read(fd_read,buf,sizeof(buf));
-  if (read_rc == 0) { // end of transmission
-    trace("connection closed normally.");
-  } else if (read_rc < 0 && errno == ECONNRESET ) {
-    set_client_connection_status(con,errno,"Error",strerror(errno));
-    trace("connection reset.");
-  } else if (read_rc < 0) {
-    set_client_connection_status(con,errno,"Error",strerror(errno));
-    errorNum("read()");
-  } else if (fd_write <0) { // -1 if we cannot write
-    // merely drain the data
-  } else {
-    buf[read_rc]=0;
-    //trace(" (%i) >> %s",read_rc,buf);
-    int write_rc = sb_write_len(fd_write,buf,read_rc);
-    if (write_rc<0) {
-      errorNum("write()");
-    //} else {
-    //  trace("%i bytes written",write_rc);
+// The relay is full-duplex: both fds are non-blocking and each direction
+// has its own buffer, so a slow reader on one side never stalls data
+// flowing the other way. We only ask poll() for POLLOUT when a buffer
+// has data waiting, and only for POLLIN when a buffer has room.
+//
+// In copy mode a direction only holds a buffer while it has bytes in
+// flight, so an idle connection costs no relay memory.
+//
+// Rate limits work the same way: a direction whose buckets are empty
+// stops asking for POLLIN until throttle_until, and the kernel's socket
+// buffers push back on the sender in the meantime.
+
+#ifdef __linux__
+
+// Spare (empty) pipes are kept per thread and handed to the next relay
+// on that thread, so we don't pay for pipe2() on every connection.
+#define SHUTTLE_SPARE_PIPES 4
+
+typedef struct shuttle_pipe_cache {
+  int count;
+  int fd[SHUTTLE_SPARE_PIPES][2];
+} shuttle_pipe_cache;
+
+pthread_key_t shuttle_pipe_cache_key;
+pthread_once_t shuttle_pipe_cache_key_once = PTHREAD_ONCE_INIT;
+
+void shuttle_pipe_cache_destroy(void *ptr) {
+  shuttle_pipe_cache *cache = ptr;
+  for (int i=0; i<cache->count; i++) {
+    close(cache->fd[i][0]);
+    close(cache->fd[i][1]);
+  }
+  free(cache);
+}
+
+void shuttle_pipe_cache_key_init() {
+  int rc = pthread_key_create(&shuttle_pipe_cache_key, shuttle_pipe_cache_destroy);
+  if (rc != 0) {
+    unexpected_exit(51,"pthread_key_create() for splice pipe");
+  }
+}
+
+shuttle_pipe_cache *shuttle_pipe_cache_get() {
+  pthread_once(&shuttle_pipe_cache_key_once, shuttle_pipe_cache_key_init);
+  shuttle_pipe_cache *cache = pthread_getspecific(shuttle_pipe_cache_key);
+  if (cache == NULL) {
+    cache=malloc(sizeof(shuttle_pipe_cache));
+    if (cache == NULL) {
+      unexpected_exit(52,"Error allocating splice pipe");
     }
-    return write_rc;
+    cache->count=0;
+    pthread_setspecific(shuttle_pipe_cache_key, cache);
   }
-  return read_rc;
+  return cache;
 }
 
-// IMPROVEMENT: not all errors are reported to the WebUI via set_client_connection_status(). This could be improved. 
-// return 1 if exit cleanly, 0 on error
-int shuttle_data_back_and_forth(client_connection *con) {
-  struct pollfd pfd[3];
-  int pfd_max;
-  int pfd_idx;
-  int timeout;
-  int rc;
+// returns 1 on success, 0 if no pipe could be had
+int shuttle_pipe_open(shuttle_direction *dir) {
+  shuttle_pipe_cache *cache = shuttle_pipe_cache_get();
+  if (cache->count > 0) {
+    cache->count--;
+    dir->pipe_fd[0] = cache->fd[cache->count][0];
+    dir->pipe_fd[1] = cache->fd[cache->count][1];
+  } else if (pipe2(dir->pipe_fd, O_CLOEXEC | O_NONBLOCK) < 0) {
+    errorNum("pipe2() for splice; falling back to copy");
+    dir->pipe_fd[0]=dir->pipe_fd[1]=-1;
+    return 0;
+  }
+  fcntl(dir->pipe_fd[1], F_SETPIPE_SZ, SHUTTLE_PIPE_SIZE); // best effort
+  int capacity = fcntl(dir->pipe_fd[1], F_GETPIPE_SZ);
+  dir->pipe_capacity = capacity > 0 ? capacity : 4096;
+  if (dir->pipe_capacity > SHUTTLE_PIPE_SIZE) {
+    dir->pipe_capacity = SHUTTLE_PIPE_SIZE;
+  }
+  return 1;
+}
 
-  int in_can_write = 1;
-  int out_can_write = 1;
+void shuttle_pipe_close(shuttle_direction *dir) {
+  if (dir->pipe_fd[0] < 0) {
+    return;
+  }
+  shuttle_pipe_cache *cache = shuttle_pipe_cache_get();
+  // a pipe that still holds bytes belongs to this connection only; never recycle it
+  if (dir->len == 0 && cache->count < SHUTTLE_SPARE_PIPES) {
+    cache->fd[cache->count][0] = dir->pipe_fd[0];
+    cache->fd[cache->count][1] = dir->pipe_fd[1];
+    cache->count++;
+  } else {
+    close(dir->pipe_fd[0]);
+    close(dir->pipe_fd[1]);
+  }
+  dir->pipe_fd[0]=dir->pipe_fd[1]=-1;
+}
 
-  trace("shuttle started");
-  trace("FD = %i %i",con->fd_in, con->fd_out);
+#else // __linux__
 
-  // General Comment: This loop structure is rather stupid
-  // in that it blocks on read and write operations. IE:
-  // a blocking operation for data in one direction will
-  // also block data moving in the opposite direction. 
-  // But its easy to write this way, so, whatever...
-  int continue_loop = 1;
-  while (continue_loop) {
-
-    pfd[0].fd = con->fd_in;
-    pfd[0].events = POLLRDNORM;
-    pfd[0].revents = 0;
-
-    pfd[1].fd = con->fd_out;
-    pfd[1].events = POLLRDNORM;
-    pfd[1].revents = 0;
-   
-    pfd_max=2;
-    timeout = -1; // block indefinitely
-
-    trace2("poll()... %i %i ",con->fd_in, con->fd_out);
-    do {
-      rc = poll(pfd,pfd_max,timeout);
-    } while (rc < 0 && errno == EINTR);
-    trace2("... poll() returned %i",rc);
-    if (rc < 0) {
-      errorNum("poll()");
-      return 0;
-    }
-
-    for (int i=0;i<pfd_max;i++) {
-      short tmp = pfd[i].revents;
-      tmp |= POLLRDNORM;
-      tmp ^= POLLRDNORM;
-      if (tmp != 0) {
-        trace("poll() %i  fd %i revents = %s %s %s %s %s %s %s %s", i, pfd[i].fd,
-          pfd[i].revents & POLLERR ? "POLLERR" : "",
-          pfd[i].revents & POLLHUP ? "POLLHUP" : "",
-          pfd[i].revents & POLLNVAL ? "POLLNVAL" : "",
-          pfd[i].revents & POLLPRI ? "POLLPRI" : "",
-          pfd[i].revents & POLLRDBAND ? "POLLRDBAND" : "",
-          pfd[i].revents & POLLRDNORM ? "POLLRDNORM" : "",
-          pfd[i].revents & POLLWRBAND ? "POLLWRBAND" : "",
-          pfd[i].revents & POLLWRNORM ? "POLLWRNORM" : ""
-          );
+// splice() is Linux-specific.
+int shuttle_pipe_open(shuttle_direction *dir) {
+  return 0;
+}
+
+void shuttle_pipe_close(shuttle_direction *dir) {
+}
+
+#endif // __linux__
+
+void shuttle_direction_use_copy(shuttle_direction *dir) {
+  dir->use_splice=0;
+  dir->head=0;
+}
+
+void shuttle_buffer_acquire(shuttle_direction *dir) {
+  dir->buf = buffer_pool_get(dir->buf_size);
+  dir->buf_size = buffer_pool_size(dir->buf);
+  dir->head = 0;
+  dir->peak = 0;
+  dir->filled = 0;
+}
+
+// Hand the (empty) buffer back to the pool, keeping its size for next time.
+void shuttle_buffer_put(shuttle_direction *dir) {
+  buffer_pool_put(dir->buf);
+  dir->buf = NULL;
+  dir->head = 0;
+}
+
+// Only called once the buffer has been drained. Picks the size of the next one:
+// bigger if reads kept filling this one, smaller if it was mostly unused.
+void shuttle_buffer_release(shuttle_direction *dir) {
+  if (dir->filled && dir->buf_size < SHUTTLE_BUFFER_MAX) {
+    dir->buf_size *= SHUTTLE_BUFFER_GROWTH;
+    trace2("%s relay buffer grows to %zu",dir->name,dir->buf_size);
+  } else if (!dir->filled && dir->peak < dir->buf_size / SHUTTLE_BUFFER_GROWTH && dir->buf_size > SHUTTLE_BUFFER_MIN) {
+    dir->buf_size /= SHUTTLE_BUFFER_GROWTH;
+    trace2("%s relay buffer shrinks to %zu",dir->name,dir->buf_size);
+  }
+  if (dir->buf_size > SHUTTLE_BUFFER_MAX) {
+    dir->buf_size = SHUTTLE_BUFFER_MAX;
+  } else if (dir->buf_size < SHUTTLE_BUFFER_MIN) {
+    dir->buf_size = SHUTTLE_BUFFER_MIN;
+  }
+  shuttle_buffer_put(dir);
+}
+
+// The buckets that apply to one direction of a connection. 'bucket' must have room for SHUTTLE_RATE_LIMITS.
+// returns how many there are
+int shuttle_rate_limits(client_connection *con, int traffic_direction, token_bucket **bucket) {
+  int count = 0;
+  proxy_instance *proxy = thread_local_get_proxy_instance();
+  if (proxy && token_bucket_enabled(&proxy->rate_limit[traffic_direction])) {
+    bucket[count++] = &proxy->rate_limit[traffic_direction];
+  }
+  if (con->route_rate_limit[traffic_direction]) {
+    bucket[count++] = con->route_rate_limit[traffic_direction];
+  }
+  if (con->tunnel && token_bucket_enabled(&ssh_tunnel_owner(con->tunnel)->rate_limit[traffic_direction])) {
+    bucket[count++] = &ssh_tunnel_owner(con->tunnel)->rate_limit[traffic_direction];
+  }
+  return count;
+}
+
+int shuttle_rate_limited(client_connection *con) {
+  token_bucket *bucket[SHUTTLE_RATE_LIMITS];
+  return shuttle_rate_limits(con, TRAFFIC_TX, bucket) + shuttle_rate_limits(con, TRAFFIC_RX, bucket) > 0;
+}
+
+int shuttle_direction_init(shuttle_direction *dir, char *name, int fd_read, int fd_write, atomic_ullong *byte_count, int traffic_direction, int relay_mode) {
+  dir->name = name;
+  dir->fd_read = fd_read;
+  dir->fd_write = fd_write;
+  dir->byte_count = byte_count;
+  dir->traffic_direction = traffic_direction;
+  dir->buf = NULL;
+  dir->buf_size = SHUTTLE_BUFFER_MIN;
+  dir->head = dir->len = dir->peak = 0;
+  dir->filled = 0;
+  dir->use_splice = 0;
+  dir->pipe_fd[0] = dir->pipe_fd[1] = -1;
+  dir->pipe_capacity = 0;
+  dir->pipe_full = 0;
+  dir->rate_limit_count = 0;
+  dir->throttle_until = 0;
+  dir->read_eof = 0;
+  dir->write_shutdown = 0;
+
+  // byte dumps need the data in user space, so trace2 forces the copy path
+  if (relay_mode == RELAY_MODE_SPLICE && !byte_dump_enabled() && shuttle_pipe_open(dir)) {
+    dir->use_splice=1;
+    return 1;
+  }
+  shuttle_direction_use_copy(dir);
+  return 1;
+}
+
+void shuttle_direction_free(shuttle_direction *dir) {
+  shuttle_pipe_close(dir);
+  buffer_pool_put(dir->buf);
+  dir->buf=NULL;
+}
+
+int shuttle_set_nonblocking(int fd) {
+  int flags = fcntl(fd, F_GETFL);
+  if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+    errorNum("fcntl(O_NONBLOCK) on fd %i",fd);
+    return 0;
+  }
+  return 1;
+}
+
+// return 1 on success, 0 on error
+int shuttle_relay_init(shuttle_relay *relay, client_connection *con, int relay_mode) {
+  relay->con = con;
+  atomic_store_explicit(&con->last_activity, time(NULL), memory_order_relaxed);
+  proxy_instance *proxy = thread_local_get_proxy_instance();
+  relay->traffic = proxy ? &proxy->traffic : NULL;
+  if (!shuttle_set_nonblocking(con->fd_in) || !shuttle_set_nonblocking(con->fd_out)) {
+    return 0;
+  }
+  // initialize both before checking, so shuttle_relay_free() is always safe
+  int ok_tx = shuttle_direction_init(&relay->dir[0], "client->server", con->fd_in, con->fd_out, &con->bytes_tx, TRAFFIC_TX, relay_mode);
+  int ok_rx = shuttle_direction_init(&relay->dir[1], "server->client", con->fd_out, con->fd_in, &con->bytes_rx, TRAFFIC_RX, relay_mode);
+  int ok = ok_tx && ok_rx;
+  relay->dir[0].rate_limit_count = shuttle_rate_limits(con, TRAFFIC_TX, relay->dir[0].rate_limit);
+  relay->dir[1].rate_limit_count = shuttle_rate_limits(con, TRAFFIC_RX, relay->dir[1].rate_limit);
+  relay->rate_limited = relay->dir[0].rate_limit_count + relay->dir[1].rate_limit_count > 0;
+  if (!ok) {
+    shuttle_relay_free(relay);
+  }
+  return ok;
+}
+
+void shuttle_relay_free(shuttle_relay *relay) {
+  shuttle_direction_free(&relay->dir[0]);
+  shuttle_direction_free(&relay->dir[1]);
+}
+
+int shuttle_direction_wants_read(shuttle_direction *dir) {
+  if (dir->read_eof || dir->throttle_until) {
+    return 0;
+  }
+  if (dir->use_splice) {
+    return !dir->pipe_full && dir->len < dir->pipe_capacity;
+  }
+  return dir->buf == NULL || dir->len < dir->buf_size;
+}
+
+// Which events the relay is waiting for on each of its two fds.
+void shuttle_relay_poll_events(shuttle_relay *relay, short *events_in, short *events_out) {
+  *events_in = 0;
+  *events_out = 0;
+  if (shuttle_direction_wants_read(&relay->dir[0])) {
+    *events_in |= POLLIN;
+  }
+  if (shuttle_direction_wants_read(&relay->dir[1])) {
+    *events_out |= POLLIN;
+  }
+  if (relay->dir[0].len > 0) {
+    *events_out |= POLLOUT;
+  }
+  if (relay->dir[1].len > 0) {
+    *events_in |= POLLOUT;
+  }
+}
+
+void shuttle_byte_dump_iov(int fd, char *prefix, struct iovec *iov, size_t bytes) {
+  for (int i=0; i<2 && bytes>0; i++) {
+    size_t n = iov[i].iov_len < bytes ? iov[i].iov_len : bytes;
+    byte_dump(fd, prefix, iov[i].iov_base, n);
+    bytes -= n;
+  }
+}
+
+// How many bytes the rate limits let us read right now.
+// returns 0 if a bucket is short; dir->throttle_until then says when to try again.
+size_t shuttle_direction_allowance(shuttle_direction *dir) {
+  if (dir->rate_limit_count == 0) {
+    return SIZE_MAX;
+  }
+  long long now = token_bucket_now();
+  long long allowance = LLONG_MAX;
+  int wait_ms = 0;
+  for (int i=0; i<dir->rate_limit_count; i++) {
+    token_bucket *tb = dir->rate_limit[i];
+    long long tokens = token_bucket_available(tb, now);
+    long long quantum = token_bucket_quantum(tb);
+    if (tokens < quantum) {
+      int ms = token_bucket_wait_ms(tb, quantum, now);
+      if (ms > wait_ms) {
+        wait_ms = ms;
       }
+    } else if (tokens < allowance) {
+      allowance = tokens;
     }
+  }
+  if (wait_ms > 0) {
+    trace2("%s rate limited for %i ms",dir->name,wait_ms);
+    dir->throttle_until = now + wait_ms * 1000000LL;
+    return 0;
+  }
+  return allowance < (long long)SIZE_MAX ? (size_t)allowance : SIZE_MAX;
+}
 
-    if (pfd[0].revents & POLLHUP) {
-      in_can_write=0;
+void shuttle_direction_charge(shuttle_direction *dir, size_t bytes) {
+  for (int i=0; i<dir->rate_limit_count; i++) {
+    token_bucket_consume(dir->rate_limit[i], bytes);
+  }
+}
+
+// returns >0 bytes moved, 0 if the read side has reached end-of-stream, <0 error (errno set; EAGAIN means try later)
+ssize_t shuttle_direction_read(shuttle_direction *dir) {
+  ssize_t rc;
+  size_t allowance = shuttle_direction_allowance(dir);
+  if (allowance == 0) {
+    errno = EAGAIN;
+    return -1;
+  }
+#ifdef __linux__
+  if (dir->use_splice) {
+    size_t want = dir->pipe_capacity - dir->len;
+    if (want > allowance) {
+      want = allowance;
+    }
+    do {
+      rc = splice(dir->fd_read, NULL, dir->pipe_fd[1], NULL, want, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+    } while (rc < 0 && errno == EINTR);
+    if (rc < 0 && (errno == EINVAL || errno == ENOSYS) && dir->len == 0) {
+      // nothing was moved and the pipe is empty, so it's safe to switch this direction to copy.
+      debug("%s splice() not supported (%s); falling back to copy",dir->name,strerror(errno));
+      shuttle_pipe_close(dir);
+      shuttle_direction_use_copy(dir);
+      return shuttle_direction_read(dir);
     }
-    if (pfd[1].revents & POLLHUP) {
-      out_can_write=0;
+    if (rc < 0 && errno == EAGAIN && dir->len > 0) {
+      // Can't tell "socket empty" from "pipe out of slots". Assume the pipe, and wait for a write.
+      dir->pipe_full=1;
     }
+    if (rc > 0) {
+      dir->len += rc;
+      shuttle_direction_charge(dir, rc);
+    }
+    return rc;
+  }
+#endif
+  if (dir->buf == NULL) {
+    shuttle_buffer_acquire(dir);
+  }
+  struct iovec iov[2];
+  size_t free_space = dir->buf_size - dir->len;
+  size_t space = free_space < allowance ? free_space : allowance;
+  size_t tail = (dir->head + dir->len) % dir->buf_size;
+  iov[0].iov_base = dir->buf + tail;
+  iov[0].iov_len = dir->buf_size - tail < space ? dir->buf_size - tail : space;
+  iov[1].iov_base = dir->buf;
+  iov[1].iov_len = space - iov[0].iov_len;
+  do {
+    rc = readv(dir->fd_read, iov, iov[1].iov_len > 0 ? 2 : 1);
+  } while (rc < 0 && errno == EINTR);
+  if (rc > 0) {
+    shuttle_byte_dump_iov(dir->fd_read, "<< ", iov, rc);
+    dir->len += rc;
+    shuttle_direction_charge(dir, rc);
+    if ((size_t)rc == free_space) {
+      dir->filled = 1;
+    }
+    if (dir->len > dir->peak) {
+      dir->peak = dir->len;
+    }
+  } else if (dir->len == 0) {
+    // nothing arrived; don't sit on the buffer while waiting. Nothing went
+    // through it either, so it says nothing about what size the next should be.
+    int saved_errno = errno;
+    shuttle_buffer_put(dir);
+    errno = saved_errno;
+  }
+  return rc;
+}
 
-    if (pfd[0].revents & (POLLERR | POLLNVAL)) {
-      errorNum("Error on fd_in socket. Exiting.");
-      return 0;
+// returns >0 bytes moved, <0 error (errno set; EAGAIN means try later)
+ssize_t shuttle_direction_write(shuttle_direction *dir) {
+  ssize_t rc;
+#ifdef __linux__
+  if (dir->use_splice) {
+    do {
+      rc = splice(dir->pipe_fd[0], NULL, dir->fd_write, NULL, dir->len, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+    } while (rc < 0 && errno == EINTR);
+    if (rc > 0) {
+      dir->len -= rc;
+      dir->pipe_full = 0;
     }
-    if (pfd[1].revents & (POLLERR | POLLNVAL)) {
-      errorNum("Error on fd_out socket. Exiting.");
-      return 0;
+    return rc;
+  }
+#endif
+  struct iovec iov[2];
+  iov[0].iov_base = dir->buf + dir->head;
+  iov[0].iov_len = dir->buf_size - dir->head < dir->len ? dir->buf_size - dir->head : dir->len;
+  iov[1].iov_base = dir->buf;
+  iov[1].iov_len = dir->len - iov[0].iov_len;
+  do {
+    rc = writev(dir->fd_write, iov, iov[1].iov_len > 0 ? 2 : 1);
+  } while (rc < 0 && errno == EINTR);
+  if (rc > 0) {
+    shuttle_byte_dump_iov(dir->fd_write, ">> ", iov, rc);
+    dir->len -= rc;
+    dir->head = (dir->head + rc) % dir->buf_size;
+    if (dir->len == 0) {
+      shuttle_buffer_release(dir);
     }
+  }
+  return rc;
+}
 
-    if (pfd[0].revents & POLLRDNORM) {
-      if (out_can_write) {
-        rc=shuttle(con, con->fd_in, con->fd_out);
-      } else {
-        rc=shuttle(con, con->fd_in, -1);
-      }
-      if (rc<0) {
-        return 0; // error
-      } else if (rc == 0) {
-        continue_loop=0;
-        close(con->fd_in);
-        con->fd_in=-1; 
+// Move as much as possible without blocking.
+// returns number of bytes + state changes made (0 = nothing to do right now), <0 on error
+long shuttle_direction_pump(shuttle_relay *relay, shuttle_direction *dir) {
+  client_connection *con = relay->con;
+  long progress = 0;
+  ssize_t rc;
+
+  if (dir->len > 0) {
+    rc = shuttle_direction_write(dir);
+    if (rc > 0) {
+      atomic_fetch_add_explicit(dir->byte_count, rc, memory_order_relaxed);
+      traffic_counter_add_bytes(relay->traffic, dir->traffic_direction, rc);
+      progress += rc;
+    } else if (rc < 0 && errno != EAGAIN) {
+      set_client_connection_status(con,errno,"Error",strerror(errno));
+      if (errno == ECONNRESET || errno == EPIPE) {
+        trace("%s connection reset.",dir->name);
       } else {
-        lock_client_connection(con);
-        con->bytes_tx += rc;
-        unlock_client_connection(con);
-        //trace2("shuttle in->out %i bytes",rc);
+        errorNum("%s write()",dir->name);
       }
+      return -1;
     }
-    if (pfd[1].revents & POLLRDNORM) {
-      if (in_can_write) {
-        rc=shuttle(con, con->fd_out, con->fd_in);
+  }
+
+  if (dir->throttle_until && token_bucket_now() >= dir->throttle_until) {
+    dir->throttle_until = 0;
+  }
+  if (shuttle_direction_wants_read(dir)) {
+    rc = shuttle_direction_read(dir);
+    if (rc > 0) {
+      progress += rc;
+    } else if (rc == 0) {
+      trace("%s end of transmission",dir->name);
+      dir->read_eof = 1;
+      progress++;
+    } else if (errno != EAGAIN) {
+      set_client_connection_status(con,errno,"Error",strerror(errno));
+      if (errno == ECONNRESET) {
+        trace("%s connection reset.",dir->name);
       } else {
-        rc=shuttle(con, con->fd_out, -1);
+        errorNum("%s read()",dir->name);
       }
-      if (rc<0) {
-        return 0; // error
-      } else if (rc == 0) {
-        continue_loop=0;
-        close(con->fd_out);
-        con->fd_out=-1;
-      } else {
-        lock_client_connection(con);
-        con->bytes_rx += rc;
-        unlock_client_connection(con);
-      //  trace("shuttle out->in %i bytes",rc);
+      return -1;
+    }
+  }
+
+  // pass the half-close along once everything read before it has been delivered
+  if (dir->read_eof && dir->len == 0 && !dir->write_shutdown) {
+    trace("%s shutdown(SHUT_WR) fd %i",dir->name,dir->fd_write);
+    if (shutdown(dir->fd_write, SHUT_WR) < 0 && errno != ENOTCONN) {
+      errorNum("%s shutdown()",dir->name);
+    }
+    dir->write_shutdown = 1;
+    progress++;
+  }
+  return progress;
+}
+
+// Call whenever either fd may be ready. Moves data in both directions until nothing more can be done without blocking.
+// returns SHUTTLE_RELAY_ACTIVE, SHUTTLE_RELAY_DONE or SHUTTLE_RELAY_ERROR
+int shuttle_relay_pump(shuttle_relay *relay) {
+  client_connection *con = relay->con;
+  if (atomic_load(&con->thread_should_exit)) {
+    trace("shuttle asked to exit");
+    return SHUTTLE_RELAY_ERROR; // whoever asked has set the status
+  }
+  long progress, total_progress = 0;
+  do {
+    progress = 0;
+    for (int i=0; i<2; i++) {
+      long rc = shuttle_direction_pump(relay, &relay->dir[i]);
+      if (rc < 0) {
+        return SHUTTLE_RELAY_ERROR;
       }
+      progress += rc;
+    }
+    total_progress += progress;
+  } while (progress > 0);
+
+  if (total_progress > 0) {
+    time_t now = time(NULL);
+    if (atomic_load_explicit(&con->last_activity, memory_order_relaxed) != now) {
+      atomic_store_explicit(&con->last_activity, now, memory_order_relaxed);
+    }
+  }
+
+  if (relay->dir[0].write_shutdown && relay->dir[1].write_shutdown) {
+    return SHUTTLE_RELAY_DONE;
+  }
+  return SHUTTLE_RELAY_ACTIVE;
+}
+
+// returns -1 if no direction is waiting on a rate limit, otherwise milliseconds until one may read again (0 = already)
+int shuttle_relay_throttle_ms(shuttle_relay *relay) {
+  int ms = -1;
+  long long now = 0;
+  for (int i=0; i<2; i++) {
+    shuttle_direction *dir = &relay->dir[i];
+    if (dir->throttle_until == 0) {
+      continue;
+    }
+    if (now == 0) {
+      now = token_bucket_now();
     }
+    long long left = dir->throttle_until - now;
+    int left_ms = left <= 0 ? 0 : (int)((left + 999999) / 1000000);
+    if (ms < 0 || left_ms < ms) {
+      ms = left_ms;
+    }
+  }
+  return ms;
+}
+
+// poll() timeout for a relay: forever, unless the reaper may ask it to exit or a rate limit is due to let up.
+int shuttle_relay_poll_timeout(shuttle_relay *relay) {
+  int timeout = atomic_load(&relay->con->idle_timeout) > 0 ? SHUTTLE_IDLE_CHECK_MS : -1;
+  int throttle_ms = shuttle_relay_throttle_ms(relay);
+  if (throttle_ms >= 0 && (timeout < 0 || throttle_ms < timeout)) {
+    timeout = throttle_ms;
+  }
+  return timeout;
+}
+
+// IMPROVEMENT: not all errors are reported to the WebUI via set_client_connection_status(). This could be improved.
+// return 1 if exit cleanly, 0 on error
+int shuttle_data_back_and_forth(client_connection *con) {
+  struct pollfd pfd[2];
+  shuttle_relay relay;
+  int rc;
 
-    if (!(in_can_write || (pfd[0].revents&POLLRDNORM))) {
-      continue_loop=0;
+  trace("shuttle started");
+  trace("FD = %i %i",con->fd_in, con->fd_out);
+
+  proxy_instance *proxy = thread_local_get_proxy_instance();
+  int relay_mode = proxy ? proxy->relay_mode : RELAY_MODE_COPY;
+  if (relay_mode == RELAY_MODE_URING && shuttle_rate_limited(con)) {
+    // uring keeps a receive posted at all times, so there's no read to hold back
+    debug("rate limited connection; relaying with copy instead of uring");
+    relay_mode = RELAY_MODE_COPY;
+  }
+  if (relay_mode == RELAY_MODE_URING && !byte_dump_enabled()) {
+    int fallback = 0;
+    int ok = shuttle_uring_relay(con, &fallback);
+    if (!fallback) {
+      return ok;
     }
-    if (!(out_can_write || (pfd[1].revents&POLLRDNORM))) {
-      continue_loop=0;
+  }
+
+  if (!shuttle_relay_init(&relay, con, relay_mode)) {
+    return 0;
+  }
+
+  int state = shuttle_relay_pump(&relay);
+  while (state == SHUTTLE_RELAY_ACTIVE) {
+    shuttle_relay_poll_events(&relay, &pfd[0].events, &pfd[1].events);
+    // An fd we want nothing from is left out, otherwise a POLLHUP on it would spin the loop.
+    pfd[0].fd = pfd[0].events ? con->fd_in : -1;
+    pfd[1].fd = pfd[1].events ? con->fd_out : -1;
+    pfd[0].revents = pfd[1].revents = 0;
+
+    trace2("poll()... %i %i ",pfd[0].fd, pfd[1].fd);
+    do {
+      rc = poll(pfd,2,shuttle_relay_poll_timeout(&relay));
+    } while (rc < 0 && errno == EINTR);
+    trace2("... poll() returned %i",rc);
+    if (rc < 0) {
+      errorNum("poll()");
+      state = SHUTTLE_RELAY_ERROR;
+      break;
     }
 
-  } 
+    if ((pfd[0].revents | pfd[1].revents) & POLLNVAL) {
+      error("Invalid fd in shuttle. Exiting.");
+      state = SHUTTLE_RELAY_ERROR;
+      break;
+    }
+    // POLLERR and POLLHUP are picked up by the read()/write() that follows; a timeout just re-checks thread_should_exit
+    state = shuttle_relay_pump(&relay);
+  }
+  shuttle_relay_free(&relay);
+
   // don't need to use mutex because only the connection thread changes these values -- and we're the connection thread :)
-  trace("shuttle connection closed normally. Tx %llu  Rx %llu  bytes",con->bytes_tx,con->bytes_rx);
-  return 1;
+  trace("shuttle connection closed %s. Tx %llu  Rx %llu  bytes",state == SHUTTLE_RELAY_DONE ? "normally" : "with error",con->bytes_tx,con->bytes_rx);
+  return state == SHUTTLE_RELAY_DONE;
 }
 
+// Swallows everything the client sends, on this thread. Normally null routes
+// go to the shared null sink instead; this is for when it can't take them.
+// return 1 if the client closed cleanly, 0 on error
 int shuttle_null_connection(client_connection *con) {
-  int rc;
-  unsigned char buf[10];
+  ssize_t rc;
+  proxy_instance *proxy = thread_local_get_proxy_instance();
+  unsigned char *buf = buffer_pool_get(SHUTTLE_BUFFER_MAX);
+  size_t buf_size = buffer_pool_size(buf);
   while(1) {
-    rc=sb_read_len(con->fd_in, buf, 1);
-    if (rc == 1) {
-      lock_client_connection(con);
-      con->bytes_rx += 1;
-      unlock_client_connection(con);
-    } else {
-      set_client_connection_status(con,errno,"Error",strerror(errno));
+    do {
+      rc = read(con->fd_in, buf, buf_size);
+    } while (rc < 0 && errno == EINTR);
+    if (rc <= 0) {
       break;
     }
+    byte_dump(con->fd_in, "<< ", buf, rc);
+    atomic_fetch_add_explicit(&con->bytes_rx, rc, memory_order_relaxed);
+    traffic_counter_add_bytes(proxy ? &proxy->traffic : NULL, TRAFFIC_RX, rc);
   }
-  if (rc==0) {
-    return 1;
+  if (rc < 0) {
+    set_client_connection_status(con,errno,"Error",strerror(errno));
   }
-  return 0;
+  buffer_pool_put(buf);
+  return rc == 0;
 }
-  
 
@@ -4,7 +4,79 @@
 #ifndef SHUTTLE_H
 #define SHUTTLE_H
 
+#include<stddef.h>
+
 #include"client_connection.h"
+#include"traffic_counter.h"
+#include"token_bucket.h"
+
+// Copy-mode relay buffers come from the buffer pool and are only held while
+// bytes are in flight. Each direction starts at SHUTTLE_BUFFER_MIN and grows
+// (by SHUTTLE_BUFFER_GROWTH) while reads keep filling it, up to
+// SHUTTLE_BUFFER_MAX; it shrinks again when a buffer goes mostly unused.
+#define SHUTTLE_BUFFER_MIN    (16*1024)
+#define SHUTTLE_BUFFER_MAX    (256*1024)
+#define SHUTTLE_BUFFER_GROWTH 4
+
+// Bytes held in a splice pipe per direction.
+#define SHUTTLE_PIPE_SIZE 65536
+
+// With an idle timeout, relays wake up at least this often to check thread_should_exit.
+#define SHUTTLE_IDLE_CHECK_MS 1000
+
+// Buckets that can shape one direction: the proxy's, the route rule's and the ssh tunnel's.
+#define SHUTTLE_RATE_LIMITS 3
+
+// shuttle_relay_pump() return values
+#define SHUTTLE_RELAY_ERROR  -1
+#define SHUTTLE_RELAY_DONE    0 // both directions reached end-of-stream and were flushed
+#define SHUTTLE_RELAY_ACTIVE  1
+
+// One direction of a relay: bytes read from fd_read are buffered, then written to fd_write.
+typedef struct shuttle_direction {
+  char *name;
+  int fd_read;
+  int fd_write;
+  atomic_ullong *byte_count; // &con->bytes_tx or &con->bytes_rx
+  int traffic_direction;     // TRAFFIC_TX or TRAFFIC_RX
+
+  // copy mode: ring buffer of buf_size bytes; NULL while len is 0
+  unsigned char *buf;
+  size_t buf_size; // size of buf, or of the next one to be acquired
+  size_t head;     // index of the first byte not yet written
+  size_t len;      // bytes waiting to be written
+  size_t peak;     // highest len seen since buf was acquired
+  int filled;      // a read used all the free space since buf was acquired
+
+  // splice mode: the pipe is the buffer
+  int use_splice;
+  int pipe_fd[2];
+  size_t pipe_capacity;
+  int pipe_full; // splice() into the pipe would block; wait for a write before reading again
+
+  // bandwidth shaping: we only read while every bucket has tokens
+  token_bucket *rate_limit[SHUTTLE_RATE_LIMITS];
+  int rate_limit_count;
+  long long throttle_until; // token_bucket_now() after which we may read again; 0 = not throttled
+
+  int read_eof;       // fd_read reached end-of-stream
+  int write_shutdown; // shutdown(fd_write,SHUT_WR) has been done; this direction is finished
+} shuttle_direction;
+
+typedef struct shuttle_relay {
+  client_connection *con;
+  traffic_counter *traffic; // the proxy's totals; may be NULL
+  shuttle_direction dir[2]; // [0] client -> server (bytes_tx), [1] server -> client (bytes_rx)
+  int rate_limited;         // either direction has buckets; it may need waking up without any fd activity
+} shuttle_relay;
+
+int  shuttle_relay_init(shuttle_relay *relay, client_connection *con, int relay_mode);
+void shuttle_relay_free(shuttle_relay *relay);
+void shuttle_relay_poll_events(shuttle_relay *relay, short *events_in, short *events_out);
+int  shuttle_relay_pump(shuttle_relay *relay);
+int  shuttle_relay_poll_timeout(shuttle_relay *relay);
+int  shuttle_relay_throttle_ms(shuttle_relay *relay);
+int  shuttle_rate_limited(client_connection *con);
 
 int shuttle_data_back_and_forth(client_connection *con);
 int shuttle_null_connection(client_connection *con);
@@ -0,0 +1,392 @@
+// Copyright 2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+// SPDX-License-Identifier: MIT-0
+
+#include<stdlib.h>
+#include<string.h>
+#include<errno.h>
+#include<sys/socket.h>
+#include<time.h>
+
+#include"log.h"
+#include"client_connection.h"
+#include"shuttle_uring.h"
+
+#ifndef HAVE_LIBURING
+
+int shuttle_uring_relay(client_connection *con, int *fallback) {
+  debug("relayMode uring: built without liburing; falling back to copy");
+  *fallback = 1;
+  return 0;
+}
+
+#else // HAVE_LIBURING
+
+#include<liburing.h>
+
+#include"buffer_pool.h"
+#include"proxy_instance.h"
+#include"thread_local.h"
+#include"traffic_counter.h"
+#include"shuttle.h"
+
+// How it works, per direction:
+//   - one multishot recv stays armed on fd_read. The kernel picks a buffer
+//     from a provided buffer ring for every chunk it receives, so a
+//     single submission keeps producing completions.
+//   - received buffers are queued, then sent to fd_write as one chain of
+//     linked sends (IOSQE_IO_LINK keeps them in order). A buffer goes
+//     back to the ring once its send completes.
+//   - when every buffer is waiting to be sent the recv ends with ENOBUFS;
+//     that's our back-pressure. We re-arm it once a buffer comes back.
+// One io_uring_enter() then submits and reaps work for both directions.
+
+#define URING_QUEUE_DEPTH   64
+#define URING_BUFFER_COUNT  4      // per direction; must be a power of 2
+#define URING_BUFFER_SIZE   16384  // URING_BUFFER_COUNT * URING_BUFFER_SIZE is one buffer pool buffer
+
+// user_data layout: bid << 16 | direction << 8 | op
+#define URING_OP_RECV   1
+#define URING_OP_SEND   2
+#define URING_OP_CANCEL 3
+#define URING_DATA(op,dir,bid) (((unsigned long long)(bid) << 16) | ((dir) << 8) | (op))
+#define URING_DATA_OP(data)  ((int)((data) & 0xff))
+#define URING_DATA_DIR(data) ((int)(((data) >> 8) & 0xff))
+#define URING_DATA_BID(data) ((int)(((data) >> 16) & 0xffff))
+
+typedef struct uring_direction {
+  char *name;
+  int index;
+  int fd_read;
+  int fd_write;
+  atomic_ullong *byte_count;
+
+  struct io_uring_buf_ring *buf_ring;
+  unsigned char *buf;             // URING_BUFFER_COUNT * URING_BUFFER_SIZE, from the buffer pool
+
+  int recv_armed;                 // a multishot recv is outstanding
+  int read_eof;
+  int write_shutdown;
+
+  // received, not yet sent (FIFO)
+  int pending_bid[URING_BUFFER_COUNT];
+  int pending_len[URING_BUFFER_COUNT];
+  int pending_head;
+  int pending_count;
+
+  int sends_in_flight;            // sends in the current linked chain
+} uring_direction;
+
+typedef struct uring_relay {
+  client_connection *con;
+  traffic_counter *traffic;       // the proxy's totals; may be NULL
+  struct io_uring ring;
+  uring_direction dir[2];
+  int in_flight;                  // requests the kernel still owns
+  int received_any;               // once set, we're committed; no more fallback
+} uring_relay;
+
+void uring_buffer_recycle(uring_direction *dir, int bid) {
+  io_uring_buf_ring_add(dir->buf_ring, dir->buf + bid * URING_BUFFER_SIZE, URING_BUFFER_SIZE, bid, io_uring_buf_ring_mask(URING_BUFFER_COUNT), 0);
+  io_uring_buf_ring_advance(dir->buf_ring, 1);
+}
+
+// returns 1 on success, 0 on error (-errno in *err)
+int uring_direction_init(uring_relay *relay, uring_direction *dir, int index, char *name, int fd_read, int fd_write, atomic_ullong *byte_count, int *err) {
+  memset(dir, 0, sizeof(uring_direction));
+  dir->name = name;
+  dir->index = index;
+  dir->fd_read = fd_read;
+  dir->fd_write = fd_write;
+  dir->byte_count = byte_count;
+  dir->buf = buffer_pool_get(URING_BUFFER_COUNT * URING_BUFFER_SIZE);
+  dir->buf_ring = io_uring_setup_buf_ring(&relay->ring, URING_BUFFER_COUNT, index, 0, err);
+  if (dir->buf_ring == NULL) {
+    return 0;
+  }
+  for (int bid=0; bid<URING_BUFFER_COUNT; bid++) {
+    uring_buffer_recycle(dir, bid);
+  }
+  return 1;
+}
+
+void uring_direction_free(uring_relay *relay, uring_direction *dir) {
+  if (dir->buf_ring) {
+    io_uring_free_buf_ring(&relay->ring, dir->buf_ring, URING_BUFFER_COUNT, dir->index);
+    dir->buf_ring = NULL;
+  }
+  buffer_pool_put(dir->buf);
+  dir->buf = NULL;
+}
+
+struct io_uring_sqe *uring_get_sqe(uring_relay *relay) {
+  struct io_uring_sqe *sqe = io_uring_get_sqe(&relay->ring);
+  if (sqe == NULL) {
+    // submission queue full; hand what we have to the kernel and try again
+    io_uring_submit(&relay->ring);
+    sqe = io_uring_get_sqe(&relay->ring);
+  }
+  return sqe;
+}
+
+int uring_arm_recv(uring_relay *relay, uring_direction *dir) {
+  struct io_uring_sqe *sqe = uring_get_sqe(relay);
+  if (sqe == NULL) {
+    return 0;
+  }
+  io_uring_prep_recv_multishot(sqe, dir->fd_read, NULL, 0, 0);
+  sqe->flags |= IOSQE_BUFFER_SELECT;
+  sqe->buf_group = dir->index;
+  io_uring_sqe_set_data64(sqe, URING_DATA(URING_OP_RECV, dir->index, 0));
+  dir->recv_armed = 1;
+  relay->in_flight++;
+  return 1;
+}
+
+// Send everything that's queued as a single chain of linked sends.
+int uring_send_pending(uring_relay *relay, uring_direction *dir) {
+  while (dir->pending_count > 0) {
+    struct io_uring_sqe *sqe = uring_get_sqe(relay);
+    if (sqe == NULL) {
+      return 0;
+    }
+    int bid = dir->pending_bid[dir->pending_head];
+    int len = dir->pending_len[dir->pending_head];
+    dir->pending_head = (dir->pending_head + 1) % URING_BUFFER_COUNT;
+    dir->pending_count--;
+
+    // MSG_WAITALL: the kernel retries short sends itself, so a chain member completes whole or fails.
+    io_uring_prep_send(sqe, dir->fd_write, dir->buf + bid * URING_BUFFER_SIZE, len, MSG_WAITALL | MSG_NOSIGNAL);
+    if (dir->pending_count > 0) {
+      sqe->flags |= IOSQE_IO_LINK;
+    }
+    io_uring_sqe_set_data64(sqe, URING_DATA(URING_OP_SEND, dir->index, bid));
+    dir->sends_in_flight++;
+    relay->in_flight++;
+  }
+  return 1;
+}
+
+// Queue whatever work this direction can do next.
+// returns 1 on success, 0 on error
+int uring_direction_kick(uring_relay *relay, uring_direction *dir) {
+  if (dir->sends_in_flight == 0 && dir->pending_count > 0) {
+    if (!uring_send_pending(relay, dir)) {
+      return 0;
+    }
+  }
+  if (!dir->recv_armed && !dir->read_eof && dir->pending_count + dir->sends_in_flight < URING_BUFFER_COUNT) {
+    if (!uring_arm_recv(relay, dir)) {
+      return 0;
+    }
+  }
+  if (dir->read_eof && dir->pending_count == 0 && dir->sends_in_flight == 0 && !dir->write_shutdown) {
+    trace("%s shutdown(SHUT_WR) fd %i",dir->name,dir->fd_write);
+    if (shutdown(dir->fd_write, SHUT_WR) < 0 && errno != ENOTCONN) {
+      errorNum("%s shutdown()",dir->name);
+    }
+    dir->write_shutdown = 1;
+  }
+  return 1;
+}
+
+// returns 1 to keep going, 0 on error, -1 if io_uring turns out to be unusable.
+// Whether falling back is still possible is up to the caller, once it has seen the whole batch.
+int uring_handle_cqe(uring_relay *relay, struct io_uring_cqe *cqe) {
+  unsigned long long data = io_uring_cqe_get_data64(cqe);
+  int op = URING_DATA_OP(data);
+  uring_direction *dir = &relay->dir[URING_DATA_DIR(data) & 1];
+  client_connection *con = relay->con;
+
+  if (op == URING_OP_CANCEL) {
+    relay->in_flight--;
+    return 1;
+  }
+
+  if (op == URING_OP_RECV) {
+    if (!(cqe->flags & IORING_CQE_F_MORE)) {
+      dir->recv_armed = 0;
+      relay->in_flight--;
+    }
+    if (cqe->res > 0) {
+      relay->received_any = 1;
+      int bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+      int slot = (dir->pending_head + dir->pending_count) % URING_BUFFER_COUNT;
+      dir->pending_bid[slot] = bid;
+      dir->pending_len[slot] = cqe->res;
+      dir->pending_count++;
+    } else if (cqe->res == 0) {
+      trace("%s end of transmission",dir->name);
+      dir->read_eof = 1;
+    } else if (cqe->res == -ENOBUFS) {
+      // every buffer is waiting to be sent; re-armed when one comes back
+    } else if (cqe->res == -EINVAL || cqe->res == -EOPNOTSUPP) {
+      debug("%s multishot recv not supported (%s)",dir->name,strerror(-cqe->res));
+      return -1;
+    } else {
+      set_client_connection_status(con,-cqe->res,"Error",strerror(-cqe->res));
+      if (cqe->res == -ECONNRESET) {
+        trace("%s connection reset.",dir->name);
+      } else {
+        errno = -cqe->res;
+        errorNum("%s io_uring recv",dir->name);
+      }
+      return 0;
+    }
+    return 1;
+  }
+
+  // URING_OP_SEND
+  relay->in_flight--;
+  dir->sends_in_flight--;
+  uring_buffer_recycle(dir, URING_DATA_BID(data));
+  if (cqe->res < 0) {
+    if (cqe->res != -ECANCELED) { // -ECANCELED: an earlier link in the chain failed, and was reported
+      set_client_connection_status(con,-cqe->res,"Error",strerror(-cqe->res));
+      if (cqe->res == -ECONNRESET || cqe->res == -EPIPE) {
+        trace("%s connection reset.",dir->name);
+      } else {
+        errno = -cqe->res;
+        errorNum("%s io_uring send",dir->name);
+      }
+    }
+    return 0;
+  }
+  atomic_fetch_add_explicit(dir->byte_count, cqe->res, memory_order_relaxed);
+  atomic_store_explicit(&relay->con->last_activity, time(NULL), memory_order_relaxed);
+  traffic_counter_add_bytes(relay->traffic, dir->index == 0 ? TRAFFIC_TX : TRAFFIC_RX, cqe->res);
+  return 1;
+}
+
+// Cancel whatever the kernel still holds, and wait for it to let go of our buffers.
+void uring_relay_quiesce(uring_relay *relay) {
+  if (relay->in_flight == 0) {
+    return;
+  }
+  for (int i=0; i<2; i++) {
+    struct io_uring_sqe *sqe = uring_get_sqe(relay);
+    if (sqe == NULL) {
+      break;
+    }
+    io_uring_prep_cancel_fd(sqe, relay->dir[i].fd_read, IORING_ASYNC_CANCEL_ALL);
+    io_uring_sqe_set_data64(sqe, URING_DATA(URING_OP_CANCEL, i, 0));
+    relay->in_flight++;
+  }
+  io_uring_submit(&relay->ring);
+  while (relay->in_flight > 0) {
+    struct io_uring_cqe *cqe;
+    if (io_uring_wait_cqe(&relay->ring, &cqe) < 0) {
+      break;
+    }
+    unsigned long long data = io_uring_cqe_get_data64(cqe);
+    if (URING_DATA_OP(data) != URING_OP_RECV || !(cqe->flags & IORING_CQE_F_MORE)) {
+      relay->in_flight--;
+    }
+    if (URING_DATA_OP(data) == URING_OP_RECV && cqe->res > 0) {
+      relay->received_any = 1; // bytes taken off the socket that we'll never send; too late to fall back
+    }
+    io_uring_cqe_seen(&relay->ring, cqe);
+  }
+}
+
+int shuttle_uring_relay(client_connection *con, int *fallback) {
+  uring_relay relay;
+  memset(&relay, 0, sizeof(relay));
+  relay.con = con;
+  proxy_instance *proxy = thread_local_get_proxy_instance();
+  relay.traffic = proxy ? &proxy->traffic : NULL;
+  *fallback = 0;
+
+  int rc = io_uring_queue_init(URING_QUEUE_DEPTH, &relay.ring, 0);
+  if (rc < 0) {
+    debug("io_uring_queue_init(): %s; falling back to copy",strerror(-rc));
+    *fallback = 1;
+    return 0;
+  }
+  int err = 0;
+  if (!uring_direction_init(&relay, &relay.dir[0], 0, "client->server", con->fd_in, con->fd_out, &con->bytes_tx, &err) ||
+      !uring_direction_init(&relay, &relay.dir[1], 1, "server->client", con->fd_out, con->fd_in, &con->bytes_rx, &err)) {
+    debug("io_uring buffer ring: %s; falling back to copy",strerror(-err));
+    uring_direction_free(&relay, &relay.dir[0]);
+    uring_direction_free(&relay, &relay.dir[1]);
+    io_uring_queue_exit(&relay.ring);
+    *fallback = 1;
+    return 0;
+  }
+
+  trace("shuttle (io_uring) started");
+  atomic_store_explicit(&con->last_activity, time(NULL), memory_order_relaxed);
+  int ok = 1;
+  while (ok == 1 && !(relay.dir[0].write_shutdown && relay.dir[1].write_shutdown)) {
+    if (atomic_load(&con->thread_should_exit)) {
+      trace("shuttle (io_uring) asked to exit");
+      ok = 0; // the reaper has set the status
+      break;
+    }
+    for (int i=0; i<2 && ok; i++) {
+      ok = uring_direction_kick(&relay, &relay.dir[i]);
+    }
+    if (!ok || (relay.dir[0].write_shutdown && relay.dir[1].write_shutdown)) {
+      break;
+    }
+
+    if (atomic_load(&con->idle_timeout) > 0) {
+      // wake up now and then to look at thread_should_exit
+      struct __kernel_timespec ts = { .tv_sec = SHUTTLE_IDLE_CHECK_MS / 1000, .tv_nsec = (SHUTTLE_IDLE_CHECK_MS % 1000) * 1000000 };
+      struct io_uring_cqe *cqe;
+      do {
+        rc = io_uring_submit_and_wait_timeout(&relay.ring, &cqe, 1, &ts, NULL);
+      } while (rc == -EINTR);
+      if (rc == -ETIME) {
+        rc = 0;
+      }
+    } else {
+      do {
+        rc = io_uring_submit_and_wait(&relay.ring, 1);
+      } while (rc == -EINTR);
+    }
+    if (rc < 0) {
+      errno = -rc;
+      errorNum("io_uring_submit_and_wait()");
+      ok = 0;
+      break;
+    }
+
+    // Handle the whole batch before deciding anything: a recv that completed
+    // after the one saying io_uring can't be used still has bytes in our buffers.
+    struct io_uring_cqe *cqes[URING_QUEUE_DEPTH];
+    unsigned count = io_uring_peek_batch_cqe(&relay.ring, cqes, URING_QUEUE_DEPTH);
+    int unusable = 0;
+    for (unsigned i=0; i<count; i++) {
+      rc = uring_handle_cqe(&relay, cqes[i]); // keep the bookkeeping going even after a failure
+      if (rc < 0) {
+        unusable = 1;
+      } else if (ok == 1) {
+        ok = rc;
+      }
+    }
+    io_uring_cq_advance(&relay.ring, count);
+    if (unusable && ok == 1) {
+      ok = -1;
+    }
+  }
+
+  uring_relay_quiesce(&relay);
+  uring_direction_free(&relay, &relay.dir[0]);
+  uring_direction_free(&relay, &relay.dir[1]);
+  io_uring_queue_exit(&relay.ring);
+
+  if (ok < 0 && relay.received_any) {
+    // data is already out of the sockets, so copy can't take over from here
+    set_client_connection_status(con,EOPNOTSUPP,"Error","io_uring multishot recv failed mid-connection");
+    error("io_uring became unusable after data was received; closing connection");
+    ok = 0;
+  }
+  if (ok < 0) {
+    *fallback = 1;
+    return 0;
+  }
+  trace("shuttle (io_uring) connection closed %s. Tx %llu  Rx %llu  bytes",ok ? "normally" : "with error",con->bytes_tx,con->bytes_rx);
+  return ok;
+}
+
+#endif // HAVE_LIBURING
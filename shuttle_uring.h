@@ -0,0 +1,15 @@
+// Copyright 2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+// SPDX-License-Identifier: MIT-0
+
+#ifndef SHUTTLE_URING_H
+#define SHUTTLE_URING_H
+
+#include"client_connection.h"
+
+// io_uring relay backend (Linux, built only when liburing is found; see Makefile).
+// returns 1 if exit cleanly, 0 on error.
+// *fallback is set to 1 if io_uring can't be used here; nothing has been
+// read from either fd in that case, and the caller should relay the normal way.
+int shuttle_uring_relay(client_connection *con, int *fallback);
+
+#endif // SHUTTLE_URING_H
@@ -9,6 +9,7 @@
 #include"log.h"
 #include"safe_blocking_readwrite.h"
 #include"socks5.h"
+#include"socks5_client.h"
 #include"client_connection.h"
 #include"shuttle.h"
 
@@ -23,7 +24,7 @@ int sock5_client_negotiate_auth(client_connection *con, int *failure_type) {
   if (rc < 0) { return 0; }
 
   rc=sb_read_len(con->fd_out,buf,2);
-  if (rc < 0) { return 0; }
+  if (rc != 2) { return 0; }
   if (buf[0] != 0x05 || buf[1] != SOCKS5_AUTH_NONE_REQUIRED) {
     error("ssh SOCKS5 server does not support a suitable authentication method.");
     return 0;
@@ -32,10 +33,12 @@ int sock5_client_negotiate_auth(client_connection *con, int *failure_type) {
   return 1;
 }
 
-int socks5_client_send_command(client_connection *con, int *failure_type) {
-  unsigned char buf[300];
-  int rc;
-
+// Build the CONNECT (or whatever the client asked for) request for con's destination.
+// returns the number of bytes written to buf, 0 on error
+int socks5_client_build_command(client_connection *con, unsigned char *buf, int buflen) {
+  if (buflen < 4+1+255+2) {
+    return 0;
+  }
   buf[0]=0x05; // socks version 5
   buf[1]=con->socks_command;
   buf[2]=0x00; // reserved
@@ -61,7 +64,37 @@ int socks5_client_send_command(client_connection *con, int *failure_type) {
   int port = host_id_get_port(&con->dst_host);
   buf[idx] = (port >> 8) & 0x0FF; ++idx; 
   buf[idx] = (port     ) & 0x0FF; ++idx; 
- 
+  return idx;
+}
+
+// Length of the server's reply to a command, given its first 'len' bytes.
+// returns the full length once it can be known (len >= 5), 0 if more bytes are needed, -1 if malformed
+int socks5_client_reply_len(unsigned char *buf, int len) {
+  if (len < 5) {
+    return 0;
+  }
+  if (buf[0] != 0x05) {
+    return -1;
+  }
+  if (buf[3] == SOCKS5_ADDRTYPE_IPV4) {
+    return 4+4+2;
+  } else if (buf[3] == SOCKS5_ADDRTYPE_IPV6) {
+    return 4+16+2;
+  } else if (buf[3] == SOCKS5_ADDRTYPE_DOMAIN) {
+    return 4+1+buf[4]+2;
+  }
+  return -1;
+}
+
+int socks5_client_send_command(client_connection *con, int *failure_type) {
+  unsigned char buf[300];
+  int rc;
+
+  int idx = socks5_client_build_command(con, buf, sizeof(buf));
+  if (idx == 0) {
+    con->tunnel_verdict=CIRCUIT_VERDICT_NONE; // our problem, not the tunnel's
+    return 0;
+  }
   rc=sb_write_len(con->fd_out, buf, idx);
   if (rc < 0) { return 0; }
   
@@ -78,8 +111,9 @@ int socks5_client_get_command_response(client_connection *con, int *failure_type
 
   rc=sb_read_len(con->fd_out,buf,4);
   if (rc != 4) {
-    if (rc == 0) { // socket unexpectedly closed
+    if (rc == 0) { // socket unexpectedly closed: ssh can't reach the destination
       *failure_type=SOCKS5_REPLY_CONNECTION_REFUSED;
+      con->tunnel_verdict=CIRCUIT_VERDICT_NONE;
     }
     return 0;
   }
@@ -95,17 +129,19 @@ int socks5_client_get_command_response(client_connection *con, int *failure_type
   int addr_type=buf[3];
   if (addr_type == SOCKS5_ADDRTYPE_IPV4) {
     rc=sb_read_len(con->fd_out, &(buf[idx]),4);
-    if (rc < 0) { return 0;}
+    if (rc <= 0) { return 0;}
     idx += 4;
   } else if (addr_type == SOCKS5_ADDRTYPE_IPV6) {
     rc=sb_read_len(con->fd_out, &(buf[idx]),16);
-    if (rc < 0) { return 0;}
+    if (rc <= 0) { return 0;}
     idx += 16;
-  } else if (addr_type == SOCKS5_ADDRTYPE_IPV4) {
+  } else if (addr_type == SOCKS5_ADDRTYPE_DOMAIN) {
+    rc=sb_read_len(con->fd_out, &(buf[idx]),1);
+    if (rc <= 0) { return 0;}
     int len=buf[4];
     idx += 1;
     rc=sb_read_len(con->fd_out, &(buf[idx]),len);
-    if (rc < 0) { return 0;}
+    if (rc < len) { return 0;}
     idx += len;
   } else {
     error("Unknown address type %i",addr_type);
@@ -113,11 +149,12 @@ int socks5_client_get_command_response(client_connection *con, int *failure_type
   }
   // port
   rc=sb_read_len(con->fd_out, &(buf[idx]),2);
-  if (rc < 0) { return 0;}
+  if (rc <= 0) { return 0;}
   idx += 2;
 
   // I could check or log the IP and port, 
   // or I could ignore what the server sent back to us...
+  con->tunnel_verdict=CIRCUIT_VERDICT_ALIVE;
 
   if (buf[1] != SOCKS5_REPLY_SUCCEED) {
     trace("SSH SOCKS5 server returned error: %i",buf[1]);
@@ -127,33 +164,29 @@ int socks5_client_get_command_response(client_connection *con, int *failure_type
   return 1;
 }
 
+// Open a (blocking) connection to the tunnel's SOCKS5 or HTTP server.
 // returns 1 on success, 0 on error
-int connect_to_ssh_socks5_proxy(client_connection *con, ssh_tunnel *tun) {
-  struct sockaddr_in saddr_in;
+int connect_to_tunnel(client_connection *con, ssh_tunnel *tun) {
+  struct sockaddr_storage addr;
+  socklen_t addr_len = ssh_tunnel_addr(tun, &addr);
+  if (addr_len == 0) {
+    set_client_connection_status(con, CCSTATUS_ERR_NETWORK,"DNS Failure","Unable to resolve the tunnel's server name.");
+    con->tunnel_verdict=CIRCUIT_VERDICT_DEAD;
+    return 0;
+  }
 
-  con->fd_out = socket(PF_INET, SOCK_STREAM, 0);
+  con->fd_out = socket(addr.ss_family, SOCK_STREAM, 0);
   if (con->fd_out < 0) {
     set_client_connection_status(con,errno,"Error",strerror(errno));
     errorNum("socket()");
     return 0;
   }
 
-  // FIXME: get local address from ssh_tunnel structure
-  unsigned long proxy_ip = 0x7F000001; // 127.0.0.1
-  int proxy_port = tun->socks_port;
-
-  trace("Attempting to connect to %08lx : %i", proxy_ip, proxy_port);
-
-  // FIXME TODO: support ipv6
-  bzero(&saddr_in, sizeof(saddr_in));
-  saddr_in.sin_len = sizeof(saddr_in);
-  saddr_in.sin_addr.s_addr = htonl(proxy_ip);
-  saddr_in.sin_family = AF_INET;
-  saddr_in.sin_port = htons(proxy_port); 
+  trace("Attempting to connect to %s server of tunnel %s", ssh_tunnel_type_str(tun->type), tun->name);
 
   int rc;
   do {
-    rc = connect(con->fd_out, (struct sockaddr*)&saddr_in, sizeof(saddr_in));
+    rc = connect(con->fd_out, (struct sockaddr*)&addr, addr_len);
   } while (rc < 0 && errno == EINTR);
   if (rc < 0) {
     int tmp_errno=errno;
@@ -163,10 +196,10 @@ int connect_to_ssh_socks5_proxy(client_connection *con, ssh_tunnel *tun) {
     con->fd_out=-1;
     errno=tmp_errno;
     if (errno == ECONNREFUSED) {
-      set_client_connection_status(con, CCSTATUS_OKAY,"Waiting","SSH SOCKS5 proxy connection refused.");
-      trace("connect(%08lx:%i) connection refused.",proxy_ip, proxy_port);
+      set_client_connection_status(con, CCSTATUS_OKAY,"Waiting","Tunnel server connection refused.");
+      trace("connect() to tunnel %s: connection refused.",tun->name);
     } else {
-      errorNum("connect(%08lx:%i)",proxy_ip,proxy_port);
+      errorNum("connect() to tunnel %s",tun->name);
       set_client_connection_status(con, CCSTATUS_ERROR,NULL,strerror(tmp_errno));
     }
     return 0;
@@ -174,26 +207,124 @@ int connect_to_ssh_socks5_proxy(client_connection *con, ssh_tunnel *tun) {
   return 1;
 }
 
+// Build the greeting and the command back to back, for servers that take
+// the command before they've answered the greeting.
+// returns the number of bytes written to buf, 0 on error
+int socks5_client_build_pipelined(client_connection *con, unsigned char *buf, int buflen) {
+  if (buflen < SOCKS5_CLIENT_GREETING_LEN) {
+    return 0;
+  }
+  buf[0]=0x05; // socks version 5
+  buf[1]=0x01; // only one auth method supported by this client
+  buf[2]=SOCKS5_AUTH_NONE_REQUIRED;
+  int len = socks5_client_build_command(con, buf+SOCKS5_CLIENT_GREETING_LEN, buflen-SOCKS5_CLIENT_GREETING_LEN);
+  if (len == 0) {
+    return 0;
+  }
+  return SOCKS5_CLIENT_GREETING_LEN + len;
+}
+
+// Length of the method reply and command reply together, given their first 'len' bytes.
+// returns the full length once it can be known, 0 if more bytes are needed,
+// -1 if malformed, -2 if the server refused our authentication method
+int socks5_client_pipelined_reply_len(unsigned char *buf, int len) {
+  if (len >= 1 && buf[0] != 0x05) {
+    return -1;
+  }
+  if (len >= 2 && buf[1] != SOCKS5_AUTH_NONE_REQUIRED) {
+    return -2;
+  }
+  if (len < 2) {
+    return 0;
+  }
+  int reply_len = socks5_client_reply_len(buf+2, len-2);
+  if (reply_len <= 0) {
+    return reply_len;
+  }
+  return 2 + reply_len;
+}
+
+// Send greeting and command in one write, then read both replies, never
+// reading past the end of the command reply.
+// returns 1 if connection successful, 0 otherwise.
+int socks5_client_pipelined_handshake(client_connection *con, ssh_tunnel *tun, int *failure_type) {
+  unsigned char buf[SOCKS5_CLIENT_GREETING_LEN+4+1+255+2];
+  int len = socks5_client_build_pipelined(con, buf, sizeof(buf));
+  if (len == 0) {
+    *failure_type=SOCKS5_REPLY_ADDRESS_TYPE_NOT_SUPPORTED;
+    con->tunnel_verdict=CIRCUIT_VERDICT_NONE;
+    return 0;
+  }
+  if (sb_write_len(con->fd_out, buf, len) < 0) {
+    return 0;
+  }
+  trace("sent greeting and command to SOCKS5 server of %s: %s", tun->name, client_connection_str(con, (char*)buf, sizeof(buf)));
+
+  int have=0;
+  int want=2+5; // method reply, and enough of the command reply to know its length
+  while (have < want) {
+    int rc=sb_read(con->fd_out, buf+have, want-have);
+    if (rc <= 0) {
+      if (rc == 0 && have >= 2) { // ssh closes rather than replying when it can't reach the destination
+        *failure_type=SOCKS5_REPLY_CONNECTION_REFUSED;
+        con->tunnel_verdict=CIRCUIT_VERDICT_NONE;
+      }
+      return 0;
+    }
+    have += rc;
+    int reply_len = socks5_client_pipelined_reply_len(buf, have);
+    if (reply_len == -2) {
+      // the server reads our command as a failed authentication and drops the connection
+      error("SOCKS5 server of %s does not support a suitable authentication method.",tun->name);
+      return 0;
+    }
+    if (reply_len < 0) {
+      error("SOCKS5 server of %s sent a malformed reply",tun->name);
+      return 0;
+    }
+    if (reply_len > 0) {
+      want = reply_len;
+    }
+  }
+  *failure_type=buf[3];
+  con->tunnel_verdict=CIRCUIT_VERDICT_ALIVE;
+  if (buf[3] != SOCKS5_REPLY_SUCCEED) {
+    trace("SOCKS5 server of %s returned error: %i",tun->name,buf[3]);
+    return 0;
+  }
+  trace("Successfully received response from SOCKS5 server of %s.",tun->name);
+  return 1;
+}
+
 // returns 1 if connection successful, 0 otherwise.
 // specific failure type written to failure_type
 int connect_via_ssh_socks5(client_connection *con, ssh_tunnel *tun, int *failure_type) {
   int ok=1;
 
   *failure_type=SOCKS5_REPLY_SERVER_FAILURE;
+  con->tunnel_verdict=CIRCUIT_VERDICT_NONE;
 
   if (ok) {
     set_client_connection_status(con, CCSTATUS_OKAY,"Connecting","Connecting to SSH SOCKS5 server");
-    ok = connect_to_ssh_socks5_proxy(con, tun);
+    ok = connect_to_tunnel(con, tun);
   }
   if (ok) {
+    con->tunnel_verdict=CIRCUIT_VERDICT_DEAD; // until it answers
+
     set_client_connection_status(con, CCSTATUS_OKAY,"Negotiating","Negotiating connection with SSH SOCKS5 server");
-    ok = sock5_client_negotiate_auth(con, failure_type);
-  }
-  if (ok) {
-    ok = socks5_client_send_command(con, failure_type); 
   }
-  if (ok) {
-    ok = socks5_client_get_command_response(con, failure_type); 
+  if (ok && tun->pipeline) {
+    ok = socks5_client_pipelined_handshake(con, tun, failure_type);
+  } else {
+    if (ok) {
+      ok = sock5_client_negotiate_auth(con, failure_type);
+    }
+    if (ok) {
+      ok = socks5_client_send_command(con, failure_type); 
+    }
+    if (ok) {
+      ok = socks5_client_get_command_response(con, failure_type); 
+    }
   }
   if (ok) {
     set_client_connection_status(con, CCSTATUS_OKAY,NULL,NULL);
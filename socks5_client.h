@@ -7,6 +7,13 @@
 #include"client_connection.h"
 #include"ssh_tunnel.h"
 
+#define SOCKS5_CLIENT_GREETING_LEN 3 // version, one method, "no authentication"
+
+int connect_to_tunnel(client_connection *con, ssh_tunnel *tun);
 int connect_via_ssh_socks5(client_connection* con, ssh_tunnel *tun, int* failure_type);
+int socks5_client_build_command(client_connection *con, unsigned char *buf, int buflen);
+int socks5_client_reply_len(unsigned char *buf, int len);
+int socks5_client_build_pipelined(client_connection *con, unsigned char *buf, int buflen);
+int socks5_client_pipelined_reply_len(unsigned char *buf, int len);
 
 #endif // SOCKS5_CLIENT_H
@@ -4,6 +4,7 @@
 #include<stdio.h>
 #include<errno.h>
 #include<strings.h>
+#include<string.h>
 #include<stdlib.h>
 #include <arpa/inet.h>
 
@@ -19,9 +20,16 @@
 #include"safe_close.h"
 #include"string2.h"
 #include"dns_util.h"
+#include"tcp_keepalive.h"
+#include"event_loop.h"
+#include"null_sink.h"
+#include"happy_eyeballs.h"
+#include"tunnel_race.h"
+#include"http_connect_client.h"
 
 // returns 1 if connection successful, 0 otherwise.
 int connect_null(client_connection *con, int *failure_type) {
+  *failure_type = SOCKS5_REPLY_SUCCEED;
   return 1;
 }
 
@@ -30,34 +38,30 @@ int connect_null(client_connection *con, int *failure_type) {
 int connect_direct(client_connection *con, int *failure_type) {
   *failure_type = SOCKS5_REPLY_SERVER_FAILURE;
 
-  if (host_id_has_name(&con->dst_host) && !host_id_has_addr(&con->dst_host)) {
-    // first, check if the name can be converted to an IP address. 
-    // TODO: check for IPV6
-    struct sockaddr_in sin; 
-    sin.sin_len=sizeof(sin);
-    sin.sin_family=AF_INET;
-    sin.sin_port=htons(host_id_get_port(&con->dst_host));
-    if (inet_pton(AF_INET,host_id_get_name(&con->dst_host),&sin.sin_addr) == 1) {
-      host_id_set_addr_in(&con->dst_host,&sin);
-      trace("%s converted to IPv4 address",host_id_get_name(&con->dst_host));
-    } else {
-      resolve_dns_for_host_id(&con->dst_host);
-    }
-  }
-
-  struct sockaddr_in saddr_in;
+  // An address already on dst_host (from the client, or from a rule's resolveDNS / map) is the only one we try.
+  // Otherwise try everything the name resolves to.
+  struct sockaddr_storage addrs[HAPPY_EYEBALLS_MAX_ADDRS];
+  int count=0;
   if (host_id_has_addr(&con->dst_host)) {
-    if (con->dst_host.addr.sa.sa_family == AF_INET) {
-      memcpy(&saddr_in,&(con->dst_host.addr.sa_in),sizeof(struct sockaddr_in));
-    } else if (con->socks_address_type == SOCKS5_ADDRTYPE_IPV6) {
-      warn("Unsupported address type: IPv6");
-      *failure_type = SOCKS5_REPLY_ADDRESS_TYPE_NOT_SUPPORTED;
-      return 0;
+    int family = con->dst_host.addr.sa.sa_family;
+    if (family == AF_INET) {
+      memcpy(&addrs[0],&(con->dst_host.addr.sa_in),sizeof(struct sockaddr_in));
+    } else if (family == AF_INET6) {
+      memcpy(&addrs[0],&(con->dst_host.addr.sa_in6),sizeof(struct sockaddr_in6));
     } else {
-      error("Unsupported address type: %u",con->socks_address_type);
+      error("Unsupported address family: %i",family);
       *failure_type = SOCKS5_REPLY_ADDRESS_TYPE_NOT_SUPPORTED;
       return 0;
     }
+    count=1;
+  } else if (host_id_has_name(&con->dst_host)) {
+    count = resolve_dns_all_for_host_id(&con->dst_host, addrs, HAPPY_EYEBALLS_MAX_ADDRS);
+    if (count == 0) {
+      *failure_type = SOCKS5_REPLY_HOST_UNREACHABLE;
+      set_client_connection_status(con, CCSTATUS_ERR_NETWORK,"DNS Failure","Unable to resolve remote host name.");
+      return 0;
+    }
+    happy_eyeballs_order(addrs, count);
   } else {
     char buf[2048];
     error("Unsupported address and/or type: %s", host_id_str(&(con->dst_host),buf,sizeof(buf)));
@@ -65,37 +69,190 @@ int connect_direct(client_connection *con, int *failure_type) {
     return 0;
   }
 
-  con->fd_out = socket(PF_INET, SOCK_STREAM, 0);
-  if (con->fd_out < 0) {
-    errorNum("socket()");
-    return 0;
-  }
+  happy_eyeballs_result result;
+  int connected = happy_eyeballs_connect(addrs, count, con->connect_timeout * 1000, &result);
+  lock_client_connection(con);
+  con->connect_ms = (int)result.elapsed_ms;
+  con->connect_attempts = result.attempts;
+  unlock_client_connection(con);
 
-  int rc;
-  do {
-    rc = connect(con->fd_out, (struct sockaddr*)&saddr_in, sizeof(saddr_in));
-  } while (rc < 0 && errno == EINTR);
-  if (rc < 0) {
-    int tmp_errno=errno;
-    do {
-      rc = close(con->fd_out);
-    } while (rc<0 && errno == EINTR);
-    con->fd_out=-1;
-    errno=tmp_errno;
+  if (!connected) {
     char buf[500];
-    errorNum("connect()");
+    error("connect() failed after %i attempt(s) in %lli ms: %s",result.attempts,result.elapsed_ms,strerror(result.error));
     error( "for connection %s",client_connection_str(con,buf, sizeof(buf)));
-    if (errno == ECONNREFUSED || errno == ECONNRESET) {
+    if (result.error == ECONNREFUSED || result.error == ECONNRESET) {
       *failure_type = SOCKS5_REPLY_CONNECTION_REFUSED;
+    } else if (result.error == ETIMEDOUT) {
+      *failure_type = SOCKS5_REPLY_TTL_EXPIRED;
+      snprintf(buf,sizeof(buf),"No connection after %i seconds.",con->connect_timeout);
+      set_client_connection_status(con, CCSTATUS_ERR_NETWORK,"Connect Timeout",buf);
+    } else if (result.error == ENETUNREACH) {
+      *failure_type = SOCKS5_REPLY_NETWORK_UNREACHABLE;
+    } else if (result.error == EHOSTUNREACH) {
+      *failure_type = SOCKS5_REPLY_HOST_UNREACHABLE;
     }
     return 0;
   }
 
-  trace("Connect success");
+  con->fd_out = result.fd;
+  struct sockaddr_storage *winner = &addrs[result.winner];
+  if (winner->ss_family == AF_INET6) {
+    host_id_set_addr_in6(&con->dst_host, (struct sockaddr_in6*)winner);
+  } else {
+    host_id_set_addr_in(&con->dst_host, (struct sockaddr_in*)winner);
+  }
+  char buf[200];
+  debug("Connected to %s in %lli ms, attempt %i of %i",host_id_addr_str(&con->dst_host,buf,sizeof(buf)),result.elapsed_ms,result.winner+1,count);
   *failure_type = SOCKS5_REPLY_SUCCEED;
   return 1;
 }
 
+// Connect through one of a rule's ssh tunnels, per the rule's strategy.
+// returns 1 if connection successful, 0 otherwise.
+// specific failure type written to failure_type
+int connect_via_ssh_tunnels(client_connection *con, route_rule *route, ssh_tunnel **tunnels, int tun_max, int *failure_type) {
+  // leave out tunnels whose circuit breaker is open
+  ssh_tunnel *allowed[ROUTE_RULE_MAX_SSH_TUNNELS_PER_RULE];
+  int allowed_max=0;
+  time_t now=time(NULL);
+  for (int i=0; i<tun_max; i++) {
+    if (circuit_breaker_allow(&tunnels[i]->breaker, now)) {
+      allowed[allowed_max++] = tunnels[i];
+    } else {
+      debug("Skipping ssh_tunnel %s: circuit breaker open",tunnels[i]->name);
+    }
+  }
+  if (allowed_max == 0) {
+    *failure_type = SOCKS5_REPLY_NETWORK_UNREACHABLE;
+    set_client_connection_status(con, CCSTATUS_ERR_NETWORK,"Circuit Open","Every ssh tunnel for this route has failed repeatedly; waiting before trying again.");
+    return 0;
+  }
+  tunnels = allowed;
+  tun_max = allowed_max;
+
+  int start_delay_ms = TUNNEL_RACE_FAILOVER;
+  if (route->strategy == ROUTE_STRATEGY_RACE) {
+    start_delay_ms = route->race_delay;
+  }
+  int timeout_ms = TUNNEL_RACE_DEFAULT_TIMEOUT_MS;
+  if (con->connect_timeout > 0) {
+    timeout_ms = con->connect_timeout * 1000;
+  }
+
+  set_client_connection_status(con, CCSTATUS_OKAY,"Connecting","Connecting to SSH SOCKS5 server");
+  tunnel_race_result result;
+  int connected = tunnel_race_connect(con, tunnels, tun_max, start_delay_ms, timeout_ms, &result);
+  lock_client_connection(con);
+  con->tunnel = result.winner;
+  con->connect_ms = (int)result.elapsed_ms;
+  con->connect_attempts = result.attempts;
+  unlock_client_connection(con);
+  *failure_type = result.failure_type;
+  if (!connected) {
+    if (result.failure_type == SOCKS5_REPLY_CONNECTION_REFUSED) {
+      set_client_connection_status(con, CCSTATUS_ERR_NETWORK,"Connection Refused","Connection to remote host was refused.");
+    } else {
+      char buf[200];
+      snprintf(buf,sizeof(buf),"No ssh tunnel could connect within %i seconds.",timeout_ms/1000);
+      set_client_connection_status(con, CCSTATUS_ERR_NETWORK,"Tunnel Timeout",buf);
+    }
+    return 0;
+  }
+  con->fd_out = result.fd;
+  set_client_connection_status(con, CCSTATUS_OKAY,NULL,NULL);
+  return 1;
+}
+
+// A tunnel with replicas is as good as its best replica.
+double tunnel_ewma_score(ssh_tunnel *tun) {
+  if (tun->replica_count == 0) {
+    return tunnel_balance_ewma_score(&tun->balance);
+  }
+  double best = tunnel_balance_ewma_score(&tun->replica[0]->balance);
+  for (int i=1; i<tun->replica_count; i++) {
+    double score = tunnel_balance_ewma_score(&tun->replica[i]->balance);
+    if (score < best) {
+      best = score;
+    }
+  }
+  return best;
+}
+
+// Put a rule's tunnels in the order its balance policy wants them tried.
+void order_tunnels(route_rule *route, int tun_max, ssh_tunnel **order) {
+  if (route->balance == TUNNEL_BALANCE_ROUND_ROBIN) {
+    unsigned int first = atomic_fetch_add_explicit(&route->round_robin_next, 1, memory_order_relaxed) % tun_max;
+    for (int i=0; i<tun_max; i++) {
+      order[i] = route->tunnel[(first + i) % tun_max];
+    }
+  } else if (route->balance == TUNNEL_BALANCE_LEAST_CONNECTIONS || route->balance == TUNNEL_BALANCE_EWMA) {
+    double score[ROUTE_RULE_MAX_SSH_TUNNELS_PER_RULE];
+    int rank[ROUTE_RULE_MAX_SSH_TUNNELS_PER_RULE];
+    for (int i=0; i<tun_max; i++) {
+      if (route->balance == TUNNEL_BALANCE_LEAST_CONNECTIONS) {
+        score[i] = tunnel_balance_load(&route->tunnel[i]->balance);
+      } else {
+        score[i] = tunnel_ewma_score(route->tunnel[i]);
+      }
+    }
+    tunnel_balance_rank(score, tun_max, rank);
+    for (int i=0; i<tun_max; i++) {
+      order[i] = route->tunnel[rank[i]];
+    }
+  } else {
+    for (int i=0; i<tun_max; i++) {
+      order[i] = route->tunnel[i];
+    }
+  }
+  // count it now, so a burst of new connections doesn't all pick the same tunnel before the next count
+  tunnel_balance_picked(&order[0]->balance);
+}
+
+// Replace each tunnel that has replicas with the replicas themselves: ready
+// ones before those still starting, least loaded first, with ties taken in
+// turn. A racing rule only gets the first replica of each tunnel, so it
+// races tunnels rather than copies of the same one. If they don't all fit,
+// a tunnel gets fewer of its replicas so that every tunnel after it still
+// gets one, keeping failover to them.
+// returns the new number of tunnels in 'order'
+int expand_replicas(route_rule *route, ssh_tunnel **order, int tun_max) {
+  ssh_tunnel *out[ROUTE_RULE_MAX_SSH_TUNNELS_PER_RULE];
+  int out_max=0;
+  for (int i=0; i<tun_max; i++) {
+    ssh_tunnel *tun = order[i];
+    if (tun->replica_count == 0) {
+      out[out_max++] = tun;
+      continue;
+    }
+    ssh_tunnel *rotated[SSH_TUNNEL_MAX_REPLICAS];
+    double score[SSH_TUNNEL_MAX_REPLICAS];
+    int rank[SSH_TUNNEL_MAX_REPLICAS];
+    unsigned int first = atomic_fetch_add_explicit(&tun->replica_next, 1, memory_order_relaxed) % tun->replica_count;
+    for (int r=0; r<tun->replica_count; r++) {
+      rotated[r] = tun->replica[(first + r) % tun->replica_count];
+      score[r] = tunnel_balance_load(&rotated[r]->balance);
+      if (!ssh_tunnel_is_ready(rotated[r])) {
+        score[r] += 1000000;
+      }
+    }
+    tunnel_balance_rank(score, tun->replica_count, rank);
+    int wanted = route->strategy == ROUTE_STRATEGY_RACE ? 1 : tun->replica_count;
+    int room = ROUTE_RULE_MAX_SSH_TUNNELS_PER_RULE - out_max - (tun_max - i - 1);
+    if (wanted > room) {
+      debug("Trying %i of the %i replicas of ssh_tunnel %s, leaving room for the rule's other tunnels",room,wanted,tun->name);
+      wanted = room;
+    }
+    for (int r=0; r<wanted; r++) {
+      out[out_max++] = rotated[rank[r]];
+    }
+    if (i == 0) {
+      tunnel_balance_picked(&rotated[rank[0]]->balance);
+    }
+  }
+  memcpy(order, out, sizeof(ssh_tunnel*) * out_max);
+  return out_max;
+}
+
 int socks_connect(proxy_instance *proxy, service *srv, client_connection *con, int *failure_type) {
 
   int ok=1;
@@ -105,11 +262,15 @@ int socks_connect(proxy_instance *proxy, service *srv, client_connection *con, i
   // Also notify main thread if we need SSH child activity. 
   int tun_max;
   int have_ssh_tunnel=0;
+  int only_ssh_tunnels=1;
   for (tun_max=0; route->tunnel[tun_max] != NULL && tun_max < ROUTE_RULE_MAX_SSH_TUNNELS_PER_RULE; tun_max++) {
     ssh_tunnel *tun = route->tunnel[tun_max];
     if (tun != ssh_tunnel_direct && tun != ssh_tunnel_null && tun->command_to_run[0]) {
       have_ssh_tunnel=1;
     }
+    if (tun == ssh_tunnel_direct || tun == ssh_tunnel_null) {
+      only_ssh_tunnels=0;
+    }
   }
   if (tun_max == 0) {
     error("Rule %s line %i used for routing, but it has no tunnels! This should not happen.", con->route->file_name, con->route->file_line_number);
@@ -119,11 +280,32 @@ int socks_connect(proxy_instance *proxy, service *srv, client_connection *con, i
     thread_msg_send(" ",1);
   } 
 
+  ssh_tunnel *order[ROUTE_RULE_MAX_SSH_TUNNELS_PER_RULE];
+  if (ok) {
+    order_tunnels(route, tun_max, order);
+    tun_max = expand_replicas(route, order, tun_max);
+  }
+
+  // A connection that finds none of its ssh tunnels ready has to wait for ssh to start: a "cold start".
+  int cold_start = ok && have_ssh_tunnel;
+  for (int i=0; cold_start && i<tun_max; i++) {
+    if (order[i] != ssh_tunnel_direct && order[i] != ssh_tunnel_null && ssh_tunnel_is_ready(order[i])) {
+      cold_start = 0;
+    }
+  }
+
   int attempt_to_connect=1;
   int connect_attempt=0;
+  if (ok && only_ssh_tunnels) {
+    // Handshakes with ssh tunnels don't block, so they can be raced and needn't sleep between retries.
+    // Rules mixing in direct or null still go one tunnel at a time below.
+    ok = connect_via_ssh_tunnels(con, route, order, tun_max, failure_type);
+    attempt_to_connect=0;
+  }
   while (ok && attempt_to_connect) {
     int tun_idx = connect_attempt % tun_max;
-    ssh_tunnel *tun = route->tunnel[tun_idx];
+    ssh_tunnel *tun = order[tun_idx];
+    unsigned long long ready_generation = ssh_tunnel_state_generation();
 
     lock_client_connection(con);
     con->tunnel = tun;
@@ -136,10 +318,21 @@ int socks_connect(proxy_instance *proxy, service *srv, client_connection *con, i
     } else if (tun ==  ssh_tunnel_null) {
       debug("Connecting to null, the consumer of bytes, oblivion.");
       connection_created = connect_null(con, failure_type);
-    // TODO: add support for connecting to a SOCKS5 server. IE: not direct or SSH.
+    } else if (!circuit_breaker_allow(&tun->breaker, time(NULL))) {
+      debug("Skipping ssh_tunnel %s: circuit breaker open",tun->name);
+    } else if (!ssh_tunnel_is_ready(tun)) {
+      debug("Skipping ssh_tunnel %s: %s",tun->name,ssh_tunnel_state_str(atomic_load(&tun->state)));
     } else {
-      debug("Attempting to connect to ssh_tunnel %s on port %i",tun->name, tun->socks_port);
-      connection_created = connect_via_ssh_socks5(con, tun, failure_type);
+      long long handshake_start = token_bucket_now();
+      if (tun->type == TUNNEL_TYPE_HTTP_CONNECT) {
+        debug("Attempting to connect via HTTP proxy %s",tun->name);
+        connection_created = connect_via_http_connect(con, tun, failure_type);
+      } else {
+        debug("Attempting to connect to %s tunnel %s",ssh_tunnel_type_str(tun->type),tun->name);
+        connection_created = connect_via_ssh_socks5(con, tun, failure_type);
+      }
+      tunnel_balance_record(&tun->balance, connection_created, (token_bucket_now() - handshake_start) / 1000000);
+      circuit_breaker_record_verdict(&tun->breaker, con->tunnel_verdict, time(NULL));
     }
 
     if (!connection_created && *failure_type == SOCKS5_REPLY_CONNECTION_REFUSED) {
@@ -148,6 +341,12 @@ int socks_connect(proxy_instance *proxy, service *srv, client_connection *con, i
       attempt_to_connect=0;
       set_client_connection_status(con, CCSTATUS_ERR_NETWORK,"Connection Refused","Connection to remote host was refused.");
     }
+    if (!connection_created && connect_attempt+1 >= tun_max && (*failure_type == SOCKS5_REPLY_TTL_EXPIRED || *failure_type == SOCKS5_REPLY_HOST_UNREACHABLE)) {
+      // connect_direct() already tried every address for the full connectTimeout; trying again won't help
+      trace("Connection timed out or host unreachable on every tunnel.");
+      ok=0;
+      attempt_to_connect=0;
+    }
   
     if (connection_created) { 
       attempt_to_connect=0;
@@ -166,15 +365,32 @@ int socks_connect(proxy_instance *proxy, service *srv, client_connection *con, i
         trace("Connection attempt failed. Giving up.");
         ok=0;
       } else if (attempt_to_connect) {
-        debug("Connection attempt failed. Will try next ssh_tunnel in a few milliseconds.");
-        usleep(100000);
+        debug("Connection attempt failed. Will try next ssh_tunnel in a few milliseconds, or as soon as a tunnel comes up.");
+        ssh_tunnel_wait_for_change(ready_generation, 100);
       }
     }
     connect_attempt++;
   } 
+  if (ok && con->fd_out >= 0) {
+    tcp_keepalive_set(con->fd_out, proxy->tcp_keepalive, proxy->tcp_user_timeout);
+  }
+  if (ok && cold_start && con->tunnel && con->tunnel != ssh_tunnel_direct && con->tunnel != ssh_tunnel_null) {
+    debug("Cold start: waited for ssh_tunnel %s to start",con->tunnel->name);
+    atomic_fetch_add(&ssh_tunnel_owner(con->tunnel)->cold_starts, 1);
+  }
   return ok;
 }
 
+// Once connected, the data can be moved by a shared thread instead of this one.
+// returns 1 if the null sink or an event loop took ownership of 'con' (including closing it),
+//         0 if the caller should call socks_connect_shuttle() itself.
+int socks_connect_handoff(client_connection *con) {
+  if (con->tunnel == ssh_tunnel_null) {
+    return null_sink_handoff(con);
+  }
+  return event_loop_handoff(con);
+}
+
 int socks_connect_shuttle(client_connection *con) {
   int ok=1;
   if (con->tunnel == ssh_tunnel_null) {
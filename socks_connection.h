@@ -9,6 +9,7 @@
 #include"client_connection.h"
 
 int socks_connect(proxy_instance *proxy, service *srv, client_connection *con, int *failure_type);
+int socks_connect_handoff(client_connection *con);
 int socks_connect_shuttle(client_connection *con);
 char *socks_connect_str_destination(client_connection *con, char *buf, int buflen);
 
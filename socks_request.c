@@ -0,0 +1,100 @@
+// Copyright 2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+// SPDX-License-Identifier: MIT-0
+
+#include<string.h>
+
+#include"socks5.h"
+#include"service_socks.h"
+#include"socks_request.h"
+
+// SOCKS4: version, command, port (2), IPv4 address (4), NUL-terminated user id
+int socks_request_parse4(unsigned char *buf, int len, socks_request *req) {
+  if (len < 8) {
+    return SOCKS_REQUEST_MORE;
+  }
+  req->command = buf[1];
+  req->port = ((unsigned int)buf[2]) << 8 | (unsigned int)buf[3];
+  req->address_type = SOCKS5_ADDRTYPE_IPV4;
+  memcpy(req->addr, &buf[4], 4);
+  for (int i=8; i<len && i<8+SOCKS_REQUEST_MAX_USERID; i++) {
+    if (buf[i] == 0) {
+      req->len = i+1;
+      return SOCKS_REQUEST_DONE;
+    }
+  }
+  if (len >= 8+SOCKS_REQUEST_MAX_USERID) {
+    return SOCKS_REQUEST_ERROR;
+  }
+  return SOCKS_REQUEST_MORE;
+}
+
+// SOCKS5 request: version, command, reserved, address type, address, port (2)
+// returns the request's length once complete, SOCKS_REQUEST_MORE or SOCKS_REQUEST_ERROR
+int socks_request_parse5(unsigned char *buf, int len, socks_request *req) {
+  if ((len >= 1 && buf[0] != 0x05) || (len >= 3 && buf[2] != 0x00)) {
+    return SOCKS_REQUEST_ERROR;
+  }
+  if (len >= 4 && buf[3] != SOCKS5_ADDRTYPE_IPV4 && buf[3] != SOCKS5_ADDRTYPE_IPV6 && buf[3] != SOCKS5_ADDRTYPE_DOMAIN) {
+    return SOCKS_REQUEST_ERROR;
+  }
+  if (len < 5) {
+    return SOCKS_REQUEST_MORE;
+  }
+  req->command = buf[1];
+  req->address_type = buf[3];
+  int addr_len;
+  int idx = 4;
+  if (req->address_type == SOCKS5_ADDRTYPE_IPV4) {
+    addr_len = 4;
+  } else if (req->address_type == SOCKS5_ADDRTYPE_IPV6) {
+    addr_len = 16;
+  } else {
+    addr_len = buf[4];
+    idx++;
+  }
+  if (len < idx+addr_len+2) {
+    return SOCKS_REQUEST_MORE;
+  }
+  memcpy(req->addr, &buf[idx], addr_len);
+  if (req->address_type == SOCKS5_ADDRTYPE_DOMAIN) {
+    req->addr[addr_len] = 0;
+  }
+  idx += addr_len;
+  req->port = ((unsigned int)buf[idx]) << 8 | (unsigned int)buf[idx+1];
+  return idx+2;
+}
+
+// Parse the first 'len' bytes the client sent.
+// returns SOCKS_REQUEST_*; with DONE, req->len bytes of buf were greeting and request
+int socks_request_parse(unsigned char *buf, int len, socks_request *req) {
+  memset(req, 0, sizeof(*req));
+  req->version = SOCKS_VERSION_ERROR;
+  if (len < 1) {
+    return SOCKS_REQUEST_MORE;
+  }
+  if (buf[0] != 0x04 && buf[0] != 0x05) {
+    return SOCKS_REQUEST_ERROR;
+  }
+  req->version = buf[0];
+  if (req->version == 4) {
+    return socks_request_parse4(buf, len, req);
+  }
+
+  if (len < 2) {
+    return SOCKS_REQUEST_MORE;
+  }
+  req->method_count = buf[1];
+  if (len < 2+req->method_count) {
+    return SOCKS_REQUEST_MORE;
+  }
+  req->greeting_len = 2+req->method_count;
+  int rc = socks_request_parse5(buf+req->greeting_len, len-req->greeting_len, req);
+  if (rc == SOCKS_REQUEST_MORE) {
+    return SOCKS_REQUEST_GREETING;
+  }
+  if (rc == SOCKS_REQUEST_ERROR) {
+    return SOCKS_REQUEST_ERROR;
+  }
+  req->len = req->greeting_len + rc;
+  return SOCKS_REQUEST_DONE;
+}
@@ -0,0 +1,35 @@
+// Copyright 2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+// SPDX-License-Identifier: MIT-0
+
+#ifndef SOCKS_REQUEST_H
+#define SOCKS_REQUEST_H
+
+// Parser for what a SOCKS client sends before the relay starts: a SOCKS4
+// request, or a SOCKS5 greeting followed by its request. The caller reads
+// into one buffer, as much as the client has sent, and parses the whole
+// buffer again after each read. A client that sends its SOCKS5 request
+// without waiting for the method reply is parsed in one go. Whatever
+// follows the request in the buffer is the client's first data.
+
+#define SOCKS_REQUEST_BUFFER_SIZE 4096 // read buffer; room for the largest request, plus what follows it
+#define SOCKS_REQUEST_MAX_USERID  1000 // SOCKS4 user id, including the NUL
+
+#define SOCKS_REQUEST_ERROR    -1 // malformed; see 'version' to tell a bad version from a bad request
+#define SOCKS_REQUEST_MORE      0 // need more bytes
+#define SOCKS_REQUEST_GREETING  1 // SOCKS5 greeting complete, request not yet; the method reply can go out
+#define SOCKS_REQUEST_DONE      2 // request complete
+
+typedef struct socks_request {
+  int version;          // 4 or 5; SOCKS_VERSION_ERROR until the first byte is in, or if it's neither
+  int method_count;     // SOCKS5: auth methods the client offered
+  int greeting_len;     // SOCKS5: bytes taken by the greeting, once complete; 0 for SOCKS4
+  int command;
+  int address_type;     // SOCKS5_ADDRTYPE_*; always IPv4 for SOCKS4
+  unsigned char addr[256]; // 4 or 16 bytes, or a NUL-terminated domain name of up to 255 characters
+  int port;
+  int len;              // bytes taken by greeting and request, once complete
+} socks_request;
+
+int socks_request_parse(unsigned char *buf, int len, socks_request *req);
+
+#endif // SOCKS_REQUEST_H
@@ -6,7 +6,13 @@
 #include<unistd.h>
 #include<errno.h>
 #include<sys/wait.h>
+#include<signal.h>
 #include<fcntl.h>
+#include<string.h>
+#include<poll.h>
+#include<sys/socket.h>
+#include<netinet/in.h>
+#include<arpa/inet.h>
 
 #include"log.h"
 #include"ssh_tunnel.h"
@@ -88,6 +94,121 @@ int create_tunnel_pipes(ssh_tunnel *ssh) {
 }
 
 
+void ssh_tunnel_probe_close(ssh_tunnel *ssh) {
+  int rc;
+  if (ssh->probe_fd >= 0) {
+    do {
+      rc = close(ssh->probe_fd);
+    } while (rc < 0 && errno == EINTR);
+  }
+  ssh->probe_fd=-1;
+  ssh->probe_stage=0;
+}
+
+// One non-blocking step of the readiness probe of a starting tunnel: connect
+// to its SOCKS port, send a SOCKS5 greeting and wait for ssh to accept it.
+// Called from the main loop, which polls every SSH_TUNNEL_PROBE_INTERVAL_MS
+// while any tunnel is starting. Marks the tunnel READY on success.
+void ssh_tunnel_probe(ssh_tunnel *ssh) {
+  int rc;
+  if (ssh->probe_stage == 0) {
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(ssh->socks_port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    ssh->probe_fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (ssh->probe_fd < 0) {
+      errorNum("socket() for readiness probe of %s", ssh->name);
+      return;
+    }
+    int flags = fcntl(ssh->probe_fd, F_GETFL);
+    if (flags < 0 || fcntl(ssh->probe_fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+      errorNum("fcntl() for readiness probe of %s", ssh->name);
+      ssh_tunnel_probe_close(ssh);
+      return;
+    }
+    do {
+      rc = connect(ssh->probe_fd, (struct sockaddr*)&addr, sizeof(addr));
+    } while (rc < 0 && errno == EINTR);
+    if (rc < 0 && errno != EINPROGRESS) {
+      trace2("readiness probe of %s: %s", ssh->name, strerror(errno));
+      ssh_tunnel_probe_close(ssh); // not listening yet; try again next time round
+      return;
+    }
+    ssh->probe_stage = 1;
+    ssh->probe_started_ms = ssh_tunnel_now_ms();
+  }
+
+  struct pollfd pfd;
+  pfd.fd = ssh->probe_fd;
+  pfd.events = ssh->probe_stage == 1 ? POLLOUT : POLLIN;
+  pfd.revents = 0;
+  do {
+    rc = poll(&pfd, 1, 0);
+  } while (rc < 0 && errno == EINTR);
+  if (rc == 0) {
+    if (ssh_tunnel_now_ms() - ssh->probe_started_ms >= SSH_TUNNEL_PROBE_REPLY_MS) {
+      debug("readiness probe of %s got no reply, retrying", ssh->name);
+      ssh_tunnel_probe_close(ssh);
+    }
+    return;
+  }
+  if (rc < 0) {
+    errorNum("poll() for readiness probe of %s", ssh->name);
+    ssh_tunnel_probe_close(ssh);
+    return;
+  }
+
+  if (ssh->probe_stage == 1) {
+    int so_error = 0;
+    socklen_t len = sizeof(so_error);
+    if (getsockopt(ssh->probe_fd, SOL_SOCKET, SO_ERROR, &so_error, &len) < 0) {
+      so_error = errno;
+    }
+    unsigned char greeting[3] = { 5, 1, 0 }; // SOCKS5, one method: no authentication
+    if (so_error == 0) {
+      do {
+        rc = send(ssh->probe_fd, greeting, sizeof(greeting), 0);
+      } while (rc < 0 && errno == EINTR);
+      if (rc != sizeof(greeting)) {
+        so_error = rc < 0 ? errno : EIO;
+      }
+    }
+    if (so_error != 0) {
+      trace2("readiness probe of %s: %s", ssh->name, strerror(so_error));
+      ssh_tunnel_probe_close(ssh);
+      return;
+    }
+    ssh->probe_stage = 2;
+    return;
+  }
+
+  unsigned char reply[2];
+  do {
+    rc = recv(ssh->probe_fd, reply, sizeof(reply), 0);
+  } while (rc < 0 && errno == EINTR);
+  ssh_tunnel_probe_close(ssh);
+  if (rc == 2 && reply[0] == 5 && reply[1] == 0) {
+    ssh->startup_ms = ssh_tunnel_now_ms() - ssh->fork_ms;
+    ssh->ready_count++;
+    info("SSH tunnel %s ready after %lli ms", ssh->name, ssh->startup_ms);
+    ssh_tunnel_set_state(ssh, SSH_TUNNEL_READY);
+  } else {
+    trace2("readiness probe of %s: unexpected reply (%i bytes)", ssh->name, rc);
+  }
+}
+
+// Should the main loop poll more often to probe starting tunnels?
+int ssh_tunnels_starting(ssh_tunnel *ssh_tunnel_list) {
+  for (ssh_tunnel *ssh=ssh_tunnel_list; ssh; ssh = ssh->next) {
+    if (atomic_load(&ssh->state) == SSH_TUNNEL_STARTING) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
 int ssh_report_interval=10;
 int check_ssh_tunnel(ssh_tunnel *ssh) {
   int is_running=0;
@@ -97,6 +218,10 @@ int check_ssh_tunnel(ssh_tunnel *ssh) {
   int should_be_running = 0;
   if (ssh->mark > 0) {
     should_be_running=1;
+    ssh->last_used = cur_time;
+  }
+  if (ssh->keep_warm) {
+    should_be_running=1;
   }
 
 
@@ -117,6 +242,8 @@ int check_ssh_tunnel(ssh_tunnel *ssh) {
     } else if (tmp > 0) {
       debug("SSH child for %s (%llu) pid %i exited, code = %i",ssh->name, ssh->id, ssh->pid, exit_code);
       ssh_tunnel_close_pipes(ssh);
+      ssh_tunnel_probe_close(ssh);
+      ssh_tunnel_set_state(ssh, SSH_TUNNEL_DOWN);
       ssh->pid = -1;
     } else {
       // should never happen. 
@@ -128,6 +255,18 @@ int check_ssh_tunnel(ssh_tunnel *ssh) {
     needs_to_run=1;
   }
 
+  if (is_running && !should_be_running && ssh->idle_timeout > 0 && cur_time - ssh->last_used >= ssh->idle_timeout) {
+    if (atomic_load(&ssh->state) != SSH_TUNNEL_DOWN) {
+      info("SSH tunnel %s unused for %i seconds, stopping pid %i", ssh->name, ssh->idle_timeout, ssh->pid);
+    }
+    // no new connection may use it from now on; waitpid() above reaps it once it has gone
+    ssh_tunnel_probe_close(ssh);
+    ssh_tunnel_set_state(ssh, SSH_TUNNEL_DOWN);
+    if (kill(ssh->pid, SIGTERM) < 0 && errno != ESRCH) {
+      errorNum("kill() ssh child for %s pid %i",ssh->name,ssh->pid);
+    }
+  }
+
   if (!is_running && needs_to_run) {
     if (time(NULL) - ssh->start_time < 2) { // "poor-programmer"'s rate throttling
       needs_to_run=0;
@@ -140,6 +279,9 @@ int check_ssh_tunnel(ssh_tunnel *ssh) {
     ssh->pid = fork();
     if (ssh->pid > 0) {
       ssh->start_time = time(NULL);
+      ssh->fork_ms = ssh_tunnel_now_ms();
+      ssh->last_used = ssh->start_time;
+      ssh_tunnel_set_state(ssh, SSH_TUNNEL_STARTING);
       debug("SSH child started for %s (%i) pid %i: %s", ssh->name, ssh->id, ssh->pid, ssh->command_to_run);
     } else if (ssh->pid == 0) {
       int rc;
@@ -160,7 +302,8 @@ int check_ssh_tunnel(ssh_tunnel *ssh) {
         unexpected_exit(83,"dup2()");
       }
       char cmd_buf[8192];
-      snprintf(cmd_buf,sizeof(cmd_buf),"exec %s",ssh->command_to_run);
+      char command[8192];
+      snprintf(cmd_buf,sizeof(cmd_buf),"exec %s",ssh_tunnel_command(ssh,command,sizeof(command)));
       rc=execlp( "/bin/bash", "bash", "-c", cmd_buf, NULL);
       errorNum("execlp() returned %i",rc);
       unexpected_exit(84,"execlp()");
@@ -168,6 +311,10 @@ int check_ssh_tunnel(ssh_tunnel *ssh) {
       errorNum("fork()");
     }
   } 
+
+  if (ssh->pid > 0 && atomic_load(&ssh->state) == SSH_TUNNEL_STARTING) {
+    ssh_tunnel_probe(ssh);
+  }
   return did_update;
 }
 
@@ -207,9 +354,44 @@ void check_ssh_tunnels(proxy_instance *proxy_instance_list, ssh_tunnel *ssh_tunn
     }
   } 
 
+  // A tunnel with replicas runs no ssh itself: if it, or any of its replicas, is
+  // needed then they all are, so a replica that exits is restarted on its own.
+  for (ssh=ssh_tunnel_list; ssh; ssh = ssh->next) {
+    for (int i=0; i<ssh->replica_count; i++) {
+      ssh->mark += ssh->replica[i]->mark;
+      ssh->connection_count += ssh->replica[i]->connection_count;
+    }
+  }
+
+  // "standby warm": a failover rule's second tunnel runs whenever its first does
+  for (proxy=proxy_instance_list; proxy; proxy = proxy->next) {
+    for (route_rule *route=proxy->route_rule_list; route; route=route->next) {
+      if (route->standby != ROUTE_STANDBY_WARM || route->strategy != ROUTE_STRATEGY_FAILOVER) {
+        continue;
+      }
+      ssh_tunnel *primary = route->tunnel[0];
+      ssh_tunnel *standby = primary ? route->tunnel[1] : NULL;
+      if (standby == NULL || standby == ssh_tunnel_direct || standby == ssh_tunnel_null) {
+        continue;
+      }
+      if ((primary->mark > 0 || primary->keep_warm) && standby->mark == 0) {
+        standby->mark = 1;
+      }
+    }
+  }
+
+  for (ssh=ssh_tunnel_list; ssh; ssh = ssh->next) {
+    for (int i=0; i<ssh->replica_count && ssh->mark > 0; i++) {
+      if (ssh->replica[i]->mark == 0) {
+        ssh->replica[i]->mark = 1;
+      }
+    }
+  }
+
   // Now go update tunnel status and check any that should be running. 
   for (ssh=ssh_tunnel_list; ssh; ssh = ssh->next) {
-    if (ssh == ssh_tunnel_direct || ssh == ssh_tunnel_null) {
+    tunnel_balance_set_connections(&ssh->balance, ssh->connection_count);
+    if (ssh == ssh_tunnel_direct || ssh == ssh_tunnel_null || ssh->replica_count > 0 || ssh->command_to_run[0] == 0) {
       continue;
     }
     check_ssh_tunnel(ssh);
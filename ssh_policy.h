@@ -7,6 +7,7 @@
 #include"proxy_instance.h"
 #include"ssh_tunnel.h"
 
+int  ssh_tunnels_starting(ssh_tunnel *ssh_tunnel_list);
 void check_ssh_tunnels(proxy_instance *proxy_instance_list, ssh_tunnel *ssh_tunnel_list);
 
 #endif // SSH_POLICY_H
@@ -5,8 +5,12 @@
 #include<stdlib.h>
 #include<unistd.h>
 #include<string.h>
+#include<pthread.h>
+#include<sys/time.h>
+#include<arpa/inet.h>
 
 #include"log.h"
+#include"dns_util.h"
 #include"ssh_tunnel.h"
 
 unsigned long long ssh_id_pool=0;
@@ -15,6 +19,12 @@ ssh_tunnel *ssh_tunnel_direct;
 ssh_tunnel *ssh_tunnel_socks_proxy;
 ssh_tunnel *ssh_tunnel_null;
 
+// Signalled whenever any tunnel changes state. The generation counter lets a
+// waiter notice a change that happened between its check and its wait.
+pthread_mutex_t ssh_tunnel_state_mutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t  ssh_tunnel_state_cond  = PTHREAD_COND_INITIALIZER;
+unsigned long long ssh_tunnel_state_gen = 0;
+
 ssh_tunnel *new_ssh_tunnel() {
   ssh_id_pool++;
   trace("new_ssh_tunnel(%llu)",ssh_id_pool);
@@ -28,6 +38,28 @@ ssh_tunnel *new_ssh_tunnel() {
   ssh->command_to_run[0]=0;
   ssh->socks_port=0;
   ssh->name[0]=0;
+  ssh->type=TUNNEL_TYPE_SSH;
+  host_id_init(&ssh->server);
+  if (pthread_mutex_init(&ssh->server_mutex,NULL)) {
+    errorNum("pthread_mutex_init()");
+    unexpected_exit(73,"pthread_mutex_init()");
+  }
+  ssh->server_addr_len=0;
+  ssh->server_resolved=0;
+  ssh->server_resolving=0;
+  token_bucket_init(&ssh->rate_limit[0],0,0);
+  token_bucket_init(&ssh->rate_limit[1],0,0);
+  ssh->mark=0;
+  ssh->connection_count=0;
+  tunnel_balance_init(&ssh->balance);
+  circuit_breaker_init(&ssh->breaker,0,CIRCUIT_BREAKER_DEFAULT_WINDOW,CIRCUIT_BREAKER_DEFAULT_COOLDOWN);
+  ssh->replicas=1;
+  ssh->keep_warm=0;
+  ssh->idle_timeout=0;
+  ssh->pipeline=1;
+  ssh->pool=NULL;
+  ssh->replica_count=0;
+  atomic_init(&ssh->replica_next,0);
 
   ssh->pid=-1;
   ssh->start_time=0;
@@ -43,6 +75,16 @@ ssh_tunnel *new_ssh_tunnel() {
   ssh->child_stdout_fd=-1;
   ssh->child_stderr_fd=-1;
 
+  atomic_init(&ssh->state, SSH_TUNNEL_DOWN);
+  ssh->probe_fd=-1;
+  ssh->probe_stage=0;
+  ssh->probe_started_ms=0;
+  ssh->fork_ms=0;
+  ssh->startup_ms=-1;
+  ssh->ready_count=0;
+  ssh->last_used=0;
+  atomic_init(&ssh->cold_starts,0);
+
   return ssh;
 }
 
@@ -133,3 +175,264 @@ ssh_tunnel *parse_ssh_tunnel_spec(char *str) {
 
 }
 
+
+int ssh_tunnel_type_from_str(char *str) {
+  if (strcmp(str,"ssh")==0) {
+    return TUNNEL_TYPE_SSH;
+  } else if (strcmp(str,"socks5")==0) {
+    return TUNNEL_TYPE_SOCKS5;
+  } else if (strcmp(str,"httpConnect")==0) {
+    return TUNNEL_TYPE_HTTP_CONNECT;
+  }
+  return TUNNEL_TYPE_INVALID;
+}
+
+char *ssh_tunnel_type_str(int type) {
+  switch (type) {
+    case TUNNEL_TYPE_SSH:          return "ssh";
+    case TUNNEL_TYPE_SOCKS5:       return "socks5";
+    case TUNNEL_TYPE_HTTP_CONNECT: return "httpConnect";
+  }
+  return "invalid";
+}
+
+// "host:port", "1.2.3.4:port" or "[::1]:port"
+// returns 1 if ok, 0 if malformed
+int ssh_tunnel_parse_server(ssh_tunnel *ssh, char *str) {
+  char host[MAX_DNS];
+  char *colon = strrchr(str,':');
+  if (colon == NULL || colon == str) {
+    return 0;
+  }
+  int port;
+  char extra;
+  if (sscanf(colon+1,"%i%c",&port,&extra) != 1 || port <= 0 || port > 65535) {
+    return 0;
+  }
+  int len = colon - str;
+  if (str[0] == '[' && colon[-1] == ']') {
+    str++;
+    len -= 2;
+  }
+  if (len <= 0 || len >= (int)sizeof(host)) {
+    return 0;
+  }
+  memcpy(host,str,len);
+  host[len]=0;
+  host_id_init(&ssh->server);
+  host_id_set_name(&ssh->server,host);
+  host_id_set_port(&ssh->server,port);
+  return 1;
+}
+
+// Catch tunnels whose settings don't go together.
+// returns 1 if ok, 0 otherwise
+int ssh_tunnel_validate(ssh_tunnel *head) {
+  for (ssh_tunnel *ssh=head; ssh; ssh=ssh->next) {
+    if (ssh->type == TUNNEL_TYPE_SSH) {
+      continue;
+    }
+    if (!host_id_has_name(&ssh->server)) {
+      error("ssh %s: type %s needs a server <host>:<port>",ssh->name,ssh_tunnel_type_str(ssh->type));
+      return 0;
+    }
+    if (ssh->command_to_run[0] || ssh->replicas > 1 || ssh->keep_warm || ssh->idle_timeout > 0) {
+      error("ssh %s: type %s is not run by us; command, replicas, keepWarm and idleTimeout don't apply",ssh->name,ssh_tunnel_type_str(ssh->type));
+      return 0;
+    }
+    // not fatal: it's looked up again when a connection needs it
+    if (!ssh_tunnel_resolve_server(ssh)) {
+      warn("ssh %s: can't resolve server %s yet",ssh->name,host_id_get_name(&ssh->server));
+    }
+  }
+  return 1;
+}
+
+// Look up an unmanaged upstream's "server" (blocking) and keep the result for ssh_tunnel_addr().
+// A failed lookup keeps the previous address, if there was one.
+// returns 1 if it resolved, 0 otherwise
+int ssh_tunnel_resolve_server(ssh_tunnel *ssh) {
+  host_id id = ssh->server; // a copy; resolving writes to it
+  int ok = resolve_dns_for_host_id(&id);
+  pthread_mutex_lock(&ssh->server_mutex);
+  if (ok) {
+    struct sockaddr *sa = host_id_get_addr(&id);
+    ssh->server_addr_len = sa->sa_family == AF_INET6 ? sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in);
+    memcpy(&ssh->server_addr, sa, ssh->server_addr_len);
+  }
+  ssh->server_resolved = time(NULL);
+  ssh->server_resolving = 0;
+  pthread_mutex_unlock(&ssh->server_mutex);
+  return ok;
+}
+
+void *ssh_tunnel_resolve_thread(void *data) {
+  ssh_tunnel_resolve_server((ssh_tunnel*)data);
+  return NULL;
+}
+
+// Where the tunnel's SOCKS5 or HTTP server is: 127.0.0.1:socksPort for ssh,
+// which we run locally, otherwise where "server" last resolved to. This never
+// blocks: once that is SSH_TUNNEL_SERVER_TTL seconds old a thread of its own
+// looks it up again, so a gateway's DNS changes are picked up, while
+// connections carry on with the address they have.
+// returns the length of the address written to 'addr', 0 if it hasn't resolved
+socklen_t ssh_tunnel_addr(ssh_tunnel *ssh, struct sockaddr_storage *addr) {
+  memset(addr, 0, sizeof(*addr));
+  if (ssh->type == TUNNEL_TYPE_SSH) {
+    struct sockaddr_in *sin = (struct sockaddr_in*)addr;
+    sin->sin_family = AF_INET;
+    sin->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    sin->sin_port = htons(ssh->socks_port);
+    return sizeof(struct sockaddr_in);
+  }
+  time_t now = time(NULL);
+  pthread_mutex_lock(&ssh->server_mutex);
+  socklen_t len = ssh->server_addr_len;
+  memcpy(addr, &ssh->server_addr, len);
+  int stale = now - ssh->server_resolved >= (len > 0 ? SSH_TUNNEL_SERVER_TTL : SSH_TUNNEL_SERVER_RETRY);
+  if (stale && !ssh->server_resolving) {
+    pthread_attr_t attr;
+    pthread_t thread;
+    ssh->server_resolving = 1;
+    if (pthread_attr_init(&attr) == 0) {
+      pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+      if (pthread_create(&thread, &attr, ssh_tunnel_resolve_thread, ssh) != 0) {
+        errorNum("pthread_create() for DNS lookup of %s",host_id_get_name(&ssh->server));
+        ssh->server_resolving = 0;
+      }
+      pthread_attr_destroy(&attr);
+    } else {
+      ssh->server_resolving = 0;
+    }
+  }
+  pthread_mutex_unlock(&ssh->server_mutex);
+  return len;
+}
+
+// Create the replicas of every tunnel configured with "replicas" > 1, named
+// <tunnel>.1, <tunnel>.2, ... on consecutive SOCKS ports from the tunnel's
+// own, and insert them into the list right after it.
+// returns 1 if ok, 0 if a tunnel's replicas can't be told apart
+int ssh_tunnel_create_replicas(ssh_tunnel *head) {
+  for (ssh_tunnel *ssh=head; ssh; ssh=ssh->next) {
+    if (ssh->replicas <= 1 || ssh->pool != NULL || ssh->replica_count > 0) {
+      continue;
+    }
+    if (strstr(ssh->command_to_run,"%p") == NULL) {
+      error("ssh %s: with replicas, the command must contain %%p where each replica's socksPort goes",ssh->name);
+      return 0;
+    }
+    if (ssh->socks_port <= 0 || ssh->socks_port + ssh->replicas - 1 > 65535) {
+      error("ssh %s: socksPort %i leaves no room for %i replicas",ssh->name,ssh->socks_port,ssh->replicas);
+      return 0;
+    }
+    ssh_tunnel *prev = ssh;
+    for (int i=0; i<ssh->replicas; i++) {
+      ssh_tunnel *rep = new_ssh_tunnel();
+      if (snprintf(rep->name,sizeof(rep->name),"%s.%i",ssh->name,i+1) >= (int)sizeof(rep->name)) {
+        error("ssh %s: name too long for its replicas' names",ssh->name);
+        return 0;
+      }
+      rep->socks_port = ssh->socks_port + i;
+      strncpy(rep->command_to_run,ssh->command_to_run,sizeof(rep->command_to_run)-1);
+      rep->command_to_run[sizeof(rep->command_to_run)-1]=0;
+      rep->log = ssh->log;
+      rep->keep_warm = ssh->keep_warm;
+      rep->idle_timeout = ssh->idle_timeout;
+      rep->pipeline = ssh->pipeline;
+      rep->breaker.threshold = ssh->breaker.threshold; // new_ssh_tunnel() set up the rest
+      rep->breaker.window = ssh->breaker.window;
+      rep->breaker.cooldown = ssh->breaker.cooldown;
+      rep->pool = ssh;
+      ssh->replica[ssh->replica_count++] = rep;
+      rep->next = prev->next;
+      prev->next = rep;
+      prev = rep;
+    }
+    debug("ssh %s: %i replicas on ports %i-%i",ssh->name,ssh->replica_count,ssh->socks_port,ssh->socks_port+ssh->replica_count-1);
+    ssh = prev;
+  }
+  return 1;
+}
+
+// Rate limits are set on the tunnel, and shared by all of its replicas.
+ssh_tunnel *ssh_tunnel_owner(ssh_tunnel *ssh) {
+  return ssh->pool ? ssh->pool : ssh;
+}
+
+// The tunnel's command with every "%p" replaced by its socks port.
+char *ssh_tunnel_command(ssh_tunnel *ssh, char *buf, int buflen) {
+  char port[20];
+  snprintf(port,sizeof(port),"%i",ssh->socks_port);
+  int len=0;
+  for (char *src=ssh->command_to_run; *src && len < buflen-1; src++) {
+    if (src[0] == '%' && src[1] == 'p') {
+      for (char *p=port; *p && len < buflen-1; p++) {
+        buf[len++] = *p;
+      }
+      src++;
+    } else {
+      buf[len++] = *src;
+    }
+  }
+  buf[len]=0;
+  return buf;
+}
+
+long long ssh_tunnel_now_ms() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+void ssh_tunnel_set_state(ssh_tunnel *ssh, int state) {
+  if (atomic_load(&ssh->state) == state) {
+    return;
+  }
+  pthread_mutex_lock(&ssh_tunnel_state_mutex);
+  atomic_store(&ssh->state, state);
+  ssh_tunnel_state_gen++;
+  pthread_cond_broadcast(&ssh_tunnel_state_cond);
+  pthread_mutex_unlock(&ssh_tunnel_state_mutex);
+}
+
+// Tunnels without a command aren't started by us, so there's nothing to wait for.
+int ssh_tunnel_is_ready(ssh_tunnel *ssh) {
+  return ssh->command_to_run[0] == 0 || atomic_load(&ssh->state) == SSH_TUNNEL_READY;
+}
+
+char *ssh_tunnel_state_str(int state) {
+  switch (state) {
+    case SSH_TUNNEL_STARTING: return "starting";
+    case SSH_TUNNEL_READY:    return "ready";
+  }
+  return "down";
+}
+
+unsigned long long ssh_tunnel_state_generation() {
+  pthread_mutex_lock(&ssh_tunnel_state_mutex);
+  unsigned long long gen = ssh_tunnel_state_gen;
+  pthread_mutex_unlock(&ssh_tunnel_state_mutex);
+  return gen;
+}
+
+// Block until some tunnel changes state after 'generation' was read, or timeout_ms passes.
+void ssh_tunnel_wait_for_change(unsigned long long generation, int timeout_ms) {
+  if (timeout_ms <= 0) {
+    return;
+  }
+  struct timeval now;
+  struct timespec deadline;
+  gettimeofday(&now, NULL);
+  long long nsec = (long long)now.tv_usec * 1000 + (long long)(timeout_ms % 1000) * 1000000;
+  deadline.tv_sec = now.tv_sec + timeout_ms / 1000 + nsec / 1000000000;
+  deadline.tv_nsec = nsec % 1000000000;
+
+  pthread_mutex_lock(&ssh_tunnel_state_mutex);
+  int rc = 0;
+  while (ssh_tunnel_state_gen == generation && rc == 0) {
+    rc = pthread_cond_timedwait(&ssh_tunnel_state_cond, &ssh_tunnel_state_mutex, &deadline);
+  }
+  pthread_mutex_unlock(&ssh_tunnel_state_mutex);
+}
@@ -5,15 +5,19 @@
 #define SSH_TUNNEL_H
 
 #include<time.h>
+#include<stdatomic.h>
 
 #include"log.h"
+#include"host_id.h"
+#include"token_bucket.h"
+#include"tunnel_balance.h"
+#include"circuit_breaker.h"
 
-// TODO: we should support connecting to a SOCKS5 proxy either not managed by this application, or in a remote host. Right now, it *must* be SSH running locally.
-// example: 
-//   - I want to use an interface different than 127.0.0.1 for the socks proxy Im connecting to
-//   - I want to connect to some other host which is already running a socks5 proxy
-// in other words, this file must be refactored from "ssh_tunnel" to <something else> which is a super-set
-// of ssh_tunnel, direct, null, non-managed local socks proxy, and non-managed remote proxy. 
+// An ssh_tunnel is any upstream a route can go "via": by default an ssh
+// process we run locally (type ssh, SOCKS5 on 127.0.0.1:socksPort), or an
+// already-running SOCKS5 or HTTP CONNECT gateway that we don't manage
+// (type socks5 / httpConnect, at "server" host:port).
+// TODO: direct and null are still special ssh_tunnel instances rather than types.
 
 /*
 // via
@@ -39,20 +43,68 @@ transport
 
 */
 
+// Readiness of the SOCKS port an ssh child provides. The main thread moves a
+// tunnel to STARTING when it forks ssh, probes the port with a SOCKS5
+// greeting until ssh answers, and then marks it READY; connection threads
+// wait on ssh_tunnel_wait_for_change() instead of retrying blindly.
+#define SSH_TUNNEL_DOWN     0
+#define SSH_TUNNEL_STARTING 1
+#define SSH_TUNNEL_READY    2
+
+#define SSH_TUNNEL_PROBE_INTERVAL_MS   20   // main loop poll timeout while a tunnel is starting
+#define SSH_TUNNEL_PROBE_REPLY_MS    2000   // give up on a probe that got no greeting reply
+
+#define SSH_TUNNEL_MAX_REPLICAS        16   // ssh processes per tunnel
+#define SSH_TUNNEL_MAX_NAME_LEN       196   // leaves room in 'name' for a replica's ".16"
+
+#define SSH_TUNNEL_SERVER_TTL          60   // seconds before an unmanaged upstream's address is looked up again
+#define SSH_TUNNEL_SERVER_RETRY         5   // seconds between lookups while it doesn't resolve
+
+#define TUNNEL_TYPE_SSH          0 // ssh -D run by us; SOCKS5 on 127.0.0.1:socks_port
+#define TUNNEL_TYPE_SOCKS5       1 // unmanaged SOCKS5 server at 'server'
+#define TUNNEL_TYPE_HTTP_CONNECT 2 // unmanaged HTTP proxy at 'server', using CONNECT
+#define TUNNEL_TYPE_INVALID     -1
+
 typedef struct ssh_tunnel {
   struct ssh_tunnel *next;
   unsigned long long id;
 
   // specified by the user
   char   name[200];            // unique name for this tunnel
+  int    type;                 // TUNNEL_TYPE_*
+  host_id server;              // "server"; name and port of an unmanaged upstream
   int    socks_port;           // what local port does the SOCKS5 server come up on?
   char   command_to_run[8192]; // how do we build the tunnel?
   log_config log; // TODO: log SSH activity to the appropriate log
+  token_bucket rate_limit[2]; // shared by every connection through this tunnel; [0] up (client -> server), [1] down
+  circuit_breaker breaker;    // "circuitBreaker"; skips the tunnel after repeated handshake failures
+  int    replicas;             // "replicas"; ssh processes to run, on socks_port, socks_port+1, ...
+  int    keep_warm;            // "keepWarm"; run ssh even when no connection needs it
+  int    idle_timeout;         // "idleTimeout"; stop ssh after this many seconds unused, 0 = never
+  int    pipeline;             // "pipelineHandshake"; send the SOCKS5 greeting and command in one write
+
+  // A tunnel with more than one replica runs no ssh itself. Each replica is
+  // a tunnel of its own in the list, supervised and restarted on its own,
+  // and connections are spread across them.
+  struct ssh_tunnel *pool;     // for a replica, the tunnel it belongs to; otherwise NULL
+  struct ssh_tunnel *replica[SSH_TUNNEL_MAX_REPLICAS];
+  int    replica_count;        // 0 unless replicas > 1
+  atomic_uint replica_next;    // rotates the choice between equally loaded replicas
+
+  // where 'server' resolved to. Looked up off the connection threads, which only read it.
+  pthread_mutex_t server_mutex;
+  struct sockaddr_storage server_addr; // ** USE MUTEX
+  socklen_t server_addr_len;           // ** USE MUTEX 0 if it hasn't resolved
+  time_t server_resolved;              // ** USE MUTEX when it was last looked up
+  int    server_resolving;             // ** USE MUTEX a lookup is running
 
   // for use by main thread when marking SSH tunnels that need to be active
   int mark; 
   int connection_count;
 
+  // handshake latency / failure EWMA and load, for rules that balance between tunnels
+  tunnel_balance_stats balance;
+
   // run-time info
   pid_t  pid;
   time_t start_time;
@@ -64,6 +116,17 @@ typedef struct ssh_tunnel {
   int    child_stdout_fd;
   int    child_stderr_fd;
 
+  // readiness; 'state' is read by connection threads, the rest is main thread only
+  atomic_int state;          // SSH_TUNNEL_*
+  int    probe_fd;           // non-blocking socket to socks_port while STARTING, or -1
+  int    probe_stage;        // 0 = none, 1 = connecting, 2 = greeting sent
+  long long probe_started_ms;
+  long long fork_ms;         // when ssh was last started
+  long long startup_ms;      // fork to READY for the last start, -1 if never ready
+  unsigned long long ready_count;
+  time_t last_used;          // last time a connection needed the tunnel
+  atomic_ulong cold_starts;  // connections that had to wait for ssh to start
+
 } ssh_tunnel;
 
 // "special" tunnels
@@ -80,4 +143,21 @@ ssh_tunnel *parse_ssh_tunnel_spec(char *str);
 void reset_ssh_tunnel(ssh_tunnel *ssh);
 ssh_tunnel *ssh_tunnel_init(ssh_tunnel *head);
 
+int  ssh_tunnel_type_from_str(char *str);
+char *ssh_tunnel_type_str(int type);
+int  ssh_tunnel_parse_server(ssh_tunnel *ssh, char *str);
+int  ssh_tunnel_validate(ssh_tunnel *head);
+int  ssh_tunnel_resolve_server(ssh_tunnel *ssh);
+socklen_t ssh_tunnel_addr(ssh_tunnel *ssh, struct sockaddr_storage *addr);
+int  ssh_tunnel_create_replicas(ssh_tunnel *head);
+ssh_tunnel *ssh_tunnel_owner(ssh_tunnel *ssh);
+char *ssh_tunnel_command(ssh_tunnel *ssh, char *buf, int buflen);
+
+long long ssh_tunnel_now_ms();
+void ssh_tunnel_set_state(ssh_tunnel *ssh, int state);
+int  ssh_tunnel_is_ready(ssh_tunnel *ssh);
+char *ssh_tunnel_state_str(int state);
+unsigned long long ssh_tunnel_state_generation();
+void ssh_tunnel_wait_for_change(unsigned long long generation, int timeout_ms);
+
 #endif // SSH_TUNNEL_H
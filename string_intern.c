@@ -0,0 +1,104 @@
+// Copyright 2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+// SPDX-License-Identifier: MIT-0
+
+#include<stdlib.h>
+#include<string.h>
+
+#include"log.h"
+#include"string_intern.h"
+
+#define STRING_INTERN_ALIGN sizeof(void*) // blobs may hold pointers
+
+string_intern *new_string_intern() {
+  string_intern *si = calloc(1, sizeof(string_intern));
+  if (si == NULL) {
+    unexpected_exit(66,"Error allocating string_intern");
+  }
+  si->table_size = 1024;
+  si->table = calloc(si->table_size, sizeof(string_intern_entry));
+  if (si->table == NULL) {
+    unexpected_exit(66,"Error allocating string_intern");
+  }
+  si->bytes = sizeof(string_intern) + si->table_size * sizeof(string_intern_entry);
+  return si;
+}
+
+unsigned int string_intern_hash(unsigned char *data, size_t len) {
+  unsigned int hash = 5381;
+  for (size_t i=0; i<len; i++) {
+    hash = hash * 33 + data[i];
+  }
+  return hash;
+}
+
+void *string_intern_alloc(string_intern *si, size_t len) {
+  size_t aligned = (len + STRING_INTERN_ALIGN - 1) & ~(STRING_INTERN_ALIGN - 1);
+  string_intern_chunk *chunk = si->chunk;
+  if (chunk == NULL || chunk->used + aligned > chunk->size) {
+    size_t size = aligned > STRING_INTERN_CHUNK_SIZE ? aligned : STRING_INTERN_CHUNK_SIZE;
+    chunk = malloc(sizeof(string_intern_chunk) + size);
+    if (chunk == NULL) {
+      unexpected_exit(66,"Error allocating string_intern chunk");
+    }
+    chunk->size = size;
+    chunk->used = 0;
+    chunk->next = si->chunk;
+    si->chunk = chunk;
+    si->bytes += sizeof(string_intern_chunk) + size;
+  }
+  void *ptr = chunk->data + chunk->used;
+  chunk->used += aligned;
+  return ptr;
+}
+
+// keep the table at most half full
+void string_intern_grow(string_intern *si) {
+  size_t new_size = si->table_size * 2;
+  string_intern_entry *new_table = calloc(new_size, sizeof(string_intern_entry));
+  if (new_table == NULL) {
+    unexpected_exit(66,"Error allocating string_intern");
+  }
+  for (size_t i=0; i<si->table_size; i++) {
+    string_intern_entry *e = &si->table[i];
+    if (e->data == NULL) {
+      continue;
+    }
+    size_t slot = e->hash & (new_size - 1);
+    while (new_table[slot].data != NULL) {
+      slot = (slot + 1) & (new_size - 1);
+    }
+    new_table[slot] = *e;
+  }
+  free(si->table);
+  si->bytes += (new_size - si->table_size) * sizeof(string_intern_entry);
+  si->table = new_table;
+  si->table_size = new_size;
+}
+
+// returns the arena's copy of 'len' bytes at 'data', making one if this is the first time
+void *string_intern_bytes(string_intern *si, void *data, size_t len) {
+  unsigned int hash = string_intern_hash(data, len);
+  size_t slot = hash & (si->table_size - 1);
+  while (si->table[slot].data != NULL) {
+    string_intern_entry *e = &si->table[slot];
+    if (e->hash == hash && e->len == len && memcmp(e->data, data, len) == 0) {
+      return e->data;
+    }
+    slot = (slot + 1) & (si->table_size - 1);
+  }
+
+  void *copy = string_intern_alloc(si, len);
+  memcpy(copy, data, len);
+  si->table[slot].data = copy;
+  si->table[slot].len = len;
+  si->table[slot].hash = hash;
+  si->count++;
+  if (si->count * 2 > si->table_size) {
+    string_intern_grow(si);
+  }
+  return copy;
+}
+
+char *string_intern_str(string_intern *si, char *str) {
+  return string_intern_bytes(si, str, strlen(str) + 1);
+}
@@ -0,0 +1,46 @@
+// Copyright 2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+// SPDX-License-Identifier: MIT-0
+
+#ifndef STRING_INTERN_H
+#define STRING_INTERN_H
+
+#include<stddef.h>
+
+// Arena of interned strings and other small read-only blobs.
+//
+// Interning the same bytes twice returns the same pointer, so a million route
+// rules that say "endsWith .example.com via bastion" share one copy of
+// ".example.com" and one tunnel list. The copies are packed into large chunks
+// instead of a malloc() each, and live as long as the arena, which is never
+// freed.
+//
+// Not thread safe: it is filled while the config loads, and only read after.
+
+#define STRING_INTERN_CHUNK_SIZE (256 * 1024)
+
+typedef struct string_intern_chunk {
+  struct string_intern_chunk *next;
+  size_t size;
+  size_t used;
+  char data[];
+} string_intern_chunk;
+
+typedef struct string_intern_entry {
+  void *data; // NULL if the slot is empty
+  size_t len;
+  unsigned int hash;
+} string_intern_entry;
+
+typedef struct string_intern {
+  string_intern_chunk *chunk; // the one being filled; earlier ones follow 'next'
+  string_intern_entry *table; // open addressing
+  size_t table_size;          // a power of two
+  size_t count;
+  size_t bytes;               // chunk and table memory, for the log
+} string_intern;
+
+string_intern *new_string_intern();
+void *string_intern_bytes(string_intern *si, void *data, size_t len);
+char *string_intern_str(string_intern *si, char *str);
+
+#endif // STRING_INTERN_H
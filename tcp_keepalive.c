@@ -0,0 +1,47 @@
+// Copyright 2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+// SPDX-License-Identifier: MIT-0
+
+#include<sys/types.h>
+#include<sys/socket.h>
+#include<netinet/in.h>
+#include<netinet/tcp.h>
+
+#include"log.h"
+#include"tcp_keepalive.h"
+
+// probes are sent this often once the connection has been idle for keepalive_s
+#define TCP_KEEPALIVE_INTERVAL_S 10
+#define TCP_KEEPALIVE_PROBES     3
+
+void tcp_keepalive_setsockopt(int fd, int level, int option, int value, char *name) {
+  if (setsockopt(fd, level, option, &value, sizeof(value)) < 0) {
+    errorNum("setsockopt(%s) on fd %i",name,fd);
+  }
+}
+
+void tcp_keepalive_set(int fd, int keepalive_s, int user_timeout_s) {
+  if (fd < 0) {
+    return;
+  }
+  if (keepalive_s > 0) {
+    tcp_keepalive_setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, 1, "SO_KEEPALIVE");
+#ifdef TCP_KEEPIDLE
+    tcp_keepalive_setsockopt(fd, IPPROTO_TCP, TCP_KEEPIDLE, keepalive_s, "TCP_KEEPIDLE");
+#elif defined(TCP_KEEPALIVE)
+    tcp_keepalive_setsockopt(fd, IPPROTO_TCP, TCP_KEEPALIVE, keepalive_s, "TCP_KEEPALIVE"); // macOS spelling
+#endif
+#ifdef TCP_KEEPINTVL
+    tcp_keepalive_setsockopt(fd, IPPROTO_TCP, TCP_KEEPINTVL, TCP_KEEPALIVE_INTERVAL_S, "TCP_KEEPINTVL");
+#endif
+#ifdef TCP_KEEPCNT
+    tcp_keepalive_setsockopt(fd, IPPROTO_TCP, TCP_KEEPCNT, TCP_KEEPALIVE_PROBES, "TCP_KEEPCNT");
+#endif
+  }
+  if (user_timeout_s > 0) {
+#ifdef TCP_USER_TIMEOUT
+    tcp_keepalive_setsockopt(fd, IPPROTO_TCP, TCP_USER_TIMEOUT, user_timeout_s * 1000, "TCP_USER_TIMEOUT");
+#else
+    trace("tcpUserTimeout is not supported on this platform; ignored");
+#endif
+  }
+}
@@ -0,0 +1,13 @@
+// Copyright 2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+// SPDX-License-Identifier: MIT-0
+
+#ifndef TCP_KEEPALIVE_H
+#define TCP_KEEPALIVE_H
+
+// Detects peers that vanished without a FIN (sleeping laptop, dropped VPN, ...).
+//   keepalive_s:    idle seconds before the first probe; 0 leaves SO_KEEPALIVE off
+//   user_timeout_s: drop the connection if sent data stays unacknowledged this long; 0 leaves the system default
+// Failures are logged and otherwise ignored.
+void tcp_keepalive_set(int fd, int keepalive_s, int user_timeout_s);
+
+#endif // TCP_KEEPALIVE_H
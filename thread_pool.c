@@ -0,0 +1,260 @@
+// Copyright 2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+// SPDX-License-Identifier: MIT-0
+
+#include<stdlib.h>
+#include<errno.h>
+#include<pthread.h>
+
+#include"log.h"
+#include"main_config.h"
+#include"thread_local.h"
+#include"service_thread.h"
+#include"thread_pool.h"
+
+// Each worker owns a deque of thread_data items. The main thread deals new
+// connections out to the workers round-robin. A worker takes from the front
+// of its own deque; a worker with nothing to do steals from the back of
+// somebody else's, so one slow handshake doesn't hold up the connections
+// queued behind it.
+//
+// Workers with nothing to do sleep on pool_cond. 'queued' counts items
+// sitting in any deque; 'idle' counts workers not running a handler.
+
+#define THREAD_POOL_MAX_SIZE      4096
+#define THREAD_POOL_DEQUE_INITIAL 16
+
+typedef struct thread_pool_worker {
+  int index;
+  pthread_t thread_id;
+
+  pthread_mutex_t mutex;
+  thread_data **deque; // ** USE MUTEX ring buffer
+  int capacity;        // ** USE MUTEX
+  int head;            // ** USE MUTEX index of the oldest item
+  int count;           // ** USE MUTEX
+} thread_pool_worker;
+
+thread_pool_worker *pool_worker = NULL;
+int pool_size = 0;
+int pool_overflow_policy = POOL_OVERFLOW_SPAWN;
+int pool_next_worker = 0; // only used by the main thread
+
+pthread_mutex_t pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t pool_cond = PTHREAD_COND_INITIALIZER;
+int pool_idle = 0;   // ** USE pool_mutex
+int pool_queued = 0; // ** USE pool_mutex
+unsigned long long pool_overflow_spawned = 0; // ** USE pool_mutex
+unsigned long long pool_rejected = 0;         // ** USE pool_mutex
+unsigned long long pool_stolen = 0;           // ** USE pool_mutex
+
+void thread_pool_lock(pthread_mutex_t *mutex) {
+  int rc;
+  do {
+    rc = pthread_mutex_lock(mutex);
+  } while (rc == EINTR);
+}
+
+void thread_pool_unlock(pthread_mutex_t *mutex) {
+  int rc;
+  do {
+    rc = pthread_mutex_unlock(mutex);
+  } while (rc == EINTR);
+}
+
+void thread_pool_push(thread_pool_worker *worker, thread_data *data) {
+  thread_pool_lock(&worker->mutex);
+  if (worker->count == worker->capacity) {
+    int new_capacity = worker->capacity * 2;
+    thread_data **new_deque = malloc(sizeof(thread_data*) * new_capacity);
+    if (new_deque == NULL) {
+      unexpected_exit(71,"Error growing thread pool deque");
+    }
+    for (int i=0; i<worker->count; i++) {
+      new_deque[i] = worker->deque[(worker->head + i) % worker->capacity];
+    }
+    free(worker->deque);
+    worker->deque = new_deque;
+    worker->capacity = new_capacity;
+    worker->head = 0;
+  }
+  worker->deque[(worker->head + worker->count) % worker->capacity] = data;
+  worker->count++;
+  thread_pool_unlock(&worker->mutex);
+}
+
+// owner end: oldest item first
+thread_data *thread_pool_take(thread_pool_worker *worker) {
+  thread_data *data = NULL;
+  thread_pool_lock(&worker->mutex);
+  if (worker->count > 0) {
+    data = worker->deque[worker->head];
+    worker->head = (worker->head + 1) % worker->capacity;
+    worker->count--;
+  }
+  thread_pool_unlock(&worker->mutex);
+  return data;
+}
+
+// thief end: newest item first
+thread_data *thread_pool_steal(thread_pool_worker *victim) {
+  thread_data *data = NULL;
+  thread_pool_lock(&victim->mutex);
+  if (victim->count > 0) {
+    victim->count--;
+    data = victim->deque[(victim->head + victim->count) % victim->capacity];
+  }
+  thread_pool_unlock(&victim->mutex);
+  return data;
+}
+
+thread_data *thread_pool_find_work(thread_pool_worker *worker) {
+  thread_data *data = thread_pool_take(worker);
+  if (data) {
+    return data;
+  }
+  for (int i=1; i<pool_size; i++) {
+    thread_pool_worker *victim = &pool_worker[(worker->index + i) % pool_size];
+    data = thread_pool_steal(victim);
+    if (data) {
+      thread_pool_lock(&pool_mutex);
+      pool_stolen++;
+      thread_pool_unlock(&pool_mutex);
+      return data;
+    }
+  }
+  return NULL;
+}
+
+void *thread_pool_worker_thread(void *arg) {
+  thread_pool_worker *worker = arg;
+  thread_local_set_log_config(NULL);
+  debug("thread pool worker %i started",worker->index);
+
+  thread_pool_lock(&pool_mutex); // already counted as idle by thread_pool_start()
+  while (1) {
+    while (pool_queued == 0) {
+      pthread_cond_wait(&pool_cond, &pool_mutex);
+    }
+    thread_pool_unlock(&pool_mutex);
+
+    thread_data *data = thread_pool_find_work(worker);
+
+    thread_pool_lock(&pool_mutex);
+    if (data == NULL) {
+      // somebody else got there first
+      continue;
+    }
+    pool_queued--;
+    pool_idle--;
+    thread_pool_unlock(&pool_mutex);
+
+    // the handler does service_thread_setup() and frees 'data'
+    data->srv->connection_handler(data);
+    thread_local_set_proxy_instance(NULL);
+    thread_local_set_service(NULL);
+    thread_local_set_client_connection(NULL);
+
+    thread_pool_lock(&pool_mutex);
+    pool_idle++;
+  }
+  return NULL;
+}
+
+// returns 1 on success, 0 on error
+int thread_pool_start(int size, int overflow_policy) {
+  if (size <= 0) {
+    return 1; // no pool; that's allowed
+  }
+  if (size > THREAD_POOL_MAX_SIZE) {
+    size = THREAD_POOL_MAX_SIZE;
+  }
+  pool_overflow_policy = overflow_policy;
+  pool_worker = calloc(size, sizeof(thread_pool_worker));
+  if (pool_worker == NULL) {
+    unexpected_exit(70,"Error allocating thread pool");
+  }
+  for (int i=0; i<size; i++) {
+    thread_pool_worker *worker = &pool_worker[i];
+    worker->index = i;
+    pthread_mutex_init(&worker->mutex, NULL);
+    worker->capacity = THREAD_POOL_DEQUE_INITIAL;
+    worker->deque = malloc(sizeof(thread_data*) * worker->capacity);
+    if (worker->deque == NULL) {
+      unexpected_exit(70,"Error allocating thread pool");
+    }
+  }
+  // workers look at each other's deques, so they all must exist before any thread starts
+  pool_idle = size;
+  for (int i=0; i<size; i++) {
+    thread_pool_worker *worker = &pool_worker[i];
+    int rc = pthread_create(&worker->thread_id, NULL, thread_pool_worker_thread, worker);
+    if (rc != 0) {
+      errno = rc;
+      errorNum("pthread_create() for thread pool");
+      return 0;
+    }
+    pthread_detach(worker->thread_id);
+    pool_size = i+1;
+  }
+  info("Started thread pool of %i thread%s, overflow policy %s", size, size == 1 ? "" : "s", pool_overflow_str(overflow_policy));
+  return 1;
+}
+
+int thread_pool_running() {
+  return pool_size > 0;
+}
+
+// Called by the main thread for each accepted connection.
+// returns THREAD_POOL_ACCEPTED, THREAD_POOL_OVERFLOW or THREAD_POOL_REJECTED
+int thread_pool_submit(proxy_instance *proxy, service *srv, client_connection *con) {
+  if (!thread_pool_running()) {
+    return THREAD_POOL_OVERFLOW;
+  }
+
+  thread_pool_lock(&pool_mutex);
+  if (pool_idle - pool_queued <= 0 && pool_overflow_policy != POOL_OVERFLOW_QUEUE) {
+    if (pool_overflow_policy == POOL_OVERFLOW_REJECT) {
+      pool_rejected++;
+      thread_pool_unlock(&pool_mutex);
+      debug("thread pool busy; rejecting connection");
+      set_client_connection_status(con,CCSTATUS_ERROR,"Rejected","All pooled threads are busy (threadPoolOverflow reject)");
+      service_thread_shutdown(con, 0);
+      return THREAD_POOL_REJECTED;
+    }
+    pool_overflow_spawned++;
+    thread_pool_unlock(&pool_mutex);
+    trace("thread pool busy; spawning a thread");
+    return THREAD_POOL_OVERFLOW;
+  }
+  thread_pool_unlock(&pool_mutex);
+
+  thread_data *data = malloc(sizeof(thread_data));
+  if (!data) {
+    unexpected_exit(72,"cannot allocate thread_data");
+  }
+  data->proxy = proxy;
+  data->srv = srv;
+  data->con = con;
+
+  thread_pool_worker *worker = &pool_worker[pool_next_worker];
+  pool_next_worker = (pool_next_worker + 1) % pool_size;
+  thread_pool_push(worker, data);
+
+  // count it only once it can actually be found, so woken workers don't come up empty
+  thread_pool_lock(&pool_mutex);
+  pool_queued++;
+  pthread_cond_signal(&pool_cond);
+  thread_pool_unlock(&pool_mutex);
+  return THREAD_POOL_ACCEPTED;
+}
+
+void thread_pool_get_stats(thread_pool_stats *stats) {
+  thread_pool_lock(&pool_mutex);
+  stats->size = pool_size;
+  stats->idle = pool_idle;
+  stats->queued = pool_queued;
+  stats->overflow_spawned = pool_overflow_spawned;
+  stats->rejected = pool_rejected;
+  stats->stolen = pool_stolen;
+  thread_pool_unlock(&pool_mutex);
+}
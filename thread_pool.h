@@ -0,0 +1,34 @@
+// Copyright 2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+// SPDX-License-Identifier: MIT-0
+
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include"proxy_instance.h"
+#include"service.h"
+#include"client_connection.h"
+
+// A fixed set of pre-spawned threads that run service connection handlers,
+// so accepting a connection doesn't cost a pthread_create().
+
+// thread_pool_submit() return values
+#define THREAD_POOL_ACCEPTED  1 // a pooled thread will run the handler
+#define THREAD_POOL_OVERFLOW  0 // pool is busy; caller should start its own thread
+#define THREAD_POOL_REJECTED -1 // pool is busy; connection has been closed
+
+int thread_pool_start(int size, int overflow_policy);
+int thread_pool_running();
+int thread_pool_submit(proxy_instance *proxy, service *srv, client_connection *con);
+
+typedef struct thread_pool_stats {
+  int size;
+  int idle;
+  int queued;
+  unsigned long long overflow_spawned;
+  unsigned long long rejected;
+  unsigned long long stolen;
+} thread_pool_stats;
+
+void thread_pool_get_stats(thread_pool_stats *stats);
+
+#endif // THREAD_POOL_H
@@ -0,0 +1,193 @@
+// Copyright 2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+// SPDX-License-Identifier: MIT-0
+
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<errno.h>
+#include<time.h>
+#include<pthread.h>
+
+#include"token_bucket.h"
+
+void token_bucket_lock(token_bucket *tb) {
+  int rc;
+  do {
+    rc = pthread_mutex_lock(&tb->mutex);
+  } while (rc == EINTR);
+}
+
+void token_bucket_unlock(token_bucket *tb) {
+  int rc;
+  do {
+    rc = pthread_mutex_unlock(&tb->mutex);
+  } while (rc == EINTR);
+}
+
+long long token_bucket_now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+void token_bucket_init(token_bucket *tb, long long rate, long long burst) {
+  pthread_mutex_init(&tb->mutex, NULL);
+  tb->throttled = 0;
+  token_bucket_set(tb, rate, burst);
+}
+
+// Change the settings of a bucket token_bucket_init() has already set up,
+// while the config is loaded (before any connection uses it). Starts full.
+void token_bucket_set(token_bucket *tb, long long rate, long long burst) {
+  tb->rate = rate > 0 ? rate : 0;
+  tb->burst = burst > 0 ? burst : tb->rate;
+  tb->tokens = tb->burst; // start full
+  tb->last_refill = token_bucket_now();
+}
+
+// "<number>[k|m|g]" -> bytes, 1024-based. returns 1 on success, 0 on error
+int token_bucket_parse_size(char *str, long long *value) {
+  char *end;
+  errno = 0;
+  long long n = strtoll(str, &end, 10);
+  if (end == str || errno != 0 || n < 0) {
+    return 0;
+  }
+  if (*end == 'k' || *end == 'K') { n *= 1024LL; end++; }
+  else if (*end == 'm' || *end == 'M') { n *= 1024LL*1024; end++; }
+  else if (*end == 'g' || *end == 'G') { n *= 1024LL*1024*1024; end++; }
+  if (*end != 0) {
+    return 0;
+  }
+  *value = n;
+  return 1;
+}
+
+// returns 1 on success, 0 on error
+int token_bucket_parse(token_bucket *tb, char *spec) {
+  char rate_str[100];
+  long long rate = 0, burst = 0;
+  char *slash = strchr(spec, '/');
+  if (slash == NULL) {
+    if (!token_bucket_parse_size(spec, &rate)) {
+      return 0;
+    }
+  } else {
+    if (slash - spec >= (long)sizeof(rate_str)) {
+      return 0;
+    }
+    strncpy(rate_str, spec, slash - spec);
+    rate_str[slash - spec] = 0;
+    if (!token_bucket_parse_size(rate_str, &rate) || !token_bucket_parse_size(slash+1, &burst)) {
+      return 0;
+    }
+  }
+  // the mutex was set up by token_bucket_init() when the owner was made
+  token_bucket_set(tb, rate, burst);
+  return 1;
+}
+
+int token_bucket_enabled(token_bucket *tb) {
+  return tb->rate > 0;
+}
+
+char *token_bucket_str(token_bucket *tb, char *buf, int buflen) {
+  if (!token_bucket_enabled(tb)) {
+    snprintf(buf, buflen, "unlimited");
+  } else {
+    snprintf(buf, buflen, "%lli/%lli", tb->rate, tb->burst);
+  }
+  return buf;
+}
+
+// How many tokens a reader should wait for, so a slow rate doesn't mean lots of tiny reads.
+long long token_bucket_quantum(token_bucket *tb) {
+  long long quantum = tb->rate / TOKEN_BUCKET_HZ;
+  if (quantum > tb->burst) {
+    quantum = tb->burst;
+  }
+  return quantum > 0 ? quantum : 1;
+}
+
+// Must hold the mutex.
+void token_bucket_refill(token_bucket *tb, long long now) {
+  long long elapsed = now - tb->last_refill;
+  if (elapsed <= 0) {
+    return;
+  }
+  double add = (double)elapsed * tb->rate / 1000000000.0;
+  if (tb->tokens + add >= tb->burst) {
+    tb->tokens = tb->burst;
+    tb->last_refill = now;
+    return;
+  }
+  long long whole = (long long)add;
+  if (whole > 0) {
+    // only move the clock forward by the time those whole tokens took, so fractions aren't lost
+    tb->tokens += whole;
+    tb->last_refill += (long long)((double)whole * 1000000000.0 / tb->rate);
+  }
+}
+
+// returns the tokens in the bucket (possibly negative), or the burst size if unlimited.
+long long token_bucket_available(token_bucket *tb, long long now) {
+  if (!token_bucket_enabled(tb)) {
+    return tb->burst;
+  }
+  token_bucket_lock(tb);
+  token_bucket_refill(tb, now);
+  long long tokens = tb->tokens;
+  token_bucket_unlock(tb);
+  return tokens;
+}
+
+void token_bucket_consume(token_bucket *tb, long long bytes) {
+  if (!token_bucket_enabled(tb)) {
+    return;
+  }
+  token_bucket_lock(tb);
+  tb->tokens -= bytes;
+  token_bucket_unlock(tb);
+}
+
+// How long until the bucket holds 'want' tokens. Each call that comes back non-zero counts as a throttle.
+// returns milliseconds, rounded up.
+int token_bucket_wait_ms(token_bucket *tb, long long want, long long now) {
+  if (!token_bucket_enabled(tb)) {
+    return 0;
+  }
+  if (want > tb->burst) {
+    want = tb->burst; // never going to get more than that
+  }
+  token_bucket_lock(tb);
+  token_bucket_refill(tb, now);
+  long long need = want - tb->tokens;
+  long long ns = 0;
+  if (need > 0) {
+    ns = (long long)((double)need * 1000000000.0 / tb->rate) - (now - tb->last_refill);
+    tb->throttled++;
+  }
+  token_bucket_unlock(tb);
+  if (need <= 0) {
+    return 0;
+  }
+  long long ms = (ns + 999999) / 1000000;
+  if (ms < 1) {
+    ms = 1;
+  } else if (ms > 1000000000) {
+    ms = 1000000000;
+  }
+  return (int)ms;
+}
+
+void token_bucket_get_stats(token_bucket *tb, token_bucket_stats *stats) {
+  stats->rate = tb->rate;
+  stats->burst = tb->burst;
+  token_bucket_lock(tb);
+  if (token_bucket_enabled(tb)) {
+    token_bucket_refill(tb, token_bucket_now());
+  }
+  stats->tokens = tb->tokens;
+  stats->throttled = tb->throttled;
+  token_bucket_unlock(tb);
+}
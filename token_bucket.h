@@ -0,0 +1,53 @@
+// Copyright 2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+// SPDX-License-Identifier: MIT-0
+
+#ifndef TOKEN_BUCKET_H
+#define TOKEN_BUCKET_H
+
+#include<pthread.h>
+
+// Token bucket used to shape relay bandwidth. One bucket is shared by
+// every connection it applies to (a proxy instance, a route rule or an
+// ssh tunnel), in one direction. Tokens are bytes; they trickle in at
+// 'rate' per second and pile up to at most 'burst'.
+//
+// A read may take more than is in the bucket, leaving it in debt; the
+// next reader then waits until the debt is paid off.
+//
+// Times are nanoseconds from token_bucket_now(); the functions that
+// take 'now' do so in order to be testable.
+
+#define TOKEN_BUCKET_HZ 50 // readers wait for at least rate/TOKEN_BUCKET_HZ bytes, so they wake at most this often
+
+typedef struct token_bucket {
+  long long rate;  // bytes per second; 0 = unlimited
+  long long burst; // bytes
+
+  pthread_mutex_t mutex;
+  long long tokens;              // ** USE MUTEX  negative while in debt
+  long long last_refill;         // ** USE MUTEX
+  unsigned long long throttled;  // ** USE MUTEX  times a reader had to wait
+} token_bucket;
+
+typedef struct token_bucket_stats {
+  long long rate;
+  long long burst;
+  long long tokens;
+  unsigned long long throttled;
+} token_bucket_stats;
+
+long long token_bucket_now();
+
+void token_bucket_init(token_bucket *tb, long long rate, long long burst); // burst <= 0 means one second's worth
+void token_bucket_set(token_bucket *tb, long long rate, long long burst);  // same, on an initialised bucket
+int  token_bucket_parse(token_bucket *tb, char *spec);                     // "<rate>[/<burst>]", k/m/g suffixes; 1 ok, 0 error
+int  token_bucket_enabled(token_bucket *tb);
+char *token_bucket_str(token_bucket *tb, char *buf, int buflen);
+
+long long token_bucket_quantum(token_bucket *tb);
+long long token_bucket_available(token_bucket *tb, long long now);
+void token_bucket_consume(token_bucket *tb, long long bytes);
+int  token_bucket_wait_ms(token_bucket *tb, long long want, long long now);
+void token_bucket_get_stats(token_bucket *tb, token_bucket_stats *stats);
+
+#endif // TOKEN_BUCKET_H
@@ -0,0 +1,67 @@
+// Copyright 2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+// SPDX-License-Identifier: MIT-0
+
+#include<stdint.h>
+#include<pthread.h>
+
+#include"log.h"
+#include"traffic_counter.h"
+
+traffic_counter traffic_global; // zero-initialized, which is a valid starting state
+
+// Threads are given shards round-robin the first time they count something.
+// The shard number is kept (plus one, so NULL means "not yet") in a pthread key.
+atomic_uint traffic_next_shard;
+pthread_key_t traffic_shard_key;
+pthread_once_t traffic_shard_key_once = PTHREAD_ONCE_INIT;
+
+void traffic_shard_key_init() {
+  int rc = pthread_key_create(&traffic_shard_key, NULL);
+  if (rc != 0) {
+    unexpected_exit(56,"pthread_key_create() for traffic counters");
+  }
+}
+
+int traffic_shard() {
+  pthread_once(&traffic_shard_key_once, traffic_shard_key_init);
+  uintptr_t shard = (uintptr_t)pthread_getspecific(traffic_shard_key);
+  if (shard == 0) {
+    shard = atomic_fetch_add_explicit(&traffic_next_shard, 1, memory_order_relaxed) % TRAFFIC_COUNTER_SHARDS + 1;
+    pthread_setspecific(traffic_shard_key, (void*)shard);
+  }
+  return (int)(shard - 1);
+}
+
+void traffic_counter_init(traffic_counter *counter) {
+  for (int i=0; i<TRAFFIC_COUNTER_SHARDS; i++) {
+    atomic_init(&counter->shard[i].bytes[TRAFFIC_TX], 0);
+    atomic_init(&counter->shard[i].bytes[TRAFFIC_RX], 0);
+    atomic_init(&counter->shard[i].connections, 0);
+  }
+}
+
+void traffic_counter_add_bytes(traffic_counter *counter, int direction, unsigned long long bytes) {
+  int shard = traffic_shard();
+  if (counter) {
+    atomic_fetch_add_explicit(&counter->shard[shard].bytes[direction], bytes, memory_order_relaxed);
+  }
+  atomic_fetch_add_explicit(&traffic_global.shard[shard].bytes[direction], bytes, memory_order_relaxed);
+}
+
+void traffic_counter_add_connection(traffic_counter *counter) {
+  int shard = traffic_shard();
+  if (counter) {
+    atomic_fetch_add_explicit(&counter->shard[shard].connections, 1, memory_order_relaxed);
+  }
+  atomic_fetch_add_explicit(&traffic_global.shard[shard].connections, 1, memory_order_relaxed);
+}
+
+// The shards are read one at a time, so the totals are not a single instant snapshot. Good enough for the web UI.
+void traffic_counter_get(traffic_counter *counter, traffic_totals *totals) {
+  totals->bytes_tx = totals->bytes_rx = totals->connections = 0;
+  for (int i=0; i<TRAFFIC_COUNTER_SHARDS; i++) {
+    totals->bytes_tx += atomic_load_explicit(&counter->shard[i].bytes[TRAFFIC_TX], memory_order_relaxed);
+    totals->bytes_rx += atomic_load_explicit(&counter->shard[i].bytes[TRAFFIC_RX], memory_order_relaxed);
+    totals->connections += atomic_load_explicit(&counter->shard[i].connections, memory_order_relaxed);
+  }
+}
@@ -0,0 +1,47 @@
+// Copyright 2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+// SPDX-License-Identifier: MIT-0
+
+#ifndef TRAFFIC_COUNTER_H
+#define TRAFFIC_COUNTER_H
+
+#include<stdatomic.h>
+
+// Aggregate traffic totals, bumped from every relay thread at once.
+// Threads are handed one of TRAFFIC_COUNTER_SHARDS shards round-robin, so
+// with more threads than shards some share one; the adds are atomic either
+// way, and spreading them keeps most of the cache-line traffic off any one
+// line. Readers sum the shards with relaxed loads.
+
+#define TRAFFIC_COUNTER_SHARDS 16
+#define TRAFFIC_COUNTER_ALIGN  64 // a cache line
+
+#define TRAFFIC_TX 0 // client -> server
+#define TRAFFIC_RX 1 // server -> client
+
+// one cache line each, aligned to it: anything holding a traffic_counter
+// must be allocated with (at least) TRAFFIC_COUNTER_ALIGN alignment
+typedef struct traffic_counter_shard {
+  _Alignas(TRAFFIC_COUNTER_ALIGN) atomic_ullong bytes[2]; // indexed by TRAFFIC_TX / TRAFFIC_RX
+  atomic_ullong connections;
+} traffic_counter_shard;
+
+_Static_assert(sizeof(traffic_counter_shard) == TRAFFIC_COUNTER_ALIGN, "traffic_counter_shard must fill exactly one cache line");
+
+typedef struct traffic_counter {
+  traffic_counter_shard shard[TRAFFIC_COUNTER_SHARDS];
+} traffic_counter;
+
+typedef struct traffic_totals {
+  unsigned long long bytes_tx;
+  unsigned long long bytes_rx;
+  unsigned long long connections;
+} traffic_totals;
+
+extern traffic_counter traffic_global;
+
+void traffic_counter_init(traffic_counter *counter);
+void traffic_counter_add_bytes(traffic_counter *counter, int direction, unsigned long long bytes); // also adds to traffic_global
+void traffic_counter_add_connection(traffic_counter *counter);                                     // also adds to traffic_global
+void traffic_counter_get(traffic_counter *counter, traffic_totals *totals);
+
+#endif // TRAFFIC_COUNTER_H
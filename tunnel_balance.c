@@ -0,0 +1,112 @@
+// Copyright 2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+// SPDX-License-Identifier: MIT-0
+
+#include<string.h>
+
+#include"log.h"
+#include"tunnel_balance.h"
+
+void tunnel_balance_init(tunnel_balance_stats *st) {
+  if (pthread_mutex_init(&st->mutex,NULL)) {
+    errorNum("pthread_mutex_init()");
+    unexpected_exit(57,"pthread_mutex_init()");
+  }
+  st->latency_ms = 0.0;
+  st->failure_rate = 0.0;
+  st->handshakes = 0;
+  st->failures = 0;
+  atomic_init(&st->connections,0);
+  atomic_init(&st->picked,0);
+}
+
+// One handshake's outcome. 'ms' is only used for successful ones.
+void tunnel_balance_record(tunnel_balance_stats *st, int ok, long long ms) {
+  pthread_mutex_lock(&st->mutex);
+  if (ok) {
+    // the first sample sets the average, rather than being dragged towards 0
+    if (st->handshakes == st->failures) {
+      st->latency_ms = (double)ms;
+    } else {
+      st->latency_ms += TUNNEL_BALANCE_EWMA_ALPHA * ((double)ms - st->latency_ms);
+    }
+    st->failure_rate -= TUNNEL_BALANCE_EWMA_ALPHA * st->failure_rate;
+  } else {
+    st->failure_rate += TUNNEL_BALANCE_EWMA_ALPHA * (1.0 - st->failure_rate);
+    st->failures++;
+  }
+  st->handshakes++;
+  pthread_mutex_unlock(&st->mutex);
+}
+
+// Called by the main thread after counting each tunnel's connections.
+void tunnel_balance_set_connections(tunnel_balance_stats *st, int connections) {
+  atomic_store_explicit(&st->connections, connections, memory_order_relaxed);
+  atomic_store_explicit(&st->picked, 0, memory_order_relaxed);
+}
+
+void tunnel_balance_picked(tunnel_balance_stats *st) {
+  atomic_fetch_add_explicit(&st->picked, 1, memory_order_relaxed);
+}
+
+// active connections, counting those sent this way since the main thread last counted
+int tunnel_balance_load(tunnel_balance_stats *st) {
+  return atomic_load_explicit(&st->connections, memory_order_relaxed) + atomic_load_explicit(&st->picked, memory_order_relaxed);
+}
+
+double tunnel_balance_ewma_score(tunnel_balance_stats *st) {
+  pthread_mutex_lock(&st->mutex);
+  double score = st->latency_ms + st->failure_rate * TUNNEL_BALANCE_FAILURE_PENALTY_MS;
+  pthread_mutex_unlock(&st->mutex);
+  return score;
+}
+
+void tunnel_balance_get_snapshot(tunnel_balance_stats *st, tunnel_balance_snapshot *snap) {
+  pthread_mutex_lock(&st->mutex);
+  snap->latency_ms = st->latency_ms;
+  snap->failure_rate = st->failure_rate;
+  snap->handshakes = st->handshakes;
+  snap->failures = st->failures;
+  pthread_mutex_unlock(&st->mutex);
+  snap->load = tunnel_balance_load(st);
+  snap->score = snap->latency_ms + snap->failure_rate * TUNNEL_BALANCE_FAILURE_PENALTY_MS;
+}
+
+// order[] gets the indices 0..count-1, lowest score first; equal scores keep their original order.
+void tunnel_balance_rank(double *score, int count, int *order) {
+  for (int i=0; i<count; i++) {
+    order[i] = i;
+  }
+  // insertion sort: a rule has a handful of tunnels, and it's stable
+  for (int i=1; i<count; i++) {
+    int idx = order[i];
+    int j = i;
+    while (j > 0 && score[order[j-1]] > score[idx]) {
+      order[j] = order[j-1];
+      j--;
+    }
+    order[j] = idx;
+  }
+}
+
+int tunnel_balance_from_str(char *str) {
+  if (strcmp(str,"inOrder")==0) {
+    return TUNNEL_BALANCE_IN_ORDER;
+  } else if (strcmp(str,"roundRobin")==0) {
+    return TUNNEL_BALANCE_ROUND_ROBIN;
+  } else if (strcmp(str,"leastConnections")==0) {
+    return TUNNEL_BALANCE_LEAST_CONNECTIONS;
+  } else if (strcmp(str,"ewma")==0) {
+    return TUNNEL_BALANCE_EWMA;
+  }
+  return TUNNEL_BALANCE_INVALID;
+}
+
+char *tunnel_balance_str(int policy) {
+  switch (policy) {
+    case TUNNEL_BALANCE_IN_ORDER:          return "inOrder";
+    case TUNNEL_BALANCE_ROUND_ROBIN:       return "roundRobin";
+    case TUNNEL_BALANCE_LEAST_CONNECTIONS: return "leastConnections";
+    case TUNNEL_BALANCE_EWMA:              return "ewma";
+  }
+  return "invalid";
+}
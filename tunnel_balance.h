@@ -0,0 +1,59 @@
+// Copyright 2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+// SPDX-License-Identifier: MIT-0
+
+#ifndef TUNNEL_BALANCE_H
+#define TUNNEL_BALANCE_H
+
+#include<pthread.h>
+#include<stdatomic.h>
+
+// Load balancing between the tunnels of a "via a, b, c" rule. The policy
+// only decides the order the tunnels are tried in; the rule's strategy
+// (failover or race) still decides how they're tried.
+//
+// Each tunnel keeps an exponentially weighted moving average of how long
+// its SOCKS5 handshakes take and how often they fail; "ewma" tries the
+// lowest score first, where score = latency + failure rate * penalty.
+// A tunnel that has never been tried scores 0, so it gets tried.
+
+#define TUNNEL_BALANCE_INVALID           -1
+#define TUNNEL_BALANCE_IN_ORDER           0 // as listed
+#define TUNNEL_BALANCE_ROUND_ROBIN        1
+#define TUNNEL_BALANCE_LEAST_CONNECTIONS  2
+#define TUNNEL_BALANCE_EWMA               3
+
+#define TUNNEL_BALANCE_EWMA_ALPHA         0.2    // weight of the newest sample
+#define TUNNEL_BALANCE_FAILURE_PENALTY_MS 1000.0 // a tunnel that always fails scores as if it took this much longer
+
+typedef struct tunnel_balance_stats {
+  pthread_mutex_t mutex;
+  double latency_ms;              // ** USE MUTEX  EWMA of successful handshake time
+  double failure_rate;            // ** USE MUTEX  EWMA of 1 per failed handshake, 0 per successful one
+  unsigned long long handshakes;  // ** USE MUTEX
+  unsigned long long failures;    // ** USE MUTEX
+
+  atomic_int connections; // active connections, as of the main thread's last check_ssh_tunnels()
+  atomic_int picked;      // connections sent this way since then
+} tunnel_balance_stats;
+
+typedef struct tunnel_balance_snapshot {
+  double latency_ms;
+  double failure_rate;
+  unsigned long long handshakes;
+  unsigned long long failures;
+  int load;
+  double score;
+} tunnel_balance_snapshot;
+
+void tunnel_balance_init(tunnel_balance_stats *st);
+void tunnel_balance_record(tunnel_balance_stats *st, int ok, long long ms);
+void tunnel_balance_set_connections(tunnel_balance_stats *st, int connections);
+void tunnel_balance_picked(tunnel_balance_stats *st);
+int  tunnel_balance_load(tunnel_balance_stats *st);
+double tunnel_balance_ewma_score(tunnel_balance_stats *st);
+void tunnel_balance_get_snapshot(tunnel_balance_stats *st, tunnel_balance_snapshot *snap);
+void tunnel_balance_rank(double *score, int count, int *order);
+int  tunnel_balance_from_str(char *str);
+char *tunnel_balance_str(int policy);
+
+#endif // TUNNEL_BALANCE_H
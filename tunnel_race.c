@@ -0,0 +1,479 @@
+// Copyright 2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+// SPDX-License-Identifier: MIT-0
+
+#include<stdlib.h>
+#include<string.h>
+#include<strings.h>
+#include<unistd.h>
+#include<fcntl.h>
+#include<poll.h>
+#include<errno.h>
+#include<time.h>
+#include<netinet/in.h>
+#include<sys/socket.h>
+
+#include"log.h"
+#include"socks5.h"
+#include"socks5_client.h"
+#include"http_connect_client.h"
+#include"tunnel_race.h"
+
+#define TR_WAITING    0 // not in flight; (re)starts at start_at
+#define TR_CONNECTING 1
+#define TR_GREETING   2 // writing the greeting (and the command too, when pipelining)
+#define TR_METHOD     3 // reading the method reply
+#define TR_COMMAND    4 // writing the command (the CONNECT request for httpConnect)
+#define TR_REPLY      5 // reading the command reply
+#define TR_DONE       6 // negotiated; the winner
+#define TR_FAILED     7 // the tunnel answered with an error; not retried
+
+#define TR_STEP_PENDING  0
+#define TR_STEP_DONE     1
+#define TR_STEP_RETRY   -1
+#define TR_STEP_FAILED  -2
+
+typedef struct tunnel_race_candidate {
+  ssh_tunnel *tun;
+  int state;
+  int fd;
+  long long start_at;
+  long long started; // when the current attempt began
+  int retry_ms;
+  int not_ready; // the tunnel's ssh is still starting; waits for it to come up
+  int failure_type;
+  int verdict; // CIRCUIT_VERDICT_* of the current attempt
+  unsigned char out[HTTP_CONNECT_MAX_REQUEST];
+  int out_len;
+  int out_off;
+  unsigned char in[HTTP_CONNECT_MAX_REPLY];
+  int in_len;
+  int in_want;
+  int pipelined; // greeting and command went out together; 'in' holds the method reply, then the command reply
+} tunnel_race_candidate;
+
+long long tunnel_race_now_ms() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+void tunnel_race_close(tunnel_race_candidate *c) {
+  int rc;
+  if (c->fd < 0) {
+    return;
+  }
+  do {
+    rc = close(c->fd);
+  } while (rc < 0 && errno == EINTR);
+  c->fd = -1;
+}
+
+// returns 1 if the connect is in progress (or done), 0 if it failed right away.
+// A server name that doesn't resolve fails the candidate (TR_FAILED) rather than being retried.
+int tunnel_race_start(tunnel_race_candidate *c) {
+  struct sockaddr_storage addr;
+  socklen_t addr_len = ssh_tunnel_addr(c->tun, &addr);
+  if (addr_len == 0) {
+    debug("ssh_tunnel %s: server %s doesn't resolve",c->tun->name,host_id_get_name(&c->tun->server));
+    c->state = TR_FAILED;
+    c->failure_type = SOCKS5_REPLY_NETWORK_UNREACHABLE;
+    c->verdict = CIRCUIT_VERDICT_DEAD;
+    return 0;
+  }
+  c->fd = socket(addr.ss_family, SOCK_STREAM, 0);
+  if (c->fd < 0) {
+    errorNum("socket()");
+    return 0;
+  }
+  int flags = fcntl(c->fd, F_GETFL);
+  if (flags < 0 || fcntl(c->fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+    errorNum("fcntl()");
+    tunnel_race_close(c);
+    return 0;
+  }
+
+  int rc;
+  do {
+    rc = connect(c->fd, (struct sockaddr*)&addr, addr_len);
+  } while (rc < 0 && errno == EINTR);
+  if (rc < 0 && errno != EINPROGRESS) {
+    trace("connect() for %s: %s",c->tun->name,strerror(errno));
+    tunnel_race_close(c);
+    return 0;
+  }
+  c->state = TR_CONNECTING;
+  return 1;
+}
+
+// Read an HTTP proxy's reply to CONNECT without going past its blank line,
+// so whatever the destination sends first stays in the socket for the relay.
+int tunnel_race_http_reply(tunnel_race_candidate *c) {
+  int rc;
+  do {
+    rc = recv(c->fd, c->in + c->in_len, sizeof(c->in) - c->in_len, MSG_PEEK);
+  } while (rc < 0 && errno == EINTR);
+  if (rc < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+    return TR_STEP_PENDING;
+  }
+  if (rc <= 0) {
+    c->failure_type = SOCKS5_REPLY_CONNECTION_REFUSED;
+    return TR_STEP_FAILED;
+  }
+  int reply_len = http_connect_reply_len((char*)c->in, c->in_len + rc);
+  if (reply_len < 0) {
+    error("HTTP proxy %s sent reply headers longer than %i bytes",c->tun->name,HTTP_CONNECT_MAX_REPLY);
+    c->failure_type = SOCKS5_REPLY_SERVER_FAILURE;
+    return TR_STEP_FAILED;
+  }
+  int take = reply_len > 0 ? reply_len - c->in_len : rc;
+  do {
+    rc = recv(c->fd, c->in + c->in_len, take, 0);
+  } while (rc < 0 && errno == EINTR);
+  if (rc != take) {
+    c->failure_type = SOCKS5_REPLY_SERVER_FAILURE;
+    return TR_STEP_FAILED;
+  }
+  c->in_len += take;
+  if (reply_len == 0) {
+    return TR_STEP_PENDING;
+  }
+  int status = http_connect_reply_status((char*)c->in, c->in_len);
+  if (status < 0) {
+    error("HTTP proxy %s sent a malformed reply",c->tun->name);
+    c->failure_type = SOCKS5_REPLY_SERVER_FAILURE;
+    return TR_STEP_FAILED;
+  }
+  c->failure_type = http_connect_failure_type(status);
+  c->verdict = CIRCUIT_VERDICT_ALIVE; // whatever the status, the proxy answered
+  if (c->failure_type != SOCKS5_REPLY_SUCCEED) {
+    trace("HTTP proxy %s answered CONNECT with status %i",c->tun->name,status);
+    return TR_STEP_FAILED;
+  }
+  c->state = TR_DONE;
+  return TR_STEP_DONE;
+}
+
+// Move one candidate's handshake along as far as it will go without blocking.
+int tunnel_race_step(client_connection *con, tunnel_race_candidate *c) {
+  int rc;
+  for (;;) {
+    if (c->state == TR_REPLY && c->tun->type == TUNNEL_TYPE_HTTP_CONNECT) {
+      return tunnel_race_http_reply(c);
+    }
+    if (c->state == TR_CONNECTING) {
+      int so_error = 0;
+      socklen_t len = sizeof(so_error);
+      if (getsockopt(c->fd, SOL_SOCKET, SO_ERROR, &so_error, &len) < 0) {
+        so_error = errno;
+      }
+      if (so_error != 0) {
+        trace("connect() for %s: %s",c->tun->name,strerror(so_error));
+        return TR_STEP_RETRY; // not listening yet
+      }
+      c->verdict = CIRCUIT_VERDICT_DEAD; // until it answers
+      if (c->tun->type == TUNNEL_TYPE_HTTP_CONNECT) {
+        c->out_len = http_connect_build_request(con, (char*)c->out, sizeof(c->out));
+        c->out_off = 0;
+        if (c->out_len == 0) {
+          c->failure_type = SOCKS5_REPLY_ADDRESS_TYPE_NOT_SUPPORTED;
+          c->verdict = CIRCUIT_VERDICT_NONE;
+          return TR_STEP_FAILED;
+        }
+        c->state = TR_COMMAND;
+        continue;
+      }
+      c->pipelined = c->tun->pipeline;
+      if (c->pipelined) {
+        c->out_len = socks5_client_build_pipelined(con, c->out, sizeof(c->out));
+        if (c->out_len == 0) {
+          c->failure_type = SOCKS5_REPLY_ADDRESS_TYPE_NOT_SUPPORTED;
+          c->verdict = CIRCUIT_VERDICT_NONE;
+          return TR_STEP_FAILED;
+        }
+      } else {
+        c->out[0]=0x05; // socks version 5
+        c->out[1]=0x01; // only one auth method supported by this client
+        c->out[2]=SOCKS5_AUTH_NONE_REQUIRED;
+        c->out_len=SOCKS5_CLIENT_GREETING_LEN;
+      }
+      c->out_off=0;
+      c->state = TR_GREETING;
+    } else if (c->state == TR_GREETING || c->state == TR_COMMAND) {
+      do {
+        rc = send(c->fd, c->out + c->out_off, c->out_len - c->out_off, 0);
+      } while (rc < 0 && errno == EINTR);
+      if (rc < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        return TR_STEP_PENDING;
+      }
+      if (rc < 0) {
+        trace("send() to %s: %s",c->tun->name,strerror(errno));
+        return TR_STEP_RETRY;
+      }
+      c->out_off += rc;
+      if (c->out_off < c->out_len) {
+        return TR_STEP_PENDING;
+      }
+      c->in_len = 0;
+      if (c->state == TR_GREETING && c->pipelined) {
+        c->in_want = 2+5; // method reply, and enough of the command reply to know its length
+        c->state = TR_REPLY;
+      } else if (c->state == TR_GREETING) {
+        c->in_want = 2;
+        c->state = TR_METHOD;
+      } else if (c->tun->type == TUNNEL_TYPE_HTTP_CONNECT) {
+        c->state = TR_REPLY;
+      } else {
+        c->in_want = 5; // enough to know the length of the rest
+        c->state = TR_REPLY;
+      }
+    } else if (c->state == TR_METHOD || c->state == TR_REPLY) {
+      do {
+        rc = recv(c->fd, c->in + c->in_len, c->in_want - c->in_len, 0);
+      } while (rc < 0 && errno == EINTR);
+      if (rc < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        return TR_STEP_PENDING;
+      }
+      if (rc <= 0) {
+        if (c->state == TR_REPLY) {
+          // ssh closes the connection, rather than replying, when it can't reach the destination
+          c->failure_type = SOCKS5_REPLY_CONNECTION_REFUSED;
+          if (!c->pipelined || c->in_len >= 2) {
+            c->verdict = CIRCUIT_VERDICT_NONE;
+          }
+          return TR_STEP_FAILED;
+        }
+        return TR_STEP_RETRY;
+      }
+      c->in_len += rc;
+      if (c->state == TR_REPLY && c->pipelined && socks5_client_pipelined_reply_len(c->in, c->in_len) == -2) {
+        // the server takes our command for a failed authentication and hangs up
+        error("ssh SOCKS5 server %s does not support a suitable authentication method.",c->tun->name);
+        c->failure_type = SOCKS5_REPLY_SERVER_FAILURE;
+        return TR_STEP_FAILED;
+      }
+      if (c->in_len < c->in_want) {
+        continue;
+      }
+      if (c->state == TR_METHOD) {
+        if (c->in[0] != 0x05 || c->in[1] != SOCKS5_AUTH_NONE_REQUIRED) {
+          error("ssh SOCKS5 server %s does not support a suitable authentication method.",c->tun->name);
+          c->failure_type = SOCKS5_REPLY_SERVER_FAILURE;
+          return TR_STEP_FAILED;
+        }
+        c->out_len = socks5_client_build_command(con, c->out, sizeof(c->out));
+        c->out_off = 0;
+        if (c->out_len == 0) {
+          c->failure_type = SOCKS5_REPLY_ADDRESS_TYPE_NOT_SUPPORTED;
+          c->verdict = CIRCUIT_VERDICT_NONE;
+          return TR_STEP_FAILED;
+        }
+        c->state = TR_COMMAND;
+      } else {
+        int skip = c->pipelined ? 2 : 0;
+        int reply_len = c->pipelined ? socks5_client_pipelined_reply_len(c->in, c->in_len) : socks5_client_reply_len(c->in, c->in_len);
+        if (reply_len < 0) {
+          error("ssh SOCKS5 server %s sent a malformed reply",c->tun->name);
+          c->failure_type = SOCKS5_REPLY_SERVER_FAILURE;
+          return TR_STEP_FAILED;
+        }
+        if (c->in_len < reply_len) {
+          c->in_want = reply_len;
+          continue;
+        }
+        c->verdict = CIRCUIT_VERDICT_ALIVE; // a well-formed reply, whatever it says about the destination
+        if (c->in[skip+1] != SOCKS5_REPLY_SUCCEED) {
+          trace("SSH SOCKS5 server %s returned error: %i",c->tun->name,c->in[skip+1]);
+          c->failure_type = c->in[skip+1];
+          return TR_STEP_FAILED;
+        }
+        c->state = TR_DONE;
+        return TR_STEP_DONE;
+      }
+    } else {
+      return TR_STEP_PENDING;
+    }
+  }
+}
+
+int tunnel_race_in_flight(tunnel_race_candidate *c) {
+  return c->state >= TR_CONNECTING && c->state <= TR_REPLY;
+}
+
+// Negotiate a SOCKS5 connection to con's destination through the first of 'tunnels' that can provide one.
+// start_delay_ms is how long to wait before starting each successive tunnel (0: all at once), or
+// TUNNEL_RACE_FAILOVER to only start a tunnel once those before it have failed.
+// returns 1 if connected, 0 otherwise; details in 'result'
+int tunnel_race_connect(client_connection *con, ssh_tunnel **tunnels, int count, int start_delay_ms, int timeout_ms, tunnel_race_result *result) {
+  // a rule's tunnels, replicas included, can't come to more than ROUTE_RULE_MAX_SSH_TUNNELS_PER_RULE
+  if (count > ROUTE_RULE_MAX_SSH_TUNNELS_PER_RULE) {
+    warn("Racing only the first %i of %i tunnels",ROUTE_RULE_MAX_SSH_TUNNELS_PER_RULE,count);
+    count = ROUTE_RULE_MAX_SSH_TUNNELS_PER_RULE;
+  }
+  // too big for a connection thread's stack, at 2.7 KB each
+  tunnel_race_candidate *c = malloc(sizeof(tunnel_race_candidate) * (count > 0 ? count : 1));
+  if (c == NULL) {
+    unexpected_exit(69,"Error allocating tunnel race");
+  }
+  struct pollfd pfd[ROUTE_RULE_MAX_SSH_TUNNELS_PER_RULE];
+  int pfd_idx[ROUTE_RULE_MAX_SSH_TUNNELS_PER_RULE];
+  int failover = start_delay_ms == TUNNEL_RACE_FAILOVER;
+
+  long long start = tunnel_race_now_ms();
+  for (int i=0; i<count; i++) {
+    c[i].tun = tunnels[i];
+    c[i].state = TR_WAITING;
+    c[i].fd = -1;
+    c[i].start_at = failover ? start : start + (long long)i * start_delay_ms;
+    c[i].retry_ms = TUNNEL_RACE_RETRY_MIN_MS;
+    c[i].not_ready = 0;
+    c[i].failure_type = SOCKS5_REPLY_SERVER_FAILURE;
+    c[i].verdict = CIRCUIT_VERDICT_NONE;
+  }
+  result->winner = NULL;
+  result->fd = -1;
+  result->failure_type = SOCKS5_REPLY_SERVER_FAILURE;
+  result->attempts = 0;
+
+  int winner = -1;
+  int timed_out = 0;
+  while (winner < 0) {
+    unsigned long long ready_generation = ssh_tunnel_state_generation();
+    long long now = tunnel_race_now_ms();
+    if (timeout_ms > 0 && now - start >= timeout_ms) {
+      timed_out = 1;
+      break;
+    }
+
+    // start whatever is due
+    int in_flight = 0;
+    int failed = 0;
+    int not_ready = 0;
+    for (int i=0; i<count; i++) {
+      in_flight += tunnel_race_in_flight(&c[i]);
+      failed += c[i].state == TR_FAILED;
+      c[i].not_ready = c[i].state == TR_WAITING && !ssh_tunnel_is_ready(c[i].tun);
+      not_ready += c[i].not_ready;
+    }
+    for (int i=0; i<count && !(failover && in_flight > 0); i++) {
+      if (c[i].state == TR_WAITING && !c[i].not_ready && c[i].start_at <= now) {
+        result->attempts++;
+        if (failover) {
+          lock_client_connection(con);
+          con->tunnel = c[i].tun;
+          unlock_client_connection(con);
+        }
+        c[i].started = now;
+        c[i].verdict = CIRCUIT_VERDICT_NONE;
+        if (tunnel_race_start(&c[i])) {
+          in_flight++;
+        } else if (c[i].state == TR_FAILED) {
+          tunnel_balance_record(&c[i].tun->balance, 0, 0);
+          circuit_breaker_record_verdict(&c[i].tun->breaker, c[i].verdict, time(NULL));
+          result->failure_type = c[i].failure_type;
+          failed++;
+        } else {
+          tunnel_balance_record(&c[i].tun->balance, 0, 0);
+          c[i].start_at = now + c[i].retry_ms;
+          c[i].retry_ms = c[i].retry_ms * 2 > TUNNEL_RACE_RETRY_MAX_MS ? TUNNEL_RACE_RETRY_MAX_MS : c[i].retry_ms * 2;
+        }
+      }
+    }
+    if (failed == count) {
+      break;
+    }
+
+    // wait for progress, the next start, or the deadline
+    long long wake = timeout_ms > 0 ? start + timeout_ms : now + TUNNEL_RACE_DEFAULT_TIMEOUT_MS;
+    int pfd_max = 0;
+    for (int i=0; i<count; i++) {
+      if (tunnel_race_in_flight(&c[i])) {
+        pfd[pfd_max].fd = c[i].fd;
+        pfd[pfd_max].events = (c[i].state == TR_METHOD || c[i].state == TR_REPLY) ? POLLIN : POLLOUT;
+        pfd[pfd_max].revents = 0;
+        pfd_idx[pfd_max] = i;
+        pfd_max++;
+      } else if (c[i].state == TR_WAITING && !c[i].not_ready && !(failover && in_flight > 0) && c[i].start_at < wake) {
+        wake = c[i].start_at;
+      }
+    }
+    int wait_ms = (int)(wake - now);
+    if (wait_ms < 0) {
+      wait_ms = 0;
+    }
+    if (not_ready > 0 && pfd_max == 0) {
+      // nothing in flight: sleep until a tunnel comes up (or something else is due)
+      ssh_tunnel_wait_for_change(ready_generation, wait_ms);
+      continue;
+    }
+    if (not_ready > 0 && wait_ms > SSH_TUNNEL_PROBE_INTERVAL_MS) {
+      wait_ms = SSH_TUNNEL_PROBE_INTERVAL_MS; // can't poll() a condition variable; look again soon
+    }
+    int rc;
+    do {
+      rc = poll(pfd, pfd_max, wait_ms);
+    } while (rc < 0 && errno == EINTR);
+    if (rc < 0) {
+      errorNum("poll() in tunnel race");
+      break;
+    }
+
+    now = tunnel_race_now_ms();
+    for (int p=0; p<pfd_max && winner < 0; p++) {
+      if (pfd[p].revents == 0) {
+        continue;
+      }
+      tunnel_race_candidate *cand = &c[pfd_idx[p]];
+      int step = tunnel_race_step(con, cand);
+      if (step != TR_STEP_PENDING) {
+        tunnel_balance_record(&cand->tun->balance, step == TR_STEP_DONE, now - cand->started);
+        // a retry after connecting is a broken handshake; before, ssh still starting
+        circuit_breaker_record_verdict(&cand->tun->breaker, cand->verdict, time(NULL));
+      }
+      if (step == TR_STEP_DONE) {
+        winner = pfd_idx[p];
+      } else if (step == TR_STEP_RETRY) {
+        tunnel_race_close(cand);
+        cand->state = TR_WAITING;
+        cand->start_at = now + cand->retry_ms;
+        cand->retry_ms = cand->retry_ms * 2 > TUNNEL_RACE_RETRY_MAX_MS ? TUNNEL_RACE_RETRY_MAX_MS : cand->retry_ms * 2;
+      } else if (step == TR_STEP_FAILED) {
+        tunnel_race_close(cand);
+        cand->state = TR_FAILED;
+        result->failure_type = cand->failure_type;
+      }
+    }
+  }
+
+  // a tunnel still mid-handshake when time ran out is the one the breaker is for: up, but going nowhere
+  for (int i=0; timed_out && i<count; i++) {
+    if (tunnel_race_in_flight(&c[i])) {
+      debug("ssh_tunnel %s still negotiating after %i ms",c[i].tun->name,timeout_ms);
+      circuit_breaker_record(&c[i].tun->breaker, 0, time(NULL));
+    }
+  }
+
+  // keep the winner; abandon the rest
+  for (int i=0; i<count; i++) {
+    if (i != winner) {
+      tunnel_race_close(&c[i]);
+    }
+  }
+  result->elapsed_ms = tunnel_race_now_ms() - start;
+  if (winner < 0) {
+    if (timed_out) {
+      debug("No tunnel negotiated a connection within %i ms",timeout_ms);
+    }
+    free(c);
+    return 0;
+  }
+  result->winner = c[winner].tun;
+  result->fd = c[winner].fd;
+  free(c);
+  int flags = fcntl(result->fd, F_GETFL);
+  if (flags >= 0) {
+    fcntl(result->fd, F_SETFL, flags & ~O_NONBLOCK);
+  }
+  result->failure_type = SOCKS5_REPLY_SUCCEED;
+  debug("Connected via %s in %lli ms after %i attempt(s)",result->winner->name,result->elapsed_ms,result->attempts);
+  return 1;
+}
@@ -0,0 +1,39 @@
+// Copyright 2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+// SPDX-License-Identifier: MIT-0
+
+#ifndef TUNNEL_RACE_H
+#define TUNNEL_RACE_H
+
+#include"client_connection.h"
+#include"ssh_tunnel.h"
+#include"route_rule.h"
+
+// SOCKS5 (or HTTP CONNECT) handshakes with several tunnels at once, without
+// blocking on any of them. Each candidate runs its own non-blocking state
+// machine (connect, greeting, method reply, command, command reply; for
+// httpConnect just the request and its reply) and the first to get a
+// successful reply wins; the others are closed.
+//
+// A tunnel whose ssh is still starting isn't tried until the main thread's
+// readiness probe marks it READY; the race sleeps on the tunnel state
+// condition variable meanwhile, so connections go through the moment the
+// tunnel is up. A tunnel that refuses the connection anyway is retried with
+// a short, growing delay until the deadline. A tunnel that answers with an
+// error is not retried.
+
+#define TUNNEL_RACE_FAILOVER         -1  // start_delay_ms: one candidate at a time, in order
+#define TUNNEL_RACE_RETRY_MIN_MS     10  // first retry of a tunnel that refused the connection
+#define TUNNEL_RACE_RETRY_MAX_MS    200
+#define TUNNEL_RACE_DEFAULT_TIMEOUT_MS 10000 // when connectTimeout is 0
+
+typedef struct tunnel_race_result {
+  ssh_tunnel *winner; // NULL if none
+  int fd;             // connected and negotiated socket to the winner, in blocking mode; -1 if none
+  int failure_type;   // SOCKS5_REPLY_* to give the client if there's no winner
+  int attempts;       // connections started, retries included
+  long long elapsed_ms;
+} tunnel_race_result;
+
+int tunnel_race_connect(client_connection *con, ssh_tunnel **tunnels, int count, int start_delay_ms, int timeout_ms, tunnel_race_result *result);
+
+#endif // TUNNEL_RACE_H
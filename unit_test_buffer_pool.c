@@ -0,0 +1,44 @@
+// Copyright 2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+// SPDX-License-Identifier: MIT-0
+
+#include<stdlib.h>
+#include<string.h>
+
+#include"unit_test.h"
+#include"buffer_pool.h"
+
+void unit_test_buffer_pool() {
+  ut_name("buffer_pool");
+
+  void *a = buffer_pool_get(1);
+  ut_assert_long_match("buffer_pool size 01", 256, buffer_pool_size(a));
+  void *b = buffer_pool_get(300);
+  ut_assert_long_match("buffer_pool size 02", 1024, buffer_pool_size(b));
+  void *c = buffer_pool_get(16384);
+  ut_assert_long_match("buffer_pool size 03", 16384, buffer_pool_size(c));
+  void *d = buffer_pool_get(16385);
+  ut_assert_long_match("buffer_pool size 04", 65536, buffer_pool_size(d));
+  void *e = buffer_pool_get(BUFFER_POOL_MAX_SIZE + 1);
+  ut_assert_long_match("buffer_pool size 05", BUFFER_POOL_MAX_SIZE + 1, buffer_pool_size(e));
+  memset(e, 0x5a, BUFFER_POOL_MAX_SIZE + 1);
+
+  buffer_pool_stats stats;
+  buffer_pool_get_stats(0, &stats);
+  ut_assert_long_match("buffer_pool stats 01", 256, stats.size);
+  ut_assert("buffer_pool stats 02", stats.in_use >= 1);
+  long long in_use = stats.in_use;
+
+  // a returned buffer is handed out again from this thread's cache
+  buffer_pool_put(a);
+  buffer_pool_get_stats(0, &stats);
+  ut_assert_long_match("buffer_pool stats 03", in_use - 1, stats.in_use);
+  void *a2 = buffer_pool_get(200);
+  ut_assert("buffer_pool reuse 01", a2 == a);
+
+  buffer_pool_put(a2);
+  buffer_pool_put(b);
+  buffer_pool_put(c);
+  buffer_pool_put(d);
+  buffer_pool_put(e);
+  buffer_pool_put(NULL);
+}
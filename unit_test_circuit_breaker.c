@@ -0,0 +1,65 @@
+// Copyright 2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+// SPDX-License-Identifier: MIT-0
+
+#include"unit_test.h"
+#include"circuit_breaker.h"
+
+void unit_test_circuit_breaker() {
+  ut_name("circuit_breaker");
+
+  circuit_breaker cb;
+  char buf[100];
+  circuit_breaker_init(&cb, 0, CIRCUIT_BREAKER_DEFAULT_WINDOW, CIRCUIT_BREAKER_DEFAULT_COOLDOWN);
+  ut_assert_true ("circuit_breaker parse 01", circuit_breaker_parse(&cb, "3"));
+  ut_assert_string_match("circuit_breaker parse 02", "3/30/10", circuit_breaker_str(&cb, buf, sizeof(buf)));
+  ut_assert_true ("circuit_breaker parse 03", circuit_breaker_parse(&cb, "5/60/20"));
+  ut_assert_string_match("circuit_breaker parse 04", "5/60/20", circuit_breaker_str(&cb, buf, sizeof(buf)));
+  ut_assert_true ("circuit_breaker parse 05", circuit_breaker_parse(&cb, "0"));
+  ut_assert_false("circuit_breaker parse 06", circuit_breaker_enabled(&cb));
+  ut_assert_false("circuit_breaker parse 07", circuit_breaker_parse(&cb, "3x"));
+  ut_assert_false("circuit_breaker parse 08", circuit_breaker_parse(&cb, "3/0"));
+  ut_assert_false("circuit_breaker parse 09", circuit_breaker_parse(&cb, "3/"));
+  ut_assert_false("circuit_breaker parse 10", circuit_breaker_parse(&cb, "1/2/3/4"));
+
+  // disabled never opens
+  circuit_breaker_init(&cb, 0, 30, 10);
+  for (int i=0; i<10; i++) {
+    circuit_breaker_record(&cb, 0, 1000);
+  }
+  ut_assert_true("circuit_breaker off 01", circuit_breaker_allow(&cb, 1000));
+
+  // opens after 3 failures in a row
+  circuit_breaker_init(&cb, 3, 30, 10);
+  circuit_breaker_record(&cb, 0, 1000);
+  circuit_breaker_record(&cb, 0, 1001);
+  circuit_breaker_record(&cb, 1, 1002); // a success starts the count again
+  circuit_breaker_record(&cb, 0, 1003);
+  circuit_breaker_record(&cb, 0, 1004);
+  ut_assert_true("circuit_breaker 01", circuit_breaker_allow(&cb, 1004));
+  circuit_breaker_record(&cb, 0, 1005);
+  ut_assert_false("circuit_breaker 02", circuit_breaker_allow(&cb, 1006));
+  circuit_breaker_stats stats;
+  circuit_breaker_get_stats(&cb, &stats);
+  ut_assert_int_match ("circuit_breaker 03", CIRCUIT_OPEN, stats.state);
+  ut_assert_long_match("circuit_breaker 04", 1, stats.times_opened);
+  ut_assert_long_match("circuit_breaker 05", 1, stats.skipped);
+
+  // after the cooldown one probe gets through; a failed probe opens it again
+  ut_assert_true ("circuit_breaker 06", circuit_breaker_allow(&cb, 1015));
+  ut_assert_false("circuit_breaker 07", circuit_breaker_allow(&cb, 1015));
+  circuit_breaker_record(&cb, 0, 1016);
+  ut_assert_false("circuit_breaker 08", circuit_breaker_allow(&cb, 1017));
+  // a probe that never reports back is replaced a cooldown later; a successful one closes the breaker
+  ut_assert_true ("circuit_breaker 09", circuit_breaker_allow(&cb, 1026));
+  ut_assert_true ("circuit_breaker 10", circuit_breaker_allow(&cb, 1036));
+  circuit_breaker_record(&cb, 1, 1037);
+  ut_assert_true ("circuit_breaker 11", circuit_breaker_allow(&cb, 1037));
+  ut_assert_true ("circuit_breaker 12", circuit_breaker_allow(&cb, 1037));
+
+  // failures spread wider than the window don't add up
+  circuit_breaker_init(&cb, 3, 30, 10);
+  circuit_breaker_record(&cb, 0, 2000);
+  circuit_breaker_record(&cb, 0, 2020);
+  circuit_breaker_record(&cb, 0, 2040);
+  ut_assert_true("circuit_breaker window 01", circuit_breaker_allow(&cb, 2040));
+}
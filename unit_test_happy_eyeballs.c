@@ -0,0 +1,93 @@
+// Copyright 2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+// SPDX-License-Identifier: MIT-0
+
+#include<string.h>
+#include<unistd.h>
+#include<errno.h>
+#include<netinet/in.h>
+#include<arpa/inet.h>
+#include<sys/socket.h>
+
+#include"unit_test.h"
+#include"happy_eyeballs.h"
+
+void ut_he_addr(struct sockaddr_storage *ss, int family, int tag) {
+  memset(ss, 0, sizeof(struct sockaddr_storage));
+  ss->ss_family = family;
+  if (family == AF_INET) {
+    ((struct sockaddr_in*)ss)->sin_port = htons(tag);
+  } else {
+    ((struct sockaddr_in6*)ss)->sin6_port = htons(tag);
+  }
+}
+
+int ut_he_tag(struct sockaddr_storage *ss) {
+  if (ss->ss_family == AF_INET) {
+    return ntohs(((struct sockaddr_in*)ss)->sin_port);
+  }
+  return ntohs(((struct sockaddr_in6*)ss)->sin6_port);
+}
+
+void unit_test_happy_eyeballs() {
+  ut_name("happy_eyeballs");
+
+  // 6 6 6 4 4 -> 6 4 6 4 6, order within a family kept
+  struct sockaddr_storage addrs[HAPPY_EYEBALLS_MAX_ADDRS];
+  ut_he_addr(&addrs[0], AF_INET6, 1);
+  ut_he_addr(&addrs[1], AF_INET6, 2);
+  ut_he_addr(&addrs[2], AF_INET6, 3);
+  ut_he_addr(&addrs[3], AF_INET,  4);
+  ut_he_addr(&addrs[4], AF_INET,  5);
+  happy_eyeballs_order(addrs, 5);
+  ut_assert_int_match("happy_eyeballs order 01", 1, ut_he_tag(&addrs[0]));
+  ut_assert_int_match("happy_eyeballs order 02", 4, ut_he_tag(&addrs[1]));
+  ut_assert_int_match("happy_eyeballs order 03", 2, ut_he_tag(&addrs[2]));
+  ut_assert_int_match("happy_eyeballs order 04", 5, ut_he_tag(&addrs[3]));
+  ut_assert_int_match("happy_eyeballs order 05", 3, ut_he_tag(&addrs[4]));
+
+  // the first address's family goes first
+  ut_he_addr(&addrs[0], AF_INET,  1);
+  ut_he_addr(&addrs[1], AF_INET,  2);
+  ut_he_addr(&addrs[2], AF_INET6, 3);
+  happy_eyeballs_order(addrs, 3);
+  ut_assert_int_match("happy_eyeballs order 06", 1, ut_he_tag(&addrs[0]));
+  ut_assert_int_match("happy_eyeballs order 07", 3, ut_he_tag(&addrs[1]));
+  ut_assert_int_match("happy_eyeballs order 08", 2, ut_he_tag(&addrs[2]));
+
+  // a refused address is skipped without waiting out the attempt delay
+  int listener = socket(AF_INET, SOCK_STREAM, 0);
+  struct sockaddr_in sin;
+  memset(&sin, 0, sizeof(sin));
+  sin.sin_family = AF_INET;
+  sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  sin.sin_port = 0;
+  bind(listener, (struct sockaddr*)&sin, sizeof(sin));
+  listen(listener, 4);
+  socklen_t len = sizeof(sin);
+  getsockname(listener, (struct sockaddr*)&sin, &len);
+  int refused = socket(AF_INET, SOCK_STREAM, 0); // bound, never listening: connections to it are refused
+  struct sockaddr_in sin_refused = sin;
+  sin_refused.sin_port = 0;
+  bind(refused, (struct sockaddr*)&sin_refused, sizeof(sin_refused));
+  len = sizeof(sin_refused);
+  getsockname(refused, (struct sockaddr*)&sin_refused, &len);
+
+  memset(addrs, 0, sizeof(addrs));
+  memcpy(&addrs[0], &sin_refused, sizeof(sin_refused));
+  memcpy(&addrs[1], &sin, sizeof(sin));
+  happy_eyeballs_result result;
+  ut_assert_true     ("happy_eyeballs connect 01", happy_eyeballs_connect(addrs, 2, 5000, &result));
+  ut_assert_int_match("happy_eyeballs connect 02", 1, result.winner);
+  ut_assert_int_match("happy_eyeballs connect 03", 2, result.attempts);
+  ut_assert_true     ("happy_eyeballs connect 04", result.fd >= 0);
+  ut_assert_true     ("happy_eyeballs connect 05", result.elapsed_ms < HAPPY_EYEBALLS_ATTEMPT_DELAY_MS);
+  close(result.fd);
+
+  ut_assert_false    ("happy_eyeballs connect 06", happy_eyeballs_connect(addrs, 1, 5000, &result));
+  ut_assert_int_match("happy_eyeballs connect 07", ECONNREFUSED, result.error);
+  ut_assert_int_match("happy_eyeballs connect 08", -1, result.fd);
+  ut_assert_false    ("happy_eyeballs connect 09", happy_eyeballs_connect(addrs, 0, 5000, &result));
+
+  close(refused);
+  close(listener);
+}
@@ -0,0 +1,9 @@
+// Copyright 2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+// SPDX-License-Identifier: MIT-0
+
+#ifndef UNIT_TEST_HAPPY_EYEBALLS_H
+#define UNIT_TEST_HAPPY_EYEBALLS_H
+
+void unit_test_happy_eyeballs(void);
+
+#endif // UNIT_TEST_HAPPY_EYEBALLS_H
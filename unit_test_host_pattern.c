@@ -0,0 +1,186 @@
+// Copyright 2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+// SPDX-License-Identifier: MIT-0
+
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<regex.h>
+#include<fnmatch.h>
+
+#include"unit_test.h"
+#include"host_pattern.h"
+
+void ut_host_pattern_match(char *test, int type, char *pattern, char *str, int expected) {
+  char err[200];
+  host_pattern *p = host_pattern_compile(pattern, type, err, sizeof(err));
+  if (p == NULL) {
+    ut_assert_string_match(test, "", err);
+    return;
+  }
+  char name[300];
+  snprintf(name, sizeof(name), "%s %s ~ %s", test, pattern, str);
+  ut_assert_int_match(name, expected, host_pattern_match(p, str));
+
+  // the DFA of just this pattern must agree
+  int id = 7, found[4];
+  host_pattern_dfa *dfa = host_pattern_dfa_build(&p, &id, 1);
+  ut_assert_true(name, dfa != NULL);
+  if (dfa) {
+    int count = host_pattern_dfa_match(dfa, str, found, 4);
+    ut_assert_int_match(name, expected, count);
+    host_pattern_dfa_free(dfa);
+  }
+  host_pattern_free(p);
+}
+
+void ut_host_pattern_error(char *test, int type, char *pattern) {
+  char err[200] = "";
+  host_pattern *p = host_pattern_compile(pattern, type, err, sizeof(err));
+  ut_assert_true(test, p == NULL && err[0] != 0);
+  host_pattern_free(p);
+}
+
+unsigned int ut_host_pattern_seed = 4242;
+
+int ut_host_pattern_rand(int n) {
+  ut_host_pattern_seed = ut_host_pattern_seed * 1103515245 + 12345;
+  return (ut_host_pattern_seed >> 16) % n;
+}
+
+void ut_host_pattern_random_name(char *buf, int buflen) {
+  char *parts[] = { "www", "build", "build-01", "build-7a", "Corp", "example", "com", "org", "10", "0", "b", "ab", "x-y" };
+  int n = 1 + ut_host_pattern_rand(5);
+  buf[0] = 0;
+  for (int i=0; i<n; i++) {
+    if (i > 0) {
+      strncat(buf, ".", buflen - strlen(buf) - 1);
+    }
+    strncat(buf, parts[ut_host_pattern_rand(13)], buflen - strlen(buf) - 1);
+  }
+}
+
+void unit_test_host_pattern() {
+  ut_name("host_pattern");
+
+  ut_host_pattern_match("glob 01", HOST_PATTERN_GLOB, "*.corp.example.com", "build.corp.example.com", 1);
+  ut_host_pattern_match("glob 02", HOST_PATTERN_GLOB, "*.corp.example.com", "corp.example.com", 0);
+  ut_host_pattern_match("glob 03", HOST_PATTERN_GLOB, "*.corp.example.com", "a.b.corp.example.com", 1);
+  ut_host_pattern_match("glob 04", HOST_PATTERN_GLOB, "*.build-??.corp.example.com", "x.build-07.corp.example.com", 1);
+  ut_host_pattern_match("glob 05", HOST_PATTERN_GLOB, "*.build-??.corp.example.com", "x.build-7.corp.example.com", 0);
+  ut_host_pattern_match("glob 06", HOST_PATTERN_GLOB, "*.BUILD-??.corp.example.com", "X.build-AB.CORP.example.com", 1);
+  ut_host_pattern_match("glob 07", HOST_PATTERN_GLOB, "db[0-9].example.com", "db7.example.com", 1);
+  ut_host_pattern_match("glob 08", HOST_PATTERN_GLOB, "db[!0-9].example.com", "db7.example.com", 0);
+  ut_host_pattern_match("glob 09", HOST_PATTERN_GLOB, "db[!0-9].example.com", "dbx.example.com", 1);
+  ut_host_pattern_match("glob 10", HOST_PATTERN_GLOB, "10.1.*", "10.1.2.3", 1);
+  ut_host_pattern_match("glob 11", HOST_PATTERN_GLOB, "10.1.*", "110.1.2.3", 0);
+  ut_host_pattern_match("glob 12", HOST_PATTERN_GLOB, "a\\*b", "a*b", 1);
+  ut_host_pattern_match("glob 13", HOST_PATTERN_GLOB, "a\\*b", "axb", 0);
+  ut_host_pattern_match("glob 14", HOST_PATTERN_GLOB, "*", "", 1);
+  ut_host_pattern_match("glob 15", HOST_PATTERN_GLOB, "a**b", "ab", 1);
+  ut_host_pattern_match("glob 16", HOST_PATTERN_GLOB, "[A-C]x", "bx", 1);
+
+  ut_host_pattern_match("regex 01", HOST_PATTERN_REGEX, "corp", "www.corp.example.com", 1);
+  ut_host_pattern_match("regex 02", HOST_PATTERN_REGEX, "^corp", "www.corp.example.com", 0);
+  ut_host_pattern_match("regex 03", HOST_PATTERN_REGEX, "\\.com$", "www.example.com", 1);
+  ut_host_pattern_match("regex 04", HOST_PATTERN_REGEX, "\\.com$", "www.example.com.au", 0);
+  ut_host_pattern_match("regex 05", HOST_PATTERN_REGEX, "^build-\\d+\\.corp\\.", "build-123.corp.example.com", 1);
+  ut_host_pattern_match("regex 06", HOST_PATTERN_REGEX, "^build-\\d+\\.corp\\.", "build-.corp.example.com", 0);
+  ut_host_pattern_match("regex 07", HOST_PATTERN_REGEX, "^(www|api)\\.example\\.(com|org)$", "API.example.org", 1);
+  ut_host_pattern_match("regex 08", HOST_PATTERN_REGEX, "^(www|api)\\.example\\.(com|org)$", "app.example.org", 0);
+  ut_host_pattern_match("regex 09", HOST_PATTERN_REGEX, "^[^.]+\\.example\\.com$", "a.b.example.com", 0);
+  ut_host_pattern_match("regex 10", HOST_PATTERN_REGEX, "^[^.]+\\.example\\.com$", "ab.example.com", 1);
+  ut_host_pattern_match("regex 11", HOST_PATTERN_REGEX, "^a?b*c+$", "bbc", 1);
+  ut_host_pattern_match("regex 12", HOST_PATTERN_REGEX, "^a?b*c+$", "aab", 0);
+  ut_host_pattern_match("regex 13", HOST_PATTERN_REGEX, "x\\$", "ax$", 1);
+  ut_host_pattern_match("regex 14", HOST_PATTERN_REGEX, "x\\\\$", "ax\\", 1);
+  ut_host_pattern_match("regex 15", HOST_PATTERN_REGEX, "(a*)*$", "bbb", 1);
+  ut_host_pattern_match("regex 16", HOST_PATTERN_REGEX, "^(a|)+$", "aaa", 1);
+  ut_host_pattern_match("regex 17", HOST_PATTERN_REGEX, "", "anything", 1);
+
+  ut_host_pattern_error("error 01", HOST_PATTERN_GLOB, "db[0-9");
+  ut_host_pattern_error("error 02", HOST_PATTERN_GLOB, "trailing\\");
+  ut_host_pattern_error("error 03", HOST_PATTERN_REGEX, "(abc");
+  ut_host_pattern_error("error 04", HOST_PATTERN_REGEX, "abc)");
+  ut_host_pattern_error("error 05", HOST_PATTERN_REGEX, "*abc");
+  ut_host_pattern_error("error 06", HOST_PATTERN_REGEX, "a{2}");
+  ut_host_pattern_error("error 07", HOST_PATTERN_REGEX, "a^b");
+  ut_host_pattern_error("error 08", HOST_PATTERN_REGEX, "[z-a]");
+
+  // Every pattern at once, in one DFA, against the system's own regex and
+  // fnmatch on random names.
+  char *regexes[] = { "corp", "^build-[0-9a-f]+\\.", "(www|api)\\.example", "\\.(com|org)$", "^[^.]*$", "b.*b",
+                      "^10\\.0\\.", "x-y|ab", "^(ab)*$", "0$", "[0-9][a-z]", "example\\.com\\.example" };
+  char *globs[] = { "*.example.com", "build-??.*", "*[0-9]", "10.*", "www.*.org", "*corp*", "b", "*.ab.*" };
+  int nr = sizeof(regexes) / sizeof(regexes[0]);
+  int ng = sizeof(globs) / sizeof(globs[0]);
+  host_pattern *pattern[40];
+  int id[40];
+  regex_t posix[40];
+  char err[200];
+  for (int i=0; i<nr; i++) {
+    pattern[i] = host_pattern_compile(regexes[i], HOST_PATTERN_REGEX, err, sizeof(err));
+    regcomp(&posix[i], regexes[i], REG_EXTENDED | REG_ICASE | REG_NOSUB);
+    id[i] = i * 10;
+  }
+  for (int i=0; i<ng; i++) {
+    pattern[nr+i] = host_pattern_compile(globs[i], HOST_PATTERN_GLOB, err, sizeof(err));
+    id[nr+i] = (nr+i) * 10;
+  }
+  host_pattern_dfa *dfa = host_pattern_dfa_build(pattern, id, nr + ng);
+  ut_assert_true("host_pattern dfa 01", dfa != NULL);
+  int mismatches = 0;
+  int matches = 0;
+  for (int n=0; dfa && n<3000; n++) {
+    char name[200];
+    ut_host_pattern_random_name(name, sizeof(name));
+    int want[40];
+    for (int i=0; i<nr; i++) {
+      want[i] = regexec(&posix[i], name, 0, NULL, 0) == 0;
+    }
+    for (int i=0; i<ng; i++) {
+      want[nr+i] = fnmatch(globs[i], name, FNM_CASEFOLD) == 0;
+    }
+    int found[40];
+    int count = host_pattern_dfa_match(dfa, name, found, 40);
+    int got[40];
+    memset(got, 0, sizeof(got));
+    for (int i=0; i<count; i++) {
+      got[found[i] / 10]++;
+    }
+    for (int i=0; i<nr+ng; i++) {
+      matches += want[i];
+      int nfa = host_pattern_match(pattern[i], name);
+      if (got[i] != want[i] || nfa != want[i]) {
+        if (mismatches++ < 5) {
+          char test[300];
+          snprintf(test, sizeof(test), "host_pattern dfa %s ~ %s", pattern[i]->source, name);
+          ut_assert_int_match(test, want[i], got[i]);
+          ut_assert_int_match(test, want[i], nfa);
+        }
+      }
+    }
+  }
+  ut_assert_int_match("host_pattern dfa 02", 0, mismatches);
+  ut_assert_true("host_pattern dfa 03", matches > 1000);
+  int one[1];
+  ut_assert_int_match("host_pattern dfa 04", -1, dfa ? host_pattern_dfa_match(dfa, "build-01.example.com", one, 1) : -1);
+  host_pattern_dfa_free(dfa);
+
+  // a DFA that would blow up is refused rather than built
+  host_pattern *blowup[20];
+  for (int i=0; i<20; i++) {
+    char source[40];
+    snprintf(source, sizeof(source), "a.*b%c.*c$", 'a' + i);
+    blowup[i] = host_pattern_compile(source, HOST_PATTERN_REGEX, err, sizeof(err));
+  }
+  ut_assert_true("host_pattern dfa 05", host_pattern_dfa_build(blowup, id, 20) == NULL);
+  for (int i=0; i<20; i++) {
+    host_pattern_free(blowup[i]);
+  }
+  for (int i=0; i<nr+ng; i++) {
+    host_pattern_free(pattern[i]);
+  }
+  for (int i=0; i<nr; i++) {
+    regfree(&posix[i]);
+  }
+}
@@ -0,0 +1,53 @@
+// Copyright 2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+// SPDX-License-Identifier: MIT-0
+
+#include<string.h>
+#include<arpa/inet.h>
+
+#include"unit_test.h"
+#include"socks5.h"
+#include"http_connect_client.h"
+
+void unit_test_http_connect() {
+  ut_name("http_connect");
+
+  char buf[HTTP_CONNECT_MAX_REQUEST];
+  client_connection *con = new_client_connection();
+  con->socks_address_type = SOCKS5_ADDRTYPE_DOMAIN;
+  host_id_set_name(&con->dst_host, "www.example.com");
+  host_id_set_port(&con->dst_host, 443);
+  int len = http_connect_build_request(con, buf, sizeof(buf));
+  ut_assert_string_match("http_connect request 01", "CONNECT www.example.com:443 HTTP/1.1\r\nHost: www.example.com:443\r\n\r\n", buf);
+  ut_assert_int_match("http_connect request 02", strlen(buf), len);
+  ut_assert_int_match("http_connect request 03", 0, http_connect_build_request(con, buf, 20));
+
+  struct sockaddr_in6 sin6;
+  memset(&sin6, 0, sizeof(sin6));
+  sin6.sin6_family = AF_INET6;
+  sin6.sin6_port = htons(22);
+  inet_pton(AF_INET6, "2001:db8::1", &sin6.sin6_addr);
+  host_id_init(&con->dst_host);
+  host_id_set_addr_in6(&con->dst_host, &sin6);
+  con->socks_address_type = SOCKS5_ADDRTYPE_IPV6;
+  http_connect_build_request(con, buf, sizeof(buf));
+  ut_assert_string_match("http_connect request 04", "CONNECT [2001:db8::1]:22 HTTP/1.1\r\nHost: [2001:db8::1]:22\r\n\r\n", buf);
+
+  char *ok = "HTTP/1.1 200 Connection established\r\nProxy-Agent: test\r\n\r\nSSH-2.0";
+  ut_assert_int_match("http_connect reply 01", 0, http_connect_reply_len(ok, 20));
+  ut_assert_int_match("http_connect reply 02", 0, http_connect_reply_len(ok, 57));
+  ut_assert_int_match("http_connect reply 03", 58, http_connect_reply_len(ok, strlen(ok)));
+  ut_assert_int_match("http_connect reply 04", 200, http_connect_reply_status(ok, 58));
+  ut_assert_int_match("http_connect reply 05", 17, http_connect_reply_len("HTTP/1.0 200 OK\n\n", 17));
+  ut_assert_int_match("http_connect reply 06", 403, http_connect_reply_status("HTTP/1.0 403 Forbidden\r\n\r\n", 26));
+  ut_assert_int_match("http_connect reply 07", -1, http_connect_reply_status("SSH-2.0-OpenSSH\r\n\r\n", 19));
+  ut_assert_int_match("http_connect reply 08", -1, http_connect_reply_status("HTTP/1.1 2x0 OK\r\n\r\n", 19));
+  char big[HTTP_CONNECT_MAX_REPLY];
+  memset(big, 'x', sizeof(big));
+  ut_assert_int_match("http_connect reply 09", -1, http_connect_reply_len(big, sizeof(big)));
+
+  ut_assert_int_match("http_connect failure 01", SOCKS5_REPLY_SUCCEED, http_connect_failure_type(200));
+  ut_assert_int_match("http_connect failure 02", SOCKS5_REPLY_NOT_ALLOWED, http_connect_failure_type(407));
+  ut_assert_int_match("http_connect failure 03", SOCKS5_REPLY_HOST_UNREACHABLE, http_connect_failure_type(502));
+  ut_assert_int_match("http_connect failure 04", SOCKS5_REPLY_TTL_EXPIRED, http_connect_failure_type(504));
+  ut_assert_int_match("http_connect failure 05", SOCKS5_REPLY_SERVER_FAILURE, http_connect_failure_type(500));
+}
@@ -8,6 +8,20 @@
 #include"unit_test_config_file.h"
 #include"unit_test_host_id.h"
 #include"unit_test_string2.h"
+#include"unit_test_buffer_pool.h"
+#include"unit_test_traffic_counter.h"
+#include"unit_test_token_bucket.h"
+#include"unit_test_happy_eyeballs.h"
+#include"unit_test_tunnel_balance.h"
+#include"unit_test_circuit_breaker.h"
+#include"unit_test_ssh_tunnel.h"
+#include"unit_test_http_connect.h"
+#include"unit_test_socks5_client.h"
+#include"unit_test_socks_request.h"
+#include"unit_test_route_index.h"
+#include"unit_test_route_cache.h"
+#include"unit_test_string_intern.h"
+#include"unit_test_host_pattern.h"
 #include"thread_local.h"
 
 int main(int argc, char **argv) {
@@ -23,6 +37,20 @@ int main(int argc, char **argv) {
   unit_test_log_level();
   unit_test_host_id();
   unit_test_string2();
+  unit_test_buffer_pool();
+  unit_test_traffic_counter();
+  unit_test_token_bucket();
+  unit_test_happy_eyeballs();
+  unit_test_tunnel_balance();
+  unit_test_circuit_breaker();
+  unit_test_ssh_tunnel();
+  unit_test_http_connect();
+  unit_test_socks5_client();
+  unit_test_socks_request();
+  unit_test_route_index();
+  unit_test_route_cache();
+  unit_test_string_intern();
+  unit_test_host_pattern();
 
   printf("--------------------\n");
   printf("Tests run:   %i\n", tests_run);
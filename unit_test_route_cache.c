@@ -0,0 +1,121 @@
+// Copyright 2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+// SPDX-License-Identifier: MIT-0
+
+#include<stdio.h>
+#include<string.h>
+
+#include"unit_test.h"
+#include"log.h"
+#include"socks5.h"
+#include"thread_local.h"
+#include"proxy_instance.h"
+#include"route_rule.h"
+#include"route_cache.h"
+#include"route_rules_engine.h"
+
+void ut_route_cache_decision(route_decision *decision, int port) {
+  memset(decision, 0, sizeof(route_decision));
+  host_id_init(&decision->dst);
+  host_id_set_port(&decision->dst, port);
+  decision->idle_timeout = -1;
+  decision->connect_timeout = -1;
+}
+
+void unit_test_route_cache() {
+  ut_name("route_cache");
+
+  // a name that looks like an address is not that address
+  host_id by_name, by_addr;
+  char key_name[ROUTE_CACHE_MAX_KEY], key_addr[ROUTE_CACHE_MAX_KEY];
+  unsigned char ipv4[4] = { 10, 1, 2, 3 };
+  host_id_init(&by_name);
+  host_id_set_name(&by_name, "10.1.2.3");
+  host_id_set_port(&by_name, 443);
+  host_id_init(&by_addr);
+  host_id_set_addr_in_from_byte_array(&by_addr, ipv4, 443);
+  route_cache_key(&by_name, key_name, sizeof(key_name));
+  route_cache_key(&by_addr, key_addr, sizeof(key_addr));
+  ut_assert_true("route_cache key 01", strcmp(key_name, key_addr) != 0);
+
+  route_cache *cache = new_route_cache(ROUTE_CACHE_STRIPES * 2);
+  route_decision decision, out;
+  ut_route_cache_decision(&decision, 1);
+  ut_assert_int_match("route_cache lookup 01", 0, route_cache_lookup(cache, key_name, &out, 1000));
+  route_cache_store(cache, key_name, &decision, 1000);
+  ut_assert_int_match("route_cache lookup 02", 1, route_cache_lookup(cache, key_name, &out, 1000));
+  ut_assert_int_match("route_cache lookup 03", 1, host_id_get_port(&out.dst));
+  ut_assert_int_match("route_cache lookup 04", 0, route_cache_lookup(cache, key_addr, &out, 1000));
+
+  // storing again replaces the decision
+  ut_route_cache_decision(&decision, 2);
+  route_cache_store(cache, key_name, &decision, 1000);
+  route_cache_lookup(cache, key_name, &out, 1000);
+  ut_assert_int_match("route_cache replace 01", 2, host_id_get_port(&out.dst));
+
+  route_cache_stats stats;
+  route_cache_get_stats(cache, &stats);
+  ut_assert_int_match("route_cache stats 01", ROUTE_CACHE_STRIPES * 2, stats.size);
+  ut_assert_int_match("route_cache stats 02", 1, stats.entries);
+  ut_assert_long_match("route_cache stats 03", 2, stats.hits);
+  ut_assert_long_match("route_cache stats 04", 2, stats.misses);
+
+  // the least recently used entries go first
+  route_cache_store(cache, key_addr, &decision, 1000);
+  char key[ROUTE_CACHE_MAX_KEY];
+  for (int i=0; i<200; i++) {
+    snprintf(key, sizeof(key), "443||host%i.example.com", i);
+    route_cache_store(cache, key, &decision, 1000);
+    route_cache_lookup(cache, key_name, &out, 1000);
+  }
+  route_cache_get_stats(cache, &stats);
+  ut_assert_int_match("route_cache lru 01", stats.size, stats.entries);
+  ut_assert_int_match("route_cache lru 02", 1, route_cache_lookup(cache, key_name, &out, 1000));
+  ut_assert_int_match("route_cache lru 03", 0, route_cache_lookup(cache, key_addr, &out, 1000));
+  ut_assert_int_match("route_cache lru 04", 1, route_cache_lookup(cache, key, &out, 1000));
+
+  // a decision that looked up a name goes stale
+  decision.resolved_dns = 1;
+  route_cache_store(cache, key_addr, &decision, 1000);
+  ut_assert_int_match("route_cache dns 01", 1, route_cache_lookup(cache, key_addr, &out, 1000 + ROUTE_CACHE_DNS_TTL - 1));
+  ut_assert_int_match("route_cache dns 02", 0, route_cache_lookup(cache, key_addr, &out, 1000 + ROUTE_CACHE_DNS_TTL));
+
+  // new rules, new generation: everything is stale
+  route_cache_invalidate(cache);
+  ut_assert_int_match("route_cache invalidate 01", 0, route_cache_lookup(cache, key_name, &out, 1000));
+  route_cache_store(cache, key_name, &decision, 1000);
+  ut_assert_int_match("route_cache invalidate 02", 1, route_cache_lookup(cache, key_name, &out, 1000));
+
+  // a cached decision does to the next connection what the rules did to the first
+  log_config quiet;
+  log_config_init(&quiet);
+  quiet.level = LOG_LEVEL_ERROR;
+  log_config *saved_log = thread_local_get_log_config();
+  thread_local_set_log_config(&quiet);
+
+  ssh_tunnel *tunnels = new_ssh_tunnel();
+  strcpy(tunnels->name,"tA");
+  proxy_instance *proxy = new_proxy_instance();
+  char *specs[] = { "network 10.1.0.0/16 to 10.2.0.0/16 idleTimeout 7", "network 10.2.0.0/16 connectTimeout 3 via tA" };
+  for (int i=0; i<2; i++) {
+    proxy->route_rule_list = insert_route_rule(proxy->route_rule_list, parse_route_rule_spec(specs[i], "unit_test", i+1, tunnels));
+  }
+  proxy->route_cache = new_route_cache(64);
+  for (int i=0; i<2; i++) {
+    client_connection *con = new_client_connection();
+    host_id_init(&con->dst_host);
+    host_id_set_addr_in_from_byte_array(&con->dst_host, ipv4, 443);
+    con->socks_address_type = SOCKS5_ADDRTYPE_IPV4;
+    ut_assert_int_match("route_cache engine 01", 1, decide_applicable_rule(proxy, NULL, con));
+    ut_assert_long_match("route_cache engine 02", 2, con->route->file_line_number);
+    char buf[300];
+    ut_assert_string_match("route_cache engine 03", "10.2.2.3", host_id_addr_str(&con->dst_host, buf, sizeof(buf)));
+    ut_assert_int_match("route_cache engine 04", 443, host_id_get_port(&con->dst_host));
+    ut_assert_int_match("route_cache engine 05", 7, atomic_load(&con->idle_timeout));
+    ut_assert_int_match("route_cache engine 06", 3, con->connect_timeout);
+  }
+  route_cache_get_stats(proxy->route_cache, &stats);
+  ut_assert_long_match("route_cache engine 07", 1, stats.hits);
+  ut_assert_long_match("route_cache engine 08", 1, stats.misses);
+
+  thread_local_set_log_config(saved_log);
+}
@@ -0,0 +1,172 @@
+// Copyright 2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+// SPDX-License-Identifier: MIT-0
+
+#include<stdio.h>
+#include<string.h>
+
+#include"unit_test.h"
+#include"log.h"
+#include"socks5.h"
+#include"thread_local.h"
+#include"proxy_instance.h"
+#include"route_rule.h"
+#include"route_index.h"
+#include"route_rules_engine.h"
+
+unsigned int ut_route_index_seed = 12345;
+
+int ut_route_index_rand(int n) {
+  ut_route_index_seed = ut_route_index_seed * 1103515245 + 12345;
+  return (ut_route_index_seed >> 16) % n;
+}
+
+void ut_route_index_rule_spec(char *buf, int buflen) {
+  char *domains[] = { "example.com", "example.org", "corp.example.com" };
+  char *domain = domains[ut_route_index_rand(3)];
+  int i = ut_route_index_rand(20), j = ut_route_index_rand(10);
+  int a = ut_route_index_rand(4), b = ut_route_index_rand(8), c = ut_route_index_rand(16);
+  char *via = ut_route_index_rand(2) ? " via tA" : " via tB";
+  switch (ut_route_index_rand(19)) {
+    case 0:  snprintf(buf,buflen,"is h%i.s%i.%s%s",i,j,domain,via); break;
+    case 1:  snprintf(buf,buflen,"is 10.%i.%i.%i%s",a,b,c,via); break;
+    case 2:  snprintf(buf,buflen,"endsWith .s%i.%s%s",j,domain,via); break;
+    case 3:  snprintf(buf,buflen,"endsWith %s%s",ut_route_index_rand(2) ? "S1.Example.com" : ".com",via); break;
+    case 4:  snprintf(buf,buflen,"startsWith %s%s",ut_route_index_rand(2) ? "h1" : "10.2.",via); break;
+    case 5:  snprintf(buf,buflen,"network 10.%i.%i.0/%i%s",a,b,ut_route_index_rand(2) ? 24 : 16,via); break;
+    case 6:  snprintf(buf,buflen,"network 10.%i.%i.%i%s",a,b,c,via); break;
+    case 7:  snprintf(buf,buflen,"network 10.0.%i.0/255.0.255.0%s",b,via); break;
+    case 8:  snprintf(buf,buflen,"contains s%i%s",j,via); break;
+    case 9:  snprintf(buf,buflen,"port %i%s",ut_route_index_rand(2) ? 443 : 22,via); break;
+    case 10: snprintf(buf,buflen,"endsWith .s%i.%s port 443%s",j,domain,via); break;
+    case 11: snprintf(buf,buflen,"network 10.%i.0.0/16 to 10.%i.0.0/16",a,ut_route_index_rand(4)); break;
+    case 12: snprintf(buf,buflen,"contains %s%s",ut_route_index_rand(2) ? "Ple.C" : "0.1",via); break;
+    case 13: snprintf(buf,buflen,"contains h%i.s port 443%s",i,via); break;
+    case 14: snprintf(buf,buflen,"matches h%i.*.%s%s",i,domain,via); break;
+    case 15: snprintf(buf,buflen,"matches *.S?.example.*%s",via); break;
+    case 16: snprintf(buf,buflen,"regex ^h1[0-9]?\\.s%i\\.%s",j,via); break;
+    case 17: snprintf(buf,buflen,"regex (org|10\\.%i\\.)%s",a,via); break;
+    default: snprintf(buf,buflen,"startsWith h%i idleTimeout 5",i); break;
+  }
+}
+
+void ut_route_index_random_destination(client_connection *con) {
+  host_id_init(&con->dst_host);
+  int port = ut_route_index_rand(3) == 0 ? 443 : 80;
+  if (ut_route_index_rand(2)) {
+    char *domains[] = { "example.com", "example.org", "corp.example.com", "CORP.EXAMPLE.COM" };
+    char name[200];
+    snprintf(name,sizeof(name),"h%i.s%i.%s",ut_route_index_rand(20),ut_route_index_rand(10),domains[ut_route_index_rand(4)]);
+    host_id_set_name(&con->dst_host, name);
+    host_id_set_port(&con->dst_host, port);
+    con->socks_address_type = SOCKS5_ADDRTYPE_DOMAIN;
+  } else {
+    unsigned char ipv4[4] = { 10, ut_route_index_rand(4), ut_route_index_rand(8), ut_route_index_rand(16) };
+    host_id_set_addr_in_from_byte_array(&con->dst_host, ipv4, port);
+    con->socks_address_type = SOCKS5_ADDRTYPE_IPV4;
+  }
+}
+
+void unit_test_route_index() {
+  ut_name("route_index");
+
+  // thousands of routing decisions; keep them out of the log
+  log_config quiet;
+  log_config_init(&quiet);
+  quiet.level = LOG_LEVEL_ERROR;
+  log_config *saved_log = thread_local_get_log_config();
+  thread_local_set_log_config(&quiet);
+
+  ssh_tunnel *tunnels = NULL;
+  ssh_tunnel *ta = new_ssh_tunnel();
+  strcpy(ta->name,"tA");
+  tunnels = insert_ssh_tunnel(tunnels, ta);
+  ssh_tunnel *tb = new_ssh_tunnel();
+  strcpy(tb->name,"tB");
+  tunnels = insert_ssh_tunnel(tunnels, tb);
+
+  proxy_instance *proxy = new_proxy_instance();
+  char spec[300];
+  for (int i=0; i<2000; i++) {
+    ut_route_index_rule_spec(spec, sizeof(spec));
+    route_rule *route = parse_route_rule_spec(spec, "unit_test", i+1, tunnels);
+    if (route == NULL) {
+      ut_assert_string_match("route_index parse", "", spec);
+      break;
+    }
+    proxy->route_rule_list = insert_route_rule(proxy->route_rule_list, route);
+  }
+  route_index *idx = route_index_build(proxy->route_rule_list);
+  ut_assert_int_match("route_index build 01", 2000, idx->rule_count);
+  ut_assert_int_match("route_index build 02", idx->rule_count, idx->count_is + idx->count_network + idx->count_ends_with + idx->count_starts_with + idx->count_contains + idx->count_patterns + idx->scan_count);
+  ut_assert_true("route_index build 03", idx->scan_count < idx->rule_count / 2);
+  // the memory report counts at least the structures themselves
+  ut_assert_true("route_index memory 01", route_rule_memory(proxy->route_rule_list) >= 2000 * sizeof(route_rule));
+  ut_assert_true("route_index memory 02", route_index_memory(idx) >= sizeof(route_index) + 2000 * (sizeof(route_rule*) + sizeof(route_index_hash_entry)));
+  ut_assert_true("route_index memory 03", idx->count_patterns == 0 || host_pattern_dfa_memory(idx->patterns) > 0);
+
+  // the index must pick the same rule, and leave the same destination, as walking the list
+  client_connection *linear = new_client_connection();
+  client_connection *indexed = new_client_connection();
+  int mismatches = 0;
+  int matched = 0;
+  for (int i=0; i<5000; i++) {
+    unsigned int seed = ut_route_index_seed;
+    ut_route_index_random_destination(linear);
+    ut_route_index_seed = seed;
+    ut_route_index_random_destination(indexed);
+
+    proxy->route_index = NULL;
+    int rc_linear = decide_applicable_rule(proxy, NULL, linear);
+    proxy->route_index = idx;
+    int rc_indexed = decide_applicable_rule(proxy, NULL, indexed);
+
+    char dst_linear[300], dst_indexed[300];
+    host_id_str(&linear->dst_host, dst_linear, sizeof(dst_linear));
+    host_id_str(&indexed->dst_host, dst_indexed, sizeof(dst_indexed));
+    if (rc_linear != rc_indexed || linear->route != indexed->route || strcmp(dst_linear, dst_indexed) != 0) {
+      if (mismatches++ < 5) {
+        ut_assert_string_match("route_index equivalence", dst_linear, dst_indexed);
+        ut_assert_long_match("route_index equivalence", linear->route->file_line_number, indexed->route->file_line_number);
+      }
+    }
+    matched += rc_linear;
+  }
+  ut_assert_int_match("route_index equivalence 01", 0, mismatches);
+  ut_assert_true("route_index equivalence 02", matched > 0);
+
+  // first rule in file order wins, whichever structure it was filed in
+  proxy_instance *small = new_proxy_instance();
+  char *specs[] = { "contains zzz via tA", "endsWith .example.com via tB", "is www.example.com via tA", "startsWith www via tA" };
+  for (int i=0; i<4; i++) {
+    small->route_rule_list = insert_route_rule(small->route_rule_list, parse_route_rule_spec(specs[i], "unit_test", i+1, tunnels));
+  }
+  small->route_index = route_index_build(small->route_rule_list);
+  host_id_init(&indexed->dst_host);
+  host_id_set_name(&indexed->dst_host, "www.example.com");
+  decide_applicable_rule(small, NULL, indexed);
+  ut_assert_long_match("route_index order 01", 2, indexed->route->file_line_number);
+  host_id_init(&indexed->dst_host);
+  host_id_set_name(&indexed->dst_host, "www.example.org");
+  decide_applicable_rule(small, NULL, indexed);
+  ut_assert_long_match("route_index order 02", 4, indexed->route->file_line_number);
+
+  // contains strings that overlap, found in a single pass over the name
+  proxy_instance *overlap = new_proxy_instance();
+  char *contains_specs[] = { "contains amp.e via tA", "contains xample via tB", "contains EXAMPLE.ORG via tA", "contains le.o via tB", "contains e via tA" };
+  for (int i=0; i<5; i++) {
+    overlap->route_rule_list = insert_route_rule(overlap->route_rule_list, parse_route_rule_spec(contains_specs[i], "unit_test", i+1, tunnels));
+  }
+  overlap->route_index = route_index_build(overlap->route_rule_list);
+  ut_assert_int_match("route_index contains 01", 5, overlap->route_index->count_contains);
+  char *names[] = { "www.example.org", "www.sample.org", "www.example.com", "WWW.EXAMPLE.ORG", "tunnel.local", "www.nothing.org", "xamp.example" };
+  long want[]   = { 2,                 4,                2,                 2,                 5,              0,                 1 };
+  for (int i=0; i<7; i++) {
+    host_id_init(&indexed->dst_host);
+    host_id_set_name(&indexed->dst_host, names[i]);
+    indexed->route = NULL;
+    int rc = decide_applicable_rule(overlap, NULL, indexed);
+    ut_assert_long_match("route_index contains 02", want[i], rc && indexed->route ? indexed->route->file_line_number : 0);
+  }
+
+  thread_local_set_log_config(saved_log);
+}
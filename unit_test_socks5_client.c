@@ -0,0 +1,38 @@
+// Copyright 2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+// SPDX-License-Identifier: MIT-0
+
+#include<string.h>
+
+#include"unit_test.h"
+#include"socks5.h"
+#include"socks5_client.h"
+
+void unit_test_socks5_client() {
+  ut_name("socks5_client");
+
+  unsigned char buf[300];
+  client_connection *con = new_client_connection();
+  con->socks_command = SOCKS5_CMD_CONNECT;
+  con->socks_address_type = SOCKS5_ADDRTYPE_DOMAIN;
+  host_id_set_name(&con->dst_host, "example.com");
+  host_id_set_port(&con->dst_host, 443);
+  int len = socks5_client_build_pipelined(con, buf, sizeof(buf));
+  ut_assert_int_match("socks5_client pipelined 01", 3+4+1+11+2, len);
+  ut_assert_int_match("socks5_client pipelined 02", 0, memcmp(buf, "\x05\x01\x00\x05\x01\x00\x03\x0b" "example.com" "\x01\xbb", len));
+  ut_assert_int_match("socks5_client pipelined 03", 0, socks5_client_build_pipelined(con, buf, 100));
+
+  unsigned char ipv4[] = { 0x05, 0x00, 0x05, 0x00, 0x00, 0x01, 1, 2, 3, 4, 0x00, 0x50, 'S', 'S', 'H' };
+  ut_assert_int_match("socks5_client reply 01", 0, socks5_client_pipelined_reply_len(ipv4, 0));
+  ut_assert_int_match("socks5_client reply 02", 0, socks5_client_pipelined_reply_len(ipv4, 2));
+  ut_assert_int_match("socks5_client reply 03", 0, socks5_client_pipelined_reply_len(ipv4, 6));
+  ut_assert_int_match("socks5_client reply 04", 2+10, socks5_client_pipelined_reply_len(ipv4, 7));
+  ut_assert_int_match("socks5_client reply 05", 2+10, socks5_client_pipelined_reply_len(ipv4, sizeof(ipv4)));
+  unsigned char domain[] = { 0x05, 0x00, 0x05, 0x04, 0x00, 0x03, 3, 'a', 'b', 'c', 0x00, 0x50 };
+  ut_assert_int_match("socks5_client reply 06", 2+4+1+3+2, socks5_client_pipelined_reply_len(domain, 7));
+  unsigned char refused[] = { 0x05, 0xFF };
+  ut_assert_int_match("socks5_client reply 07", -2, socks5_client_pipelined_reply_len(refused, 2));
+  unsigned char socks4[] = { 0x00, 0x5A, 0, 0, 0, 0, 0, 0 };
+  ut_assert_int_match("socks5_client reply 08", -1, socks5_client_pipelined_reply_len(socks4, 1));
+  unsigned char bad[] = { 0x05, 0x00, 0x05, 0x00, 0x00, 0x09, 0 };
+  ut_assert_int_match("socks5_client reply 09", -1, socks5_client_pipelined_reply_len(bad, 7));
+}
@@ -0,0 +1,9 @@
+// Copyright 2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+// SPDX-License-Identifier: MIT-0
+
+#ifndef UNIT_TEST_SOCKS5_CLIENT_H
+#define UNIT_TEST_SOCKS5_CLIENT_H
+
+void unit_test_socks5_client(void);
+
+#endif // UNIT_TEST_SOCKS5_CLIENT_H
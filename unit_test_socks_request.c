@@ -0,0 +1,65 @@
+// Copyright 2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+// SPDX-License-Identifier: MIT-0
+
+#include<string.h>
+
+#include"unit_test.h"
+#include"socks5.h"
+#include"service_socks.h"
+#include"socks_request.h"
+
+void unit_test_socks_request() {
+  ut_name("socks_request");
+  socks_request req;
+
+  // SOCKS5 greeting and CONNECT to example.com:443 in one go, followed by client data
+  unsigned char v5[] = "\x05\x02\x00\x02" "\x05\x01\x00\x03\x0b" "example.com" "\x01\xbb" "GET /";
+  int v5_len = sizeof(v5)-1;
+  ut_assert_int_match("socks_request v5 01", SOCKS_REQUEST_MORE, socks_request_parse(v5, 0, &req));
+  ut_assert_int_match("socks_request v5 02", SOCKS_VERSION_ERROR, req.version);
+  ut_assert_int_match("socks_request v5 03", SOCKS_REQUEST_MORE, socks_request_parse(v5, 3, &req));
+  ut_assert_int_match("socks_request v5 04", SOCKS_REQUEST_GREETING, socks_request_parse(v5, 4, &req));
+  ut_assert_int_match("socks_request v5 05", 2, req.method_count);
+  ut_assert_int_match("socks_request v5 06", 4, req.greeting_len);
+  ut_assert_int_match("socks_request v5 07", SOCKS_REQUEST_GREETING, socks_request_parse(v5, 4+4+1+11+1, &req));
+  ut_assert_int_match("socks_request v5 08", SOCKS_REQUEST_DONE, socks_request_parse(v5, 4+4+1+11+2, &req));
+  ut_assert_int_match("socks_request v5 09", SOCKS_REQUEST_DONE, socks_request_parse(v5, v5_len, &req));
+  ut_assert_int_match("socks_request v5 10", 4+4+1+11+2, req.len);
+  ut_assert_int_match("socks_request v5 11", SOCKS5_CMD_CONNECT, req.command);
+  ut_assert_int_match("socks_request v5 12", SOCKS5_ADDRTYPE_DOMAIN, req.address_type);
+  ut_assert_string_match("socks_request v5 13", "example.com", (char*)req.addr);
+  ut_assert_int_match("socks_request v5 14", 443, req.port);
+
+  unsigned char v6[] = { 0x05, 0x01, 0x00, 0x05, 0x01, 0x00, 0x04, 0x20, 0x01, 0x0d, 0xb8, 0,0,0,0, 0,0,0,0, 0,0,0,1, 0x00, 0x16 };
+  ut_assert_int_match("socks_request v5 15", SOCKS_REQUEST_DONE, socks_request_parse(v6, sizeof(v6), &req));
+  ut_assert_int_match("socks_request v5 16", sizeof(v6), req.len);
+  ut_assert_int_match("socks_request v5 17", 0x20, req.addr[0]);
+  ut_assert_int_match("socks_request v5 18", 22, req.port);
+
+  unsigned char bad_rsv[] = { 0x05, 0x01, 0x00, 0x05, 0x01, 0x01, 0x01 };
+  ut_assert_int_match("socks_request v5 19", SOCKS_REQUEST_ERROR, socks_request_parse(bad_rsv, sizeof(bad_rsv), &req));
+  ut_assert_int_match("socks_request v5 20", 5, req.version);
+  unsigned char bad_type[] = { 0x05, 0x01, 0x00, 0x05, 0x01, 0x00, 0x07, 0x00 };
+  ut_assert_int_match("socks_request v5 21", SOCKS_REQUEST_ERROR, socks_request_parse(bad_type, sizeof(bad_type), &req));
+
+  // SOCKS4 CONNECT to 1.2.3.4:80 with user id "bob"
+  unsigned char v4[] = { 0x04, 0x01, 0x00, 0x50, 1, 2, 3, 4, 'b', 'o', 'b', 0, 'x' };
+  ut_assert_int_match("socks_request v4 01", SOCKS_REQUEST_MORE, socks_request_parse(v4, 7, &req));
+  ut_assert_int_match("socks_request v4 02", 4, req.version);
+  ut_assert_int_match("socks_request v4 03", SOCKS_REQUEST_MORE, socks_request_parse(v4, 11, &req));
+  ut_assert_int_match("socks_request v4 04", SOCKS_REQUEST_DONE, socks_request_parse(v4, sizeof(v4), &req));
+  ut_assert_int_match("socks_request v4 05", 12, req.len);
+  ut_assert_int_match("socks_request v4 06", 80, req.port);
+  ut_assert_int_match("socks_request v4 07", SOCKS5_ADDRTYPE_IPV4, req.address_type);
+  ut_assert_int_match("socks_request v4 08", 0, memcmp(req.addr, "\x01\x02\x03\x04", 4));
+
+  unsigned char long_id[8+SOCKS_REQUEST_MAX_USERID];
+  memset(long_id, 'a', sizeof(long_id));
+  memcpy(long_id, v4, 8);
+  ut_assert_int_match("socks_request v4 09", SOCKS_REQUEST_MORE, socks_request_parse(long_id, sizeof(long_id)-1, &req));
+  ut_assert_int_match("socks_request v4 10", SOCKS_REQUEST_ERROR, socks_request_parse(long_id, sizeof(long_id), &req));
+
+  unsigned char http[] = "GET / HTTP/1.1";
+  ut_assert_int_match("socks_request version 01", SOCKS_REQUEST_ERROR, socks_request_parse(http, 1, &req));
+  ut_assert_int_match("socks_request version 02", SOCKS_VERSION_ERROR, req.version);
+}
@@ -0,0 +1,9 @@
+// Copyright 2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+// SPDX-License-Identifier: MIT-0
+
+#ifndef UNIT_TEST_SOCKS_REQUEST_H
+#define UNIT_TEST_SOCKS_REQUEST_H
+
+void unit_test_socks_request(void);
+
+#endif // UNIT_TEST_SOCKS_REQUEST_H
@@ -0,0 +1,101 @@
+// Copyright 2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+// SPDX-License-Identifier: MIT-0
+
+#include<string.h>
+#include<arpa/inet.h>
+
+#include"unit_test.h"
+#include"ssh_tunnel.h"
+
+void unit_test_ssh_tunnel() {
+  ut_name("ssh_tunnel");
+
+  char buf[200];
+  ssh_tunnel *ssh = new_ssh_tunnel();
+  ssh->socks_port = 1080;
+  strcpy(ssh->command_to_run, "ssh -D %p -N bastion");
+  ut_assert_string_match("ssh_tunnel command 01", "ssh -D 1080 -N bastion", ssh_tunnel_command(ssh, buf, sizeof(buf)));
+  strcpy(ssh->command_to_run, "ssh -D 1080 -N bastion");
+  ut_assert_string_match("ssh_tunnel command 02", "ssh -D 1080 -N bastion", ssh_tunnel_command(ssh, buf, sizeof(buf)));
+  strcpy(ssh->command_to_run, "%p%p");
+  ut_assert_string_match("ssh_tunnel command 03", "10801080", ssh_tunnel_command(ssh, buf, sizeof(buf)));
+  ut_assert_string_match("ssh_tunnel command 04", "108", ssh_tunnel_command(ssh, buf, 4));
+
+  // a single process: nothing to create
+  strcpy(ssh->command_to_run, "ssh -D %p bastion");
+  strcpy(ssh->name, "tun");
+  ssh_tunnel *other = new_ssh_tunnel();
+  strcpy(other->name, "other");
+  ssh->next = other;
+  ut_assert_true ("ssh_tunnel replicas 01", ssh_tunnel_create_replicas(ssh));
+  ut_assert_int_match("ssh_tunnel replicas 02", 0, ssh->replica_count);
+  ut_assert_true ("ssh_tunnel replicas 03", ssh->next == other);
+
+  ssh->replicas = 3;
+  ut_assert_true ("ssh_tunnel replicas 04", ssh_tunnel_create_replicas(ssh));
+  ut_assert_int_match("ssh_tunnel replicas 05", 3, ssh->replica_count);
+  ut_assert_true ("ssh_tunnel replicas 06", ssh->next == ssh->replica[0]);
+  ut_assert_true ("ssh_tunnel replicas 07", ssh->replica[2]->next == other);
+  ut_assert_string_match("ssh_tunnel replicas 08", "tun.2", ssh->replica[1]->name);
+  ut_assert_int_match("ssh_tunnel replicas 09", 1082, ssh->replica[2]->socks_port);
+  ut_assert_true ("ssh_tunnel replicas 10", ssh_tunnel_owner(ssh->replica[1]) == ssh);
+  ut_assert_true ("ssh_tunnel replicas 11", ssh_tunnel_owner(ssh) == ssh);
+  ut_assert_string_match("ssh_tunnel replicas 12", "ssh -D 1081 bastion", ssh_tunnel_command(ssh->replica[1], buf, sizeof(buf)));
+  // running it again changes nothing
+  ut_assert_true ("ssh_tunnel replicas 13", ssh_tunnel_create_replicas(ssh));
+  ut_assert_int_match("ssh_tunnel replicas 14", 3, ssh->replica_count);
+  ut_assert_true ("ssh_tunnel replicas 15", ssh->replica[2]->next == other);
+
+  // unmanaged upstreams
+  ssh_tunnel *gw = new_ssh_tunnel();
+  strcpy(gw->name, "gw");
+  ut_assert_int_match("ssh_tunnel type 01", TUNNEL_TYPE_HTTP_CONNECT, ssh_tunnel_type_from_str("httpConnect"));
+  ut_assert_int_match("ssh_tunnel type 02", TUNNEL_TYPE_INVALID, ssh_tunnel_type_from_str("http"));
+  ut_assert_true ("ssh_tunnel server 01", ssh_tunnel_parse_server(gw, "gw.example.com:3128"));
+  ut_assert_string_match("ssh_tunnel server 02", "gw.example.com", host_id_get_name(&gw->server));
+  ut_assert_int_match("ssh_tunnel server 03", 3128, host_id_get_port(&gw->server));
+  ut_assert_true ("ssh_tunnel server 04", ssh_tunnel_parse_server(gw, "[::1]:1080"));
+  ut_assert_string_match("ssh_tunnel server 05", "::1", host_id_get_name(&gw->server));
+  ut_assert_false("ssh_tunnel server 06", ssh_tunnel_parse_server(gw, "gw.example.com"));
+  ut_assert_false("ssh_tunnel server 07", ssh_tunnel_parse_server(gw, "gw.example.com:0"));
+  ut_assert_false("ssh_tunnel server 08", ssh_tunnel_parse_server(gw, "gw:80x"));
+  ut_assert_false("ssh_tunnel server 09", ssh_tunnel_parse_server(gw, ":80"));
+  gw->type = TUNNEL_TYPE_SOCKS5;
+  ut_assert_true ("ssh_tunnel validate 01", ssh_tunnel_validate(gw));
+  struct sockaddr_storage addr;
+  ut_assert_int_match("ssh_tunnel addr 01", sizeof(struct sockaddr_in6), ssh_tunnel_addr(gw, &addr));
+  ut_assert_int_match("ssh_tunnel addr 02", 1080, ntohs(((struct sockaddr_in6*)&addr)->sin6_port));
+  // the address is the one looked up last, not looked up again per call
+  ut_assert_true ("ssh_tunnel addr 03", ssh_tunnel_parse_server(gw, "127.0.0.1:3128"));
+  ut_assert_int_match("ssh_tunnel addr 04", sizeof(struct sockaddr_in6), ssh_tunnel_addr(gw, &addr));
+  ut_assert_true ("ssh_tunnel addr 05", ssh_tunnel_resolve_server(gw));
+  ut_assert_int_match("ssh_tunnel addr 06", sizeof(struct sockaddr_in), ssh_tunnel_addr(gw, &addr));
+  ut_assert_int_match("ssh_tunnel addr 07", 3128, ntohs(((struct sockaddr_in*)&addr)->sin_port));
+  ut_assert_true ("ssh_tunnel addr 08", ssh_tunnel_parse_server(gw, "[::1]:1080"));
+  strcpy(gw->command_to_run, "ssh -D 1080 bastion");
+  ut_assert_false("ssh_tunnel validate 02", ssh_tunnel_validate(gw));
+  gw->command_to_run[0] = 0;
+  host_id_init(&gw->server);
+  ut_assert_false("ssh_tunnel validate 03", ssh_tunnel_validate(gw));
+
+  // replicas must be told apart by port
+  other->replicas = 2;
+  other->socks_port = 2080;
+  strcpy(other->command_to_run, "ssh -D 2080 bastion");
+  ut_assert_false("ssh_tunnel replicas 16", ssh_tunnel_create_replicas(ssh));
+
+  // replicas get the tunnel's breaker settings, and names that fit
+  ssh_tunnel *big = new_ssh_tunnel();
+  memset(big->name, 'x', sizeof(big->name)-1);
+  big->name[sizeof(big->name)-1] = 0;
+  big->replicas = 2;
+  big->socks_port = 3080;
+  strcpy(big->command_to_run, "ssh -D %p bastion");
+  ut_assert_false("ssh_tunnel replicas 17", ssh_tunnel_create_replicas(big));
+  big->name[SSH_TUNNEL_MAX_NAME_LEN] = 0;
+  circuit_breaker_parse(&big->breaker, "4/20/5");
+  ut_assert_true ("ssh_tunnel replicas 18", ssh_tunnel_create_replicas(big));
+  ut_assert_int_match("ssh_tunnel replicas 19", SSH_TUNNEL_MAX_NAME_LEN + 2, strlen(big->replica[1]->name));
+  ut_assert_int_match("ssh_tunnel replicas 20", 4, big->replica[1]->breaker.threshold);
+  ut_assert_int_match("ssh_tunnel replicas 21", 5, big->replica[1]->breaker.cooldown);
+}
@@ -0,0 +1,52 @@
+// Copyright 2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+// SPDX-License-Identifier: MIT-0
+
+#include<stdio.h>
+#include<string.h>
+#include<stdint.h>
+
+#include"unit_test.h"
+#include"string_intern.h"
+
+void unit_test_string_intern() {
+  ut_name("string_intern");
+
+  string_intern *si = new_string_intern();
+  char buf[100];
+  strcpy(buf, ".example.com");
+  char *a = string_intern_str(si, buf);
+  strcpy(buf, ".example.org");
+  char *b = string_intern_str(si, buf);
+  ut_assert_string_match("string_intern str 01", ".example.com", a);
+  ut_assert_string_match("string_intern str 02", ".example.org", b);
+  ut_assert_true("string_intern str 03", a != buf && a != b);
+  ut_assert_true("string_intern str 04", a == string_intern_str(si, ".example.com"));
+  ut_assert_true("string_intern str 05", string_intern_str(si, "") == string_intern_str(si, ""));
+  ut_assert_int_match("string_intern str 06", 3, si->count);
+
+  // blobs are kept apart from strings with the same leading bytes, and aligned for pointers
+  void *list[3] = { a, b, NULL };
+  void **c = string_intern_bytes(si, list, sizeof(list));
+  ut_assert_true("string_intern bytes 01", c == string_intern_bytes(si, list, sizeof(list)));
+  ut_assert_true("string_intern bytes 02", c != string_intern_bytes(si, list, sizeof(void*) * 2));
+  ut_assert_true("string_intern bytes 03", c[0] == a && c[1] == b && c[2] == NULL);
+  ut_assert_int_match("string_intern bytes 04", 0, ((uintptr_t)string_intern_str(si, "x")) % sizeof(void*));
+  ut_assert_int_match("string_intern bytes 05", 0, ((uintptr_t)string_intern_bytes(si, list, sizeof(void*))) % sizeof(void*));
+
+  // enough to fill several chunks and grow the table a few times
+  char *first = NULL;
+  char *last = NULL;
+  int ok = 1;
+  for (int i=0; i<100000; i++) {
+    snprintf(buf, sizeof(buf), "host%i.generated.example.com", i);
+    char *s = string_intern_str(si, buf);
+    ok = ok && strcmp(s, buf) == 0;
+    if (i == 0) first = s;
+    last = s;
+  }
+  ut_assert_true("string_intern many 01", ok);
+  ut_assert_true("string_intern many 02", first == string_intern_str(si, "host0.generated.example.com"));
+  ut_assert_true("string_intern many 03", last == string_intern_str(si, "host99999.generated.example.com"));
+  ut_assert_true("string_intern many 04", a == string_intern_str(si, ".example.com"));
+  ut_assert_true("string_intern many 05", si->table_size >= si->count * 2);
+}
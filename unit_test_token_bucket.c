@@ -0,0 +1,53 @@
+// Copyright 2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+// SPDX-License-Identifier: MIT-0
+
+#include"unit_test.h"
+#include"token_bucket.h"
+
+#define UT_MS 1000000LL // nanoseconds
+
+void unit_test_token_bucket() {
+  ut_name("token_bucket");
+
+  token_bucket tb;
+  token_bucket_init(&tb, 0, 0); // as new_ssh_tunnel() etc. do before the config is parsed
+  ut_assert_true ("token_bucket parse 01", token_bucket_parse(&tb, "1k"));
+  ut_assert_long_match("token_bucket parse 02", 1024, tb.rate);
+  ut_assert_long_match("token_bucket parse 03", 1024, tb.burst);
+  ut_assert_true ("token_bucket parse 04", token_bucket_parse(&tb, "2m/8M"));
+  ut_assert_long_match("token_bucket parse 05", 2*1024*1024, tb.rate);
+  ut_assert_long_match("token_bucket parse 06", 8*1024*1024, tb.burst);
+  ut_assert_true ("token_bucket parse 07", token_bucket_parse(&tb, "0"));
+  ut_assert_false("token_bucket parse 08", token_bucket_enabled(&tb));
+  ut_assert_false("token_bucket parse 09", token_bucket_parse(&tb, "fast"));
+  ut_assert_false("token_bucket parse 10", token_bucket_parse(&tb, "10x"));
+  ut_assert_false("token_bucket parse 11", token_bucket_parse(&tb, "-5"));
+  ut_assert_false("token_bucket parse 12", token_bucket_parse(&tb, "5/"));
+
+  // refill, debt and waiting, on a made-up clock
+  token_bucket_set(&tb, 1000, 2000);
+  ut_assert_long_match("token_bucket 01", 20, token_bucket_quantum(&tb));
+  long long t0 = tb.last_refill;
+  tb.tokens = 0;
+  ut_assert_long_match("token_bucket 02", 500, token_bucket_available(&tb, t0 + 500*UT_MS));
+  token_bucket_consume(&tb, 700);
+  ut_assert_long_match("token_bucket 03", -200, token_bucket_available(&tb, t0 + 500*UT_MS));
+  ut_assert_int_match ("token_bucket 04", 300, token_bucket_wait_ms(&tb, 100, t0 + 500*UT_MS));
+  ut_assert_int_match ("token_bucket 05", 0, token_bucket_wait_ms(&tb, 100, t0 + 800*UT_MS));
+  ut_assert_long_match("token_bucket 06", 1, tb.throttled);
+  ut_assert_long_match("token_bucket 07", 2000, token_bucket_available(&tb, t0 + 10000*UT_MS));
+  // can't wait for more than the burst
+  ut_assert_int_match ("token_bucket 08", 0, token_bucket_wait_ms(&tb, 5000, t0 + 10000*UT_MS));
+
+  // fractions of a token aren't lost between refills
+  token_bucket_set(&tb, 3, 100);
+  t0 = tb.last_refill;
+  tb.tokens = 0;
+  ut_assert_long_match("token_bucket 09", 1, token_bucket_available(&tb, t0 + 500*UT_MS));
+  ut_assert_long_match("token_bucket 10", 3, token_bucket_available(&tb, t0 + 1000*UT_MS));
+
+  // unlimited never waits
+  token_bucket_set(&tb, 0, 0);
+  token_bucket_consume(&tb, 1000000);
+  ut_assert_int_match ("token_bucket 11", 0, token_bucket_wait_ms(&tb, 1000, t0));
+}
@@ -0,0 +1,59 @@
+// Copyright 2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+// SPDX-License-Identifier: MIT-0
+
+#include<stdlib.h>
+#include<stdint.h>
+#include<pthread.h>
+
+#include"unit_test.h"
+#include"traffic_counter.h"
+#include"proxy_instance.h"
+
+#define UT_TRAFFIC_THREADS 4
+#define UT_TRAFFIC_ADDS    10000
+
+void *unit_test_traffic_counter_thread(void *arg) {
+  traffic_counter *counter = arg;
+  for (int i=0; i<UT_TRAFFIC_ADDS; i++) {
+    traffic_counter_add_bytes(counter, TRAFFIC_TX, 3);
+    traffic_counter_add_bytes(counter, TRAFFIC_RX, 5);
+  }
+  traffic_counter_add_connection(counter);
+  return NULL;
+}
+
+void unit_test_traffic_counter() {
+  ut_name("traffic_counter");
+
+  static traffic_counter counter;
+  traffic_totals totals, global_before, global_after;
+  traffic_counter_init(&counter);
+  traffic_counter_get(&traffic_global, &global_before);
+
+  traffic_counter_get(&counter, &totals);
+  ut_assert_long_match("traffic_counter 01", 0, totals.bytes_tx + totals.bytes_rx + totals.connections);
+
+  pthread_t thread[UT_TRAFFIC_THREADS];
+  for (int i=0; i<UT_TRAFFIC_THREADS; i++) {
+    pthread_create(&thread[i], NULL, unit_test_traffic_counter_thread, &counter);
+  }
+  for (int i=0; i<UT_TRAFFIC_THREADS; i++) {
+    pthread_join(thread[i], NULL);
+  }
+
+  traffic_counter_get(&counter, &totals);
+  ut_assert_long_match("traffic_counter 02", 3L * UT_TRAFFIC_THREADS * UT_TRAFFIC_ADDS, totals.bytes_tx);
+  ut_assert_long_match("traffic_counter 03", 5L * UT_TRAFFIC_THREADS * UT_TRAFFIC_ADDS, totals.bytes_rx);
+  ut_assert_long_match("traffic_counter 04", UT_TRAFFIC_THREADS, totals.connections);
+
+  // everything is counted in the global totals as well
+  traffic_counter_get(&traffic_global, &global_after);
+  ut_assert_long_match("traffic_counter 05", totals.bytes_tx, global_after.bytes_tx - global_before.bytes_tx);
+  ut_assert_long_match("traffic_counter 06", totals.connections, global_after.connections - global_before.connections);
+
+  // each shard is a cache line of its own, also in a heap-allocated proxy_instance
+  proxy_instance *pinst = new_proxy_instance();
+  ut_assert_long_match("traffic_counter 07", 0, (uintptr_t)&pinst->traffic.shard[0] % TRAFFIC_COUNTER_ALIGN);
+  ut_assert_long_match("traffic_counter 08", TRAFFIC_COUNTER_ALIGN, (char*)&pinst->traffic.shard[1] - (char*)&pinst->traffic.shard[0]);
+  free(pinst);
+}
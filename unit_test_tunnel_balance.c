@@ -0,0 +1,47 @@
+// Copyright 2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+// SPDX-License-Identifier: MIT-0
+
+#include"unit_test.h"
+#include"tunnel_balance.h"
+
+void unit_test_tunnel_balance() {
+  ut_name("tunnel_balance");
+
+  ut_assert_int_match("tunnel_balance policy 01", TUNNEL_BALANCE_ROUND_ROBIN, tunnel_balance_from_str("roundRobin"));
+  ut_assert_int_match("tunnel_balance policy 02", TUNNEL_BALANCE_EWMA, tunnel_balance_from_str("ewma"));
+  ut_assert_int_match("tunnel_balance policy 03", TUNNEL_BALANCE_INVALID, tunnel_balance_from_str("random"));
+  ut_assert_string_match("tunnel_balance policy 04", "leastConnections", tunnel_balance_str(TUNNEL_BALANCE_LEAST_CONNECTIONS));
+
+  tunnel_balance_stats st;
+  tunnel_balance_init(&st);
+  ut_assert_true("tunnel_balance ewma 01", tunnel_balance_ewma_score(&st) == 0.0);
+  tunnel_balance_record(&st, 1, 100);
+  ut_assert_true("tunnel_balance ewma 02", tunnel_balance_ewma_score(&st) == 100.0); // first sample taken as is
+  tunnel_balance_record(&st, 1, 200);
+  ut_assert_true("tunnel_balance ewma 03", st.latency_ms == 120.0);
+  tunnel_balance_record(&st, 0, 0);
+  ut_assert_true("tunnel_balance ewma 04", st.latency_ms == 120.0); // failures don't move the latency
+  ut_assert_true("tunnel_balance ewma 05", st.failure_rate > 0.19 && st.failure_rate < 0.21);
+  ut_assert_true("tunnel_balance ewma 06", tunnel_balance_ewma_score(&st) > 300.0);
+  tunnel_balance_snapshot snap;
+  tunnel_balance_get_snapshot(&st, &snap);
+  ut_assert_long_match("tunnel_balance ewma 07", 3, snap.handshakes);
+  ut_assert_long_match("tunnel_balance ewma 08", 1, snap.failures);
+
+  tunnel_balance_set_connections(&st, 4);
+  tunnel_balance_picked(&st);
+  tunnel_balance_picked(&st);
+  ut_assert_int_match("tunnel_balance load 01", 6, tunnel_balance_load(&st));
+  tunnel_balance_set_connections(&st, 5);
+  ut_assert_int_match("tunnel_balance load 02", 5, tunnel_balance_load(&st));
+
+  // lowest first; ties keep the listed order
+  double score[5] = { 3.0, 1.0, 2.0, 1.0, 0.5 };
+  int order[5];
+  tunnel_balance_rank(score, 5, order);
+  ut_assert_int_match("tunnel_balance rank 01", 4, order[0]);
+  ut_assert_int_match("tunnel_balance rank 02", 1, order[1]);
+  ut_assert_int_match("tunnel_balance rank 03", 3, order[2]);
+  ut_assert_int_match("tunnel_balance rank 04", 2, order[3]);
+  ut_assert_int_match("tunnel_balance rank 05", 0, order[4]);
+}